@@ -1,716 +1,11298 @@
 #include <iostream>
 #include <fstream>
+#include <future>
 #include <stack>
 #include <string>
 #include <vector>
 #include <algorithm>
-#include <cctype> // 为了使用 isalpha()
-#include <queue>
+#include <cctype> // 为了使用 isxdigit()
+#include <cerrno>
 #include <set>
+#include <shared_mutex>
+#include <unordered_map>
 #include <map>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string_view>
+#include <random>
+#include <stdexcept>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#if defined(__x86_64__) || defined(_M_X64)
+#define THOMPSON_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#else
+#define THOMPSON_X86 0
+#endif
+// 单个函数使用更高的指令集，由运行时检测决定是否调用；批量匹配的通道循环要求完全展开
+#if defined(__GNUC__) || defined(__clang__)
+#define THOMPSON_TARGET(isa) __attribute__((target(isa)))
+#define THOMPSON_UNROLL_LANES _Pragma("GCC unroll 4")
+#else
+#define THOMPSON_TARGET(isa)
+#define THOMPSON_UNROLL_LANES
+#endif
 
-struct Transition
-{
-    char symbol;
-    class State *target;
-
-    Transition(char _symbol, class State *_target) : symbol(_symbol), target(_target) {}
-};
-
-class State
-{
-public:
-    int id;
-    bool isFinal;
-    std::vector<Transition> transitions;
-
-    State(int _id, bool _isFinal = false) : id(_id), isFinal(_isFinal) {}
-};
+// 调试跟踪：级别在编译期确定，默认关闭，关闭时跟踪代码整个被编译掉。
+// 需要时用 -DTHOMPSON_TRACE_LEVEL=1（阶段信息）或 2（每个状态/转换）编译，输出到 std::clog
+#ifndef THOMPSON_TRACE_LEVEL
+#define THOMPSON_TRACE_LEVEL 0
+#endif
 
-class NFA
+enum class TraceLevel
 {
-public:
-    class State *start;
-    class State *accept;
-
-    NFA(class State *_start, class State *_accept) : start(_start), accept(_accept) {}
+    Off = 0,
+    Info = 1,
+    Debug = 2
 };
 
-int stateCount = 0;
+constexpr TraceLevel kTraceLevel = static_cast<TraceLevel>(THOMPSON_TRACE_LEVEL);
 
-class State *createState(bool isFinal = false)
+// writer(std::ostream &) 只在级别打开时才会被调用（和编译）
+template <TraceLevel Level, typename Writer>
+inline void trace(Writer &&writer)
 {
-    return new class State(stateCount++, isFinal);
+    if constexpr (Level != TraceLevel::Off && static_cast<int>(Level) <= static_cast<int>(kTraceLevel))
+    {
+        writer(std::clog);
+        std::clog << '\n';
+    }
 }
 
-void addTransition(class State *from, class State *to, char symbol)
+// 编译过程的统计信息：计数器和各阶段耗时，可以直接读取，也可以导出为JSON
+struct CompileStats
 {
-    from->transitions.push_back(Transition(symbol, to));
-}
+    uint64_t nfaStates = 0;
+    uint64_t nfaEdges = 0;
+    uint64_t optimizedStates = 0;     // 化简（消除ε转换、合并等价状态）后的NFA状态数
+    uint64_t optimizedEdges = 0;
+    uint64_t byteClasses = 0;         // 子集构造使用的字节等价类数
+    uint64_t dfaStatesCreated = 0;
+    uint64_t dfaStatesFound = 0;      // 子集构造中查到已有状态的次数
+    uint64_t closureComputations = 0; // 计算（并缓存）的单状态ε闭包
+    uint64_t closureUnions = 0;       // 状态集的ε闭包（缓存闭包的并）
+    uint64_t refinementSplitters = 0; // Hopcroft 处理的 (块, 符号) 分割器
+    uint64_t blockSplits = 0;
+    uint64_t minimizedStates = 0;
+    uint64_t peakCompileBytes = 0;    // 编译预算登记的内存峰值（NFA、DFA和各阶段的工作数据）
 
-class NFA *thompsonConstruction(char inputChar)
-{
-    class State *startState = createState();
-    class State *acceptState = createState(true);
+    double parseSeconds = 0;
+    double thompsonSeconds = 0;
+    double optimizeSeconds = 0;
+    double subsetSeconds = 0;
+    double minimizeSeconds = 0;
+    double exportSeconds = 0;
 
-    if (inputChar == ' ')
-    {
-        addTransition(startState, acceptState, '\0'); // 使用 '\0' 代表空转换
-    }
-    else
+    void reset() { *this = CompileStats(); }
+
+    std::string toJson() const
     {
-        addTransition(startState, acceptState, inputChar);
+        std::ostringstream out;
+        out << "{\"nfa_states\":" << nfaStates
+            << ",\"nfa_edges\":" << nfaEdges
+            << ",\"optimized_states\":" << optimizedStates
+            << ",\"optimized_edges\":" << optimizedEdges
+            << ",\"byte_classes\":" << byteClasses
+            << ",\"dfa_states_created\":" << dfaStatesCreated
+            << ",\"dfa_states_found\":" << dfaStatesFound
+            << ",\"closure_computations\":" << closureComputations
+            << ",\"closure_unions\":" << closureUnions
+            << ",\"refinement_splitters\":" << refinementSplitters
+            << ",\"block_splits\":" << blockSplits
+            << ",\"minimized_states\":" << minimizedStates
+            << ",\"peak_bytes\":" << peakCompileBytes
+            << ",\"seconds\":{\"parse\":" << parseSeconds
+            << ",\"thompson\":" << thompsonSeconds
+            << ",\"optimize\":" << optimizeSeconds
+            << ",\"subset\":" << subsetSeconds
+            << ",\"minimize\":" << minimizeSeconds
+            << ",\"export\":" << exportSeconds << "}}";
+        return out.str();
     }
+};
 
-    return new class NFA(startState, acceptState);
-}
+// 每个线程各自累计，不同线程上的编译互不干扰。RegexCompiler 把自己的统计换进来再编译
+thread_local CompileStats compileStats;
 
-class NFA *concatenate(class NFA *nfa1, class NFA *nfa2)
+// 把作用域的耗时累加到某个阶段
+class PhaseTimer
 {
-    // 将nfa2的开始状态的所有转换添加到nfa1的接受状态
-    for (auto &transition : nfa2->start->transitions)
+public:
+    explicit PhaseTimer(double &_slot) : slot(_slot), begin(std::chrono::steady_clock::now()) {}
+    ~PhaseTimer()
     {
-        nfa1->accept->transitions.push_back(transition);
+        slot += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
     }
-    // 清除nfa2的开始状态的所有转换
-    nfa2->start->transitions.clear();
-
-    // 设置nfa1的接受状态为非终止状态
-    nfa1->accept->isFinal = false;
 
-    // 返回新的串联NFA
-    return new class NFA(nfa1->start, nfa2->accept);
-}
+private:
+    double &slot;
+    std::chrono::steady_clock::time_point begin;
+};
 
-class NFA *alternate(class NFA *nfa1, class NFA *nfa2)
+// 编译的资源上限，0 表示不限制。用户提供的模式可能让子集构造产生指数多的状态，限制之后最坏情况也是可预测的
+struct CompileLimits
 {
-    class State *startState = createState();
-    class State *acceptState = createState(true);
+    // 子集构造产生的DFA状态数。Thompson 构造和NFA化简的状态数以它的 NFA_STATES_PER_DFA_STATE 倍为上限
+    static constexpr size_t NFA_STATES_PER_DFA_STATE = 4;
 
-    addTransition(startState, nfa1->start, '\0');
-    addTransition(startState, nfa2->start, '\0');
-    addTransition(nfa1->accept, acceptState, '\0');
-    addTransition(nfa2->accept, acceptState, '\0');
-    nfa1->accept->isFinal = false;
-    nfa2->accept->isFinal = false;
+    size_t maxDFAStates = 0;
+    size_t maxMemoryBytes = 0;            // 同时存在的NFA、DFA和各阶段工作数据的字节数
+    std::chrono::milliseconds timeout{0}; // 从编译开始算起的期限
 
-    return new class NFA(startState, acceptState);
-}
+    bool unlimited() const { return maxDFAStates == 0 && maxMemoryBytes == 0 && timeout.count() == 0; }
+};
 
-class NFA *kleeneStar(class NFA *nfa)
+// 编译超出 CompileLimits 的某一项上限，resource 说明是哪一项
+class CompileLimitError : public std::runtime_error
 {
-    class State *startState = createState();
-    class State *acceptState = createState(true);
+public:
+    enum Resource
+    {
+        DFAStates,
+        Memory,
+        Deadline
+    };
 
-    addTransition(startState, acceptState, '\0');
-    addTransition(startState, nfa->start, '\0');
-    addTransition(nfa->accept, acceptState, '\0');
-    addTransition(nfa->accept, nfa->start, '\0');
-    nfa->accept->isFinal = false;
+    CompileLimitError(const std::string &message, Resource _resource) : std::runtime_error(message), resource(_resource) {}
 
-    return new class NFA(startState, acceptState);
-}
+    Resource resource;
+};
 
-std::string infixToPostfix(const std::string &regex)
+// 一次编译的资源预算。各阶段在分配主要的数据结构时登记字节数、释放时退还，used 是当前同时存在的字节数，
+// 超过上限时抛出 CompileLimitError。计数是原子的，并行子集构造的工作线程共用同一个预算
+class CompileBudget
 {
-    std::stack<char> stack;
-    std::string postfix = "";
-    std::string modifiedRegex = "";
+public:
+    explicit CompileBudget(const CompileLimits &_limits)
+        : limits(_limits), begin(std::chrono::steady_clock::now()), deadline(begin + _limits.timeout) {}
 
-    // 插入串联操作符
-    for (size_t i = 0; i < regex.size() - 1; ++i)
+    void charge(size_t bytes)
     {
-        modifiedRegex += regex[i];
-        if ((std::isalpha(regex[i]) || regex[i] == '*' || regex[i] == ')') && (std::isalpha(regex[i + 1]) || regex[i + 1] == '('))
+        size_t total = used.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+        size_t previous = peak.load(std::memory_order_relaxed);
+        while (total > previous && !peak.compare_exchange_weak(previous, total, std::memory_order_relaxed))
+        {
+        }
+        if (limits.maxMemoryBytes > 0 && total > limits.maxMemoryBytes)
         {
-            modifiedRegex += '.';
+            throw CompileLimitError("编译需要的内存超过 " + std::to_string(limits.maxMemoryBytes) + " 字节", CompileLimitError::Memory);
         }
     }
-    modifiedRegex += regex.back();
 
-    for (char c : modifiedRegex)
+    void release(size_t bytes) { used.fetch_sub(bytes, std::memory_order_relaxed); }
+
+    // 检查期限；pendingBytes 是还没有登记、但已经分配的字节数（例如正在增长的缓冲区）。
+    // 放弃之后还要释放已经构造的数据结构（大量小块分配，耗时接近构造的三分之一），所以提前这么多放弃，
+    // 整个编译连同释放大致在期限内结束
+    void check(size_t pendingBytes = 0) const
     {
-        if (std::isalpha(c) || c == ' ') // 判断字符是否为字母
+        if (limits.maxMemoryBytes > 0 && used.load(std::memory_order_relaxed) + pendingBytes > limits.maxMemoryBytes)
         {
-            postfix += c;
+            throw CompileLimitError("编译需要的内存超过 " + std::to_string(limits.maxMemoryBytes) + " 字节", CompileLimitError::Memory);
         }
-        else if (c == '(')
+        const auto now = std::chrono::steady_clock::now();
+        if (limits.timeout.count() > 0 && now + (now - begin) / 3 > deadline)
         {
-            stack.push(c);
+            throw CompileLimitError("编译超过 " + std::to_string(limits.timeout.count()) + " 毫秒", CompileLimitError::Deadline);
         }
-        else if (c == ')')
+    }
+
+    void checkStates(size_t states) const
+    {
+        if (limits.maxDFAStates > 0 && states > limits.maxDFAStates)
         {
-            while (stack.top() != '(')
-            {
-                postfix += stack.top();
-                stack.pop();
-            }
-            stack.pop();
+            throw CompileLimitError("DFA状态数超过 " + std::to_string(limits.maxDFAStates), CompileLimitError::DFAStates);
         }
-        else if (c == '*' || c == '|' || c == '.')
+    }
+
+    void checkNFAStates(size_t states) const
+    {
+        const size_t limit = limits.maxDFAStates * CompileLimits::NFA_STATES_PER_DFA_STATE;
+        if (limit > 0 && states > limit)
         {
-            // 调整操作符的优先级
-            while (!stack.empty() && stack.top() != '(' &&
-                   ((c == '*' && stack.top() == '*') ||
-                    (c == '.' && (stack.top() == '.' || stack.top() == '*')) ||
-                    (c == '|' && (stack.top() == '.' || stack.top() == '*' || stack.top() == '|'))))
-            {
-                postfix += stack.top();
-                stack.pop();
-            }
-            stack.push(c);
+            throw CompileLimitError("NFA状态数超过 " + std::to_string(limit), CompileLimitError::DFAStates);
         }
     }
 
-    while (!stack.empty())
+    size_t peakBytes() const { return peak.load(std::memory_order_relaxed); }
+
+private:
+    CompileLimits limits;
+    std::chrono::steady_clock::time_point begin;
+    std::chrono::steady_clock::time_point deadline;
+    std::atomic<size_t> used{0};
+    std::atomic<size_t> peak{0};
+};
+
+// 本线程当前编译的预算，没有时为空，下面的函数什么都不做。和 compileStats 一样由 RegexCompiler 设置
+thread_local CompileBudget *compileBudget = nullptr;
+
+inline void chargeCompileMemory(size_t bytes)
+{
+    if (compileBudget != nullptr)
     {
-        postfix += stack.top();
-        stack.pop();
+        compileBudget->charge(bytes);
     }
-
-    return postfix;
 }
 
-void generateDotFile(class NFA *nfa, const std::string &filename)
+inline void releaseCompileMemory(size_t bytes)
 {
-    std::ofstream outfile(filename);
-
-    if (outfile.is_open())
+    if (compileBudget != nullptr)
     {
-        outfile << "digraph NFA {\n";
-        outfile << "  rankdir=LR;\n";
-        outfile << "  node [shape = circle];\n";
-
-        std::stack<class State *> stack;
-        std::vector<int> visitedStates;
-        stack.push(nfa->start);
-
-        while (!stack.empty())
-        {
-            class State *currentState = stack.top();
-            stack.pop();
-
-            if (std::find(visitedStates.begin(), visitedStates.end(), currentState->id) != visitedStates.end())
-                continue;
-            visitedStates.push_back(currentState->id);
-
-            if (currentState->isFinal)
-            {
-                outfile << "  \""
-                        << "S" << currentState->id << "\" [shape = doublecircle];\n";
-            }
-            else
-            {
-                outfile << "  \""
-                        << "S" << currentState->id << "\" [shape = circle];\n";
-            }
-
-            for (const auto &transition : currentState->transitions)
-            {
-                outfile << "  \"S" << currentState->id << "\" -> \"S" << transition.target->id << "\" [label=\"" << (transition.symbol == '\0' ? "ε" : std::string(1, transition.symbol)) << "\"];\n";
-
-                stack.push(transition.target);
-            }
-        }
+        compileBudget->release(bytes);
+    }
+}
 
-        outfile << "}\n";
-        outfile.close();
-        std::cout << "NFA已生成到 " << filename << " 文件中\n";
+inline void checkCompileBudget(size_t pendingBytes = 0)
+{
+    if (compileBudget != nullptr)
+    {
+        compileBudget->check(pendingBytes);
     }
-    else
+}
+
+// 期限、内存之外再检查NFA的状态数
+inline void checkCompileBudget(size_t pendingBytes, size_t nfaStates)
+{
+    if (compileBudget != nullptr)
     {
-        std::cerr << "无法打开文件以写入输出\n";
+        compileBudget->checkNFAStates(nfaStates);
+        compileBudget->check(pendingBytes);
     }
 }
 
-NFA *generateThompsonNFAFromPostfix(const std::string &postfix)
+// 作用域内登记的一块内存，离开作用域时退还。update() 把登记的大小调整为数据结构当前的实际大小，
+// keep() 表示这块内存作为结果交给了调用者，由调用者负责退还
+class MemoryCharge
 {
-    std::stack<NFA *> nfaStack;
+public:
+    explicit MemoryCharge(size_t bytes = 0) { update(bytes); }
+    ~MemoryCharge() { releaseCompileMemory(charged); }
+    MemoryCharge(const MemoryCharge &) = delete;
+    MemoryCharge &operator=(const MemoryCharge &) = delete;
 
-    for (char c : postfix)
+    void update(size_t bytes)
     {
-        if (isalpha(c) || c == ' ') // 使用C++中的isalpha函数检查字符是否为字母
-        {
-            nfaStack.push(thompsonConstruction(c));
-        }
-        else if (c == '|')
-        {
-            NFA *nfa2 = nfaStack.top();
-            nfaStack.pop();
-            NFA *nfa1 = nfaStack.top();
-            nfaStack.pop();
-            nfaStack.push(alternate(nfa1, nfa2));
-        }
-        else if (c == '*')
+        const size_t previous = charged;
+        charged = bytes; // 超出上限时 charge() 也已经计入，析构时一并退还
+        if (bytes > previous)
         {
-            NFA *nfa = nfaStack.top();
-            nfaStack.pop();
-            nfaStack.push(kleeneStar(nfa));
+            chargeCompileMemory(bytes - previous);
         }
-        else if (c == '.')
+        else
         {
-            NFA *nfa2 = nfaStack.top();
-            nfaStack.pop();
-            NFA *nfa1 = nfaStack.top();
-            nfaStack.pop();
-            nfaStack.push(concatenate(nfa1, nfa2));
+            releaseCompileMemory(previous - bytes);
         }
     }
 
-    return nfaStack.top();
+    void keep() { charged = 0; }
+    size_t bytes() const { return charged; }
+
+private:
+    size_t charged = 0;
+};
+
+// std::vector 实际占用的字节数
+template <typename T>
+size_t vectorBytes(const std::vector<T> &items)
+{
+    return items.capacity() * sizeof(T);
 }
 
-// DFA子集构造
-struct DFAState
+// 一次 bytes 字节的堆分配实际占用的字节数：常见的分配器（如 glibc malloc）每块多一个字长的头，按16字节对齐。
+// 大量小块分配（每个DFA状态的对象和转移表结点）按请求的字节数计算会少算三分之一
+constexpr size_t heapBytes(size_t bytes)
 {
-    int id;
+    return bytes == 0 ? 0 : (bytes + sizeof(void *) + 15) / 16 * 16;
+}
+
+// 转换接受字节区间 [lo, hi]；epsilon 为真时是空转换，此时 lo/hi 没有意义。
+// 任意字节（包括 '\0'）都可以作为输入符号
+struct Transition
+{
+    uint8_t lo;
+    uint8_t hi;
+    bool epsilon;
+    uint8_t tag;     // 非0时是带标记的空转换，经过时把当前位置记到标记 tag - 1（捕获组的开始或结束）
+    uint32_t target; // 目标状态下标
+
+    Transition(uint8_t _lo, uint8_t _hi, uint32_t _target) : lo(_lo), hi(_hi), epsilon(false), tag(0), target(_target) {}
+
+    static Transition empty(uint32_t target, int tag = -1)
+    {
+        Transition transition(0, 0, target);
+        transition.epsilon = true;
+        transition.tag = static_cast<uint8_t>(tag + 1);
+        return transition;
+    }
+
+    bool accepts(unsigned char byte) const { return !epsilon && lo <= byte && byte <= hi; }
+};
+
+// NFA状态：它的转换是 NFA::edges 中从 firstEdge 开始的 edgeCount 条
+class State
+{
+public:
+    uint32_t firstEdge;
+    uint32_t edgeCount;
     bool isFinal;
-    std::set<State *> nfaStates;
-    std::map<char, DFAState *> transitions;
-    DFAState(int _id) : id(_id), isFinal(false) {}
+    int pattern; // 接受状态对应的模式编号，-1 表示没有
+
+    State(bool _isFinal = false) : firstEdge(0), edgeCount(0), isFinal(_isFinal), pattern(-1) {}
+};
+
+// 状态和转换分别存放在两个连续数组中（CSR），用32位下标引用，整个NFA随对象一起释放
+class NFA
+{
+public:
+    std::vector<State> states;
+    std::vector<Transition> edges;
+    std::vector<int> patternPriority; // 每个模式的优先级，单模式时只有一个元素
+    uint32_t start = 0;
+    uint32_t accept = 0; // 多模式NFA中每个模式有自己的接受状态，这里是第一个模式的
+
+    uint32_t size() const { return static_cast<uint32_t>(states.size()); }
+    size_t memoryBytes() const { return vectorBytes(states) + vectorBytes(edges) + vectorBytes(patternPriority); }
+    const Transition *edgesBegin(uint32_t s) const { return edges.data() + states[s].firstEdge; }
+    const Transition *edgesEnd(uint32_t s) const { return edgesBegin(s) + states[s].edgeCount; }
 };
 
-std::vector<DFAState *> dfaStates;
-std::map<std::set<State *>, int> stateMap;
-int getOrCreateDFAState(const std::set<State *> &nfaStateSet)
+// 汤普森构造过程中的NFA片段
+struct Fragment
 {
-    // 输出正在处理的NFA状态集
-    std::cout << "Checking or creating DFA state for NFA states: ";
-    for (State *s : nfaStateSet)
+    uint32_t start;
+    uint32_t accept;
+};
+
+// NFA构造用的内存池。状态编号从0开始；构造期间每个状态的转换是 pending 中的一条链表，
+// 串联时只需接上链表，finish() 再把所有链表按状态顺序整理成 NFA 的连续边表
+class NFABuilder
+{
+public:
+    uint32_t createState(bool isFinal = false)
     {
-        std::cout << s->id << " ";
+        states.emplace_back(isFinal);
+        head.push_back(NO_EDGE);
+        tail.push_back(NO_EDGE);
+        return static_cast<uint32_t>(states.size() - 1);
     }
-    std::cout << std::endl;
 
-    if (stateMap.find(nfaStateSet) == stateMap.end())
+    void addTransition(uint32_t from, const Transition &transition)
     {
-        DFAState *newState = new DFAState(dfaStates.size());
-
-        for (State *s : nfaStateSet)
+        uint32_t e = static_cast<uint32_t>(pending.size());
+        pending.push_back({transition, NO_EDGE});
+        if (tail[from] == NO_EDGE)
         {
-            if (s->isFinal)
-            {
-                newState->isFinal = true;
-                break;
-            }
+            head[from] = e;
         }
-        newState->nfaStates = nfaStateSet;
-        dfaStates.push_back(newState);
-        stateMap[nfaStateSet] = newState->id;
-
-        // 输出已经为NFA状态集创建了新的DFA状态的信息
-        std::cout << "Created new DFA state " << newState->id << " for NFA states: ";
-        for (State *s : nfaStateSet)
+        else
         {
-            std::cout << s->id << " ";
+            pending[tail[from]].next = e;
         }
-        std::cout << std::endl;
+        tail[from] = e;
+        ++states[from].edgeCount;
     }
-    else
+
+    void addEmptyTransition(uint32_t from, uint32_t to)
+    {
+        addTransition(from, Transition::empty(to));
+    }
+
+    // 两条空转换 from -> skip 和 from -> repeat（重复或进入可选部分）。带捕获的NFA中空转换的顺序就是优先级，
+    // greedy 时重复在前；只关心语言时顺序无所谓，保持跳过在前
+    void addChoice(uint32_t from, uint32_t skip, uint32_t repeat)
+    {
+        addEmptyTransition(from, greedy ? repeat : skip);
+        addEmptyTransition(from, greedy ? skip : repeat);
+    }
+
+    // 把 from 的所有转换接到 to 的转换之后
+    void moveTransitions(uint32_t from, uint32_t to)
     {
-        // 输出已经为NFA状态集找到了现有的DFA状态的信息
-        std::cout << "Found existing DFA state " << stateMap[nfaStateSet] << " for NFA states: ";
-        for (State *s : nfaStateSet)
+        if (head[from] == NO_EDGE)
+        {
+            return;
+        }
+        if (tail[to] == NO_EDGE)
         {
-            std::cout << s->id << " ";
+            head[to] = head[from];
         }
-        std::cout << std::endl;
+        else
+        {
+            pending[tail[to]].next = head[from];
+        }
+        tail[to] = tail[from];
+        states[to].edgeCount += states[from].edgeCount;
+        head[from] = tail[from] = NO_EDGE;
+        states[from].edgeCount = 0;
     }
 
-    return stateMap[nfaStateSet];
-}
+    State &state(uint32_t s) { return states[s]; }
 
-std::set<State *> eClosure(State *state)
-{
-    std::set<State *> result;
-    std::stack<State *> stack;
-    stack.push(state);
+    size_t size() const { return states.size(); }
+    size_t memoryBytes() const { return vectorBytes(states) + vectorBytes(pending) + vectorBytes(head) + vectorBytes(tail); }
 
-    while (!stack.empty())
+    NFA finish(Fragment fragment)
     {
-        State *current = stack.top();
-        stack.pop();
-
-        if (result.find(current) != result.end())
-            continue;
-        result.insert(current);
-
-        for (Transition t : current->transitions)
+        NFA nfa;
+        nfa.edges.reserve(pending.size());
+        for (uint32_t s = 0; s < states.size(); ++s)
         {
-            if (t.symbol == '\0' && result.find(t.target) == result.end())
+            states[s].firstEdge = static_cast<uint32_t>(nfa.edges.size());
+            for (uint32_t e = head[s]; e != NO_EDGE; e = pending[e].next)
             {
-                stack.push(t.target);
+                nfa.edges.push_back(pending[e].transition);
             }
         }
+        nfa.states = std::move(states);
+        nfa.start = fragment.start;
+        nfa.accept = fragment.accept;
+        if (nfa.states[nfa.accept].pattern < 0)
+        {
+            nfa.states[nfa.accept].pattern = 0;
+        }
+        nfa.patternPriority = std::move(priorities);
+        if (nfa.patternPriority.empty())
+        {
+            nfa.patternPriority.push_back(0);
+        }
+
+        states.clear();
+        pending.clear();
+        head.clear();
+        tail.clear();
+        return nfa;
     }
-    return result;
-}
 
-std::set<State *> eClosure(const std::set<State *> &stateSet)
-{
-    std::set<State *> result;
-    for (State *s : stateSet)
+    // 多模式构造时登记模式的优先级，返回模式编号
+    int addPattern(int priority)
     {
-        std::set<State *> temp = eClosure(s);
-        result.insert(temp.begin(), temp.end());
+        priorities.push_back(priority);
+        return static_cast<int>(priorities.size() - 1);
     }
 
-    // Debug output
-    std::cout << "eClosure of states: ";
-    for (State *s : stateSet)
+    bool greedy = false; // * + ? 优先多匹配（构造带捕获的NFA时打开）
+
+private:
+    static constexpr uint32_t NO_EDGE = UINT32_MAX;
+
+    struct PendingEdge
     {
-        std::cout << s->id << " ";
+        Transition transition;
+        uint32_t next;
+    };
+
+    std::vector<State> states;
+    std::vector<PendingEdge> pending;
+    std::vector<uint32_t> head;
+    std::vector<uint32_t> tail;
+    std::vector<int> priorities;
+};
+
+// DOT 标签和跟踪输出中的一个字节：可打印字符原样输出（引号和反斜杠加转义），其余写成 \xHH
+std::string byteLabel(uint8_t byte)
+{
+    if (byte == '"' || byte == '\\')
+    {
+        return std::string("\\") + static_cast<char>(byte);
     }
-    std::cout << "results in states: ";
-    for (State *s : result)
+    if (byte >= 0x20 && byte < 0x7f)
     {
-        std::cout << s->id << " ";
+        return std::string(1, static_cast<char>(byte));
     }
-    std::cout << std::endl;
+    const char *hex = "0123456789ABCDEF";
+    return std::string("\\\\x") + hex[byte >> 4] + hex[byte & 15];
+}
 
-    return result;
+std::string byteRangeLabel(uint8_t lo, uint8_t hi)
+{
+    return lo == hi ? byteLabel(lo) : byteLabel(lo) + "-" + byteLabel(hi);
 }
 
-std::set<State *> move(const std::set<State *> &stateSet, char symbol)
+std::string transitionLabel(const Transition &transition)
 {
-    std::set<State *> result;
-    for (State *s : stateSet)
+    if (transition.epsilon)
     {
-        for (Transition t : s->transitions)
-        {
-            if (t.symbol == symbol)
-            {
-                result.insert(t.target);
-            }
-        }
+        return transition.tag == 0 ? "ε" : "ε/t" + std::to_string(transition.tag - 1);
     }
+    return byteRangeLabel(transition.lo, transition.hi);
+}
 
-    // Debug output
-    std::cout << "Moving with symbol: " << symbol << " from states: ";
-    for (State *s : stateSet)
+// UTF-8 编码，返回字节数；cp 必须是合法的码点
+constexpr int encodeUtf8(uint32_t cp, uint8_t out[4])
+{
+    if (cp < 0x80)
     {
-        std::cout << s->id << " ";
+        out[0] = static_cast<uint8_t>(cp);
+        return 1;
     }
-    std::cout << "to states: ";
-    for (State *s : result)
+    if (cp < 0x800)
     {
-        std::cout << s->id << " ";
+        out[0] = static_cast<uint8_t>(0xC0 | (cp >> 6));
+        out[1] = static_cast<uint8_t>(0x80 | (cp & 0x3F));
+        return 2;
     }
-    std::cout << std::endl;
-
-    return result;
+    if (cp < 0x10000)
+    {
+        out[0] = static_cast<uint8_t>(0xE0 | (cp >> 12));
+        out[1] = static_cast<uint8_t>(0x80 | ((cp >> 6) & 0x3F));
+        out[2] = static_cast<uint8_t>(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    out[0] = static_cast<uint8_t>(0xF0 | (cp >> 18));
+    out[1] = static_cast<uint8_t>(0x80 | ((cp >> 12) & 0x3F));
+    out[2] = static_cast<uint8_t>(0x80 | ((cp >> 6) & 0x3F));
+    out[3] = static_cast<uint8_t>(0x80 | (cp & 0x3F));
+    return 4;
 }
 
-void constructDFAFromNFA(NFA *nfa, const std::set<State *> &nfaStates)
+// 从 text[i] 解码一个 UTF-8 字符，成功时 i 移到字符之后。
+// 非法的序列（截断、过长编码、代理区、超出 U+10FFFF）返回 false 且 i 不变
+constexpr bool decodeUtf8(std::string_view text, size_t &i, uint32_t &cp)
 {
-    std::set<State *> startStateSet = eClosure(nfa->start);
-    std::queue<std::set<State *>> processQueue;
-    processQueue.push(startStateSet);
-    getOrCreateDFAState(startStateSet);
-
-    std::set<char> inputSymbols;
-    for (State *s : nfaStates)
+    constexpr uint32_t minimum[5] = {0, 0, 0x80, 0x800, 0x10000};
+    uint8_t lead = static_cast<uint8_t>(text[i]);
+    size_t length = lead < 0x80 ? 1 : (lead >> 5) == 0x6 ? 2 : (lead >> 4) == 0xE ? 3 : (lead >> 3) == 0x1E ? 4 : 0;
+    if (length == 0 || i + length > text.size())
+    {
+        return false;
+    }
+    uint32_t value = length == 1 ? lead : lead & (0x7F >> length);
+    for (size_t k = 1; k < length; ++k)
     {
-        for (Transition t : s->transitions)
+        uint8_t c = static_cast<uint8_t>(text[i + k]);
+        if ((c & 0xC0) != 0x80)
         {
-            if (t.symbol != '\0')
-            {
-                inputSymbols.insert(t.symbol);
-            }
+            return false;
         }
+        value = (value << 6) | (c & 0x3F);
     }
-
-    while (!processQueue.empty())
+    if (value < minimum[length] || value > 0x10FFFF || (value >= 0xD800 && value <= 0xDFFF))
     {
-        std::set<State *> currentStateSet = processQueue.front();
-        processQueue.pop();
-        DFAState *currentDFAState = dfaStates[getOrCreateDFAState(currentStateSet)];
+        return false;
+    }
+    cp = value;
+    i += length;
+    return true;
+}
+
+// 码点区间编译成字节自动机用的字节区间序列：序列的第 k 个字节落在第 k 个区间内。
+// 序列之间互不相交，并集恰好是区间内所有码点（跳过代理区）的 UTF-8 编码
+using ByteRangeSequence = std::vector<std::pair<uint8_t, uint8_t>>;
+using CodePointRanges = std::vector<std::pair<uint32_t, uint32_t>>;
+
+// 字节模式 (?-u:...) 的字符类里 0x80 以上的原始字节不是码点，在区间中记为 RAW_BYTE_BASE + 字节，编译成单个字节
+constexpr uint32_t RAW_BYTE_BASE = 0x110000;
 
-        // 输出当前正在处理的DFA状态
-        std::cout << "Processing DFA state: ";
-        for (State *s : currentStateSet)
+// 逐个生成序列，每个序列调用一次 sink(first, last, length)：第 k 个字节落在 [first[k], last[k]] 内。
+// 只用常量表达式允许的操作，编译期的正则表达式编译也用它
+template <typename Sink>
+constexpr void forEachUtf8Sequence(uint32_t lo, uint32_t hi, Sink &&sink)
+{
+    if (hi >= RAW_BYTE_BASE)
+    {
+        if (lo <= 0x10FFFF)
         {
-            std::cout << s->id << " "; // 假设State有一个名为"name"的成员，表示状态的名称
+            forEachUtf8Sequence(lo, 0x10FFFF, sink);
+            lo = RAW_BYTE_BASE;
         }
-        std::cout << std::endl;
+        uint8_t first[1] = {static_cast<uint8_t>(lo - RAW_BYTE_BASE)}, last[1] = {static_cast<uint8_t>(hi - RAW_BYTE_BASE)};
+        sink(first, last, 1);
+        return;
+    }
+    if (lo < 0xD800 && hi > 0xDFFF)
+    {
+        forEachUtf8Sequence(lo, 0xD7FF, sink);
+        forEachUtf8Sequence(0xE000, hi, sink);
+        return;
+    }
+    if (lo >= 0xD800 && lo <= 0xDFFF)
+    {
+        lo = 0xE000;
+    }
+    if (hi >= 0xD800 && hi <= 0xDFFF)
+    {
+        hi = 0xD7FF;
+    }
+    if (lo > hi)
+    {
+        return;
+    }
 
-        for (char symbol : inputSymbols)
+    // 先按编码长度分段
+    for (uint32_t limit : {0x7Fu, 0x7FFu, 0xFFFFu})
+    {
+        if (lo <= limit && limit < hi)
         {
-            std::set<State *> nextStateSet = eClosure(move(currentStateSet, symbol));
+            forEachUtf8Sequence(lo, limit, sink);
+            forEachUtf8Sequence(limit + 1, hi, sink);
+            return;
+        }
+    }
 
-            // 输出对应于给定符号的转移的结果状态集合
-            std::cout << "Moving with symbol " << symbol << " results in states: ";
-            for (State *s : nextStateSet)
+    // 再拆到每一段都是“高位相同，低 6k 位取满”的形式，这样逐字节的区间才是精确的
+    for (int k = 1; k < 4; ++k)
+    {
+        uint32_t mask = (uint32_t(1) << (6 * k)) - 1;
+        if ((lo & ~mask) != (hi & ~mask))
+        {
+            if ((lo & mask) != 0)
             {
-                std::cout << s->id << " ";
+                forEachUtf8Sequence(lo, lo | mask, sink);
+                forEachUtf8Sequence((lo | mask) + 1, hi, sink);
+                return;
             }
-            std::cout << std::endl;
-
-            if (!nextStateSet.empty())
+            if ((hi & mask) != mask)
             {
-
-                if (stateMap.find(nextStateSet) == stateMap.end()) // Check if this DFA state hasn't been processed yet
-                {
-                    processQueue.push(nextStateSet);
-                }
-                int nextStateId = getOrCreateDFAState(nextStateSet); // Always get or create DFA state
-                currentDFAState->transitions[symbol] = dfaStates[nextStateId];
+                forEachUtf8Sequence(lo, (hi & ~mask) - 1, sink);
+                forEachUtf8Sequence(hi & ~mask, hi, sink);
+                return;
             }
         }
     }
+
+    uint8_t first[4] = {}, last[4] = {};
+    int length = encodeUtf8(lo, first);
+    encodeUtf8(hi, last);
+    sink(first, last, length);
 }
 
-std::set<State *> collectStatesFromNFA(NFA *nfa)
+void utf8Sequences(uint32_t lo, uint32_t hi, std::vector<ByteRangeSequence> &out)
 {
-    std::set<State *> states;
-    std::stack<State *> stack;
-    stack.push(nfa->start);
+    forEachUtf8Sequence(lo, hi, [&out](const uint8_t *first, const uint8_t *last, int length)
+                        {
+                            ByteRangeSequence sequence;
+                            for (int k = 0; k < length; ++k)
+                            {
+                                sequence.emplace_back(first[k], last[k]);
+                            }
+                            out.push_back(sequence); });
+}
 
-    while (!stack.empty())
+std::vector<ByteRangeSequence> utf8Sequences(const CodePointRanges &ranges)
+{
+    std::vector<ByteRangeSequence> sequences;
+    for (auto [lo, hi] : ranges)
     {
-        State *curr = stack.top();
-        stack.pop();
+        utf8Sequences(lo, hi, sequences);
+    }
+    return sequences;
+}
 
-        std::cout << "Processing state: S" << curr->id << std::endl; // 输出当前处理的状态
+// 后缀表达式的记号：
+//   | . * + ?        运算符（. 是串联）
+//   ' '              空串
+//   \c               转义的字面字节 c
+//   [lo-hi,...]      码点区间（十六进制）的并，按 UTF-8 编译成字节自动机
+//   {t}              匹配空串并记下位置的标记 t（十进制），只出现在带捕获的后缀表达式中
+//   其他任意字节      字面字节
+struct PostfixToken
+{
+    enum Kind
+    {
+        Literal,
+        Epsilon,
+        Class,
+        Tag,
+        Alternate,
+        Concat,
+        Star,
+        Plus,
+        Optional
+    };
 
-        if (states.find(curr) == states.end())
-        {
-            states.insert(curr);
-            std::cout << "Inserted state: S" << curr->id << " to states set. Total states: " << states.size() << std::endl; // 输出状态集合大小
+    Kind kind = Literal;
+    uint8_t byte = 0;       // Literal
+    CodePointRanges ranges; // Class：升序、互不相交
+    int tag = 0;            // Tag
+};
 
-            for (const auto &trans : curr->transitions)
+// 读取 postfix[pos] 开始的一个记号，pos 移到记号之后；没有更多记号时返回 false
+bool readPostfixToken(const std::string &postfix, size_t &pos, PostfixToken &token)
+{
+    if (pos >= postfix.size())
+    {
+        return false;
+    }
+    uint8_t c = static_cast<uint8_t>(postfix[pos++]);
+    token.ranges.clear();
+    switch (c)
+    {
+    case '|':
+        token.kind = PostfixToken::Alternate;
+        break;
+    case '.':
+        token.kind = PostfixToken::Concat;
+        break;
+    case '*':
+        token.kind = PostfixToken::Star;
+        break;
+    case '+':
+        token.kind = PostfixToken::Plus;
+        break;
+    case '?':
+        token.kind = PostfixToken::Optional;
+        break;
+    case ' ':
+        token.kind = PostfixToken::Epsilon;
+        break;
+    case '\\':
+        token.kind = PostfixToken::Literal;
+        token.byte = pos < postfix.size() ? static_cast<uint8_t>(postfix[pos++]) : c;
+        break;
+    case '[':
+    {
+        token.kind = PostfixToken::Class;
+        auto hex = [&]
+        {
+            uint32_t value = 0;
+            while (pos < postfix.size() && std::isxdigit(static_cast<unsigned char>(postfix[pos])))
+            {
+                char d = postfix[pos++];
+                value = value * 16 + (std::isdigit(static_cast<unsigned char>(d)) ? d - '0' : (d | 0x20) - 'a' + 10);
+            }
+            return value;
+        };
+        while (pos < postfix.size() && postfix[pos] != ']')
+        {
+            uint32_t lo = hex();
+            ++pos; // '-'
+            uint32_t hi = hex();
+            token.ranges.emplace_back(lo, hi);
+            if (pos < postfix.size() && postfix[pos] == ',')
             {
-                std::cout << "Transition from S" << curr->id << " to S" << trans.target->id << " with label: " << (trans.symbol == '\0' ? "ε" : std::string(1, trans.symbol)) << std::endl; // 输出转移信息
-                stack.push(trans.target);
+                ++pos;
             }
         }
+        ++pos; // ']'
+        break;
     }
-    return states;
+    case '{':
+        token.kind = PostfixToken::Tag;
+        token.tag = 0;
+        while (pos < postfix.size() && postfix[pos] != '}')
+        {
+            token.tag = token.tag * 10 + (postfix[pos++] - '0');
+        }
+        ++pos; // '}'
+        break;
+    default:
+        token.kind = PostfixToken::Literal;
+        token.byte = c;
+        break;
+    }
+    return true;
 }
 
-void generateDotFileForDFA(const std::string &filename)
+// 把字面字节追加到后缀表达式，和记号语法冲突的字节加反斜杠
+void appendPostfixByte(std::string &postfix, uint8_t byte)
 {
-    std::ofstream outfile(filename);
-
-    if (outfile.is_open())
+    if (std::string_view("|.*+? \\[]{").find(static_cast<char>(byte)) != std::string_view::npos)
     {
-        outfile << "digraph DFA {\n";
-        outfile << "  rankdir=LR;\n";
-        outfile << "  node [shape = circle];\n";
+        postfix += '\\';
+    }
+    postfix += static_cast<char>(byte);
+}
 
-        for (DFAState *dfaState : dfaStates)
-        {
-            // 我们将使用NFA状态的集合作为DFA状态的名字
-            std::string stateName = "{";
-            for (State *nfaState : dfaState->nfaStates)
-            {
-                stateName += "S" + std::to_string(nfaState->id) + ",";
+void appendPostfixTag(std::string &postfix, int tag)
+{
+    postfix += '{' + std::to_string(tag) + '}';
+}
+
+void appendPostfixClass(std::string &postfix, const CodePointRanges &ranges)
+{
+    std::ostringstream out;
+    out << std::hex << '[';
+    for (size_t i = 0; i < ranges.size(); ++i)
+    {
+        out << (i > 0 ? "," : "") << ranges[i].first << '-' << ranges[i].second;
+    }
+    out << ']';
+    postfix += out.str();
+}
+
+Fragment thompsonConstruction(NFABuilder &builder, const PostfixToken &token)
+{
+    uint32_t startState = builder.createState();
+    uint32_t acceptState = builder.createState(true);
+
+    if (token.kind == PostfixToken::Epsilon)
+    {
+        builder.addEmptyTransition(startState, acceptState);
+    }
+    else if (token.kind == PostfixToken::Tag)
+    {
+        builder.addTransition(startState, Transition::empty(acceptState, token.tag));
+    }
+    else if (token.kind == PostfixToken::Literal)
+    {
+        builder.addTransition(startState, Transition(token.byte, token.byte, acceptState));
+    }
+    else
+    {
+        // 每个 UTF-8 字节区间序列是一条从开始状态到接受状态的链，ASCII 区间就是一条边
+        for (const ByteRangeSequence &sequence : utf8Sequences(token.ranges))
+        {
+            uint32_t from = startState;
+            for (size_t k = 0; k + 1 < sequence.size(); ++k)
+            {
+                uint32_t middle = builder.createState();
+                builder.addTransition(from, Transition(sequence[k].first, sequence[k].second, middle));
+                from = middle;
+            }
+            builder.addTransition(from, Transition(sequence.back().first, sequence.back().second, acceptState));
+        }
+    }
+
+    return Fragment{startState, acceptState};
+}
+
+Fragment concatenate(NFABuilder &builder, Fragment nfa1, Fragment nfa2)
+{
+    // 将nfa2的开始状态的所有转换移到nfa1的接受状态
+    builder.moveTransitions(nfa2.start, nfa1.accept);
+
+    // 设置nfa1的接受状态为非终止状态
+    builder.state(nfa1.accept).isFinal = false;
+
+    // 返回新的串联NFA
+    return Fragment{nfa1.start, nfa2.accept};
+}
+
+Fragment alternate(NFABuilder &builder, Fragment nfa1, Fragment nfa2)
+{
+    uint32_t startState = builder.createState();
+    uint32_t acceptState = builder.createState(true);
+
+    builder.addEmptyTransition(startState, nfa1.start);
+    builder.addEmptyTransition(startState, nfa2.start);
+    builder.addEmptyTransition(nfa1.accept, acceptState);
+    builder.addEmptyTransition(nfa2.accept, acceptState);
+    builder.state(nfa1.accept).isFinal = false;
+    builder.state(nfa2.accept).isFinal = false;
+
+    return Fragment{startState, acceptState};
+}
+
+Fragment kleeneStar(NFABuilder &builder, Fragment nfa)
+{
+    uint32_t startState = builder.createState();
+    uint32_t acceptState = builder.createState(true);
+
+    builder.addChoice(startState, acceptState, nfa.start);
+    builder.addChoice(nfa.accept, acceptState, nfa.start);
+    builder.state(nfa.accept).isFinal = false;
+
+    return Fragment{startState, acceptState};
+}
+
+// x+：与 x* 相同，只是没有跳过 x 的空转换
+Fragment kleenePlus(NFABuilder &builder, Fragment nfa)
+{
+    uint32_t startState = builder.createState();
+    uint32_t acceptState = builder.createState(true);
+
+    builder.addEmptyTransition(startState, nfa.start);
+    builder.addChoice(nfa.accept, acceptState, nfa.start);
+    builder.state(nfa.accept).isFinal = false;
+
+    return Fragment{startState, acceptState};
+}
+
+// x?：与 x* 相同，只是没有回到 x 开头的空转换
+Fragment optional(NFABuilder &builder, Fragment nfa)
+{
+    uint32_t startState = builder.createState();
+    uint32_t acceptState = builder.createState(true);
+
+    builder.addChoice(startState, acceptState, nfa.start);
+    builder.addEmptyTransition(nfa.accept, acceptState);
+    builder.state(nfa.accept).isFinal = false;
+
+    return Fragment{startState, acceptState};
+}
+
+// 正则表达式的语法错误，position 是出错处在正则表达式中的字节偏移
+class RegexSyntaxError : public std::runtime_error
+{
+public:
+    RegexSyntaxError(const std::string &message, size_t _position) : std::runtime_error(message), position(_position) {}
+
+    size_t position;
+};
+
+// 读取正则表达式中从 regex[i] 开始的一个字符（可能是转义），i 移到它之后。
+// 返回码点；isByte 为真表示它是原始字节（\xHH，或不构成合法 UTF-8 的字节），不再做 UTF-8 编码
+constexpr int hexDigitValue(char c)
+{
+    return c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+}
+
+constexpr uint32_t readRegexChar(std::string_view regex, size_t &i, bool &isByte)
+{
+    isByte = false;
+    if (regex[i] == '\\' && i + 1 < regex.size())
+    {
+        char escaped = regex[i + 1];
+        if (escaped == 'n' || escaped == 't' || escaped == 'r')
+        {
+            i += 2;
+            return escaped == 'n' ? '\n' : escaped == 't' ? '\t' : '\r';
+        }
+        if (escaped == 'x' && i + 3 < regex.size() && hexDigitValue(regex[i + 2]) >= 0 && hexDigitValue(regex[i + 3]) >= 0)
+        {
+            uint32_t value = static_cast<uint32_t>(hexDigitValue(regex[i + 2]) * 16 + hexDigitValue(regex[i + 3]));
+            i += 4;
+            isByte = true;
+            return value;
+        }
+        ++i; // 其余转义都表示字符本身
+    }
+
+    uint32_t cp = 0;
+    if (decodeUtf8(regex, i, cp))
+    {
+        return cp;
+    }
+    isByte = true;
+    return static_cast<uint8_t>(regex[i++]);
+}
+
+// 排序并合并重叠或相邻的码点区间
+void normalizeRanges(CodePointRanges &ranges)
+{
+    std::sort(ranges.begin(), ranges.end());
+    CodePointRanges merged;
+    for (auto [lo, hi] : ranges)
+    {
+        if (!merged.empty() && lo <= merged.back().second + 1)
+        {
+            merged.back().second = std::max(merged.back().second, hi);
+        }
+        else
+        {
+            merged.emplace_back(lo, hi);
+        }
+    }
+    ranges.swap(merged);
+}
+
+// 规范化的区间在 [0, max] 中的补集，max 默认是 U+10FFFF，字节模式中是 0xFF
+CodePointRanges complementRanges(const CodePointRanges &ranges, uint32_t max = 0x10FFFF)
+{
+    CodePointRanges complement;
+    uint32_t next = 0;
+    for (auto [lo, hi] : ranges)
+    {
+        if (lo > next)
+        {
+            complement.emplace_back(next, lo - 1);
+        }
+        next = hi + 1;
+    }
+    if (next <= max)
+    {
+        complement.emplace_back(next, max);
+    }
+    return complement;
+}
+
+// 字节模式：升序的字节值区间换成字符类的区间，0x80 以上的字节记为 RAW_BYTE_BASE + 字节
+CodePointRanges rawByteRanges(const CodePointRanges &bytes)
+{
+    CodePointRanges ranges;
+    for (auto [lo, hi] : bytes)
+    {
+        if (lo < 0x80)
+        {
+            ranges.emplace_back(lo, std::min<uint32_t>(hi, 0x7F));
+        }
+        if (hi >= 0x80)
+        {
+            ranges.emplace_back(RAW_BYTE_BASE + std::max<uint32_t>(lo, 0x80), RAW_BYTE_BASE + hi);
+        }
+    }
+    return ranges;
+}
+
+// \d \w \s 的区间（ASCII 定义，不区分大小写地取字母），不是这几个字母时 count 为 0
+struct PerlClassRanges
+{
+    int count;
+    uint32_t ranges[4][2];
+};
+
+constexpr PerlClassRanges perlClassRanges(char letter)
+{
+    switch (letter | 0x20)
+    {
+    case 'd':
+        return PerlClassRanges{1, {{'0', '9'}}};
+    case 'w':
+        return PerlClassRanges{4, {{'0', '9'}, {'A', 'Z'}, {'_', '_'}, {'a', 'z'}}};
+    case 's':
+        return PerlClassRanges{2, {{'\t', '\r'}, {' ', ' '}}};
+    default:
+        return PerlClassRanges{0, {}};
+    }
+}
+
+// \d \w \s 和取反的 \D \W \S，不是这几个字母时返回 false。取反时在 [0, max] 中取补集
+bool perlClass(char letter, CodePointRanges &ranges, uint32_t max = 0x10FFFF)
+{
+    const PerlClassRanges perl = perlClassRanges(letter);
+    if (perl.count == 0)
+    {
+        return false;
+    }
+    ranges.clear();
+    for (int k = 0; k < perl.count; ++k)
+    {
+        ranges.emplace_back(perl.ranges[k][0], perl.ranges[k][1]);
+    }
+    if (letter >= 'A' && letter <= 'Z')
+    {
+        ranges = complementRanges(ranges, max);
+    }
+    return true;
+}
+
+// 字符类 [...]，regex[i] 是 '['。支持 ^ 取反、a-z 区间、\d 等和其他转义，紧跟在 [ 或 [^ 后的 ] 是字面量。
+// 字符类中的元素都是码点，\xHH 也按码点 U+00HH 处理。bytes 为真（字节模式 (?-u:...)）时元素都是字节：
+// \xHH 是原始字节，取反在 0x00-0xFF 中取补集，不能写非 ASCII 字符
+CodePointRanges parseClass(const std::string &regex, size_t &i, bool bytes = false)
+{
+    const uint32_t max = bytes ? 0xFF : 0x10FFFF;
+    const size_t open = i++;
+    bool negate = i < regex.size() && regex[i] == '^';
+    if (negate)
+    {
+        ++i;
+    }
+
+    CodePointRanges ranges;
+    for (bool first = true; i < regex.size() && (regex[i] != ']' || first); first = false)
+    {
+        CodePointRanges perl;
+        if (regex[i] == '\\' && i + 1 < regex.size() && perlClass(regex[i + 1], perl, max))
+        {
+            ranges.insert(ranges.end(), perl.begin(), perl.end());
+            i += 2;
+            continue;
+        }
+        const size_t element = i;
+        bool isByte;
+        uint32_t lo = readRegexChar(regex, i, isByte);
+        bool character = !isByte && lo >= 0x80; // 非 ASCII 字符，字节模式中不允许
+        uint32_t hi = lo;
+        if (i + 1 < regex.size() && regex[i] == '-' && regex[i + 1] != ']')
+        {
+            ++i;
+            hi = readRegexChar(regex, i, isByte);
+            character = character || (!isByte && hi >= 0x80);
+        }
+        if (bytes && character)
+        {
+            throw RegexSyntaxError("字节模式的字符类中只能有 ASCII 字符和 \\xHH", element);
+        }
+        ranges.emplace_back(std::min(lo, hi), std::max(lo, hi));
+    }
+    if (i >= regex.size())
+    {
+        throw RegexSyntaxError("字符类缺少 ']'", open);
+    }
+    ++i;
+    normalizeRanges(ranges);
+    if (negate)
+    {
+        ranges = complementRanges(ranges, max);
+    }
+    return bytes ? rawByteRanges(ranges) : ranges;
+}
+
+// 正则表达式的语法树
+struct RegexNode
+{
+    enum Kind
+    {
+        Empty,     // 空串
+        Literal,   // 一个字符
+        Class,     // 字符类
+        Concat,    // children 依次串联
+        Alternate, // children 任选其一
+        Repeat     // children[0] 重复 min 到 max 次
+    };
+
+    static constexpr int UNBOUNDED = -1;
+
+    Kind kind = Empty;
+    uint32_t cp = 0;        // Literal：码点，isByte 时是原始字节
+    bool isByte = false;
+    CodePointRanges ranges; // Class
+    int min = 0;
+    int max = 0;   // UNBOUNDED 表示不限
+    int group = 0; // 捕获模式下这个结点是第 group 个捕获组（从1开始按左括号编号），0 表示不是
+    std::vector<RegexNode> children;
+};
+
+// 递归下降的语法分析器：
+//   alternation := concat ('|' concat)*
+//   concat      := repeat*
+//   repeat      := atom ('*' | '+' | '?' | '{m}' | '{m,}' | '{m,n}')*
+//   atom        := '(' alternation ')' | '(?-u:' alternation ')' | '[' 字符类 ']' | '.' | ' ' | 转义 | 字面字符
+// 空格表示空串，. 匹配除换行外的任意字符；\n \t \r 是控制字符，\xHH 是原始字节，\d \w \s 是预定义的字符类，
+// 其余转义表示字符本身。不构成 {m,n} 的 { 按字面量处理。合法的 UTF-8 多字节字符是一个字符。
+// 字符类按码点匹配（[\xE9] 是 U+00E9 的 UTF-8 编码）；(?-u:...) 中是字节模式，字符类和 . 按单个字节匹配，
+// 例如 (?-u:[\x80-\xBF]) 匹配一个 UTF-8 后续字节，(?-u:[^\n]) 匹配除换行外的任意字节。
+// captures 为真时每对括号是一个捕获组，(?-u:...) 不是捕获组
+class RegexParser
+{
+public:
+    static constexpr int MAX_DEPTH = 1000;  // 括号嵌套层数
+    static constexpr int MAX_REPEAT = 1000; // {m,n} 中的次数
+    static constexpr int MAX_GROUPS = 127;  // 捕获组个数：每组两个标记，标记编号要放进 Transition::tag
+    // 有界重复展开之后的大小（字符和字符类的个数）。重复嵌套时大小按次数相乘，
+    // 例如 ((a{1000}){1000}){1000} 只有几个字符，展开后却有 10^9 个，超过上限的模式当作语法错误拒绝
+    static constexpr size_t MAX_EXPANDED_SIZE = 100000;
+    // 括号和重复都算一层嵌套：a{1}{1}{1}... 没有括号，语法树却和括号一样深，后面递归的化简、分析和生成都会爆栈
+
+    explicit RegexParser(const std::string &_regex, bool _captures = false) : regex(_regex), captures(_captures) {}
+
+    RegexNode parse()
+    {
+        Shape shape;
+        RegexNode node = parseAlternation(shape);
+        if (pos < regex.size())
+        {
+            throw RegexSyntaxError("多余的 ')'", pos);
+        }
+        // 单个重复在 parseRepeat 中已经检查过，这里检查并列的多个重复加起来的大小
+        if (shape.size > MAX_EXPANDED_SIZE)
+        {
+            throw RegexSyntaxError("展开重复之后的模式超过 " + std::to_string(MAX_EXPANDED_SIZE) + " 个字符", 0);
+        }
+        return node;
+    }
+
+    int groupCount() const { return groups; }
+
+private:
+    const std::string &regex;
+    bool captures;
+    size_t pos = 0;
+    int depth = 0;
+    int groups = 0;
+    bool bytes = false; // 在 (?-u:...) 中
+    size_t atoms = 0; // 已经分析的原子个数，每 1024 个检查一次编译预算的期限
+
+    // 分析出的子树的大小和嵌套层数，由下往上合并，不用再回头遍历子树
+    struct Shape
+    {
+        size_t size = 0; // 展开有界重复之后的大小，超过 MAX_EXPANDED_SIZE 时停在 MAX_EXPANDED_SIZE + 1
+        int nesting = 0; // 括号和重复的嵌套层数
+    };
+
+    static void addShape(Shape &shape, const Shape &child)
+    {
+        shape.size = std::min(shape.size + child.size, MAX_EXPANDED_SIZE + 1);
+        shape.nesting = std::max(shape.nesting, child.nesting);
+    }
+
+    bool at(char c) const { return pos < regex.size() && regex[pos] == c; }
+
+    RegexNode parseAlternation(Shape &shape)
+    {
+        RegexNode node;
+        node.kind = RegexNode::Alternate;
+        Shape child;
+        node.children.push_back(parseConcat(child));
+        addShape(shape, child);
+        while (at('|'))
+        {
+            ++pos;
+            child = Shape();
+            node.children.push_back(parseConcat(child));
+            addShape(shape, child);
+        }
+        if (node.children.size() == 1)
+        {
+            return std::move(node.children[0]);
+        }
+        return node;
+    }
+
+    RegexNode parseConcat(Shape &shape)
+    {
+        RegexNode node;
+        node.kind = RegexNode::Concat;
+        while (pos < regex.size() && !at('|') && !at(')'))
+        {
+            if (++atoms % 1024 == 0)
+            {
+                checkCompileBudget();
+            }
+            Shape child;
+            node.children.push_back(parseRepeat(child));
+            addShape(shape, child);
+        }
+        if (node.children.empty())
+        {
+            shape.size = 1;
+            return RegexNode();
+        }
+        if (node.children.size() == 1)
+        {
+            return std::move(node.children[0]);
+        }
+        return node;
+    }
+
+    // 连续的 * + ? 合并成一个重复：x** 就是 x*，x+? 就是 x*，x?? 就是 x?。{m,n} 不合并，每个算一层嵌套
+    RegexNode parseRepeat(Shape &shape)
+    {
+        RegexNode node = parseAtom(shape);
+        bool simple = false; // node 是紧跟在原子后面的 * + ? 生成的重复
+        for (;;)
+        {
+            const size_t op = pos;
+            int min = 0, max = RegexNode::UNBOUNDED;
+            const bool star = at('*') || at('+') || at('?');
+            if (star)
+            {
+                min = at('+') ? 1 : 0;
+                max = at('?') ? 1 : RegexNode::UNBOUNDED;
+                ++pos;
+            }
+            else if (!parseCount(min, max))
+            {
+                return node;
+            }
+            if (star && simple)
+            {
+                // 两个重复的下限都是0或1，上限都是1或不限，叠起来的下限是乘积，上限只有都是1时才是1
+                node.min *= min;
+                node.max = node.max == 1 && max == 1 ? 1 : RegexNode::UNBOUNDED;
+                continue;
+            }
+            RegexNode repeat;
+            repeat.kind = RegexNode::Repeat;
+            repeat.min = min;
+            repeat.max = max;
+            repeat.children.push_back(std::move(node));
+            node = std::move(repeat);
+            simple = star;
+            // 上限不限时展开成 min 份（至少一份）加一个星号
+            const size_t copies = static_cast<size_t>(std::max(max == RegexNode::UNBOUNDED ? min : max, 1));
+            shape.size = std::min(shape.size * copies, MAX_EXPANDED_SIZE + 1);
+            if (shape.size > MAX_EXPANDED_SIZE)
+            {
+                throw RegexSyntaxError("展开重复之后的模式超过 " + std::to_string(MAX_EXPANDED_SIZE) + " 个字符", op);
+            }
+            if (++shape.nesting + depth > MAX_DEPTH)
+            {
+                throw RegexSyntaxError("括号和重复嵌套过深", op);
+            }
+        }
+    }
+
+    // {m}、{m,} 或 {m,n}，不是这几种形式时返回 false，{ 留给 parseAtom 作为字面量
+    bool parseCount(int &min, int &max)
+    {
+        if (!at('{'))
+        {
+            return false;
+        }
+        size_t p = pos + 1;
+        auto number = [&](int &value)
+        {
+            size_t begin = p;
+            value = 0;
+            while (p < regex.size() && std::isdigit(static_cast<unsigned char>(regex[p])))
+            {
+                value = std::min(value * 10 + (regex[p++] - '0'), MAX_REPEAT + 1);
+            }
+            return p > begin;
+        };
+        if (!number(min))
+        {
+            return false;
+        }
+        max = min;
+        if (p < regex.size() && regex[p] == ',')
+        {
+            ++p;
+            if (!number(max))
+            {
+                max = RegexNode::UNBOUNDED;
+            }
+        }
+        if (p >= regex.size() || regex[p] != '}')
+        {
+            return false;
+        }
+        if (min > MAX_REPEAT || max > MAX_REPEAT)
+        {
+            throw RegexSyntaxError("重复次数超过 " + std::to_string(MAX_REPEAT), pos);
+        }
+        if (max != RegexNode::UNBOUNDED && max < min)
+        {
+            throw RegexSyntaxError("重复次数的上限小于下限", pos);
+        }
+        pos = p + 1;
+        return true;
+    }
+
+    RegexNode parseAtom(Shape &shape)
+    {
+        RegexNode node;
+        shape.size = 1;
+        char c = regex[pos];
+        CodePointRanges perl;
+        if (c == '(')
+        {
+            const size_t open = pos++;
+            if (++depth > MAX_DEPTH)
+            {
+                throw RegexSyntaxError("括号嵌套过深", open);
+            }
+            const bool byteMode = regex.compare(pos, 4, "?-u:") == 0;
+            if (byteMode)
+            {
+                pos += 4;
+            }
+            else if (captures && ++groups > MAX_GROUPS)
+            {
+                throw RegexSyntaxError("捕获组超过 " + std::to_string(MAX_GROUPS) + " 个", open);
+            }
+            const int group = captures && !byteMode ? groups : 0;
+            const bool outer = bytes;
+            bytes = bytes || byteMode;
+            shape = Shape();
+            node = parseAlternation(shape);
+            bytes = outer;
+            if (!at(')'))
+            {
+                throw RegexSyntaxError("缺少 ')'", open);
+            }
+            ++pos;
+            --depth;
+            ++shape.nesting;
+            if (byteMode)
+            {
+                return node; // 不是捕获组，里面的捕获组保持原样
+            }
+            if (node.group != 0)
+            {
+                // ((x))：内层已经是捕获组，外层套一个只有一个元素的串联
+                RegexNode inner = std::move(node);
+                node = RegexNode();
+                node.kind = RegexNode::Concat;
+                node.children.push_back(std::move(inner));
+            }
+            node.group = group;
+        }
+        else if (c == '*' || c == '+' || c == '?')
+        {
+            throw RegexSyntaxError(std::string("'") + c + "' 前面没有可以重复的内容", pos);
+        }
+        else if (c == '[')
+        {
+            node.kind = RegexNode::Class;
+            node.ranges = parseClass(regex, pos, bytes);
+        }
+        else if (c == '.')
+        {
+            node.kind = RegexNode::Class;
+            node.ranges = bytes ? rawByteRanges({{0, '\n' - 1}, {'\n' + 1, 0xFF}}) : CodePointRanges{{0, '\n' - 1}, {'\n' + 1, 0x10FFFF}};
+            ++pos;
+        }
+        else if (c == ' ')
+        {
+            ++pos; // 空串
+        }
+        else if (c == '\\' && pos + 1 < regex.size() && perlClass(regex[pos + 1], perl, bytes ? 0xFF : 0x10FFFF))
+        {
+            node.kind = RegexNode::Class;
+            node.ranges = bytes ? rawByteRanges(perl) : perl;
+            pos += 2;
+        }
+        else
+        {
+            node.kind = RegexNode::Literal;
+            node.cp = readRegexChar(regex, pos, node.isByte);
+        }
+        return node;
+    }
+};
+
+// 语法树写成后缀表达式。x{m,n} 展开为 m 个 x 的串联加上 (x(x(x)?)?)? 形式的可选部分，
+// 大小与 n 成正比；上限不限时最后一个 x 写成 x+（m 为 0 时就是 x*）。
+// 第 g 个捕获组写成 {2g-2} x . {2g-1} .，两个标记分别记下组的开始和结束位置
+void lowerRegex(const RegexNode &node, std::string &postfix, bool tagged = true)
+{
+    if (tagged && node.group > 0)
+    {
+        appendPostfixTag(postfix, 2 * node.group - 2);
+        lowerRegex(node, postfix, false);
+        postfix += '.';
+        appendPostfixTag(postfix, 2 * node.group - 1);
+        postfix += '.';
+        return;
+    }
+    switch (node.kind)
+    {
+    case RegexNode::Empty:
+        postfix += ' ';
+        break;
+    case RegexNode::Literal:
+    {
+        uint8_t bytes[4];
+        int length = node.isByte ? (bytes[0] = static_cast<uint8_t>(node.cp), 1) : encodeUtf8(node.cp, bytes);
+        for (int k = 0; k < length; ++k)
+        {
+            appendPostfixByte(postfix, bytes[k]);
+            if (k > 0)
+            {
+                postfix += '.';
+            }
+        }
+        break;
+    }
+    case RegexNode::Class:
+        appendPostfixClass(postfix, node.ranges);
+        break;
+    case RegexNode::Concat:
+    case RegexNode::Alternate:
+        for (size_t i = 0; i < node.children.size(); ++i)
+        {
+            lowerRegex(node.children[i], postfix);
+            if (i > 0)
+            {
+                postfix += node.kind == RegexNode::Concat ? '.' : '|';
+            }
+        }
+        break;
+    case RegexNode::Repeat:
+    {
+        const RegexNode &child = node.children[0];
+        int required = node.max == RegexNode::UNBOUNDED && node.min > 0 ? node.min - 1 : node.min;
+        // 有界重复把子表达式展开成多份，嵌套时长度成倍增长，每展开一份检查一次预算
+        for (int i = 0; i < required; ++i)
+        {
+            lowerRegex(child, postfix);
+            checkCompileBudget(postfix.size());
+            if (i > 0)
+            {
+                postfix += '.';
+            }
+        }
+        if (node.max == RegexNode::UNBOUNDED)
+        {
+            lowerRegex(child, postfix);
+            postfix += node.min == 0 ? '*' : '+';
+        }
+        else if (node.max > node.min)
+        {
+            int optionalCount = node.max - node.min;
+            for (int i = 0; i < optionalCount; ++i)
+            {
+                lowerRegex(child, postfix);
+                checkCompileBudget(postfix.size());
+            }
+            postfix += '?';
+            for (int i = 1; i < optionalCount; ++i)
+            {
+                postfix += ".?";
+            }
+        }
+        else if (required == 0)
+        {
+            postfix += ' '; // x{0}
+            break;
+        }
+        if (required > 0 && node.max != node.min)
+        {
+            postfix += '.';
+        }
+        break;
+    }
+    }
+}
+
+// 单个字符（可以编码成 UTF-8 的字面字符或字符类）的码点区间，其他节点返回 false
+bool singleCharRanges(const RegexNode &node, CodePointRanges &ranges)
+{
+    if (node.kind == RegexNode::Class)
+    {
+        ranges = node.ranges;
+        return true;
+    }
+    if (node.kind == RegexNode::Literal && (!node.isByte || node.cp < 0x80))
+    {
+        ranges = {{node.cp, node.cp}};
+        return true;
+    }
+    return false;
+}
+
+// 串联：展平嵌套的串联并去掉空串
+RegexNode makeConcat(std::vector<RegexNode> parts)
+{
+    RegexNode node;
+    node.kind = RegexNode::Concat;
+    for (RegexNode &part : parts)
+    {
+        if (part.kind == RegexNode::Concat)
+        {
+            for (RegexNode &child : part.children)
+            {
+                node.children.push_back(std::move(child));
+            }
+        }
+        else if (part.kind != RegexNode::Empty)
+        {
+            node.children.push_back(std::move(part));
+        }
+    }
+    if (node.children.empty())
+    {
+        return RegexNode();
+    }
+    if (node.children.size() == 1)
+    {
+        return std::move(node.children[0]);
+    }
+    return node;
+}
+
+// 选择的化简（分支已经化简过）。匹配语义是最左最长，与分支的顺序无关，所以可以自由地重排分支：
+//   1. 展平嵌套的选择，去掉重复的分支
+//   2. 提取公共前缀：abc|abd|x → ab(c|d)|x，剩下的部分递归化简
+//   3. 单个字符的分支合并成一个字符类：a|b|[x-z] → [abx-z]
+RegexNode simplifyAlternation(std::vector<RegexNode> branches)
+{
+    std::vector<RegexNode> unique;
+    std::set<std::string> seen;
+    for (size_t i = 0; i < branches.size(); ++i)
+    {
+        if (branches[i].kind == RegexNode::Alternate)
+        {
+            std::vector<RegexNode> nested = std::move(branches[i].children);
+            for (RegexNode &child : nested)
+            {
+                branches.push_back(std::move(child));
+            }
+            continue;
+        }
+        // 化简和字面量分析都会走到这里，分支很多时（几万个关键词）是解析阶段最慢的部分
+        checkCompileBudget();
+        std::string key;
+        lowerRegex(branches[i], key);
+        if (seen.insert(key).second)
+        {
+            unique.push_back(std::move(branches[i]));
+        }
+    }
+
+    // 按第一个元素分组，每组放在它第一个分支的位置
+    std::vector<std::vector<RegexNode>> groups;
+    std::map<std::string, size_t> groupOf;
+    for (RegexNode &branch : unique)
+    {
+        std::string key;
+        lowerRegex(branch.kind == RegexNode::Concat ? branch.children[0] : branch, key);
+        auto found = groupOf.emplace(key, groups.size());
+        if (found.second)
+        {
+            groups.emplace_back();
+        }
+        groups[found.first->second].push_back(std::move(branch));
+    }
+
+    std::vector<RegexNode> factored;
+    for (std::vector<RegexNode> &group : groups)
+    {
+        if (group.size() == 1 || group[0].kind == RegexNode::Empty)
+        {
+            factored.push_back(std::move(group[0]));
+            continue;
+        }
+        RegexNode prefix = group[0].kind == RegexNode::Concat ? group[0].children[0] : group[0];
+        std::vector<RegexNode> rests;
+        for (RegexNode &branch : group)
+        {
+            if (branch.kind == RegexNode::Concat)
+            {
+                branch.children.erase(branch.children.begin());
+                rests.push_back(makeConcat(std::move(branch.children)));
+            }
+            else
+            {
+                rests.push_back(RegexNode());
+            }
+        }
+        std::vector<RegexNode> parts;
+        parts.push_back(std::move(prefix));
+        parts.push_back(simplifyAlternation(std::move(rests)));
+        factored.push_back(makeConcat(std::move(parts)));
+    }
+
+    CodePointRanges merged, ranges;
+    size_t firstSingle = factored.size(), singles = 0;
+    for (size_t i = 0; i < factored.size(); ++i)
+    {
+        if (singleCharRanges(factored[i], ranges))
+        {
+            merged.insert(merged.end(), ranges.begin(), ranges.end());
+            firstSingle = std::min(firstSingle, i);
+            ++singles;
+        }
+    }
+    RegexNode node;
+    node.kind = RegexNode::Alternate;
+    for (size_t i = 0; i < factored.size(); ++i)
+    {
+        if (singles > 1 && i == firstSingle)
+        {
+            RegexNode merge;
+            merge.kind = RegexNode::Class;
+            merge.ranges = merged;
+            normalizeRanges(merge.ranges);
+            node.children.push_back(std::move(merge));
+        }
+        else if (singles <= 1 || !singleCharRanges(factored[i], ranges))
+        {
+            node.children.push_back(std::move(factored[i]));
+        }
+    }
+    if (node.children.size() == 1)
+    {
+        return std::move(node.children[0]);
+    }
+    return node;
+}
+
+// 自底向上化简语法树：展平串联、化简选择，合并嵌套的重复：
+// (x*)* (x+)* (x?)* (x*)+ (x?)+ (x*)? (x+)? → x*，(x+)+ → x+，(x?)? → x?
+RegexNode simplifyRegex(RegexNode node)
+{
+    for (RegexNode &child : node.children)
+    {
+        child = simplifyRegex(std::move(child));
+    }
+
+    if (node.kind == RegexNode::Concat)
+    {
+        return makeConcat(std::move(node.children));
+    }
+    if (node.kind == RegexNode::Alternate)
+    {
+        return simplifyAlternation(std::move(node.children));
+    }
+    if (node.kind != RegexNode::Repeat)
+    {
+        return node;
+    }
+
+    RegexNode &child = node.children[0];
+    if (child.kind == RegexNode::Empty || node.max == 0)
+    {
+        return RegexNode();
+    }
+    if (node.min == 1 && node.max == 1)
+    {
+        return std::move(child);
+    }
+    auto simpleRepeat = [](const RegexNode &r)
+    {
+        return r.kind == RegexNode::Repeat && ((r.min <= 1 && r.max == RegexNode::UNBOUNDED) || (r.min == 0 && r.max == 1));
+    };
+    if (simpleRepeat(node) && simpleRepeat(child))
+    {
+        node.min = node.min * child.min;
+        node.max = node.max == 1 && child.max == 1 ? 1 : RegexNode::UNBOUNDED;
+        RegexNode inner = std::move(child.children[0]);
+        node.children[0] = std::move(inner);
+    }
+    return node;
+}
+
+// 中缀转后缀：语法分析得到语法树，化简后写成后缀表达式（编译器的中间表示）。
+// 语法错误时抛出 RegexSyntaxError
+std::string infixToPostfix(const std::string &regex)
+{
+    PhaseTimer timer(compileStats.parseSeconds);
+    std::string postfix;
+    lowerRegex(simplifyRegex(RegexParser(regex).parse()), postfix);
+    return postfix;
+}
+
+// 带捕获组的后缀表达式，groups 返回捕获组的个数。不做化简：化简会重排选择的分支、提取公共前缀，
+// 改变捕获组的结构和分支的优先顺序
+std::string infixToTaggedPostfix(const std::string &regex, int &groups)
+{
+    PhaseTimer timer(compileStats.parseSeconds);
+    RegexParser parser(regex, true);
+    std::string postfix;
+    lowerRegex(parser.parse(), postfix);
+    groups = parser.groupCount();
+    return postfix;
+}
+
+// 语法树的字面量分析，给预过滤器用。字符串集合的大小和长度都有上限，超过时视为未知：
+//   exact     这个结点匹配的全部字符串（语言有限且很小时）
+//   prefixes  每个匹配都以其中之一开头；suffixes 同理是结尾。集合中有空串时没有过滤作用
+//   factor    每个匹配都包含的字符串，可能为空
+struct LiteralInfo
+{
+    static constexpr size_t MAX_LITERALS = 16;
+    static constexpr size_t MAX_LENGTH = 32;
+
+    bool exactKnown = false;
+    std::vector<std::string> exact;
+    bool prefixesKnown = false;
+    std::vector<std::string> prefixes;
+    bool suffixesKnown = false;
+    std::vector<std::string> suffixes;
+    std::string factor;
+
+    // 可以作为匹配起点过滤条件的前缀集合：已知且不含空串
+    bool usefulPrefixes() const
+    {
+        return prefixesKnown && !prefixes.empty() &&
+               std::none_of(prefixes.begin(), prefixes.end(), [](const std::string &s)
+                            { return s.empty(); });
+    }
+};
+
+// 排序去重，数量超过上限时返回 false
+bool normalizeLiterals(std::vector<std::string> &literals)
+{
+    std::sort(literals.begin(), literals.end());
+    literals.erase(std::unique(literals.begin(), literals.end()), literals.end());
+    return literals.size() <= LiteralInfo::MAX_LITERALS;
+}
+
+// 两个集合的笛卡尔积（逐个串联），结果太大时返回 false
+bool crossLiterals(const std::vector<std::string> &first, const std::vector<std::string> &second, std::vector<std::string> &out)
+{
+    if (first.size() * second.size() > LiteralInfo::MAX_LITERALS * 4)
+    {
+        return false;
+    }
+    out.clear();
+    for (const std::string &a : first)
+    {
+        for (const std::string &b : second)
+        {
+            out.push_back(a + b);
+        }
+    }
+    return normalizeLiterals(out);
+}
+
+// exact 已知时由它得到前缀和后缀；前缀只保留开头 MAX_LENGTH 个字节（截短后仍然是前缀），后缀同理
+void finishLiteralInfo(LiteralInfo &info)
+{
+    if (info.exactKnown)
+    {
+        for (const std::string &s : info.exact)
+        {
+            info.exactKnown = info.exactKnown && s.size() <= LiteralInfo::MAX_LENGTH;
+        }
+        info.prefixes = info.suffixes = info.exact;
+        info.prefixesKnown = info.suffixesKnown = true;
+        if (!info.exactKnown)
+        {
+            info.exact.clear();
+        }
+    }
+    for (std::string &s : info.prefixes)
+    {
+        s.resize(std::min(s.size(), LiteralInfo::MAX_LENGTH));
+    }
+    for (std::string &s : info.suffixes)
+    {
+        s.erase(0, s.size() - std::min(s.size(), LiteralInfo::MAX_LENGTH));
+    }
+    info.prefixesKnown = info.prefixesKnown && normalizeLiterals(info.prefixes);
+    info.suffixesKnown = info.suffixesKnown && normalizeLiterals(info.suffixes);
+
+    // 前缀集合的公共前缀、后缀集合的公共后缀也是必须出现的字符串
+    auto keepLonger = [&info](const std::string &candidate)
+    {
+        if (candidate.size() > info.factor.size())
+        {
+            info.factor = candidate;
+        }
+    };
+    if (info.prefixesKnown && !info.prefixes.empty())
+    {
+        std::string common = info.prefixes.front();
+        for (const std::string &s : info.prefixes)
+        {
+            common.resize(std::mismatch(common.begin(), common.end(), s.begin(), s.end()).first - common.begin());
+        }
+        keepLonger(common);
+    }
+    if (info.suffixesKnown && !info.suffixes.empty())
+    {
+        std::string common = info.suffixes.front();
+        for (const std::string &s : info.suffixes)
+        {
+            auto mismatch = std::mismatch(common.rbegin(), common.rend(), s.rbegin(), s.rend());
+            common.erase(0, common.size() - (mismatch.first - common.rbegin()));
+        }
+        keepLonger(common);
+    }
+}
+
+LiteralInfo analyzeLiterals(const RegexNode &node)
+{
+    LiteralInfo info;
+    switch (node.kind)
+    {
+    case RegexNode::Empty:
+        info.exactKnown = true;
+        info.exact = {""};
+        break;
+    case RegexNode::Literal:
+    {
+        uint8_t bytes[4];
+        int length = node.isByte ? (bytes[0] = static_cast<uint8_t>(node.cp), 1) : encodeUtf8(node.cp, bytes);
+        info.exactKnown = true;
+        info.exact = {std::string(reinterpret_cast<const char *>(bytes), length)};
+        break;
+    }
+    case RegexNode::Class:
+    {
+        uint64_t count = 0;
+        for (auto [lo, hi] : node.ranges)
+        {
+            count += hi - lo + 1;
+        }
+        if (count > LiteralInfo::MAX_LITERALS)
+        {
+            break;
+        }
+        info.exactKnown = true;
+        for (auto [lo, hi] : node.ranges)
+        {
+            for (uint32_t cp = lo; cp <= hi; ++cp)
+            {
+                uint8_t bytes[4];
+                if (cp >= RAW_BYTE_BASE)
+                {
+                    info.exact.emplace_back(1, static_cast<char>(cp - RAW_BYTE_BASE));
+                }
+                else if (cp < 0xD800 || cp > 0xDFFF)
+                {
+                    info.exact.emplace_back(reinterpret_cast<const char *>(bytes), encodeUtf8(cp, bytes));
+                }
+            }
+        }
+        break;
+    }
+    case RegexNode::Concat:
+    {
+        info = analyzeLiterals(node.children[0]);
+        for (size_t i = 1; i < node.children.size(); ++i)
+        {
+            LiteralInfo next = analyzeLiterals(node.children[i]);
+            LiteralInfo combined;
+            combined.exactKnown = info.exactKnown && next.exactKnown && crossLiterals(info.exact, next.exact, combined.exact);
+            if (!combined.exactKnown)
+            {
+                combined.exact.clear();
+                // 左边是有限的字符串集合时，前缀可以越过它延伸到右边
+                combined.prefixesKnown = true;
+                if (!(info.exactKnown && next.prefixesKnown && crossLiterals(info.exact, next.prefixes, combined.prefixes)))
+                {
+                    combined.prefixesKnown = info.prefixesKnown;
+                    combined.prefixes = info.prefixes;
+                }
+                combined.suffixesKnown = true;
+                if (!(next.exactKnown && info.suffixesKnown && crossLiterals(info.suffixes, next.exact, combined.suffixes)))
+                {
+                    combined.suffixesKnown = next.suffixesKnown;
+                    combined.suffixes = next.suffixes;
+                }
+            }
+            combined.factor = info.factor.size() >= next.factor.size() ? info.factor : next.factor;
+            // 左边唯一的后缀和右边唯一的前缀相接，也是必须出现的
+            if (info.suffixesKnown && info.suffixes.size() == 1 && next.prefixesKnown && next.prefixes.size() == 1 &&
+                info.suffixes[0].size() + next.prefixes[0].size() > combined.factor.size())
+            {
+                combined.factor = info.suffixes[0] + next.prefixes[0];
+            }
+            finishLiteralInfo(combined);
+            info = std::move(combined);
+        }
+        return info;
+    }
+    case RegexNode::Alternate:
+    {
+        info.exactKnown = info.prefixesKnown = info.suffixesKnown = true;
+        for (const RegexNode &child : node.children)
+        {
+            LiteralInfo branch = analyzeLiterals(child);
+            info.exactKnown = info.exactKnown && branch.exactKnown;
+            info.prefixesKnown = info.prefixesKnown && branch.prefixesKnown;
+            info.suffixesKnown = info.suffixesKnown && branch.suffixesKnown;
+            info.exact.insert(info.exact.end(), branch.exact.begin(), branch.exact.end());
+            info.prefixes.insert(info.prefixes.end(), branch.prefixes.begin(), branch.prefixes.end());
+            info.suffixes.insert(info.suffixes.end(), branch.suffixes.begin(), branch.suffixes.end());
+        }
+        info.exactKnown = info.exactKnown && normalizeLiterals(info.exact);
+        if (!info.exactKnown)
+        {
+            info.exact.clear();
+        }
+        break;
+    }
+    case RegexNode::Repeat:
+    {
+        LiteralInfo child = analyzeLiterals(node.children[0]);
+        if (node.min == 0)
+        {
+            // x? 的语言是 x 的语言加上空串；其余可以不出现的重复什么都不能保证
+            info.exactKnown = node.max == 1 && child.exactKnown;
+            if (info.exactKnown)
+            {
+                info.exact = child.exact;
+                info.exact.push_back("");
+                info.exactKnown = normalizeLiterals(info.exact);
+            }
+            break;
+        }
+        info.prefixesKnown = child.prefixesKnown;
+        info.prefixes = child.prefixes;
+        info.suffixesKnown = child.suffixesKnown;
+        info.suffixes = child.suffixes;
+        info.factor = child.factor;
+        if (child.exactKnown && node.max == node.min)
+        {
+            std::vector<std::string> repeated = {""};
+            info.exactKnown = true;
+            for (int i = 0; i < node.min && info.exactKnown; ++i)
+            {
+                info.exactKnown = crossLiterals(repeated, child.exact, info.exact);
+                repeated = info.exact;
+            }
+        }
+        if (!info.exactKnown)
+        {
+            info.exact.clear();
+        }
+        break;
+    }
+    }
+    finishLiteralInfo(info);
+    return info;
+}
+
+// 解析一个正则表达式并做字面量分析
+LiteralInfo regexLiterals(const std::string &regex)
+{
+    return analyzeLiterals(simplifyRegex(RegexParser(regex).parse()));
+}
+
+Fragment buildFragmentFromPostfix(NFABuilder &builder, const std::string &postfix)
+{
+    std::stack<Fragment> nfaStack;
+    PostfixToken token;
+
+    for (size_t pos = 0, count = 0; readPostfixToken(postfix, pos, token); ++count)
+    {
+        if (count % 4096 == 0)
+        {
+            checkCompileBudget(postfix.size() + builder.memoryBytes(), builder.size());
+        }
+        if (token.kind == PostfixToken::Literal || token.kind == PostfixToken::Epsilon || token.kind == PostfixToken::Class ||
+            token.kind == PostfixToken::Tag)
+        {
+            nfaStack.push(thompsonConstruction(builder, token));
+        }
+        else if (token.kind == PostfixToken::Alternate)
+        {
+            Fragment nfa2 = nfaStack.top();
+            nfaStack.pop();
+            Fragment nfa1 = nfaStack.top();
+            nfaStack.pop();
+            nfaStack.push(alternate(builder, nfa1, nfa2));
+        }
+        else if (token.kind == PostfixToken::Star)
+        {
+            Fragment nfa = nfaStack.top();
+            nfaStack.pop();
+            nfaStack.push(kleeneStar(builder, nfa));
+        }
+        else if (token.kind == PostfixToken::Plus)
+        {
+            Fragment nfa = nfaStack.top();
+            nfaStack.pop();
+            nfaStack.push(kleenePlus(builder, nfa));
+        }
+        else if (token.kind == PostfixToken::Optional)
+        {
+            Fragment nfa = nfaStack.top();
+            nfaStack.pop();
+            nfaStack.push(optional(builder, nfa));
+        }
+        else if (token.kind == PostfixToken::Concat)
+        {
+            Fragment nfa2 = nfaStack.top();
+            nfaStack.pop();
+            Fragment nfa1 = nfaStack.top();
+            nfaStack.pop();
+            nfaStack.push(concatenate(builder, nfa1, nfa2));
+        }
+    }
+
+    return nfaStack.top();
+}
+
+NFA generateThompsonNFAFromPostfix(const std::string &postfix)
+{
+    PhaseTimer timer(compileStats.thompsonSeconds);
+    NFABuilder builder;
+    NFA nfa = builder.finish(buildFragmentFromPostfix(builder, postfix));
+    compileStats.nfaStates += nfa.size();
+    compileStats.nfaEdges += nfa.edges.size();
+    checkCompileBudget(0, nfa.size());
+    chargeCompileMemory(nfa.memoryBytes());
+    return nfa;
+}
+
+// 带捕获组的NFA：* + ? 的空转换按贪婪的优先级排列，标记在带标记的空转换上
+NFA generateTaggedNFAFromPostfix(const std::string &postfix)
+{
+    PhaseTimer timer(compileStats.thompsonSeconds);
+    NFABuilder builder;
+    builder.greedy = true;
+    NFA nfa = builder.finish(buildFragmentFromPostfix(builder, postfix));
+    compileStats.nfaStates += nfa.size();
+    compileStats.nfaEdges += nfa.edges.size();
+    chargeCompileMemory(nfa.memoryBytes());
+    return nfa;
+}
+
+// 多模式（词法分析器）模式：priority 越大越优先，优先级相同时编号小的优先
+struct PatternSpec
+{
+    std::string regex;
+    int priority;
+};
+
+// 每个模式的NFA通过空转换挂在同一个开始状态下，接受状态记录自己的模式编号
+NFA generateNFAForPatterns(const std::vector<PatternSpec> &patterns)
+{
+    std::vector<std::string> postfixes;
+    MemoryCharge postfixBytes;
+    for (const PatternSpec &spec : patterns)
+    {
+        postfixes.push_back(infixToPostfix(spec.regex));
+        postfixBytes.update(postfixBytes.bytes() + postfixes.back().size());
+    }
+
+    PhaseTimer timer(compileStats.thompsonSeconds);
+    NFABuilder builder;
+    uint32_t startState = builder.createState();
+    uint32_t firstAccept = startState;
+
+    for (const PatternSpec &spec : patterns)
+    {
+        int pattern = builder.addPattern(spec.priority);
+        Fragment fragment = buildFragmentFromPostfix(builder, postfixes[pattern]);
+        builder.state(fragment.accept).pattern = pattern;
+        builder.addEmptyTransition(startState, fragment.start);
+        if (pattern == 0)
+        {
+            firstAccept = fragment.accept;
+        }
+    }
+
+    NFA nfa = builder.finish(Fragment{startState, firstAccept});
+    compileStats.nfaStates += nfa.size();
+    compileStats.nfaEdges += nfa.edges.size();
+    checkCompileBudget(0, nfa.size());
+    chargeCompileMemory(nfa.memoryBytes());
+    return nfa;
+}
+
+// 字节等价类（字母表压缩）：所有转换都一视同仁的字节归为一类。
+// 每条转换区间的端点把 0..255 切成若干段，每段是一个类，类按字节顺序编号。
+// 子集构造、最小化和转移表都按类而不是按字节索引，表的宽度从 256 降到类的个数
+class ByteClasses
+{
+public:
+    // 所有字节同属一类
+    ByteClasses() : firstOf(1, 0)
+    {
+        std::fill(std::begin(classOf), std::end(classOf), 0);
+    }
+
+    // 由 nfaStates 中所有状态的非空转换划分
+    ByteClasses(const NFA &nfa, const std::vector<uint32_t> &nfaStates) : firstOf(1, 0)
+    {
+        bool boundary[256] = {};
+        for (uint32_t s : nfaStates)
+        {
+            for (const Transition *t = nfa.edgesBegin(s); t != nfa.edgesEnd(s); ++t)
+            {
+                if (!t->epsilon)
+                {
+                    boundary[t->lo] = true;
+                    if (t->hi < 255)
+                    {
+                        boundary[t->hi + 1] = true;
+                    }
+                }
+            }
+        }
+        classOf[0] = 0;
+        for (int b = 1; b < 256; ++b)
+        {
+            if (boundary[b])
+            {
+                firstOf.push_back(static_cast<uint8_t>(b));
+            }
+            classOf[b] = static_cast<uint8_t>(firstOf.size() - 1);
+        }
+    }
+
+    // 两个划分的公共细分：两边都在同一类的字节才同属一类
+    ByteClasses(const ByteClasses &a, const ByteClasses &b) : firstOf(1, 0)
+    {
+        classOf[0] = 0;
+        for (int byte = 1; byte < 256; ++byte)
+        {
+            if (a[byte] != a[byte - 1] || b[byte] != b[byte - 1])
+            {
+                firstOf.push_back(static_cast<uint8_t>(byte));
+            }
+            classOf[byte] = static_cast<uint8_t>(firstOf.size() - 1);
+        }
+    }
+
+    int size() const { return static_cast<int>(firstOf.size()); }
+    uint8_t operator[](unsigned char byte) const { return classOf[byte]; }
+
+    // 类 c 覆盖的字节区间 [first(c), last(c)]
+    uint8_t first(int c) const { return firstOf[c]; }
+    uint8_t last(int c) const { return c + 1 < size() ? static_cast<uint8_t>(firstOf[c + 1] - 1) : 255; }
+    std::string label(int c) const { return byteRangeLabel(first(c), last(c)); }
+
+private:
+    uint8_t classOf[256];
+    std::vector<uint8_t> firstOf;
+};
+
+// DFA子集构造
+struct DFAState
+{
+    int id;
+    bool isFinal;
+    std::vector<int> nfaStates; // 对应的NFA状态编号，升序
+    std::vector<int> acceptTags; // 接受的模式编号，按优先级从高到低
+    std::map<int, DFAState *> transitions; // 以字节等价类为键
+    DFAState(int _id) : id(_id), isFinal(false) {}
+
+    // std::map 的一个结点：键值对加上红黑树的颜色和三个指针
+    static constexpr size_t TRANSITION_BYTES = heapBytes(sizeof(std::pair<const int, DFAState *>) + 4 * sizeof(void *));
+
+    size_t memoryBytes() const
+    {
+        return heapBytes(sizeof(DFAState)) + heapBytes(vectorBytes(nfaStates)) + heapBytes(vectorBytes(acceptTags)) +
+               transitions.size() * TRANSITION_BYTES;
+    }
+};
+
+// 子集构造使用的NFA视图：非空转换按字节等价类存成CSR边表（覆盖多个类的区间拆成每类一条），
+// 每个状态的ε闭包只计算一次并缓存
+class SubsetNFA
+{
+public:
+    std::vector<char> isFinal;
+    std::vector<int> acceptPattern;
+    std::vector<int> patternPriority;
+    std::vector<uint32_t> edgeStart; // 状态 i 的非空转换为 edges[edgeStart[i] .. edgeStart[i + 1])
+    std::vector<std::pair<int, uint32_t>> edges; // (字节类, 目标状态)
+    std::vector<uint32_t> closureStart; // 状态 i 的ε闭包为 closureData[closureStart[i] .. closureStart[i + 1])
+    std::vector<uint32_t> closureData;
+    // 不预先计算闭包时（closureStart 为空）保留ε转换：状态 i 的ε转换目标为 epsilonTargets[epsilonStart[i] .. epsilonStart[i + 1])
+    std::vector<uint32_t> epsilonStart;
+    std::vector<uint32_t> epsilonTargets;
+    bool epsilonFree = true; // 没有ε转换（例如 optimizeNFA 的结果）时闭包就是状态本身，不计算也不存
+    ByteClasses classes; // 输入符号就是类编号 0 .. classes.size() - 1
+    uint32_t start;
+
+    // precomputeClosures 为 false 时不计算闭包表，eClosure 每次沿ε转换现算
+    SubsetNFA(const NFA &nfa, const std::vector<uint32_t> &nfaStates, bool precomputeClosures = true) : classes(nfa, nfaStates)
+    {
+        const uint32_t n = nfa.size();
+        std::vector<char> reachable(n, 0);
+        for (uint32_t s : nfaStates)
+        {
+            reachable[s] = 1;
+        }
+        start = nfa.start;
+
+        // NFA下标本身就是稠密的，不可达状态不保留转换
+        isFinal.resize(n);
+        acceptPattern.resize(n);
+        patternPriority = nfa.patternPriority;
+        edgeStart.assign(n + 1, 0);
+        if (!precomputeClosures)
+        {
+            epsilonStart.assign(n + 1, 0);
+        }
+        for (uint32_t i = 0; i < n; ++i)
+        {
+            isFinal[i] = nfa.states[i].isFinal;
+            acceptPattern[i] = nfa.states[i].isFinal ? nfa.states[i].pattern : -1;
+            for (const Transition *t = nfa.edgesBegin(i); reachable[i] && t != nfa.edgesEnd(i); ++t)
+            {
+                epsilonFree = epsilonFree && !t->epsilon;
+                for (int c = classes[t->lo]; !t->epsilon && c <= classes[t->hi]; ++c)
+                {
+                    edges.emplace_back(c, t->target);
+                }
+                if (t->epsilon && !precomputeClosures)
+                {
+                    epsilonTargets.push_back(t->target);
+                }
+            }
+            edgeStart[i + 1] = static_cast<uint32_t>(edges.size());
+            if (!precomputeClosures)
+            {
+                epsilonStart[i + 1] = static_cast<uint32_t>(epsilonTargets.size());
+            }
+        }
+
+        // 预先计算每个状态的ε闭包。闭包表最多是状态数的平方（例如 ((a?){1000}){10} 的一长串可选项），
+        // 边填边检查编译预算；一个闭包最多 n 个状态，放不下时自己倍增扩容，扩容前按新旧两块同时存在的大小检查
+        if (epsilonFree || !precomputeClosures)
+        {
+            return;
+        }
+        std::vector<uint32_t> stamp(n, UINT32_MAX);
+        std::vector<uint32_t> stack;
+        closureStart.assign(n + 1, 0);
+        size_t nextCheck = 0;
+        for (uint32_t i = 0; i < n; ++i)
+        {
+            const bool grow = closureData.capacity() - closureData.size() < n;
+            if (grow || i % 1024 == 0 || closureData.size() >= nextCheck)
+            {
+                const size_t capacity = grow ? std::max(closureData.capacity() * 2, closureData.size() + n) : 0;
+                checkCompileBudget(memoryBytes() + capacity * sizeof(uint32_t) + vectorBytes(stamp) + vectorBytes(stack));
+                closureData.reserve(capacity);
+                nextCheck = closureData.size() + 65536;
+            }
+            size_t first = closureData.size();
+            stack.push_back(i);
+            stamp[i] = i;
+            while (!stack.empty())
+            {
+                uint32_t current = stack.back();
+                stack.pop_back();
+                closureData.push_back(current);
+                for (const Transition *t = nfa.edgesBegin(current); t != nfa.edgesEnd(current); ++t)
+                {
+                    if (t->epsilon && stamp[t->target] != i)
+                    {
+                        stamp[t->target] = i;
+                        stack.push_back(t->target);
+                    }
+                }
+            }
+            std::sort(closureData.begin() + first, closureData.end());
+            closureStart[i + 1] = static_cast<uint32_t>(closureData.size());
+        }
+        compileStats.closureComputations += n;
+    }
+
+    uint32_t size() const { return static_cast<uint32_t>(isFinal.size()); }
+
+    size_t memoryBytes() const
+    {
+        return vectorBytes(isFinal) + vectorBytes(acceptPattern) + vectorBytes(patternPriority) + vectorBytes(edgeStart) +
+               vectorBytes(edges) + vectorBytes(closureStart) + vectorBytes(closureData) + vectorBytes(epsilonStart) +
+               vectorBytes(epsilonTargets);
+    }
+};
+
+// 子集构造的临时缓冲区，重复使用以避免每次转移都分配内存。
+// 并行构造时每个线程一份，计数器也在这里累加，构造结束后再汇总到 compileStats
+struct SubsetScratch
+{
+    std::vector<uint32_t> stamp;
+    uint32_t epoch = 0;
+    std::vector<std::vector<uint32_t>> buckets; // 每个字节类的 move 结果
+    std::vector<int> usedSymbols;
+    std::vector<uint32_t> result;
+    std::vector<uint32_t> stack; // 现算闭包时的深度优先栈
+    uint64_t closureUnions = 0;
+
+    void reset(const SubsetNFA &nfa)
+    {
+        stamp.assign(nfa.size(), 0);
+        epoch = 0;
+        buckets.assign(nfa.classes.size(), {});
+    }
+
+    // 不含 buckets、result 和 stack 的内容，它们不超过 NFA 的边数
+    size_t memoryBytes() const { return vectorBytes(stamp) + vectorBytes(buckets) + vectorBytes(usedSymbols); }
+};
+
+// ε闭包：targets 中所有状态的缓存闭包的并集（没有闭包表时沿ε转换深度优先现算），结果升序写入 scratch.result
+void eClosure(const SubsetNFA &nfa, const std::vector<uint32_t> &targets, SubsetScratch &scratch)
+{
+    ++scratch.closureUnions;
+    if (++scratch.epoch == 0)
+    {
+        std::fill(scratch.stamp.begin(), scratch.stamp.end(), 0);
+        scratch.epoch = 1;
+    }
+    scratch.result.clear();
+    for (uint32_t t : targets)
+    {
+        if (scratch.stamp[t] == scratch.epoch)
+        {
+            continue; // t 已经在某个闭包里，它的闭包也已经合并
+        }
+        if (nfa.epsilonFree)
+        {
+            scratch.stamp[t] = scratch.epoch;
+            scratch.result.push_back(t);
+            continue;
+        }
+        if (nfa.closureStart.empty())
+        {
+            scratch.stamp[t] = scratch.epoch;
+            scratch.stack.push_back(t);
+            while (!scratch.stack.empty())
+            {
+                uint32_t s = scratch.stack.back();
+                scratch.stack.pop_back();
+                scratch.result.push_back(s);
+                for (uint32_t e = nfa.epsilonStart[s]; e < nfa.epsilonStart[s + 1]; ++e)
+                {
+                    uint32_t target = nfa.epsilonTargets[e];
+                    if (scratch.stamp[target] != scratch.epoch)
+                    {
+                        scratch.stamp[target] = scratch.epoch;
+                        scratch.stack.push_back(target);
+                    }
+                }
+            }
+            continue;
+        }
+        for (uint32_t i = nfa.closureStart[t]; i < nfa.closureStart[t + 1]; ++i)
+        {
+            uint32_t s = nfa.closureData[i];
+            if (scratch.stamp[s] != scratch.epoch)
+            {
+                scratch.stamp[s] = scratch.epoch;
+                scratch.result.push_back(s);
+            }
+        }
+    }
+    std::sort(scratch.result.begin(), scratch.result.end());
+}
+
+// move：一次遍历状态集的所有非空转换，按符号分桶
+void move(const SubsetNFA &nfa, const uint32_t *stateSet, size_t count, SubsetScratch &scratch)
+{
+    scratch.usedSymbols.clear();
+    for (size_t i = 0; i < count; ++i)
+    {
+        uint32_t s = stateSet[i];
+        for (uint32_t e = nfa.edgeStart[s]; e < nfa.edgeStart[s + 1]; ++e)
+        {
+            auto &bucket = scratch.buckets[nfa.edges[e].first];
+            if (bucket.empty())
+            {
+                scratch.usedSymbols.push_back(nfa.edges[e].first);
+            }
+            bucket.push_back(nfa.edges[e].second);
+        }
+    }
+    // 与原来逐个符号处理的顺序一致
+    std::sort(scratch.usedSymbols.begin(), scratch.usedSymbols.end());
+}
+
+// 以状态集的预计算哈希为键的开放寻址哈希表，所有状态集连续存放在一个数组里
+class StateSetMap
+{
+public:
+    StateSetMap() : slots(64, -1) {}
+
+    static uint64_t hashSet(const uint32_t *data, size_t count)
+    {
+        uint64_t h = 0xcbf29ce484222325ULL ^ count;
+        for (size_t i = 0; i < count; ++i)
+        {
+            h = (h ^ data[i]) * 0x100000001b3ULL;
+            h ^= h >> 29;
+        }
+        return h;
+    }
+
+    // 查找状态集，不存在时返回 -1
+    int find(const uint32_t *data, size_t count, uint64_t hash) const
+    {
+        size_t mask = slots.size() - 1;
+        for (size_t i = hash & mask;; i = (i + 1) & mask)
+        {
+            int id = slots[i];
+            if (id < 0)
+            {
+                return -1;
+            }
+            if (hashes[id] == hash && equals(id, data, count))
+            {
+                return id;
+            }
+        }
+    }
+
+    // 插入新的状态集，返回它的编号（调用者保证它不存在）
+    int insert(const uint32_t *data, size_t count, uint64_t hash)
+    {
+        int id = static_cast<int>(hashes.size());
+        hashes.push_back(hash);
+        offsets.push_back(static_cast<uint32_t>(pool.size()));
+        pool.insert(pool.end(), data, data + count);
+        if (hashes.size() * 2 > slots.size())
+        {
+            rehash(slots.size() * 2);
+        }
+        else
+        {
+            place(id);
+        }
+        return id;
+    }
+
+    size_t size() const { return hashes.size(); }
+    size_t memoryBytes() const { return vectorBytes(pool) + vectorBytes(offsets) + vectorBytes(hashes) + vectorBytes(slots); }
+    // 元素实际占用的字节数，不含按倍增预留的容量
+    size_t usedBytes() const
+    {
+        return pool.size() * sizeof(uint32_t) + offsets.size() * sizeof(uint32_t) + hashes.size() * sizeof(uint64_t) + slots.size() * sizeof(int);
+    }
+    const uint32_t *data(int id) const { return pool.data() + offsets[id]; }
+    size_t count(int id) const { return (static_cast<size_t>(id) + 1 < offsets.size() ? offsets[id + 1] : pool.size()) - offsets[id]; }
+
+    void clear()
+    {
+        pool.clear();
+        offsets.clear();
+        hashes.clear();
+        slots.assign(64, -1);
+    }
+
+private:
+    std::vector<uint32_t> pool;
+    std::vector<uint32_t> offsets;
+    std::vector<uint64_t> hashes;
+    std::vector<int> slots;
+
+    bool equals(int id, const uint32_t *data, size_t n) const
+    {
+        return count(id) == n && std::equal(data, data + n, this->data(id));
+    }
+
+    void place(int id)
+    {
+        size_t mask = slots.size() - 1;
+        size_t i = hashes[id] & mask;
+        while (slots[i] >= 0)
+        {
+            i = (i + 1) & mask;
+        }
+        slots[i] = id;
+    }
+
+    void rehash(size_t capacity)
+    {
+        slots.assign(capacity, -1);
+        for (int id = 0; id < static_cast<int>(hashes.size()); ++id)
+        {
+            place(id);
+        }
+    }
+};
+
+// 一次子集构造的结果，拥有自己的全部状态。转移是指向同一个DFA中状态的指针，
+// 状态各自分配，移动DFA时地址不变；不可复制
+class DFA
+{
+public:
+    std::vector<std::unique_ptr<DFAState>> states; // 编号 i 的状态在 states[i]
+    DFAState *start = nullptr;
+    ByteClasses byteClasses; // 转换所用的字节等价类
+
+    DFA() = default;
+    DFA(DFA &&) = default;
+    DFA &operator=(DFA &&) = default;
+
+    size_t size() const { return states.size(); }
+    bool empty() const { return states.empty(); }
+
+    size_t memoryBytes() const
+    {
+        size_t bytes = vectorBytes(states);
+        for (const auto &state : states)
+        {
+            bytes += state->memoryBytes();
+        }
+        return bytes;
+    }
+
+    DFAState *add(std::unique_ptr<DFAState> state)
+    {
+        states.push_back(std::move(state));
+        return states.back().get();
+    }
+};
+
+// 最小化后的DFA，状态按从开始状态广度优先的顺序编号。
+// 单独的类型让“已经最小化”体现在接口上，只能由 minimizeDFA 得到
+class MinimizedDFA : public DFA
+{
+public:
+    MinimizedDFA() = default;
+
+private:
+    explicit MinimizedDFA(DFA &&dfa) : DFA(std::move(dfa)) {}
+    friend MinimizedDFA minimizeDFA(const DFA &dfa);
+};
+
+// 由NFA状态集创建DFA状态，接受的模式按优先级从高到低、优先级相同时按编号排列
+std::unique_ptr<DFAState> newDFAState(int id, const SubsetNFA &nfa, const uint32_t *stateSet, size_t count)
+{
+    auto newState = std::make_unique<DFAState>(id);
+    newState->nfaStates.reserve(count);
+    for (const uint32_t *p = stateSet; p != stateSet + count; ++p)
+    {
+        uint32_t s = *p;
+        newState->isFinal = newState->isFinal || nfa.isFinal[s];
+        newState->nfaStates.push_back(static_cast<int>(s));
+        if (nfa.acceptPattern[s] >= 0)
+        {
+            newState->acceptTags.push_back(nfa.acceptPattern[s]);
+        }
+    }
+    std::sort(newState->acceptTags.begin(), newState->acceptTags.end(), [&](int x, int y)
+              { return nfa.patternPriority[x] != nfa.patternPriority[y] ? nfa.patternPriority[x] > nfa.patternPriority[y] : x < y; });
+    newState->acceptTags.erase(std::unique(newState->acceptTags.begin(), newState->acceptTags.end()), newState->acceptTags.end());
+    return newState;
+}
+
+// stateMap 中编号 i 的状态集对应 dfa.states[i]
+int getOrCreateDFAState(DFA &dfa, StateSetMap &stateMap, const SubsetNFA &nfa, const std::vector<uint32_t> &nfaStateSet)
+{
+    uint64_t hash = StateSetMap::hashSet(nfaStateSet.data(), nfaStateSet.size());
+    int id = stateMap.find(nfaStateSet.data(), nfaStateSet.size(), hash);
+    if (id >= 0)
+    {
+        ++compileStats.dfaStatesFound;
+        return id;
+    }
+
+    DFAState *newState = dfa.add(newDFAState(static_cast<int>(dfa.size()), nfa, nfaStateSet.data(), nfaStateSet.size()));
+    stateMap.insert(nfaStateSet.data(), nfaStateSet.size(), hash);
+
+    ++compileStats.dfaStatesCreated;
+    trace<TraceLevel::Debug>([&](std::ostream &out)
+                             {
+                                 out << "Created new DFA state " << newState->id << " for NFA states:";
+                                 for (int s : newState->nfaStates)
+                                 {
+                                     out << " " << s;
+                                 } });
+
+    return newState->id;
+}
+
+DFA constructDFAFromNFA(const NFA &nfa, const std::vector<uint32_t> &nfaStates)
+{
+    PhaseTimer timer(compileStats.subsetSeconds);
+    SubsetNFA subset(nfa, nfaStates);
+    SubsetScratch scratch;
+    scratch.reset(subset);
+    DFA dfa;
+    StateSetMap stateMap;
+    dfa.byteClasses = subset.classes;
+    compileStats.byteClasses = subset.classes.size();
+
+    // 预算：working 是子集构造自己的数据结构，用完退还；output 是构造出的DFA，交给调用者。
+    // 每处理完一个状态更新一次，新状态在创建后的那次更新里计入，转移在状态处理完时计入
+    MemoryCharge working(subset.memoryBytes() + scratch.memoryBytes());
+    MemoryCharge output;
+    size_t outputBytes = 0;
+    size_t counted = 0;
+
+    eClosure(subset, {subset.start}, scratch);
+    dfa.start = dfa.states[getOrCreateDFAState(dfa, stateMap, subset, scratch.result)].get();
+    for (; counted < dfa.size(); ++counted)
+    {
+        outputBytes += sizeof(std::unique_ptr<DFAState>) + dfa.states[counted]->memoryBytes();
+    }
+
+    // DFA状态按创建顺序编号，依次处理即为广度优先
+    for (size_t current = 0; current < stateMap.size(); ++current)
+    {
+        DFAState *currentDFAState = dfa.states[current].get();
+        trace<TraceLevel::Debug>([&](std::ostream &out)
+                                 { out << "Processing DFA state: " << currentDFAState->id; });
+
+        move(subset, stateMap.data(static_cast<int>(current)), stateMap.count(static_cast<int>(current)), scratch);
+        for (int symbol : scratch.usedSymbols)
+        {
+            eClosure(subset, scratch.buckets[symbol], scratch);
+            scratch.buckets[symbol].clear();
+
+            int nextStateId = getOrCreateDFAState(dfa, stateMap, subset, scratch.result);
+            currentDFAState->transitions[symbol] = dfa.states[nextStateId].get();
+        }
+
+        outputBytes += currentDFAState->transitions.size() * DFAState::TRANSITION_BYTES;
+        for (; counted < dfa.size(); ++counted)
+        {
+            outputBytes += sizeof(std::unique_ptr<DFAState>) + dfa.states[counted]->memoryBytes();
+        }
+        if (compileBudget != nullptr)
+        {
+            compileBudget->checkStates(dfa.size());
+            working.update(subset.memoryBytes() + scratch.memoryBytes() + stateMap.memoryBytes());
+            output.update(outputBytes);
+            compileBudget->check();
+        }
+    }
+    compileStats.closureUnions += scratch.closureUnions;
+    output.update(dfa.memoryBytes());
+    output.keep();
+    return dfa;
+}
+
+// 线程池：固定数量的工作线程等待任务。parallelFor 把 [0, count) 切成 grain 大小的块，
+// 各线程（包括调用线程）用一个原子计数器领取，全部完成才返回。同一时间只执行一个 parallelFor
+class ThreadPool
+{
+public:
+    // threads 是参与计算的线程总数（含调用线程）
+    explicit ThreadPool(unsigned threads = std::thread::hardware_concurrency())
+    {
+        for (unsigned i = 1; i < std::max(threads, 1u); ++i)
+        {
+            workers.emplace_back([this]
+                                 { workerLoop(); });
+        }
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread &worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    unsigned size() const { return static_cast<unsigned>(workers.size()) + 1; }
+
+    // 对每个块调用 body(begin, end)，块之间没有顺序保证。
+    // body 抛出异常时不再开始新的块，等所有线程都离开 body 之后在调用线程里重新抛出第一个异常。
+    // 在 body 里再调用同一个线程池的 parallelFor 时就地顺序执行，不会等待自己占着的线程
+    template <typename Body>
+    void parallelFor(size_t count, size_t grain, Body &&body)
+    {
+        grain = std::max<size_t>(grain, 1);
+        const size_t chunks = (count + grain - 1) / grain;
+        if (chunks <= 1 || workers.empty() || runningPool() == this)
+        {
+            if (count > 0)
+            {
+                body(size_t(0), count);
+            }
+            return;
+        }
+
+        std::lock_guard<std::mutex> serial(callMutex);
+        using BodyType = std::remove_reference_t<Body>;
+        {
+            // 上一次的任务可能还有刚醒来的线程在领取（已经领不到块），等它们离开再改写任务
+            std::unique_lock<std::mutex> lock(mutex);
+            done.wait(lock, [&]
+                      { return busy == 0; });
+            job.context = const_cast<void *>(static_cast<const void *>(&body));
+            job.invoke = [](void *context, size_t begin, size_t end)
+            { (*static_cast<BodyType *>(context))(begin, end); };
+            job.count = count;
+            job.grain = grain;
+            job.chunks = chunks;
+            nextChunk.store(0, std::memory_order_relaxed);
+            finishedChunks = 0;
+            failure = nullptr;
+            failed.store(false, std::memory_order_relaxed);
+            ++generation;
+        }
+        wake.notify_all();
+        runChunks();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&]
+                  { return finishedChunks == job.chunks; });
+        if (failure)
+        {
+            std::rethrow_exception(std::exchange(failure, nullptr));
+        }
+    }
+
+private:
+    struct Job
+    {
+        void *context = nullptr;
+        void (*invoke)(void *, size_t, size_t) = nullptr;
+        size_t count = 0;
+        size_t grain = 1;
+        size_t chunks = 0;
+    };
+
+    std::vector<std::thread> workers;
+    std::mutex callMutex; // 串行化 parallelFor 的调用者
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    Job job;
+    uint64_t generation = 0;
+    unsigned busy = 0; // 正在领取当前任务的工作线程数
+    bool stopping = false;
+    std::atomic<size_t> nextChunk{0};
+    size_t finishedChunks = 0;
+    std::atomic<bool> failed{false};
+    std::exception_ptr failure; // body 抛出的第一个异常
+
+    // 当前线程正在执行哪个线程池的块，用来发现嵌套调用
+    static const ThreadPool *&runningPool()
+    {
+        thread_local const ThreadPool *pool = nullptr;
+        return pool;
+    }
+
+    // 领取并执行块。出错之后剩下的块只计数不执行，调用线程照样等到所有块都计完
+    void runChunks()
+    {
+        const ThreadPool *outer = std::exchange(runningPool(), this);
+        size_t finished = 0;
+        for (size_t chunk; (chunk = nextChunk.fetch_add(1, std::memory_order_relaxed)) < job.chunks;)
+        {
+            size_t begin = chunk * job.grain;
+            try
+            {
+                if (!failed.load(std::memory_order_relaxed))
+                {
+                    job.invoke(job.context, begin, std::min(job.count, begin + job.grain));
+                }
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!failure)
+                {
+                    failure = std::current_exception();
+                }
+                failed.store(true, std::memory_order_relaxed);
+            }
+            ++finished;
+        }
+        runningPool() = outer;
+        if (finished > 0)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finishedChunks += finished;
+        }
+    }
+
+    void workerLoop()
+    {
+        uint64_t seen = 0;
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&]
+                          { return stopping || generation != seen; });
+                if (stopping)
+                {
+                    return;
+                }
+                seen = generation;
+                ++busy;
+            }
+            runChunks();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                --busy;
+            }
+            done.notify_all();
+        }
+    }
+};
+
+// 工作窃取队列：所有者在尾部压入和取出（接近深度优先，缓存局部性好），其他线程从头部窃取
+template <typename T>
+class WorkStealingDeque
+{
+public:
+    void push(T item)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        items.push_back(std::move(item));
+    }
+
+    bool pop(T &item)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (items.empty())
+        {
+            return false;
+        }
+        item = std::move(items.back());
+        items.pop_back();
+        return true;
+    }
+
+    bool steal(T &item)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (items.empty())
+        {
+            return false;
+        }
+        item = std::move(items.front());
+        items.pop_front();
+        return true;
+    }
+
+private:
+    std::mutex mutex;
+    std::deque<T> items;
+};
+
+// 分片的状态集哈希表：用哈希的高位选分片，每个分片一把锁，不同分片上的查找和插入互不阻塞。
+// 编号为 (分片 << LOCAL_BITS) | 分片内编号
+class ShardedStateSetMap
+{
+public:
+    static constexpr int SHARD_BITS = 6;
+    static constexpr uint32_t SHARDS = uint32_t(1) << SHARD_BITS;
+    static constexpr int LOCAL_BITS = 32 - SHARD_BITS;
+
+    // 查找状态集，不存在时插入；inserted 表示是否是新插入的
+    uint32_t findOrInsert(const uint32_t *data, size_t count, uint64_t hash, bool &inserted)
+    {
+        uint32_t index = static_cast<uint32_t>(hash >> (64 - SHARD_BITS));
+        Shard &shard = shards[index];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        int id = shard.map.find(data, count, hash);
+        inserted = id < 0;
+        if (inserted)
+        {
+            id = shard.map.insert(data, count, hash);
+        }
+        return (index << LOCAL_BITS) | static_cast<uint32_t>(id);
+    }
+
+    // 所有线程结束后调用，之后才能使用下面的查询
+    void seal()
+    {
+        offsets[0] = 0;
+        for (uint32_t s = 0; s < SHARDS; ++s)
+        {
+            offsets[s + 1] = offsets[s] + shards[s].map.size();
+        }
+    }
+
+    const uint32_t *data(uint32_t id) const { return shards[id >> LOCAL_BITS].map.data(local(id)); }
+    size_t count(uint32_t id) const { return shards[id >> LOCAL_BITS].map.count(local(id)); }
+
+    // 编号压缩成 0 .. size() - 1 的连续下标
+    size_t size() const { return offsets[SHARDS]; }
+    size_t denseIndex(uint32_t id) const { return offsets[id >> LOCAL_BITS] + local(id); }
+
+private:
+    struct alignas(64) Shard
+    {
+        std::mutex mutex;
+        StateSetMap map;
+    };
+
+    Shard shards[SHARDS];
+    size_t offsets[SHARDS + 1] = {};
+
+    static int local(uint32_t id) { return static_cast<int>(id & ((uint32_t(1) << LOCAL_BITS) - 1)); }
+};
+
+// 并行子集构造：每个线程有自己的工作窃取队列和 move/ε闭包缓冲区，状态集用分片哈希表去重。
+// 线程发现状态的顺序是不确定的，所以构造完成后从开始状态出发、按字节类升序广度优先重新编号，
+// 这正是单线程 constructDFAFromNFA 的编号方式，因此结果与单线程构造完全相同
+DFA constructDFAFromNFAParallel(const NFA &nfa, const std::vector<uint32_t> &nfaStates, unsigned threadCount)
+{
+    PhaseTimer timer(compileStats.subsetSeconds);
+    threadCount = std::max(threadCount, 1u);
+    SubsetNFA subset(nfa, nfaStates);
+    DFA dfa;
+    dfa.byteClasses = subset.classes;
+    compileStats.byteClasses = subset.classes.size();
+
+    struct WorkItem
+    {
+        uint32_t id;
+        std::vector<uint32_t> stateSet;
+    };
+    struct Worker
+    {
+        WorkStealingDeque<WorkItem> queue;
+        SubsetScratch scratch;
+        std::vector<std::pair<uint32_t, std::vector<std::pair<int, uint32_t>>>> results; // (状态, [(字节类, 目标)])
+        uint64_t created = 0;
+        uint64_t found = 0;
+    };
+    auto sets = std::make_unique<ShardedStateSetMap>();
+    std::vector<Worker> workers(threadCount);
+    for (Worker &worker : workers)
+    {
+        worker.scratch.reset(subset);
+    }
+
+    eClosure(subset, {subset.start}, workers[0].scratch);
+    const std::vector<uint32_t> &startSet = workers[0].scratch.result;
+    bool inserted;
+    const uint32_t startId = sets->findOrInsert(startSet.data(), startSet.size(), StateSetMap::hashSet(startSet.data(), startSet.size()), inserted);
+    workers[0].queue.push(WorkItem{startId, startSet});
+    workers[0].created = 1;
+
+    // 尚未处理完的状态数：发现新状态时先加一再入队，处理完才减一，归零说明所有状态都已处理
+    std::atomic<size_t> pending(1);
+
+    // 预算：工作线程看不到调用线程的 compileBudget，直接使用同一个对象。
+    // 状态集、队列中的副本和各线程记下的转移在构造DFA之前一直存在，charged 是它们登记的字节数。
+    // 某个线程超出预算时记下异常并让所有线程停下，汇合后在调用线程里重新抛出
+    CompileBudget *budget = compileBudget;
+    MemoryCharge working(subset.memoryBytes() + threadCount * workers[0].scratch.memoryBytes());
+    std::atomic<size_t> charged(0);
+    std::atomic<size_t> discovered(1);
+    std::atomic<bool> aborted(false);
+    std::mutex failureMutex;
+    std::exception_ptr failure;
+
+    // 找不到工作的线程在 idle 上睡眠，直到有新的工作、全部处理完或者中止。
+    // queued 是各队列中的工作项数，入队之前先加一，所以醒来时可能还没放进队列，重试即可
+    std::mutex idleMutex;
+    std::condition_variable idle;
+    std::atomic<size_t> queued(1);
+    std::atomic<unsigned> sleeping(0);
+    auto wake = [&](bool all)
+    {
+        if (sleeping.load() > 0)
+        {
+            std::lock_guard<std::mutex> lock(idleMutex);
+            if (all)
+            {
+                idle.notify_all();
+            }
+            else
+            {
+                idle.notify_one();
+            }
+        }
+    };
+
+    auto run = [&](unsigned self)
+    {
+        Worker &worker = workers[self];
+        SubsetScratch &scratch = worker.scratch;
+        WorkItem item;
+        std::vector<std::pair<int, uint32_t>> transitions;
+        while (pending.load(std::memory_order_acquire) > 0 && !aborted.load())
+        {
+            bool found = worker.queue.pop(item);
+            for (unsigned k = 1; !found && k < threadCount; ++k)
+            {
+                found = workers[(self + k) % threadCount].queue.steal(item);
+            }
+            if (!found)
+            {
+                std::unique_lock<std::mutex> lock(idleMutex);
+                sleeping.fetch_add(1);
+                idle.wait(lock, [&]
+                          { return queued.load() > 0 || pending.load() == 0 || aborted.load(); });
+                sleeping.fetch_sub(1);
+                continue;
+            }
+            queued.fetch_sub(1);
+
+            transitions.clear();
+            size_t itemBytes = 0;
+            move(subset, item.stateSet.data(), item.stateSet.size(), scratch);
+            for (int symbol : scratch.usedSymbols)
+            {
+                eClosure(subset, scratch.buckets[symbol], scratch);
+                scratch.buckets[symbol].clear();
+
+                const std::vector<uint32_t> &next = scratch.result;
+                bool isNew;
+                uint32_t target = sets->findOrInsert(next.data(), next.size(), StateSetMap::hashSet(next.data(), next.size()), isNew);
+                if (isNew)
+                {
+                    ++worker.created;
+                    discovered.fetch_add(1, std::memory_order_relaxed);
+                    itemBytes += 2 * sizeof(uint32_t) * next.size() + sizeof(WorkItem) + sizeof(uint64_t) + sizeof(uint32_t);
+                    pending.fetch_add(1, std::memory_order_acq_rel);
+                    queued.fetch_add(1);
+                    worker.queue.push(WorkItem{target, next});
+                    wake(false);
+                }
+                else
+                {
+                    ++worker.found;
+                }
+                transitions.emplace_back(symbol, target);
+            }
+            worker.results.emplace_back(item.id, transitions);
+            if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                wake(true); // 全部处理完，叫醒等待的线程退出
+            }
+
+            if (budget != nullptr)
+            {
+                itemBytes += sizeof(worker.results.back()) + transitions.size() * sizeof(transitions[0]);
+                charged.fetch_add(itemBytes, std::memory_order_relaxed);
+                try
+                {
+                    budget->charge(itemBytes);
+                    budget->checkStates(discovered.load(std::memory_order_relaxed));
+                    budget->check();
+                }
+                catch (const CompileLimitError &)
+                {
+                    std::lock_guard<std::mutex> lock(failureMutex);
+                    if (!failure)
+                    {
+                        failure = std::current_exception();
+                    }
+                    aborted.store(true);
+                    wake(true);
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned t = 1; t < threadCount; ++t)
+    {
+        threads.emplace_back(run, t);
+    }
+    run(0);
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+    // 工作线程直接登记的字节转给 working，构造完DFA时一起退还
+    releaseCompileMemory(charged.load());
+    if (failure)
+    {
+        std::rethrow_exception(failure);
+    }
+    working.update(working.bytes() + charged.load());
+
+    // 汇总各线程的结果，然后规范编号
+    sets->seal();
+    std::vector<std::vector<std::pair<int, uint32_t>>> edgesOf(sets->size());
+    for (Worker &worker : workers)
+    {
+        for (auto &[id, edges] : worker.results)
+        {
+            edgesOf[sets->denseIndex(id)] = std::move(edges);
+        }
+        compileStats.dfaStatesCreated += worker.created;
+        compileStats.dfaStatesFound += worker.found;
+        compileStats.closureUnions += worker.scratch.closureUnions;
+    }
+
+    std::vector<int> canonical(edgesOf.size(), -1);
+    std::vector<uint32_t> order{startId};
+    canonical[sets->denseIndex(startId)] = 0;
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        for (const auto &[symbol, target] : edgesOf[sets->denseIndex(order[i])])
+        {
+            int &number = canonical[sets->denseIndex(target)];
+            if (number < 0)
+            {
+                number = static_cast<int>(order.size());
+                order.push_back(target);
+            }
+        }
+    }
+
+    for (uint32_t id : order)
+    {
+        dfa.add(newDFAState(static_cast<int>(dfa.size()), subset, sets->data(id), sets->count(id)));
+    }
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        for (const auto &[symbol, target] : edgesOf[sets->denseIndex(order[i])])
+        {
+            dfa.states[i]->transitions[symbol] = dfa.states[canonical[sets->denseIndex(target)]].get();
+        }
+    }
+    dfa.start = dfa.states[0].get();
+    chargeCompileMemory(dfa.memoryBytes());
+    trace<TraceLevel::Info>([&](std::ostream &out)
+                            { out << "Parallel subset construction: " << order.size() << " DFA states on " << threadCount << " threads"; });
+    return dfa;
+}
+
+std::vector<uint32_t> collectStatesFromNFA(const NFA &nfa)
+{
+    std::vector<uint32_t> states;
+    std::vector<char> visited(nfa.size(), 0);
+    std::stack<uint32_t> stack;
+    stack.push(nfa.start);
+
+    while (!stack.empty())
+    {
+        uint32_t curr = stack.top();
+        stack.pop();
+
+        if (!visited[curr])
+        {
+            visited[curr] = 1;
+            states.push_back(curr);
+            trace<TraceLevel::Debug>([&](std::ostream &out)
+                                     { out << "Inserted state: S" << curr << " to states set. Total states: " << states.size(); });
+
+            for (const Transition *trans = nfa.edgesBegin(curr); trans != nfa.edgesEnd(curr); ++trans)
+            {
+                trace<TraceLevel::Debug>([&](std::ostream &out)
+                                         { out << "Transition from S" << curr << " to S" << trans->target << " with label: " << transitionLabel(*trans); });
+                stack.push(trans->target);
+            }
+        }
+    }
+    std::sort(states.begin(), states.end());
+    return states;
+}
+
+// 最小化
+// DFA 最小化：结果是新的DFA，原来的DFA不变
+MinimizedDFA minimizeDFA(const DFA &dfa)
+{
+    PhaseTimer timer(compileStats.minimizeSeconds);
+    if (dfa.empty())
+    {
+        return MinimizedDFA();
+    }
+    const auto &dfaStates = dfa.states;
+
+    // 状态和字节类都换成整数下标，缺失的转移指向额外的陷阱状态 n
+    const int n = static_cast<int>(dfaStates.size());
+    const int sink = n;
+    const int total = n + 1;
+
+    std::map<const DFAState *, int> stateIndex;
+    std::vector<int> alphabet;
+    for (int i = 0; i < n; ++i)
+    {
+        stateIndex[dfaStates[i].get()] = i;
+        for (const auto &[symbol, targetState] : dfaStates[i]->transitions)
+        {
+            alphabet.push_back(symbol);
+        }
+    }
+    std::sort(alphabet.begin(), alphabet.end());
+    alphabet.erase(std::unique(alphabet.begin(), alphabet.end()), alphabet.end());
+    const int k = static_cast<int>(alphabet.size());
+
+    // 预算：下面的数组由状态数和字节类数决定，分配之前整体登记。每个 (状态, 符号) 有转移表、逆转移表、
+    // 填充位置各一个 int 和工作表的一项；每个状态有划分用的若干个 int
+    const size_t cells = static_cast<size_t>(total) * k;
+    MemoryCharge working(static_cast<size_t>(n) * (sizeof(std::pair<const DFAState *const, int>) + 4 * sizeof(void *)) +
+                         cells * (4 * sizeof(int) + sizeof(char) + sizeof(std::pair<int, int>)) +
+                         static_cast<size_t>(total) * 8 * sizeof(int));
+
+    std::vector<int> delta(static_cast<size_t>(total) * k, sink);
+    for (int i = 0; i < n; ++i)
+    {
+        for (const auto &[symbol, targetState] : dfaStates[i]->transitions)
+        {
+            int a = static_cast<int>(std::lower_bound(alphabet.begin(), alphabet.end(), symbol) - alphabet.begin());
+            delta[static_cast<size_t>(i) * k + a] = stateIndex[targetState];
+        }
+    }
+
+    // 逆转移表（CSR）：inverse[a] 中 t 的前驱为 inverseData[inverseStart[a*total+t] .. inverseStart[a*total+t+1])
+    std::vector<int> inverseStart(static_cast<size_t>(k) * total + 1, 0);
+    std::vector<int> inverseData(static_cast<size_t>(k) * total);
+    for (int s = 0; s < total; ++s)
+    {
+        for (int a = 0; a < k; ++a)
+        {
+            ++inverseStart[static_cast<size_t>(a) * total + delta[static_cast<size_t>(s) * k + a] + 1];
+        }
+    }
+    for (size_t i = 1; i < inverseStart.size(); ++i)
+    {
+        inverseStart[i] += inverseStart[i - 1];
+    }
+    {
+        std::vector<int> fill(inverseStart.begin(), inverseStart.end() - 1);
+        for (int s = 0; s < total; ++s)
+        {
+            for (int a = 0; a < k; ++a)
+            {
+                inverseData[fill[static_cast<size_t>(a) * total + delta[static_cast<size_t>(s) * k + a]]++] = s;
+            }
+        }
+    }
+
+    // 划分：elements 按块连续存放，块 b 占 [blockFirst[b], blockPast[b])
+    std::vector<int> elements(total), location(total), blockOf(total);
+    std::vector<int> blockFirst, blockPast, marked;
+
+    // 初始划分：接受的模式集合相同的状态成块（非接受状态的集合为空），陷阱状态单独成块。
+    // 这样接受不同模式的状态不会被合并，陷阱状态单独成块则保证“没有转移”和“转移到某个状态”始终被区分
+    std::map<std::pair<bool, std::vector<int>>, int> groups;
+    std::vector<int> groupOf(total);
+    for (int s = 0; s < n; ++s)
+    {
+        auto key = std::make_pair(!dfaStates[s]->isFinal, dfaStates[s]->acceptTags);
+        groupOf[s] = groups.emplace(key, static_cast<int>(groups.size())).first->second;
+    }
+    groupOf[sink] = static_cast<int>(groups.size());
+
+    int position = 0;
+    for (int pass = 0; pass <= static_cast<int>(groups.size()); ++pass)
+    {
+        int first = position;
+        for (int s = 0; s < total; ++s)
+        {
+            if (groupOf[s] == pass)
+            {
+                elements[position] = s;
+                location[s] = position;
+                blockOf[s] = static_cast<int>(blockFirst.size());
+                ++position;
+            }
+        }
+        if (position > first)
+        {
+            blockFirst.push_back(first);
+            blockPast.push_back(position);
+            marked.push_back(0);
+        }
+    }
+
+    // 待处理的 (块, 符号) 分割器
+    std::vector<std::pair<int, int>> worklist;
+    std::vector<char> inWorklist;
+    auto addSplitter = [&](int block, int a)
+    {
+        size_t key = static_cast<size_t>(block) * k + a;
+        if (inWorklist.size() <= key)
+        {
+            inWorklist.resize((static_cast<size_t>(block) + 1) * k, 0);
+        }
+        if (!inWorklist[key])
+        {
+            inWorklist[key] = 1;
+            worklist.emplace_back(block, a);
+        }
+    };
+    for (int b = 0; b < static_cast<int>(blockFirst.size()); ++b)
+    {
+        for (int a = 0; a < k; ++a)
+        {
+            addSplitter(b, a);
+        }
+    }
+
+    std::vector<int> splitterStates;
+    std::vector<int> touched;
+    while (!worklist.empty())
+    {
+        auto [splitter, a] = worklist.back();
+        worklist.pop_back();
+        if (++compileStats.refinementSplitters % 4096 == 0)
+        {
+            checkCompileBudget();
+        }
+        inWorklist[static_cast<size_t>(splitter) * k + a] = 0;
+
+        // 先复制分割块的成员，标记过程会在块内交换元素
+        splitterStates.assign(elements.begin() + blockFirst[splitter], elements.begin() + blockPast[splitter]);
+
+        // 把 a-前驱移动到各自块的前部
+        for (int t : splitterStates)
+        {
+            size_t slot = static_cast<size_t>(a) * total + t;
+            for (int i = inverseStart[slot]; i < inverseStart[slot + 1]; ++i)
+            {
+                int s = inverseData[i];
+                int b = blockOf[s];
+                int dest = blockFirst[b] + marked[b];
+                if (location[s] < dest)
+                {
+                    continue; // 已经标记过
+                }
+                int other = elements[dest];
+                std::swap(elements[location[s]], elements[dest]);
+                location[other] = location[s];
+                location[s] = dest;
+                if (marked[b]++ == 0)
+                {
+                    touched.push_back(b);
+                }
+            }
+        }
+
+        // 分裂被部分标记的块，标记部分成为新块
+        for (int b : touched)
+        {
+            int size = blockPast[b] - blockFirst[b];
+            int count = marked[b];
+            marked[b] = 0;
+            if (count == size)
+            {
+                continue;
+            }
+
+            ++compileStats.blockSplits;
+            int newBlock = static_cast<int>(blockFirst.size());
+            blockFirst.push_back(blockFirst[b]);
+            blockPast.push_back(blockFirst[b] + count);
+            marked.push_back(0);
+            blockFirst[b] += count;
+            for (int i = blockFirst[newBlock]; i < blockPast[newBlock]; ++i)
+            {
+                blockOf[elements[i]] = newBlock;
+            }
+
+            // Hopcroft：已在工作表中的块两半都要处理，否则只加入较小的一半
+            for (int c = 0; c < k; ++c)
+            {
+                size_t key = static_cast<size_t>(b) * k + c;
+                if (key < inWorklist.size() && inWorklist[key])
+                {
+                    addSplitter(newBlock, c);
+                }
+                else if (count <= size - count)
+                {
+                    addSplitter(newBlock, c);
+                }
+                else
+                {
+                    addSplitter(b, c);
+                }
+            }
+        }
+        touched.clear();
+    }
+
+    // 按块内最小的原状态编号给新状态排序，开始状态（原状态0）所在的块编号为0
+    std::vector<int> order;
+    std::vector<int> minimum(blockFirst.size(), total);
+    for (int s = 0; s < n; ++s)
+    {
+        minimum[blockOf[s]] = std::min(minimum[blockOf[s]], s);
+    }
+    for (int b = 0; b < static_cast<int>(blockFirst.size()); ++b)
+    {
+        if (minimum[b] < n)
+        {
+            order.push_back(b);
+        }
+    }
+    std::sort(order.begin(), order.end(), [&](int x, int y)
+              { return minimum[x] < minimum[y]; });
+
+    // 创建新的DFA状态
+    DFA minimized;
+    minimized.byteClasses = dfa.byteClasses;
+    std::vector<int> newIndex(blockFirst.size(), -1);
+    for (int b : order)
+    {
+        newIndex[b] = static_cast<int>(minimized.size());
+        DFAState *newState = minimized.add(std::make_unique<DFAState>(static_cast<int>(minimized.size())));
+        trace<TraceLevel::Debug>([&](std::ostream &out)
+                                 { out << "Creating new state with id: " << newState->id; });
+    }
+
+    // 设置转换：同一块中的状态等价，取最小编号的状态作为代表
+    for (int b : order)
+    {
+        DFAState *newState = minimized.states[newIndex[b]].get();
+        const int representative = minimum[b];
+        newState->isFinal = dfaStates[representative]->isFinal;
+        newState->acceptTags = dfaStates[representative]->acceptTags;
+
+        for (int a = 0; a < k; ++a)
+        {
+            int target = delta[static_cast<size_t>(representative) * k + a];
+            if (target == sink)
+            {
+                continue;
+            }
+            newState->transitions[alphabet[a]] = minimized.states[newIndex[blockOf[target]]].get();
+            trace<TraceLevel::Debug>([&](std::ostream &out)
+                                     { out << "Setting transition: " << dfa.byteClasses.label(alphabet[a]) << " -> State " << newState->transitions[alphabet[a]]->id; });
+        }
+    }
+
+    minimized.start = minimized.states[newIndex[blockOf[stateIndex[dfa.start]]]].get();
+    compileStats.minimizedStates = minimized.size();
+    chargeCompileMemory(minimized.memoryBytes());
+    trace<TraceLevel::Info>([&](std::ostream &out)
+                            { out << "Minimized DFA: " << n << " -> " << minimized.size() << " states"; });
+    return MinimizedDFA(std::move(minimized));
+}
+
+// 自动机的图导出。几万个状态的自动机也要能很快导出来调试，所以：
+//   - 输出先攒进固定大小的缓冲区再整块写出，数字直接格式化进缓冲区，不为每个名字和标签分配字符串
+//   - 边一边遍历一边写出，整个图不在内存里；额外的内存只有每个状态一个访问标记和分组用的下标
+//   - 同一对状态之间的转换合并成一条边，标签是合并后的字节区间列表（例如 "a-c,e"）
+//   - DFA 状态名（NFA状态集）可以截断，截断的名字后面带上状态编号，仍然唯一
+// 三种格式：
+//   Dot     Graphviz。NFA 从开始状态深度优先，只输出可达的状态；DFA 按状态编号
+//   Json    {"type":"nfa","start":0,"states":[{"id":0,"name":"S0","accepting":false,"patterns":[],
+//            "edges":[{"to":1,"ranges":[[97,99]]},{"to":2,"epsilon":true,"tag":0}]}, ...]}
+//           每个状态一行，按编号顺序；空转换没有 ranges，tag 只在带标记时出现；设置了图名时 type 后面有 "name"
+//   Binary  整数都是 LEB128 变长编码："TGRF" 格式版本 类型（0 = NFA，1 = DFA） 状态数 开始状态，
+//           然后按编号顺序每个状态：标志（bit0 接受） 模式数 模式编号... 边数，
+//           每条边：目标 区间数 (lo hi)...；区间数为0的是空转换，后面跟标记（0 没有，否则是标记 + 1）
+enum class GraphFormat
+{
+    Dot,
+    Json,
+    Binary
+};
+
+struct GraphExportOptions
+{
+    GraphFormat format = GraphFormat::Dot;
+    size_t maxNameLength = 0; // DFA 状态名最多保留的字符数，0 表示不截断
+    std::string graphName;    // DOT 的图名和 JSON 的 name，转义后写出；为空时 DOT 用 NFA 或 DFA，JSON 不写
+};
+
+// 图导出的输出缓冲：攒满一块再用一次 fwrite 写出，析构时写出剩下的内容
+class GraphSink
+{
+public:
+    explicit GraphSink(std::FILE *_file) : file(_file) { buffer.reserve(CAPACITY); }
+    ~GraphSink() { flush(); }
+    GraphSink(const GraphSink &) = delete;
+    GraphSink &operator=(const GraphSink &) = delete;
+
+    void append(std::string_view text)
+    {
+        if (buffer.size() + text.size() > CAPACITY)
+        {
+            flush();
+        }
+        buffer.append(text.data(), text.size());
+    }
+
+    void append(char c)
+    {
+        if (buffer.size() == CAPACITY)
+        {
+            flush();
+        }
+        buffer.push_back(c);
+    }
+
+    void appendNumber(int64_t value)
+    {
+        char digits[24];
+        auto result = std::to_chars(digits, digits + sizeof(digits), value);
+        append(std::string_view(digits, static_cast<size_t>(result.ptr - digits)));
+    }
+
+    void appendVarint(uint64_t value)
+    {
+        do
+        {
+            uint8_t byte = value & 0x7f;
+            value >>= 7;
+            append(static_cast<char>(value != 0 ? byte | 0x80 : byte));
+        } while (value != 0);
+    }
+
+    bool flush()
+    {
+        if (!buffer.empty() && std::fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size())
+        {
+            failed = true;
+        }
+        buffer.clear();
+        return !failed;
+    }
+
+private:
+    static constexpr size_t CAPACITY = size_t(1) << 16;
+
+    std::FILE *file;
+    std::string buffer;
+    bool failed = false;
+};
+
+// 从一个状态出发、合并之后的一条边
+struct GraphEdge
+{
+    uint32_t target = 0;
+    bool epsilon = false;
+    int tag = -1;                                     // 带标记的空转换的标记
+    std::vector<std::pair<uint8_t, uint8_t>> ranges; // 升序，不重叠也不相邻
+};
+
+// 按格式写出状态和边；调用顺序是 begin()，每个状态一次 state() 和它的各条 edge()，最后 end()
+class GraphWriter
+{
+public:
+    GraphWriter(std::FILE *file, const GraphExportOptions &_options, size_t stateCount) : sink(file), options(_options)
+    {
+        groupOf.assign(stateCount, 0);
+        groupSource.assign(stateCount, NONE);
+    }
+
+    void begin(bool isDFA, size_t stateCount, uint32_t start)
+    {
+        switch (options.format)
+        {
+        case GraphFormat::Dot:
+            sink.append("digraph ");
+            if (options.graphName.empty())
+            {
+                sink.append(isDFA ? "DFA" : "NFA");
+            }
+            else
+            {
+                // 和边的标签一样写成带引号的字符串，引号、反斜杠和不可打印的字节都转义
+                sink.append('"');
+                for (char c : options.graphName)
+                {
+                    sink.append(byteLabel(static_cast<uint8_t>(c)));
+                }
+                sink.append('"');
+            }
+            sink.append(" {\n  rankdir=LR;\n  node [shape = circle];\n");
+            break;
+        case GraphFormat::Json:
+            sink.append(isDFA ? "{\"type\":\"dfa\"" : "{\"type\":\"nfa\"");
+            if (!options.graphName.empty())
+            {
+                sink.append(",\"name\":\"");
+                appendJsonString(options.graphName);
+                sink.append('"');
+            }
+            sink.append(",\"start\":");
+            sink.appendNumber(start);
+            sink.append(",\"states\":[");
+            break;
+        case GraphFormat::Binary:
+            sink.append("TGRF");
+            sink.appendVarint(BINARY_VERSION);
+            sink.appendVarint(isDFA ? 1 : 0);
+            sink.appendVarint(stateCount);
+            sink.appendVarint(start);
+            break;
+        }
+    }
+
+    // 开始一个状态。name 在 DOT 和 JSON 中使用，edges 是 group() 得到的边数
+    void state(uint32_t id, std::string_view name, bool accepting, const int *patterns, size_t patternCount, size_t edgeCount)
+    {
+        switch (options.format)
+        {
+        case GraphFormat::Dot:
+            sink.append("  \"");
+            sink.append(name);
+            sink.append(accepting ? "\" [shape = doublecircle];\n" : "\" [shape = circle];\n");
+            break;
+        case GraphFormat::Json:
+            sink.append(firstState ? "\n{\"id\":" : ",\n{\"id\":");
+            sink.appendNumber(id);
+            sink.append(",\"name\":\"");
+            sink.append(name);
+            sink.append(accepting ? "\",\"accepting\":true,\"patterns\":[" : "\",\"accepting\":false,\"patterns\":[");
+            for (size_t i = 0; i < patternCount; ++i)
+            {
+                if (i > 0)
+                {
+                    sink.append(',');
+                }
+                sink.appendNumber(patterns[i]);
+            }
+            sink.append("],\"edges\":[");
+            break;
+        case GraphFormat::Binary:
+            sink.appendVarint(accepting ? 1 : 0);
+            sink.appendVarint(patternCount);
+            for (size_t i = 0; i < patternCount; ++i)
+            {
+                sink.appendVarint(static_cast<uint64_t>(patterns[i]));
+            }
+            sink.appendVarint(edgeCount);
+            break;
+        }
+        firstState = false;
+        firstEdge = true;
+    }
+
+    void edge(std::string_view from, std::string_view to, const GraphEdge &edge)
+    {
+        switch (options.format)
+        {
+        case GraphFormat::Dot:
+            sink.append("  \"");
+            sink.append(from);
+            sink.append("\" -> \"");
+            sink.append(to);
+            sink.append("\" [label=\"");
+            if (edge.epsilon)
+            {
+                sink.append("ε");
+                if (edge.tag >= 0)
+                {
+                    sink.append("/t");
+                    sink.appendNumber(edge.tag);
+                }
+            }
+            for (size_t i = 0; i < edge.ranges.size(); ++i)
+            {
+                if (i > 0)
+                {
+                    sink.append(',');
+                }
+                sink.append(byteRangeLabel(edge.ranges[i].first, edge.ranges[i].second));
+            }
+            sink.append("\"];\n");
+            break;
+        case GraphFormat::Json:
+            sink.append(firstEdge ? "{\"to\":" : ",{\"to\":");
+            sink.appendNumber(edge.target);
+            if (edge.epsilon)
+            {
+                sink.append(",\"epsilon\":true");
+                if (edge.tag >= 0)
+                {
+                    sink.append(",\"tag\":");
+                    sink.appendNumber(edge.tag);
+                }
+            }
+            else
+            {
+                sink.append(",\"ranges\":[");
+                for (size_t i = 0; i < edge.ranges.size(); ++i)
+                {
+                    sink.append(i > 0 ? ",[" : "[");
+                    sink.appendNumber(edge.ranges[i].first);
+                    sink.append(',');
+                    sink.appendNumber(edge.ranges[i].second);
+                    sink.append(']');
+                }
+                sink.append(']');
+            }
+            sink.append('}');
+            break;
+        case GraphFormat::Binary:
+            sink.appendVarint(edge.target);
+            sink.appendVarint(edge.ranges.size());
+            for (const auto &[lo, hi] : edge.ranges)
+            {
+                sink.append(static_cast<char>(lo));
+                sink.append(static_cast<char>(hi));
+            }
+            if (edge.epsilon)
+            {
+                sink.appendVarint(static_cast<uint64_t>(edge.tag + 1));
+            }
+            break;
+        }
+        firstEdge = false;
+    }
+
+    void endState()
+    {
+        if (options.format == GraphFormat::Json)
+        {
+            sink.append("]}");
+        }
+    }
+
+    bool end()
+    {
+        switch (options.format)
+        {
+        case GraphFormat::Dot:
+            sink.append("}\n");
+            break;
+        case GraphFormat::Json:
+            sink.append("\n]}\n");
+            break;
+        case GraphFormat::Binary:
+            break;
+        }
+        return sink.flush();
+    }
+
+    // 把一个状态的转换按目标分组：同一目标的字节区间合并成一条边，空转换各自一条。
+    // 边按目标第一次出现的顺序排列；返回边数，边在 edges[0 .. 边数)
+    template <typename ForEachTransition>
+    size_t group(uint32_t source, ForEachTransition &&forEach)
+    {
+        size_t count = 0;
+        auto next = [&]() -> GraphEdge &
+        {
+            if (count == edges.size())
+            {
+                edges.emplace_back();
+            }
+            GraphEdge &edge = edges[count++];
+            edge.ranges.clear();
+            return edge;
+        };
+        forEach([&](uint32_t target, bool epsilon, int tag, uint8_t lo, uint8_t hi)
+                {
+                    if (epsilon)
+                    {
+                        GraphEdge &edge = next();
+                        edge.target = target;
+                        edge.epsilon = true;
+                        edge.tag = tag;
+                        return;
+                    }
+                    if (groupSource[target] != source)
+                    {
+                        groupSource[target] = source;
+                        groupOf[target] = static_cast<uint32_t>(count);
+                        GraphEdge &edge = next();
+                        edge.target = target;
+                        edge.epsilon = false;
+                        edge.tag = -1;
+                    }
+                    edges[groupOf[target]].ranges.emplace_back(lo, hi); });
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            auto &ranges = edges[i].ranges;
+            std::sort(ranges.begin(), ranges.end());
+            size_t kept = 0;
+            for (const auto &range : ranges)
+            {
+                if (kept > 0 && ranges[kept - 1].second + 1 >= range.first)
+                {
+                    ranges[kept - 1].second = std::max(ranges[kept - 1].second, range.second);
+                }
+                else
+                {
+                    ranges[kept++] = range;
+                }
+            }
+            ranges.resize(kept);
+        }
+        return count;
+    }
+
+    std::vector<GraphEdge> edges;
+
+private:
+    static constexpr uint32_t NONE = UINT32_MAX;
+    static constexpr uint64_t BINARY_VERSION = 1;
+
+    // JSON 字符串的内容：引号和反斜杠加反斜杠，控制字符写成 \u00XX，其余字节原样写出
+    void appendJsonString(std::string_view text)
+    {
+        const char *hex = "0123456789abcdef";
+        for (char c : text)
+        {
+            const uint8_t byte = static_cast<uint8_t>(c);
+            if (c == '"' || c == '\\')
+            {
+                sink.append('\\');
+                sink.append(c);
+            }
+            else if (byte < 0x20 || byte == 0x7f)
+            {
+                sink.append("\\u00");
+                sink.append(hex[byte >> 4]);
+                sink.append(hex[byte & 15]);
+            }
+            else
+            {
+                sink.append(c);
+            }
+        }
+    }
+
+    GraphSink sink;
+    const GraphExportOptions &options;
+    std::vector<uint32_t> groupOf;     // 目标 -> 当前状态的边的下标，groupSource 等于当前状态时有效
+    std::vector<uint32_t> groupSource;
+    bool firstState = true;
+    bool firstEdge = true;
+};
+
+// NFA 状态名 "S<编号>"，写进 name（复用同一个字符串，不再分配）
+inline void nfaStateName(uint32_t id, std::string &name)
+{
+    char digits[16];
+    auto result = std::to_chars(digits, digits + sizeof(digits), id);
+    name.assign("S");
+    name.append(digits, static_cast<size_t>(result.ptr - digits));
+}
+
+// DFA 状态名：有 NFA 状态集时是 "{S0,S2,...}"，没有时（最小化的DFA、积）是 "S<编号>"。
+// 超过 maxLength 个字符时截断成前 maxLength 个字符加 "...#<编号>"
+void dfaStateName(const DFAState &state, size_t maxLength, std::string &name)
+{
+    char digits[16];
+    if (state.nfaStates.empty())
+    {
+        nfaStateName(static_cast<uint32_t>(state.id), name);
+        return;
+    }
+    name.assign("{");
+    for (int s : state.nfaStates)
+    {
+        auto result = std::to_chars(digits, digits + sizeof(digits), s);
+        name.push_back('S');
+        name.append(digits, static_cast<size_t>(result.ptr - digits));
+        name.push_back(',');
+        if (maxLength > 0 && name.size() > maxLength)
+        {
+            break;
+        }
+    }
+    name.back() = '}';
+    if (maxLength > 0 && name.size() > maxLength)
+    {
+        auto result = std::to_chars(digits, digits + sizeof(digits), state.id);
+        name.resize(maxLength);
+        name.append("...#");
+        name.append(digits, static_cast<size_t>(result.ptr - digits));
+    }
+}
+
+bool exportGraph(const NFA &nfa, std::FILE *file, const GraphExportOptions &options = {})
+{
+    PhaseTimer timer(compileStats.exportSeconds);
+    const uint32_t n = nfa.size();
+    GraphWriter writer(file, options, n);
+    writer.begin(false, n, nfa.start);
+
+    std::string from;
+    std::string to;
+    auto writeState = [&](uint32_t s)
+    {
+        size_t count = writer.group(s, [&](auto &&emit)
+                                    {
+                                        for (const Transition *t = nfa.edgesBegin(s); t != nfa.edgesEnd(s); ++t)
+                                        {
+                                            emit(t->target, t->epsilon, t->tag - 1, t->lo, t->hi);
+                                        } });
+        const State &state = nfa.states[s];
+        nfaStateName(s, from);
+        writer.state(s, from, state.isFinal, &state.pattern, state.pattern >= 0 ? 1 : 0, count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            nfaStateName(writer.edges[i].target, to);
+            writer.edge(from, to, writer.edges[i]);
+        }
+        writer.endState();
+    };
+
+    if (options.format == GraphFormat::Dot)
+    {
+        // 从开始状态深度优先，只输出可达的状态
+        std::vector<char> visited(n, 0);
+        std::vector<uint32_t> stack{nfa.start};
+        while (!stack.empty())
+        {
+            uint32_t current = stack.back();
+            stack.pop_back();
+            if (visited[current])
+            {
+                continue;
+            }
+            visited[current] = 1;
+            writeState(current);
+            for (const Transition *t = nfa.edgesBegin(current); t != nfa.edgesEnd(current); ++t)
+            {
+                stack.push_back(t->target);
+            }
+        }
+    }
+    else
+    {
+        for (uint32_t s = 0; s < n; ++s)
+        {
+            writeState(s);
+        }
+    }
+    return writer.end();
+}
+
+bool exportGraph(const DFA &dfa, std::FILE *file, const GraphExportOptions &options = {})
+{
+    PhaseTimer timer(compileStats.exportSeconds);
+    GraphWriter writer(file, options, dfa.size());
+    writer.begin(true, dfa.size(), dfa.start != nullptr ? static_cast<uint32_t>(dfa.start->id) : 0);
+
+    std::string from;
+    std::string to;
+    for (const auto &state : dfa.states)
+    {
+        size_t count = writer.group(static_cast<uint32_t>(state->id), [&](auto &&emit)
+                                    {
+                                        for (const auto &[symbol, target] : state->transitions)
+                                        {
+                                            emit(static_cast<uint32_t>(target->id), false, -1, dfa.byteClasses.first(symbol), dfa.byteClasses.last(symbol));
+                                        } });
+        dfaStateName(*state, options.maxNameLength, from);
+        writer.state(static_cast<uint32_t>(state->id), from, state->isFinal, state->acceptTags.data(), state->acceptTags.size(), count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            dfaStateName(*dfa.states[writer.edges[i].target], options.maxNameLength, to);
+            writer.edge(from, to, writer.edges[i]);
+        }
+        writer.endState();
+    }
+    return writer.end();
+}
+
+// 导出到文件（覆盖已有的内容）
+template <typename Automaton>
+bool exportGraph(const Automaton &automaton, const std::string &path, const GraphExportOptions &options = {})
+{
+    std::FILE *file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+    bool written = exportGraph(automaton, file, options);
+    return std::fclose(file) == 0 && written;
+}
+
+// 导出到已经打开的文件描述符（例如管道或标准输出），fd 本身不关闭
+template <typename Automaton>
+bool exportGraphToFd(const Automaton &automaton, int fd, const GraphExportOptions &options = {})
+{
+#ifdef _WIN32
+    const int copy = _dup(fd);
+    std::FILE *file = copy < 0 ? nullptr : _fdopen(copy, "wb");
+#else
+    const int copy = dup(fd);
+    std::FILE *file = copy < 0 ? nullptr : fdopen(copy, "wb");
+#endif
+    if (file == nullptr)
+    {
+        if (copy >= 0)
+        {
+#ifdef _WIN32
+            _close(copy); // fdopen 失败时复制出来的描述符不归 FILE 所有
+#else
+            close(copy);
+#endif
+        }
+        return false;
+    }
+    bool written = exportGraph(automaton, file, options);
+    return std::fclose(file) == 0 && written;
+}
+
+void generateDotFile(const NFA &nfa, const std::string &filename)
+{
+    if (exportGraph(nfa, filename))
+    {
+        std::cout << "NFA已生成到 " << filename << " 文件中\n";
+    }
+    else
+    {
+        std::cerr << "无法打开文件以写入输出\n";
+    }
+}
+
+// DFA 状态以对应的NFA状态集命名
+void generateDotFileForDFA(const DFA &dfa, const std::string &filename)
+{
+    if (exportGraph(dfa, filename))
+    {
+        std::cout << "DFA已生成到 " << filename << " 文件中\n";
+    }
+    else
+    {
+        std::cerr << "无法打开文件以写入输出\n";
+    }
+}
+
+void generateMinimizedDotFileForDFA(const MinimizedDFA &dfa, const std::string &filename)
+{
+    GraphExportOptions options;
+    options.graphName = "MinimizedDFA";
+    if (exportGraph(dfa, filename, options))
+    {
+        std::cout << "Minimized DFA has been generated to " << filename << "\n";
+    }
+    else
+    {
+        std::cerr << "Unable to open file for writing output\n";
+    }
+}
+
+// 只读内存映射的文件，扫描大文件时不必先复制到 std::string。
+// sequential 为 false 时按随机访问提示内核（例如映射序列化的DFA），不做预读
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string &path, bool sequential = true)
+    {
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                           sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            return;
+        }
+        LARGE_INTEGER fileSize;
+        GetFileSizeEx(file, &fileSize);
+        length = static_cast<size_t>(fileSize.QuadPart);
+        opened = true;
+        if (length == 0)
+        {
+            return;
+        }
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        base = mapping ? static_cast<const char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+        opened = base != nullptr;
+#else
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0)
+        {
+            return;
+        }
+        length = static_cast<size_t>(info.st_size);
+        opened = true;
+        if (length == 0)
+        {
+            return;
+        }
+        void *mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED)
+        {
+            opened = false;
+            return;
+        }
+        base = static_cast<const char *>(mapped);
+        madvise(mapped, length, sequential ? MADV_SEQUENTIAL : MADV_RANDOM); // 顺序扫描时让内核积极预读
+#endif
+    }
+
+    ~MappedFile()
+    {
+#ifdef _WIN32
+        if (base)
+        {
+            UnmapViewOfFile(base);
+        }
+        if (mapping)
+        {
+            CloseHandle(mapping);
+        }
+        if (file != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(file);
+        }
+#else
+        if (base)
+        {
+            munmap(const_cast<char *>(base), length);
+        }
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+#endif
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool isOpen() const { return opened; }
+    const char *data() const { return base; }
+    size_t size() const { return length; }
+
+private:
+    const char *base = nullptr;
+    size_t length = 0;
+    bool opened = false;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+};
+
+// 分词结果：pattern 为 -1 表示无法匹配任何模式的单个字节
+struct Token
+{
+    int pattern;
+    size_t begin;
+    size_t length;
+};
+
+// SIMD 扫描：运行时检测 CPU，按 AVX2 / SSSE3 / SSE2 / 标量的顺序选择实现。
+// 环境变量 THOMPSON_SIMD=scalar|sse2|ssse3 可以限制使用的指令集，用来测试和比较各个实现
+enum class SimdLevel
+{
+    Scalar,
+    SSE2,
+    SSSE3,
+    AVX2
+};
+
+SimdLevel detectSimdLevel()
+{
+    SimdLevel level = SimdLevel::Scalar;
+#if THOMPSON_X86
+    level = SimdLevel::SSE2; // x86-64 的基本指令集
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    const int maxLeaf = info[0];
+    __cpuid(info, 1);
+    const bool ssse3 = (info[2] >> 9) & 1;
+    const bool avxUsable = ((info[2] >> 27) & 1) && ((info[2] >> 28) & 1) && (_xgetbv(0) & 6) == 6;
+    bool avx2 = false;
+    if (maxLeaf >= 7 && avxUsable)
+    {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] >> 5) & 1;
+    }
+#else
+    __builtin_cpu_init();
+    const bool ssse3 = __builtin_cpu_supports("ssse3");
+    const bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+    level = avx2 ? SimdLevel::AVX2 : ssse3 ? SimdLevel::SSSE3 : level;
+#endif
+    const char *limit = std::getenv("THOMPSON_SIMD");
+    if (limit != nullptr)
+    {
+        std::string_view name(limit);
+        SimdLevel requested = name == "scalar" ? SimdLevel::Scalar : name == "sse2" ? SimdLevel::SSE2 : name == "ssse3" ? SimdLevel::SSSE3 : SimdLevel::AVX2;
+        level = std::min(level, requested);
+    }
+    return level;
+}
+
+SimdLevel simdLevel()
+{
+    static const SimdLevel level = detectSimdLevel();
+    return level;
+}
+
+inline int countTrailingZeros(uint32_t mask)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+inline int countTrailingZeros64(uint64_t mask)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, mask);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctzll(mask);
+#endif
+}
+
+// data[position, length) 以 literal 开头；partial 为 true 时，延伸到 length 之外的部分视为可能匹配
+inline bool literalAt(const unsigned char *data, size_t position, size_t length, const std::string &literal, bool partial)
+{
+    size_t available = length - position;
+    if (available >= literal.size())
+    {
+        return std::memcmp(data + position, literal.data(), literal.size()) == 0;
+    }
+    return partial && std::memcmp(data + position, literal.data(), available) == 0;
+}
+
+#if THOMPSON_X86
+// 1 到 3 个字节中任意一个的第一次出现，bytes 中没用到的位置重复 bytes[0]
+inline size_t findBytesSse2(const unsigned char *data, size_t i, size_t length, const uint8_t bytes[3])
+{
+    const __m128i v0 = _mm_set1_epi8(static_cast<char>(bytes[0]));
+    const __m128i v1 = _mm_set1_epi8(static_cast<char>(bytes[1]));
+    const __m128i v2 = _mm_set1_epi8(static_cast<char>(bytes[2]));
+    for (; i + 16 <= length; i += 16)
+    {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, v0), _mm_cmpeq_epi8(x, v1)), _mm_cmpeq_epi8(x, v2));
+        uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(hit));
+        if (mask != 0)
+        {
+            return i + countTrailingZeros(mask);
+        }
+    }
+    for (; i < length && data[i] != bytes[0] && data[i] != bytes[1] && data[i] != bytes[2]; ++i)
+    {
+    }
+    return i;
+}
+
+THOMPSON_TARGET("avx2")
+size_t findBytesAvx2(const unsigned char *data, size_t i, size_t length, const uint8_t bytes[3])
+{
+    const __m256i v0 = _mm256_set1_epi8(static_cast<char>(bytes[0]));
+    const __m256i v1 = _mm256_set1_epi8(static_cast<char>(bytes[1]));
+    const __m256i v2 = _mm256_set1_epi8(static_cast<char>(bytes[2]));
+    for (; i + 32 <= length; i += 32)
+    {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+        __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(x, v0), _mm256_cmpeq_epi8(x, v1)), _mm256_cmpeq_epi8(x, v2));
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(hit));
+        if (mask != 0)
+        {
+            return i + countTrailingZeros(mask);
+        }
+    }
+    return findBytesSse2(data, i, length, bytes);
+}
+
+// 单个字面量：同时比较字面量中两个不常见的字节（偏移 first 和 second），两者都相等的位置再逐字节确认
+inline size_t findLiteralSse2(const unsigned char *data, size_t i, size_t length, const std::string &literal,
+                              size_t first, size_t second, bool partial)
+{
+    const __m128i v1 = _mm_set1_epi8(literal[first]);
+    const __m128i v2 = _mm_set1_epi8(literal[second]);
+    const size_t reach = std::max(first, second);
+    for (; i + reach + 16 <= length; i += 16)
+    {
+        __m128i x1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + first));
+        __m128i x2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + second));
+        uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(x1, v1), _mm_cmpeq_epi8(x2, v2))));
+        for (; mask != 0; mask &= mask - 1)
+        {
+            size_t position = i + countTrailingZeros(mask);
+            if (literalAt(data, position, length, literal, partial))
+            {
+                return position;
+            }
+        }
+    }
+    for (; i < length && !literalAt(data, i, length, literal, partial); ++i)
+    {
+    }
+    return i;
+}
+
+THOMPSON_TARGET("avx2")
+size_t findLiteralAvx2(const unsigned char *data, size_t i, size_t length, const std::string &literal,
+                       size_t first, size_t second, bool partial)
+{
+    const __m256i v1 = _mm256_set1_epi8(literal[first]);
+    const __m256i v2 = _mm256_set1_epi8(literal[second]);
+    const size_t reach = std::max(first, second);
+    for (; i + reach + 32 <= length; i += 32)
+    {
+        __m256i x1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i + first));
+        __m256i x2 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i + second));
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(x1, v1), _mm256_cmpeq_epi8(x2, v2))));
+        for (; mask != 0; mask &= mask - 1)
+        {
+            size_t position = i + countTrailingZeros(mask);
+            if (literalAt(data, position, length, literal, partial))
+            {
+                return position;
+            }
+        }
+    }
+    return findLiteralSse2(data, i, length, literal, first, second, partial);
+}
+#endif
+
+// 字面量预过滤器：在DFA之前快速跳到可能开始匹配（或者可能包含匹配）的位置。
+// 按要找的东西选择实现：
+//   Bytes      不超过3个字节中的任意一个，SIMD 逐块比较
+//   ByteTable  更多的字节，查表
+//   Literal    一个字面量，SIMD 同时比较其中两个不常见的字节再确认
+//   Teddy      2 到 16 个字面量，用开头至多3个字节的高低半字节查 pshufb 表，一次筛出16/32个位置，
+//              每个位置的桶位图指出要确认哪些字面量
+//   Everywhere 没有过滤作用，每个位置都是候选
+class Prefilter
+{
+public:
+    enum Kind
+    {
+        Everywhere,
+        Bytes,
+        ByteTable,
+        Literal,
+        Teddy
+    };
+
+    Prefilter() = default;
+
+    static Prefilter forBytes(const uint8_t set[256])
+    {
+        Prefilter filter;
+        int count = 0;
+        for (int b = 0; b < 256; ++b)
+        {
+            filter.table[b] = set[b] != 0;
+            if (set[b] && count < 3)
+            {
+                filter.bytes[count] = static_cast<uint8_t>(b);
+            }
+            count += set[b] != 0;
+        }
+        if (count == 256)
+        {
+            return Prefilter();
+        }
+        filter.kind = count >= 1 && count <= 3 ? Bytes : ByteTable; // 空集合用查表，找不到任何位置
+        for (int k = std::max(count, 1); k < 3; ++k)
+        {
+            filter.bytes[k] = filter.bytes[0];
+        }
+        return filter;
+    }
+
+    // literals 都不为空，不超过 LiteralInfo::MAX_LITERALS 个
+    static Prefilter forLiterals(const std::vector<std::string> &literals)
+    {
+        uint8_t set[256] = {};
+        bool singleBytes = true;
+        for (const std::string &literal : literals)
+        {
+            set[static_cast<unsigned char>(literal[0])] = 1;
+            singleBytes = singleBytes && literal.size() == 1;
+        }
+        if (singleBytes || literals.empty())
+        {
+            return forBytes(set);
+        }
+
+        Prefilter filter = forBytes(set); // Teddy 的标量实现用首字节表
+        filter.literals = literals;
+        if (literals.size() == 1)
+        {
+            filter.kind = Literal;
+            const std::string &literal = literals[0];
+            // 两个最不常见的字节，位置不同
+            std::vector<size_t> order(literal.size());
+            for (size_t i = 0; i < order.size(); ++i)
+            {
+                order[i] = i;
+            }
+            std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+                             { return byteCommonness(literal[a]) < byteCommonness(literal[b]); });
+            filter.first = order[0];
+            filter.second = order[1];
+            return filter;
+        }
+
+        filter.kind = Teddy;
+        filter.width = 3;
+        for (const std::string &literal : literals)
+        {
+            filter.width = std::min(filter.width, literal.size());
+        }
+        for (size_t i = 0; i < literals.size(); ++i)
+        {
+            const uint8_t bucket = static_cast<uint8_t>(1u << (i % 8));
+            for (size_t k = 0; k < filter.width; ++k)
+            {
+                const unsigned char c = static_cast<unsigned char>(literals[i][k]);
+                filter.teddyLow[k][c & 15] |= bucket;
+                filter.teddyHigh[k][c >> 4] |= bucket;
+            }
+        }
+        return filter;
+    }
+
+    Kind filterKind() const { return kind; }
+
+    // [from, length) 中第一个候选位置，没有时返回 length。
+    // partial 为 true 时（流式输入，后面还有数据），末尾只出现了一部分的字面量也算候选
+    size_t find(const unsigned char *data, size_t from, size_t length, bool partial) const
+    {
+        return find(data, from, length, partial, simdLevel());
+    }
+
+    // 指定使用的指令集，level 不能高于 simdLevel()。自检用它在同一个进程里比较各个实现与标量实现
+    size_t find(const unsigned char *data, size_t from, size_t length, bool partial, SimdLevel level) const
+    {
+        switch (kind)
+        {
+        case Everywhere:
+            return from;
+        case Bytes:
+#if THOMPSON_X86
+            if (level >= SimdLevel::AVX2)
+            {
+                return findBytesAvx2(data, from, length, bytes);
+            }
+            if (level >= SimdLevel::SSE2)
+            {
+                return findBytesSse2(data, from, length, bytes);
+            }
+#endif
+            if (bytes[0] == bytes[1] && bytes[0] == bytes[2] && from < length)
+            {
+                const void *hit = std::memchr(data + from, bytes[0], length - from);
+                return hit ? static_cast<const unsigned char *>(hit) - data : length;
+            }
+            return findInTable(data, from, length);
+        case ByteTable:
+            return findInTable(data, from, length);
+        case Literal:
+#if THOMPSON_X86
+            if (level >= SimdLevel::AVX2)
+            {
+                return findLiteralAvx2(data, from, length, literals[0], first, second, partial);
+            }
+            if (level >= SimdLevel::SSE2)
+            {
+                return findLiteralSse2(data, from, length, literals[0], first, second, partial);
+            }
+#endif
+            for (size_t i = from; i < length; ++i)
+            {
+                if (literalAt(data, i, length, literals[0], partial))
+                {
+                    return i;
+                }
+            }
+            return length;
+        case Teddy:
+#if THOMPSON_X86
+            if (level >= SimdLevel::AVX2)
+            {
+                return findTeddyAvx2(data, from, length, partial);
+            }
+            if (level >= SimdLevel::SSSE3)
+            {
+                return findTeddySsse3(data, from, length, partial);
+            }
+#endif
+            return verifyTeddy(data, from, length, length, partial);
+        }
+        return from;
+    }
+
+private:
+    Kind kind = Everywhere;
+    uint8_t bytes[3] = {};
+    bool table[256] = {};
+    std::vector<std::string> literals;
+    size_t first = 0; // Literal：用来筛选的两个字节的偏移
+    size_t second = 0;
+    size_t width = 0; // Teddy：参与筛选的开头字节数
+    alignas(16) uint8_t teddyLow[3][16] = {};
+    alignas(16) uint8_t teddyHigh[3][16] = {};
+
+    // 粗略的字节频率排名（数值越大越常见），用来挑选字面量中最有区分度的字节
+    static int byteCommonness(char c)
+    {
+        const unsigned char b = static_cast<unsigned char>(c);
+        if (b == ' ' || b == 'e' || b == 't' || b == 'a' || b == 'o' || b == 'i' || b == 'n')
+        {
+            return 4;
+        }
+        if (std::islower(b) || b == '\n')
+        {
+            return 3;
+        }
+        if (std::isdigit(b) || std::isupper(b) || b == '.' || b == ',' || b == '/' || b == ':' || b == '-')
+        {
+            return 2;
+        }
+        return b < 0x80 ? 1 : 0;
+    }
+
+    size_t findInTable(const unsigned char *data, size_t i, size_t length) const
+    {
+        while (i < length && !table[data[i]])
+        {
+            ++i;
+        }
+        return i;
+    }
+
+    // 逐个位置确认字面量，只检查 [from, to) 中的起点
+    size_t verifyTeddy(const unsigned char *data, size_t from, size_t to, size_t length, bool partial) const
+    {
+        for (size_t i = findInTable(data, from, to); i < to; i = findInTable(data, i + 1, to))
+        {
+            for (const std::string &literal : literals)
+            {
+                if (literalAt(data, i, length, literal, partial))
+                {
+                    return i;
+                }
+            }
+        }
+        return to;
+    }
+
+    // 桶位图 buckets 中的字面量在 position 处确认
+    bool verifyBuckets(const unsigned char *data, size_t position, size_t length, uint32_t buckets, bool partial) const
+    {
+        for (size_t i = 0; i < literals.size(); ++i)
+        {
+            if (((buckets >> (i % 8)) & 1) && literalAt(data, position, length, literals[i], partial))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+#if THOMPSON_X86
+    THOMPSON_TARGET("ssse3")
+    size_t findTeddySsse3(const unsigned char *data, size_t i, size_t length, bool partial) const
+    {
+        const __m128i nibble = _mm_set1_epi8(0x0F);
+        __m128i low[3], high[3];
+        for (size_t k = 0; k < width; ++k)
+        {
+            low[k] = _mm_load_si128(reinterpret_cast<const __m128i *>(teddyLow[k]));
+            high[k] = _mm_load_si128(reinterpret_cast<const __m128i *>(teddyHigh[k]));
+        }
+        for (; i + width - 1 + 16 <= length; i += 16)
+        {
+            __m128i result = _mm_set1_epi8(-1);
+            for (size_t k = 0; k < width; ++k)
+            {
+                __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + k));
+                __m128i lo = _mm_shuffle_epi8(low[k], _mm_and_si128(x, nibble));
+                __m128i hi = _mm_shuffle_epi8(high[k], _mm_and_si128(_mm_srli_epi16(x, 4), nibble));
+                result = _mm_and_si128(result, _mm_and_si128(lo, hi));
+            }
+            uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(result, _mm_setzero_si128()))) ^ 0xFFFF;
+            if (mask == 0)
+            {
+                continue;
+            }
+            alignas(16) uint8_t buckets[16];
+            _mm_store_si128(reinterpret_cast<__m128i *>(buckets), result);
+            for (; mask != 0; mask &= mask - 1)
+            {
+                int k = countTrailingZeros(mask);
+                if (verifyBuckets(data, i + k, length, buckets[k], partial))
+                {
+                    return i + k;
+                }
+            }
+        }
+        return verifyTeddy(data, i, length, length, partial);
+    }
+
+    THOMPSON_TARGET("avx2")
+    size_t findTeddyAvx2(const unsigned char *data, size_t i, size_t length, bool partial) const
+    {
+        const __m256i nibble = _mm256_set1_epi8(0x0F);
+        __m256i low[3], high[3];
+        for (size_t k = 0; k < width; ++k)
+        {
+            // vpshufb 在两个128位的半边内各自查表，两边放同一张表
+            low[k] = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i *>(teddyLow[k])));
+            high[k] = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i *>(teddyHigh[k])));
+        }
+        for (; i + width - 1 + 32 <= length; i += 32)
+        {
+            __m256i result = _mm256_set1_epi8(-1);
+            for (size_t k = 0; k < width; ++k)
+            {
+                __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i + k));
+                __m256i lo = _mm256_shuffle_epi8(low[k], _mm256_and_si256(x, nibble));
+                __m256i hi = _mm256_shuffle_epi8(high[k], _mm256_and_si256(_mm256_srli_epi16(x, 4), nibble));
+                result = _mm256_and_si256(result, _mm256_and_si256(lo, hi));
+            }
+            uint32_t mask = ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(result, _mm256_setzero_si256())));
+            if (mask == 0)
+            {
+                continue;
+            }
+            alignas(32) uint8_t buckets[32];
+            _mm256_store_si256(reinterpret_cast<__m256i *>(buckets), result);
+            for (; mask != 0; mask &= mask - 1)
+            {
+                int k = countTrailingZeros(mask);
+                if (verifyBuckets(data, i + k, length, buckets[k], partial))
+                {
+                    return i + k;
+                }
+            }
+        }
+        return findTeddySsse3(data, i, length, partial);
+    }
+#endif
+};
+
+// 批量匹配判断的条件
+enum class BatchMode
+{
+    Full,  // 整个输入被接受，同 fullMatch
+    Prefix // 输入的某个前缀被接受，同 prefixMatch；对 searchDFA() 即输入中包含匹配
+};
+
+// 序列化DFA的格式错误：不是DFA文件、版本或字节序不符、文件被截断或损坏
+class DFAFormatError : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// 序列化DFA（.dfa 文件）的文件头。
+// 文件头后面是各个段，段用相对文件开头的偏移定位并按64字节对齐，文件里没有指针，
+// 所以 mmap 之后不用解析就能直接匹配，多个进程可以只读共享同一份页缓存。
+// 数值按本机字节序存放，byteOrder 用来拒绝字节序不同的机器写出的文件。
+// checksum 是 FNV-1a 64，覆盖 checksum 之前的文件头和文件头之后的全部内容
+struct DFAFileHeader
+{
+    static constexpr char MAGIC[8] = {'T', 'H', 'D', 'F', 'A', '\r', '\n', '\x1a'};
+    static constexpr uint32_t VERSION = 1;
+    static constexpr uint32_t BYTE_ORDER_MARK = 0x01020304;
+    static constexpr uint64_t ALIGNMENT = 64;
+
+    enum Section
+    {
+        BYTE_CLASSES,    // uint8_t[256]，字节 -> 类
+        FIRST_BYTES,     // uint8_t[256]，匹配能否以这个字节开始
+        TABLE,           // uint32_t[numStates << classShift]，转移表
+        ACCEPT_BITS,     // uint64_t[(numStates + 63) / 64]，接受状态位图
+        ACCEPT_PATTERNS, // int32_t[numStates]，接受状态的模式编号
+        METADATA,        // 任意文本，compile 模式写入源正则表达式
+        SECTION_COUNT
+    };
+
+    struct Extent
+    {
+        uint64_t offset;
+        uint64_t size; // 字节数
+    };
+
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint32_t byteOrder;
+    uint32_t numStates; // 包含死状态
+    uint32_t start;
+    uint32_t numClasses;
+    uint32_t classShift;
+    uint32_t reserved;
+    uint64_t fileSize;
+    Extent sections[SECTION_COUNT];
+    uint64_t checksum;
+};
+
+static_assert(sizeof(DFAFileHeader) == 152, "DFAFileHeader 的布局是文件格式的一部分");
+
+uint64_t dfaFileChecksum(const char *data, size_t fileSize)
+{
+    uint64_t hash = 1469598103934665603ULL;
+    auto mix = [&hash](const char *begin, const char *end)
+    {
+        for (const char *p = begin; p != end; ++p)
+        {
+            hash = (hash ^ static_cast<unsigned char>(*p)) * 1099511628211ULL;
+        }
+    };
+    mix(data, data + offsetof(DFAFileHeader, checksum));
+    mix(data + sizeof(DFAFileHeader), data + fileSize);
+    return hash;
+}
+
+// 表驱动的DFA匹配器
+// 把最小化后的DFA展开成稠密的 [状态][字节类] 转移表，状态0固定为死状态，
+// 这样内循环只需要一次查类表和一次查转移表，不再遍历 std::map。
+// 每行的宽度是不小于类数的2的幂，下标用移位而不是乘法计算。
+// 所有的表都放在一块序列化格式（见 DFAFileHeader）的内存里，匹配只通过指针读取：
+// 编译出来的DFA自己持有这块内存，load() 得到的DFA直接用映射的文件。
+// 表构造后不再修改，复制 CompiledDFA 只增加引用计数
+class CompiledDFA
+{
+public:
+    static constexpr uint32_t DEAD_STATE = 0;
+
+    explicit CompiledDFA(const DFA &dfa)
+        : CompiledDFA(buildTables(dfa))
+    {
+    }
+
+    // 映射一个 save() 写出的文件。verify 为 true 时检查校验和与每个转移的目标，
+    // 耗时与文件大小成正比；为 false 时只检查文件头和各段的位置，适合确定可信的文件
+    static CompiledDFA load(const std::string &path, bool verify = true)
+    {
+        auto file = std::make_shared<MappedFile>(path, false);
+        if (!file->isOpen())
+        {
+            throw DFAFormatError("无法打开文件 " + path);
+        }
+        validate(file->data(), file->size(), verify);
+        CompiledDFA dfa;
+        dfa.bind(file, file->data());
+        return dfa;
+    }
+
+    // 写成序列化格式。先在同一目录下写一个名字唯一的临时文件再改名替换：正在映射旧文件的进程不受影响，
+    // 几个进程同时写同一个文件时各写各的临时文件，最后留下其中一个完整的文件
+    bool save(const std::string &path) const
+    {
+        return save(path, metadata());
+    }
+
+    bool save(const std::string &path, std::string_view metadata) const
+    {
+        std::shared_ptr<std::vector<uint64_t>> image = buildImage(tables(), metadata);
+        const uint64_t fileSize = reinterpret_cast<const DFAFileHeader *>(image->data())->fileSize;
+        const char *bytes = reinterpret_cast<const char *>(image->data());
+        const size_t slash = path.find_last_of("/\\");
+        const std::string directory = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+#ifdef _WIN32
+        char temporary[MAX_PATH];
+        if (GetTempFileNameA(directory.c_str(), "dfa", 0, temporary) == 0)
+        {
+            return false;
+        }
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        out.write(bytes, static_cast<std::streamsize>(fileSize));
+        out.close();
+        bool ok = static_cast<bool>(out) && MoveFileExA(temporary, path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+        if (!ok)
+        {
+            std::remove(temporary);
+        }
+#else
+        std::string temporary = (slash == std::string::npos ? std::string() : directory) + ".dfa-XXXXXX";
+        int fd = mkstemp(temporary.data());
+        if (fd < 0)
+        {
+            return false;
+        }
+        bool ok = fchmod(fd, 0644) == 0; // mkstemp 建的文件只有所有者可读，映射它的可能是别的用户
+        for (uint64_t written = 0; ok && written < fileSize;)
+        {
+            ssize_t n = ::write(fd, bytes + written, static_cast<size_t>(fileSize - written));
+            ok = n > 0 || (n < 0 && errno == EINTR);
+            written += n > 0 ? static_cast<uint64_t>(n) : 0;
+        }
+        ok = ::close(fd) == 0 && ok;
+        ok = ok && std::rename(temporary.c_str(), path.c_str()) == 0;
+        if (!ok)
+        {
+            std::remove(temporary.c_str());
+        }
+#endif
+        return ok;
+    }
+
+    uint32_t stateCount() const { return numStates; }
+    uint32_t startState() const { return start; }
+    uint32_t classCount() const { return numClasses; }
+    size_t tableBytes() const { return (static_cast<size_t>(numStates) << classShift) * sizeof(uint32_t); }
+
+    // 占用的内存：整个映像（各个表和元数据）加上预过滤器
+    size_t memoryBytes() const
+    {
+        return static_cast<size_t>(header->fileSize) + (startFilter ? sizeof(Prefilter) : 0) + (requiredFilter ? sizeof(Prefilter) : 0);
+    }
+
+    // 序列化时附带的文本，编译出来的DFA为空
+    std::string_view metadata() const
+    {
+        const DFAFileHeader::Extent &extent = header->sections[DFAFileHeader::METADATA];
+        return std::string_view(base + extent.offset, extent.size);
+    }
+
+    uint32_t next(uint32_t state, unsigned char byte) const
+    {
+        return table[(static_cast<size_t>(state) << classShift) | byteClass[byte]];
+    }
+
+    uint32_t classOf(unsigned char byte) const
+    {
+        return byteClass[byte];
+    }
+
+    bool isAccepting(uint32_t state) const
+    {
+        return (acceptBits[state >> 6] >> (state & 63)) & 1;
+    }
+
+    // 接受状态对应的最高优先级模式，非接受状态返回 -1
+    int acceptingPattern(uint32_t state) const
+    {
+        return acceptPattern[state];
+    }
+
+    // 匹配能否以这个字节开始（不含空匹配）
+    bool canStartWith(unsigned char byte) const
+    {
+        return firstByte[byte];
+    }
+
+    // 附加字面量分析的结果：非锚定搜索用前缀集合跳到可能开始匹配的位置，
+    // grep 用每个匹配都必须包含的字面量跳过不可能匹配的行。
+    // 字面量不写进序列化文件，load() 得到的DFA只有首字节过滤
+    void attachLiterals(const LiteralInfo &literals)
+    {
+        if (isAccepting(start))
+        {
+            return; // 能匹配空串，每个位置都可能是匹配
+        }
+        if (literals.usefulPrefixes())
+        {
+            startFilter = std::make_shared<Prefilter>(Prefilter::forLiterals(literals.prefixes));
+        }
+        // 足够长的必需因子比一组短前缀更少误报
+        std::shared_ptr<Prefilter> required;
+        if (!literals.factor.empty() && (literals.factor.size() >= 3 || !literals.usefulPrefixes()))
+        {
+            required = std::make_shared<Prefilter>(Prefilter::forLiterals({literals.factor}));
+        }
+        else if (literals.usefulPrefixes())
+        {
+            required = std::make_shared<Prefilter>(Prefilter::forLiterals(literals.prefixes));
+        }
+        // 查表的过滤条件不比逐行运行DFA快
+        if (required && required->filterKind() != Prefilter::ByteTable && required->filterKind() != Prefilter::Everywhere)
+        {
+            requiredFilter = required;
+        }
+    }
+
+    // [from, length) 中第一个可能开始非空匹配的位置，没有时返回 length。
+    // partial 为 true 表示后面还有输入，末尾不完整的前缀也算候选
+    size_t nextCandidate(const unsigned char *data, size_t from, size_t length, bool partial) const
+    {
+        return startFilter->find(data, from, length, partial);
+    }
+
+    // 每个匹配都包含的字面量的过滤器，没有时为 nullptr
+    const Prefilter *required() const
+    {
+        return requiredFilter.get();
+    }
+
+    // 整个输入被DFA接受
+    bool fullMatch(std::string_view input) const
+    {
+        return fullMatch(input.data(), input.size());
+    }
+
+    bool fullMatch(const char *data, size_t length) const
+    {
+        const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+        const uint32_t *t = table;
+        const uint8_t *c = byteClass;
+        const uint32_t shift = classShift;
+        uint32_t s = start;
+        size_t i = 0;
+
+        // 死状态是吸收态，每16个字节才检查一次，内循环保持无分支
+        while (i + 16 <= length)
+        {
+            for (size_t k = 0; k < 16; ++k)
+            {
+                s = t[(static_cast<size_t>(s) << shift) | c[p[i + k]]];
+            }
+            if (s == DEAD_STATE)
+            {
+                return false;
+            }
+            i += 16;
+        }
+        for (; i < length; ++i)
+        {
+            s = t[(static_cast<size_t>(s) << shift) | c[p[i]]];
+        }
+        return isAccepting(s);
+    }
+
+    // 从输入开头起的最长匹配，成功时 matchLength 为匹配长度
+    bool prefixMatch(std::string_view input, size_t &matchLength) const
+    {
+        return prefixMatch(input.data(), input.size(), matchLength);
+    }
+
+    bool prefixMatch(const char *data, size_t length, size_t &matchLength) const
+    {
+        const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+        const uint32_t *t = table;
+        const uint8_t *c = byteClass;
+        const uint32_t shift = classShift;
+        uint32_t s = start;
+        size_t last = isAccepting(s) ? 0 : SIZE_MAX;
+
+        for (size_t i = 0; i < length; ++i)
+        {
+            s = t[(static_cast<size_t>(s) << shift) | c[p[i]]];
+            if (s == DEAD_STATE)
+            {
+                break;
+            }
+            last = isAccepting(s) ? i + 1 : last;
+        }
+
+        if (last == SIZE_MAX)
+        {
+            return false;
+        }
+        matchLength = last;
+        return true;
+    }
+
+    // 查找最左最长匹配，成功时匹配区间为 [matchBegin, matchEnd)
+    bool find(std::string_view input, size_t &matchBegin, size_t &matchEnd) const
+    {
+        return find(input.data(), input.size(), matchBegin, matchEnd);
+    }
+
+    // 先用正向的搜索自动机一遍找到最左最长匹配的结束位置，再用反向DFA从结束位置往回找到起点，
+    // 每个字节至多各读一次，不再从每个候选起点重新运行DFA
+    bool find(const char *data, size_t length, size_t &matchBegin, size_t &matchEnd) const
+    {
+        const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+
+        // 起点只能按字节过滤时，先确认输入中还有每个匹配都必须包含的字面量，没有就不用搜索
+        const bool weakStart = startFilter->filterKind() != Prefilter::Literal && startFilter->filterKind() != Prefilter::Teddy;
+        if (weakStart && requiredFilter && requiredFilter->find(p, 0, length, false) == length)
+        {
+            return false;
+        }
+        SearchScan scan;
+        beginSearch(scan, 0);
+        advanceSearch(scan, p, 0, length, false);
+        if (scan.matchEnd == NO_MATCH)
+        {
+            return false;
+        }
+        matchBegin = static_cast<size_t>(matchStart(p, 0, scan));
+        matchEnd = static_cast<size_t>(scan.matchEnd);
+        return true;
+    }
+
+    static constexpr uint64_t NO_MATCH = UINT64_MAX;
+    // 搜索用的自动机最多展开这么多个状态（原DFA很大时放宽到它的4倍），超过时改用不缓存的模拟
+    static constexpr uint32_t SEARCH_STATE_LIMIT = 10000;
+
+    uint32_t searchStateLimit() const
+    {
+        return std::max<uint32_t>(SEARCH_STATE_LIMIT, 4 * numStates);
+    }
+
+    // 最左最长搜索的进度，可以跨块保存，位置都是流中的绝对偏移。
+    // 搜索把每个起点看成一个线程，线程就是原DFA的一个状态：两个线程走到同一个状态时只留起点早的；
+    // 一旦有线程接受，起点更晚的线程全部丢掉、也不再加入新线程，所有线程都死掉时最后记下的就是结果
+    struct SearchScan
+    {
+        uint64_t position = 0;         // 下一个要读的字节
+        uint64_t restart = 0;          // 还活着的线程都不早于这里开始，找起点时不用往回走过这里
+        uint64_t matchEnd = NO_MATCH;  // 目前最好的匹配的结束位置
+        uint32_t state = DEAD_STATE;   // 搜索自动机的状态；模拟时线程都死掉为 DEAD_STATE，否则为 1
+        bool matched = false;          // 以下两项只在搜索自动机没有展开时使用
+        std::vector<uint32_t> threads; // 按起点排序
+
+        bool done() const { return state == DEAD_STATE; }
+    };
+
+    // 从 position 开始一次新的搜索
+    void beginSearch(SearchScan &scan, uint64_t position) const
+    {
+        const SearchAutomata &automata = searchAutomata();
+        scan.position = scan.restart = position;
+        scan.matchEnd = isAccepting(start) ? position : NO_MATCH;
+        if (automata.leftmost)
+        {
+            scan.state = automata.leftmost->start;
+            return;
+        }
+        initialThreads(scan.threads, scan.matched);
+        scan.state = scan.threads.empty() ? DEAD_STATE : 1;
+    }
+
+    // 读 data 中还没读过的字节，直到搜索结束（scan.done()）或读完。data[0] 在流中的偏移是 base，
+    // partial 为 true 表示后面还有输入（预过滤器要保留块末尾不完整的前缀）
+    void advanceSearch(SearchScan &scan, const unsigned char *data, uint64_t base, size_t length, bool partial) const
+    {
+        const SearchAutomata &automata = searchAutomata();
+        const uint64_t end = base + length;
+        // 还没有匹配、只剩下开始状态的线程时，跳到预过滤器给出的下一个可能的起点。
+        // 这个线程可能是更早开始的，所以没有跳过字节时不能移动 restart
+        const bool skip = !isAccepting(start);
+        uint64_t i = scan.position;
+        uint64_t restart = scan.restart;
+        uint64_t matchEnd = scan.matchEnd;
+
+        if (automata.leftmost)
+        {
+            const CompiledDFA &search = *automata.leftmost;
+            const uint32_t initial = search.start;
+            uint32_t s = scan.state;
+            while (s != DEAD_STATE && i < end)
+            {
+                if (s == initial && skip)
+                {
+                    uint64_t candidate = base + startFilter->find(data, static_cast<size_t>(i - base), length, partial);
+                    restart = candidate > i ? candidate : restart;
+                    i = candidate;
+                    if (i == end)
+                    {
+                        break;
+                    }
+                }
+                s = search.next(s, data[i - base]);
+                ++i;
+                matchEnd = search.isAccepting(s) ? i : matchEnd;
+            }
+            scan.state = s;
+        }
+        else
+        {
+            std::vector<uint32_t> next;
+            std::vector<uint8_t> seen(numStates, 0);
+            while (!scan.threads.empty() && i < end)
+            {
+                if (skip && !scan.matched && scan.threads.size() == 1 && scan.threads[0] == start)
+                {
+                    uint64_t candidate = base + startFilter->find(data, static_cast<size_t>(i - base), length, partial);
+                    restart = candidate > i ? candidate : restart;
+                    i = candidate;
+                    if (i == end)
+                    {
+                        break;
+                    }
+                }
+                bool accepted = stepThreads(scan.threads, scan.matched, data[i - base], next, seen);
+                scan.threads.swap(next);
+                ++i;
+                matchEnd = accepted ? i : matchEnd;
+            }
+            scan.state = scan.threads.empty() ? DEAD_STATE : 1;
+        }
+        scan.position = i;
+        scan.restart = restart;
+        scan.matchEnd = matchEnd;
+    }
+
+    // 找到的匹配的起点：从 scan.matchEnd 往回运行反向DFA，最后一次接受的位置就是最左的起点。
+    // data 至少要覆盖 [scan.restart, scan.matchEnd)
+    uint64_t matchStart(const unsigned char *data, uint64_t base, const SearchScan &scan) const
+    {
+        const SearchAutomata &automata = searchAutomata();
+        uint64_t begin = scan.matchEnd;
+        if (automata.reverse)
+        {
+            const CompiledDFA &reverse = *automata.reverse;
+            uint32_t s = reverse.start;
+            for (uint64_t i = scan.matchEnd; i > scan.restart && s != DEAD_STATE; --i)
+            {
+                s = reverse.next(s, data[i - 1 - base]);
+                begin = reverse.isAccepting(s) ? i - 1 : begin;
+            }
+            return begin;
+        }
+
+        std::vector<uint32_t> states, next;
+        std::vector<uint8_t> seen(numStates, 0);
+        reverseStartStates(states);
+        for (uint64_t i = scan.matchEnd; i > scan.restart && !states.empty(); --i)
+        {
+            reverseStep(automata, states, byteClass[data[i - 1 - base]], next, seen);
+            states.swap(next);
+            if (std::find(states.begin(), states.end(), start) != states.end())
+            {
+                begin = i - 1;
+            }
+        }
+        return begin;
+    }
+
+    // 批量匹配：inputs[i] 满足条件时置位 bitmap 的第 i 位，bitmap 至少 (count + 63) / 64 个字。
+    // 一个线程同时推进 BATCH_LANES 个输入，各自的查表互不依赖，访存延迟可以重叠；
+    // 输入很多且给了线程池时，按 BATCH_GRAIN 个一块分给各线程（块是64的倍数，各线程写不同的字）
+    void matchBatch(const std::string_view *inputs, size_t count, uint64_t *bitmap,
+                    BatchMode mode = BatchMode::Full, ThreadPool *pool = nullptr) const
+    {
+        std::fill(bitmap, bitmap + (count + 63) / 64, 0);
+        auto run = [&](size_t begin, size_t end)
+        {
+            matchLanes(inputs, begin, end, mode, [&](size_t i)
+                       { bitmap[i >> 6] |= uint64_t(1) << (i & 63); });
+        };
+        if (pool != nullptr && count >= 2 * BATCH_GRAIN)
+        {
+            pool->parallelFor(count, BATCH_GRAIN, run);
+        }
+        else
+        {
+            run(0, count);
+        }
+    }
+
+    void matchBatch(const std::vector<std::string_view> &inputs, std::vector<uint64_t> &bitmap,
+                    BatchMode mode = BatchMode::Full, ThreadPool *pool = nullptr) const
+    {
+        bitmap.resize((inputs.size() + 63) / 64);
+        matchBatch(inputs.data(), inputs.size(), bitmap.data(), mode, pool);
+    }
+
+    // 同 matchBatch，结果是满足条件的输入的下标（升序），覆盖 indices 原来的内容
+    void matchBatchIndices(const std::string_view *inputs, size_t count, std::vector<size_t> &indices,
+                           BatchMode mode = BatchMode::Full, ThreadPool *pool = nullptr) const
+    {
+        std::vector<uint64_t> bitmap((count + 63) / 64);
+        matchBatch(inputs, count, bitmap.data(), mode, pool);
+        indices.clear();
+        for (size_t w = 0; w < bitmap.size(); ++w)
+        {
+            for (uint64_t bits = bitmap[w]; bits != 0; bits &= bits - 1)
+            {
+                indices.push_back(w * 64 + countTrailingZeros64(bits));
+            }
+        }
+    }
+
+    // 最长匹配（maximal munch）分词：每个位置取最长的匹配，长度相同时取优先级最高的模式；
+    // 无法匹配的字节单独输出为 pattern = -1 的记号。结果追加到 tokens
+    void tokenize(std::string_view input, std::vector<Token> &tokens) const
+    {
+        const unsigned char *p = reinterpret_cast<const unsigned char *>(input.data());
+        const uint32_t *t = table;
+        const uint8_t *c = byteClass;
+        const uint32_t shift = classShift;
+        const size_t length = input.size();
+        size_t position = 0;
+
+        while (position < length)
+        {
+            uint32_t s = start;
+            size_t lastEnd = 0;
+            int lastPattern = -1;
+            for (size_t i = position; i < length; ++i)
+            {
+                s = t[(static_cast<size_t>(s) << shift) | c[p[i]]];
+                if (s == DEAD_STATE)
+                {
+                    break;
+                }
+                if (acceptPattern[s] >= 0)
+                {
+                    lastEnd = i + 1;
+                    lastPattern = acceptPattern[s];
+                }
+            }
+
+            if (lastPattern < 0)
+            {
+                tokens.push_back(Token{-1, position, 1});
+                ++position;
+            }
+            else
+            {
+                tokens.push_back(Token{lastPattern, position, lastEnd - position});
+                position = lastEnd;
+            }
+        }
+    }
+
+    // 非锚定搜索用的DFA：每一步都把开始状态并入当前状态集合（相当于在模式前加上任意串），
+    // 到达接受状态就说明有匹配在这里结束。grep 模式用它一遍扫描判断一行是否包含匹配。
+    // 第一次调用时构造，复制出来的DFA共用；状态数超过 searchStateLimit() 时不展开，返回 nullptr
+    const CompiledDFA *searchDFA() const
+    {
+        std::call_once(searchCache->unanchoredBuilt, [this]
+                       { searchCache->unanchored = buildUnanchored(); });
+        return searchCache->unanchored.get();
+    }
+
+private:
+    static constexpr int BATCH_LANES = 4; // 8 条通道时状态和指针放不进寄存器，反而更慢
+    static constexpr size_t BATCH_GRAIN = 4096;
+    static constexpr size_t BATCH_STEP = 64; // 每走这么多字节检查一次哪些输入已经结束
+
+    // 对 [begin, end) 中满足条件的输入调用 onMatch(i)。各条通道同步推进到最短的剩余长度（至多 BATCH_STEP），
+    // 再把结束的通道换成下一个输入。通道数固定，内循环可以完全展开；
+    // 没有输入可换的通道停在死状态，读一块全零的填充字节
+    template <typename OnMatch>
+    void matchLanes(const std::string_view *inputs, size_t begin, size_t end, BatchMode mode, OnMatch &&onMatch) const
+    {
+        static const unsigned char padding[BATCH_STEP] = {};
+        const uint32_t *t = table;
+        const uint8_t *c = byteClass;
+        const uint32_t shift = classShift;
+        const bool prefix = mode == BatchMode::Prefix;
+        const bool startAccepts = isAccepting(start);
+
+        const unsigned char *data[BATCH_LANES];
+        size_t remaining[BATCH_LANES];
+        uint32_t state[BATCH_LANES];
+        bool accepted[BATCH_LANES];
+        size_t item[BATCH_LANES];
+        int active = 0;
+        size_t next = begin;
+
+        // 给通道 l 换上下一个需要运行DFA的输入，没有时变成填充通道
+        auto refill = [&](int l)
+        {
+            for (; next < end; ++next)
+            {
+                const std::string_view input = inputs[next];
+                if (!input.empty() && !(prefix && startAccepts))
+                {
+                    data[l] = reinterpret_cast<const unsigned char *>(input.data());
+                    remaining[l] = input.size();
+                    state[l] = start;
+                    accepted[l] = false;
+                    item[l] = next++;
+                    return true;
+                }
+                if (startAccepts)
+                {
+                    onMatch(next);
+                }
+            }
+            data[l] = padding;
+            remaining[l] = SIZE_MAX;
+            state[l] = DEAD_STATE;
+            accepted[l] = false;
+            return false;
+        };
+        for (int l = 0; l < BATCH_LANES; ++l)
+        {
+            active += refill(l);
+        }
+
+        while (active > 0)
+        {
+            size_t steps = BATCH_STEP;
+            for (int l = 0; l < BATCH_LANES; ++l)
+            {
+                steps = std::min(steps, remaining[l]);
+            }
+            if (prefix)
+            {
+                for (size_t k = 0; k < steps; ++k)
+                {
+                    THOMPSON_UNROLL_LANES
+                    for (int l = 0; l < BATCH_LANES; ++l)
+                    {
+                        state[l] = t[(static_cast<size_t>(state[l]) << shift) | c[data[l][k]]];
+                        accepted[l] |= isAccepting(state[l]);
+                    }
+                }
+            }
+            else
+            {
+                for (size_t k = 0; k < steps; ++k)
+                {
+                    THOMPSON_UNROLL_LANES
+                    for (int l = 0; l < BATCH_LANES; ++l)
+                    {
+                        state[l] = t[(static_cast<size_t>(state[l]) << shift) | c[data[l][k]]];
+                    }
+                }
+            }
+
+            for (int l = 0; l < BATCH_LANES; ++l)
+            {
+                if (data[l] == padding)
+                {
+                    continue;
+                }
+                data[l] += steps;
+                remaining[l] -= steps;
+                if (remaining[l] != 0 && state[l] != DEAD_STATE && !accepted[l])
+                {
+                    continue;
+                }
+                if (prefix ? accepted[l] : remaining[l] == 0 && isAccepting(state[l]))
+                {
+                    onMatch(item[l]);
+                }
+                active -= !refill(l);
+            }
+        }
+    }
+
+    // 构造时先把各个表填在这里，再写成序列化格式
+    struct Tables
+    {
+        uint32_t numStates = 1;
+        uint32_t start = DEAD_STATE;
+        uint32_t numClasses = 1;
+        uint32_t classShift = 0;
+        uint8_t byteClass[256] = {};
+        uint8_t firstByte[256] = {};
+        std::vector<uint32_t> table;
+        std::vector<uint64_t> acceptBits;
+        std::vector<int32_t> acceptPattern;
+    };
+
+    CompiledDFA() = default;
+
+    explicit CompiledDFA(const Tables &tables)
+    {
+        std::shared_ptr<std::vector<uint64_t>> image = buildImage(tables, {});
+        bind(image, reinterpret_cast<const char *>(image->data()));
+    }
+
+    static Tables buildTables(const DFA &dfa)
+    {
+        const auto &states = dfa.states;
+        const ByteClasses &classes = dfa.byteClasses;
+        Tables t;
+        t.numStates = static_cast<uint32_t>(states.size()) + 1;
+        t.numClasses = static_cast<uint32_t>(classes.size());
+        while ((uint32_t(1) << t.classShift) < t.numClasses)
+        {
+            ++t.classShift;
+        }
+        for (int b = 0; b < 256; ++b)
+        {
+            t.byteClass[b] = classes[static_cast<unsigned char>(b)];
+        }
+        t.table.assign(static_cast<size_t>(t.numStates) << t.classShift, DEAD_STATE);
+        t.acceptBits.assign((t.numStates + 63) / 64, 0);
+        t.acceptPattern.assign(t.numStates, -1);
+
+        // DFA状态 i 编号为 i + 1
+        std::map<const DFAState *, uint32_t> index;
+        for (size_t i = 0; i < states.size(); ++i)
+        {
+            index[states[i].get()] = static_cast<uint32_t>(i) + 1;
+        }
+        if (dfa.start != nullptr && index.count(dfa.start))
+        {
+            t.start = index[dfa.start];
+        }
+
+        for (size_t i = 0; i < states.size(); ++i)
+        {
+            uint32_t from = static_cast<uint32_t>(i) + 1;
+            if (states[i]->isFinal)
+            {
+                t.acceptBits[from >> 6] |= uint64_t(1) << (from & 63);
+                t.acceptPattern[from] = states[i]->acceptTags.empty() ? 0 : states[i]->acceptTags.front();
+            }
+            for (const auto &[byteClassId, target] : states[i]->transitions)
+            {
+                t.table[(static_cast<size_t>(from) << t.classShift) | static_cast<uint32_t>(byteClassId)] = index[target];
+            }
+        }
+
+        // 能从开始状态走出的首字节，find() 用来跳过不可能开始匹配的位置
+        for (int b = 0; b < 256; ++b)
+        {
+            t.firstByte[b] = t.table[(static_cast<size_t>(t.start) << t.classShift) | t.byteClass[b]] != DEAD_STATE;
+        }
+        return t;
+    }
+
+    // 从当前的表复制一份，save() 附加新的元数据时重新生成文件内容
+    Tables tables() const
+    {
+        Tables t;
+        t.numStates = numStates;
+        t.start = start;
+        t.numClasses = numClasses;
+        t.classShift = classShift;
+        std::copy(byteClass, byteClass + 256, t.byteClass);
+        std::copy(firstByte, firstByte + 256, t.firstByte);
+        t.table.assign(table, table + (static_cast<size_t>(numStates) << classShift));
+        t.acceptBits.assign(acceptBits, acceptBits + (numStates + 63) / 64);
+        t.acceptPattern.assign(acceptPattern, acceptPattern + numStates);
+        return t;
+    }
+
+    // 搜索用的自动机，第一次搜索时才构造，复制出来的 CompiledDFA 共用一份。
+    // 状态数超过 searchStateLimit() 的不展开（指针为空），搜索时直接模拟，耗时仍与输入长度成正比
+    struct SearchAutomata
+    {
+        std::once_flag built;
+        std::once_flag unanchoredBuilt;
+        std::shared_ptr<const CompiledDFA> unanchored; // searchDFA()
+        std::shared_ptr<const CompiledDFA> leftmost; // 最左最长匹配的结束位置，见 SearchScan
+        std::shared_ptr<const CompiledDFA> reverse;  // 反向DFA，从结束位置往回找起点
+        // 反向转移的 CSR 数组：字节类 c 上到达状态 t 的来源是
+        // reverseSources[reverseOffsets[c * numStates + t] .. reverseOffsets[c * numStates + t + 1])
+        std::vector<uint32_t> reverseOffsets;
+        std::vector<uint32_t> reverseSources;
+    };
+
+    const SearchAutomata &searchAutomata() const
+    {
+        std::call_once(searchCache->built, [this]
+                       {
+                           buildReverseEdges(*searchCache);
+                           searchCache->leftmost = buildLeftmost();
+                           searchCache->reverse = buildReverse(*searchCache); });
+        return *searchCache;
+    }
+
+    // 每个字节类取它的第一个字节，派生的自动机用它求转移
+    std::vector<int> classRepresentatives() const
+    {
+        std::vector<int> representative(numClasses, -1);
+        for (int b = 255; b >= 0; --b)
+        {
+            representative[byteClass[b]] = b;
+        }
+        return representative;
+    }
+
+    // 沿用这个DFA的字节类的派生自动机：rows 是状态 1 到 states 依次排列的转移行，接受状态由调用者填
+    Tables derivedTables(uint32_t states, uint32_t startState, const std::vector<uint32_t> &rows) const
+    {
+        Tables t;
+        t.numStates = states + 1;
+        t.start = startState;
+        t.numClasses = numClasses;
+        t.classShift = classShift;
+        std::copy(byteClass, byteClass + 256, t.byteClass);
+        std::fill(std::begin(t.firstByte), std::end(t.firstByte), 1);
+        t.table.assign(size_t(1) << classShift, DEAD_STATE);
+        t.table.insert(t.table.end(), rows.begin(), rows.end());
+        t.acceptBits.assign((t.numStates + 63) / 64, 0);
+        t.acceptPattern.assign(t.numStates, -1);
+        return t;
+    }
+
+    void initialThreads(std::vector<uint32_t> &threads, bool &matched) const
+    {
+        threads.clear();
+        if (start != DEAD_STATE)
+        {
+            threads.push_back(start);
+        }
+        matched = isAccepting(start);
+    }
+
+    // 搜索的一步（见 SearchScan），返回是否有线程接受。seen 是 numStates 个全零的标记，返回时仍然全零
+    bool stepThreads(const std::vector<uint32_t> &threads, bool &matched, unsigned char byte,
+                     std::vector<uint32_t> &next, std::vector<uint8_t> &seen) const
+    {
+        next.clear();
+        for (uint32_t s : threads)
+        {
+            uint32_t t = this->next(s, byte);
+            if (t != DEAD_STATE && !seen[t])
+            {
+                seen[t] = 1;
+                next.push_back(t);
+            }
+        }
+        if (!matched && start != DEAD_STATE && !seen[start])
+        {
+            next.push_back(start); // 从下一个位置开始的线程
+        }
+        for (uint32_t t : next)
+        {
+            seen[t] = 0;
+        }
+        auto accepting = std::find_if(next.begin(), next.end(), [this](uint32_t t)
+                                      { return isAccepting(t); });
+        if (accepting == next.end())
+        {
+            return false;
+        }
+        next.erase(accepting + 1, next.end());
+        matched = true;
+        return true;
+    }
+
+    // 子集构造 searchDFA()，超过 searchStateLimit() 个状态时返回空指针
+    std::shared_ptr<const CompiledDFA> buildUnanchored() const
+    {
+        std::map<std::vector<uint32_t>, uint32_t> index;
+        std::vector<std::vector<uint32_t>> sets;
+        std::vector<uint32_t> startSet;
+        if (start != DEAD_STATE)
+        {
+            startSet.push_back(start);
+        }
+        index[startSet] = 1;
+        sets.push_back(startSet);
+
+        // 搜索DFA沿用同一套字节类
+        const std::vector<int> representative = classRepresentatives();
+
+        const uint32_t stride = uint32_t(1) << classShift;
+        std::vector<uint32_t> rows; // 每个状态一行，依次追加
+        std::vector<uint32_t> next;
+        for (size_t i = 0; i < sets.size(); ++i)
+        {
+            if (sets.size() > searchStateLimit())
+            {
+                return nullptr;
+            }
+            for (uint32_t c = 0; c < stride; ++c)
+            {
+                if (c >= numClasses)
+                {
+                    rows.push_back(DEAD_STATE); // 对齐用的空位
+                    continue;
+                }
+                next = startSet;
+                for (uint32_t s : sets[i])
+                {
+                    uint32_t t = this->next(s, static_cast<unsigned char>(representative[c]));
+                    if (t != DEAD_STATE)
+                    {
+                        next.push_back(t);
+                    }
+                }
+                std::sort(next.begin(), next.end());
+                next.erase(std::unique(next.begin(), next.end()), next.end());
+
+                auto found = index.find(next);
+                if (found == index.end())
+                {
+                    found = index.emplace(next, static_cast<uint32_t>(sets.size()) + 1).first;
+                    sets.push_back(next);
+                }
+                rows.push_back(found->second);
+            }
+        }
+
+        Tables search = derivedTables(static_cast<uint32_t>(sets.size()), 1, rows);
+        for (size_t i = 0; i < sets.size(); ++i)
+        {
+            uint32_t id = static_cast<uint32_t>(i) + 1;
+            for (uint32_t s : sets[i])
+            {
+                if (isAccepting(s) && search.acceptPattern[id] < 0)
+                {
+                    search.acceptBits[id >> 6] |= uint64_t(1) << (id & 63);
+                    search.acceptPattern[id] = acceptPattern[s];
+                }
+            }
+        }
+        return std::shared_ptr<const CompiledDFA>(new CompiledDFA(search));
+    }
+
+    // 展开搜索自动机：状态是线程列表加上是否已经匹配，线程都死掉时是死状态
+    std::shared_ptr<const CompiledDFA> buildLeftmost() const
+    {
+        const std::vector<int> representative = classRepresentatives();
+        const uint32_t stride = uint32_t(1) << classShift;
+        std::map<std::vector<uint32_t>, uint32_t> index; // 线程列表，最后一个元素是 matched
+        std::vector<std::vector<uint32_t>> keys;
+        auto intern = [&](std::vector<uint32_t> key, bool matched)
+        {
+            if (key.empty())
+            {
+                return DEAD_STATE;
+            }
+            key.push_back(matched);
+            auto found = index.find(key);
+            if (found == index.end())
+            {
+                keys.push_back(key);
+                found = index.emplace(std::move(key), static_cast<uint32_t>(keys.size())).first;
+            }
+            return found->second;
+        };
+
+        std::vector<uint32_t> threads, next, rows;
+        std::vector<uint8_t> seen(numStates, 0);
+        bool matched;
+        initialThreads(threads, matched);
+        const uint32_t initial = intern(threads, matched);
+        for (size_t i = 0; i < keys.size(); ++i)
+        {
+            if (keys.size() > searchStateLimit())
+            {
+                return nullptr;
+            }
+            threads.assign(keys[i].begin(), keys[i].end() - 1);
+            for (uint32_t c = 0; c < stride; ++c)
+            {
+                bool m = keys[i].back() != 0;
+                if (c < numClasses)
+                {
+                    stepThreads(threads, m, static_cast<unsigned char>(representative[c]), next, seen);
+                }
+                rows.push_back(c < numClasses ? intern(next, m) : DEAD_STATE);
+            }
+        }
+
+        Tables search = derivedTables(static_cast<uint32_t>(keys.size()), initial, rows);
+        for (size_t i = 0; i < keys.size(); ++i)
+        {
+            uint32_t id = static_cast<uint32_t>(i) + 1;
+            uint32_t last = keys[i][keys[i].size() - 2]; // 有线程接受时只有最后一个接受
+            if (isAccepting(last))
+            {
+                search.acceptBits[id >> 6] |= uint64_t(1) << (id & 63);
+                search.acceptPattern[id] = acceptPattern[last];
+            }
+        }
+        return std::shared_ptr<const CompiledDFA>(new CompiledDFA(search));
+    }
+
+    void buildReverseEdges(SearchAutomata &automata) const
+    {
+        const size_t slots = static_cast<size_t>(numClasses) * numStates;
+        automata.reverseOffsets.assign(slots + 1, 0);
+        for (uint32_t s = 1; s < numStates; ++s)
+        {
+            for (uint32_t c = 0; c < numClasses; ++c)
+            {
+                uint32_t t = table[(static_cast<size_t>(s) << classShift) | c];
+                automata.reverseOffsets[static_cast<size_t>(c) * numStates + t + 1] += t != DEAD_STATE;
+            }
+        }
+        for (size_t i = 0; i < slots; ++i)
+        {
+            automata.reverseOffsets[i + 1] += automata.reverseOffsets[i];
+        }
+        automata.reverseSources.resize(automata.reverseOffsets[slots]);
+        std::vector<uint32_t> fill(automata.reverseOffsets.begin(), automata.reverseOffsets.end() - 1);
+        for (uint32_t s = 1; s < numStates; ++s)
+        {
+            for (uint32_t c = 0; c < numClasses; ++c)
+            {
+                uint32_t t = table[(static_cast<size_t>(s) << classShift) | c];
+                if (t != DEAD_STATE)
+                {
+                    automata.reverseSources[fill[static_cast<size_t>(c) * numStates + t]++] = s;
+                }
+            }
+        }
+    }
+
+    // 反向DFA从全部接受状态出发，状态集合含有开始状态时，从当前位置到匹配结束是一个匹配
+    void reverseStartStates(std::vector<uint32_t> &states) const
+    {
+        states.clear();
+        for (uint32_t s = 1; s < numStates; ++s)
+        {
+            if (isAccepting(s))
+            {
+                states.push_back(s);
+            }
+        }
+    }
+
+    void reverseStep(const SearchAutomata &automata, const std::vector<uint32_t> &states, uint32_t byteClassId,
+                     std::vector<uint32_t> &next, std::vector<uint8_t> &seen) const
+    {
+        next.clear();
+        for (uint32_t t : states)
+        {
+            const size_t slot = static_cast<size_t>(byteClassId) * numStates + t;
+            for (uint32_t k = automata.reverseOffsets[slot]; k < automata.reverseOffsets[slot + 1]; ++k)
+            {
+                uint32_t s = automata.reverseSources[k];
+                if (!seen[s])
+                {
+                    seen[s] = 1;
+                    next.push_back(s);
+                }
+            }
+        }
+        for (uint32_t s : next)
+        {
+            seen[s] = 0;
+        }
+    }
+
+    // 子集构造反向DFA，超过 searchStateLimit() 个状态时返回空指针
+    std::shared_ptr<const CompiledDFA> buildReverse(const SearchAutomata &automata) const
+    {
+        const uint32_t stride = uint32_t(1) << classShift;
+        std::map<std::vector<uint32_t>, uint32_t> index;
+        std::vector<std::vector<uint32_t>> sets;
+        auto intern = [&](std::vector<uint32_t> &set)
+        {
+            if (set.empty())
+            {
+                return DEAD_STATE;
+            }
+            std::sort(set.begin(), set.end());
+            auto found = index.find(set);
+            if (found == index.end())
+            {
+                sets.push_back(set);
+                found = index.emplace(set, static_cast<uint32_t>(sets.size())).first;
+            }
+            return found->second;
+        };
+
+        std::vector<uint32_t> states, next, rows;
+        std::vector<uint8_t> seen(numStates, 0);
+        reverseStartStates(states);
+        const uint32_t initial = intern(states);
+        for (size_t i = 0; i < sets.size(); ++i)
+        {
+            if (sets.size() > searchStateLimit())
+            {
+                return nullptr;
+            }
+            states = sets[i];
+            for (uint32_t c = 0; c < stride; ++c)
+            {
+                next.clear();
+                if (c < numClasses)
+                {
+                    reverseStep(automata, states, c, next, seen);
+                }
+                rows.push_back(intern(next));
+            }
+        }
+
+        Tables reverse = derivedTables(static_cast<uint32_t>(sets.size()), initial, rows);
+        for (size_t i = 0; i < sets.size(); ++i)
+        {
+            uint32_t id = static_cast<uint32_t>(i) + 1;
+            if (std::binary_search(sets[i].begin(), sets[i].end(), start))
+            {
+                reverse.acceptBits[id >> 6] |= uint64_t(1) << (id & 63);
+                reverse.acceptPattern[id] = 0;
+            }
+        }
+        return std::shared_ptr<const CompiledDFA>(new CompiledDFA(reverse));
+    }
+
+    // 按序列化格式排布各个表。缓冲区用 uint64_t 保证8字节对齐，段之间补零
+    static std::shared_ptr<std::vector<uint64_t>> buildImage(const Tables &t, std::string_view metadata)
+    {
+        const void *parts[DFAFileHeader::SECTION_COUNT] = {
+            t.byteClass, t.firstByte, t.table.data(), t.acceptBits.data(), t.acceptPattern.data(), metadata.data()};
+        const uint64_t sizes[DFAFileHeader::SECTION_COUNT] = {
+            sizeof(t.byteClass), sizeof(t.firstByte), t.table.size() * sizeof(uint32_t),
+            t.acceptBits.size() * sizeof(uint64_t), t.acceptPattern.size() * sizeof(int32_t), metadata.size()};
+
+        DFAFileHeader header{};
+        std::memcpy(header.magic, DFAFileHeader::MAGIC, sizeof(header.magic));
+        header.version = DFAFileHeader::VERSION;
+        header.headerSize = sizeof(DFAFileHeader);
+        header.byteOrder = DFAFileHeader::BYTE_ORDER_MARK;
+        header.numStates = t.numStates;
+        header.start = t.start;
+        header.numClasses = t.numClasses;
+        header.classShift = t.classShift;
+        uint64_t offset = sizeof(DFAFileHeader);
+        for (int i = 0; i < DFAFileHeader::SECTION_COUNT; ++i)
+        {
+            offset = (offset + DFAFileHeader::ALIGNMENT - 1) / DFAFileHeader::ALIGNMENT * DFAFileHeader::ALIGNMENT;
+            header.sections[i] = DFAFileHeader::Extent{offset, sizes[i]};
+            offset += sizes[i];
+        }
+        header.fileSize = offset;
+
+        auto image = std::make_shared<std::vector<uint64_t>>((offset + 7) / 8, 0);
+        char *data = reinterpret_cast<char *>(image->data());
+        for (int i = 0; i < DFAFileHeader::SECTION_COUNT; ++i)
+        {
+            if (sizes[i] != 0)
+            {
+                std::memcpy(data + header.sections[i].offset, parts[i], sizes[i]);
+            }
+        }
+        std::memcpy(data, &header, sizeof(header));
+        header.checksum = dfaFileChecksum(data, header.fileSize);
+        std::memcpy(data + offsetof(DFAFileHeader, checksum), &header.checksum, sizeof(header.checksum));
+        return image;
+    }
+
+    // 检查一块内存是不是完整的序列化DFA，各段都在文件内、大小与文件头一致
+    static void validate(const char *data, size_t size, bool verify)
+    {
+        if (size < sizeof(DFAFileHeader) || std::memcmp(data, DFAFileHeader::MAGIC, sizeof(DFAFileHeader::MAGIC)) != 0)
+        {
+            throw DFAFormatError("不是序列化的DFA文件");
+        }
+        if (reinterpret_cast<uintptr_t>(data) % alignof(uint64_t) != 0)
+        {
+            throw DFAFormatError("DFA数据没有按8字节对齐");
+        }
+        const DFAFileHeader &header = *reinterpret_cast<const DFAFileHeader *>(data);
+        if (header.byteOrder != DFAFileHeader::BYTE_ORDER_MARK)
+        {
+            throw DFAFormatError("DFA文件的字节序与本机不同");
+        }
+        if (header.version != DFAFileHeader::VERSION || header.headerSize != sizeof(DFAFileHeader))
+        {
+            throw DFAFormatError("不支持的DFA文件版本 " + std::to_string(header.version));
+        }
+        if (header.fileSize != size)
+        {
+            throw DFAFormatError("DFA文件长度与文件头不符，文件可能被截断");
+        }
+        if (header.numStates == 0 || header.start >= header.numStates || header.classShift > 8 ||
+            header.numClasses == 0 || header.numClasses > (uint32_t(1) << header.classShift))
+        {
+            throw DFAFormatError("DFA文件头中的状态数或字节类数无效");
+        }
+
+        const uint64_t expected[DFAFileHeader::SECTION_COUNT] = {
+            256, 256, (uint64_t(header.numStates) << header.classShift) * sizeof(uint32_t),
+            (uint64_t(header.numStates) + 63) / 64 * sizeof(uint64_t), uint64_t(header.numStates) * sizeof(int32_t), 0};
+        for (int i = 0; i < DFAFileHeader::SECTION_COUNT; ++i)
+        {
+            const DFAFileHeader::Extent &extent = header.sections[i];
+            bool placed = extent.offset >= sizeof(DFAFileHeader) && extent.offset % DFAFileHeader::ALIGNMENT == 0 &&
+                          extent.offset <= size && extent.size <= size - extent.offset;
+            if (!placed || (i != DFAFileHeader::METADATA && extent.size != expected[i]))
+            {
+                throw DFAFormatError("DFA文件的第 " + std::to_string(i) + " 段位置或大小无效");
+            }
+        }
+
+        // 接受状态的模式编号由 tokenize 等直接使用，代价只与状态数成正比，总是检查：
+        // 非接受状态为 -1，接受状态为非负的编号，死状态不接受
+        const uint64_t *acceptBits = reinterpret_cast<const uint64_t *>(data + header.sections[DFAFileHeader::ACCEPT_BITS].offset);
+        const int32_t *patterns = reinterpret_cast<const int32_t *>(data + header.sections[DFAFileHeader::ACCEPT_PATTERNS].offset);
+        for (uint32_t s = 0; s < header.numStates; ++s)
+        {
+            const bool accepting = (acceptBits[s >> 6] >> (s & 63)) & 1;
+            if (patterns[s] < -1 || (patterns[s] >= 0) != accepting || (s == DEAD_STATE && accepting))
+            {
+                throw DFAFormatError("DFA文件中状态 " + std::to_string(s) + " 的接受模式编号无效");
+            }
+        }
+
+        if (!verify)
+        {
+            return;
+        }
+        if (dfaFileChecksum(data, size) != header.checksum)
+        {
+            throw DFAFormatError("DFA文件校验和不符，文件已损坏");
+        }
+        const uint8_t *classes = reinterpret_cast<const uint8_t *>(data + header.sections[DFAFileHeader::BYTE_CLASSES].offset);
+        for (int b = 0; b < 256; ++b)
+        {
+            if (classes[b] >= header.numClasses)
+            {
+                throw DFAFormatError("DFA文件中的字节类编号无效");
+            }
+        }
+        const uint32_t *table = reinterpret_cast<const uint32_t *>(data + header.sections[DFAFileHeader::TABLE].offset);
+        const uint64_t entries = uint64_t(header.numStates) << header.classShift;
+        for (uint64_t i = 0; i < entries; ++i)
+        {
+            if (table[i] >= header.numStates)
+            {
+                throw DFAFormatError("DFA文件的转移表中有无效的状态编号");
+            }
+        }
+    }
+
+    // 让各个指针指向 data 中的段，owner 负责让这块内存活得和DFA一样久
+    void bind(std::shared_ptr<const void> owner, const char *data)
+    {
+        storage = std::move(owner);
+        base = data;
+        header = reinterpret_cast<const DFAFileHeader *>(data);
+        numStates = header->numStates;
+        start = header->start;
+        numClasses = header->numClasses;
+        classShift = header->classShift;
+        byteClass = reinterpret_cast<const uint8_t *>(data + header->sections[DFAFileHeader::BYTE_CLASSES].offset);
+        firstByte = reinterpret_cast<const uint8_t *>(data + header->sections[DFAFileHeader::FIRST_BYTES].offset);
+        table = reinterpret_cast<const uint32_t *>(data + header->sections[DFAFileHeader::TABLE].offset);
+        acceptBits = reinterpret_cast<const uint64_t *>(data + header->sections[DFAFileHeader::ACCEPT_BITS].offset);
+        acceptPattern = reinterpret_cast<const int32_t *>(data + header->sections[DFAFileHeader::ACCEPT_PATTERNS].offset);
+        startFilter = std::make_shared<Prefilter>(Prefilter::forBytes(firstByte));
+        requiredFilter.reset();
+        searchCache = std::make_shared<SearchAutomata>();
+    }
+
+    std::shared_ptr<const void> storage; // 自己持有的缓冲区，或者映射的文件
+    const char *base = nullptr;
+    const DFAFileHeader *header = nullptr;
+    uint32_t numStates = 1; // 包含死状态
+    uint32_t start = DEAD_STATE;
+    uint32_t numClasses = 1;
+    uint32_t classShift = 0; // 每行 1 << classShift 个元素
+    const uint8_t *byteClass = nullptr;
+    const uint8_t *firstByte = nullptr;
+    const uint32_t *table = nullptr;
+    const uint64_t *acceptBits = nullptr;
+    const int32_t *acceptPattern = nullptr;
+    std::shared_ptr<const Prefilter> startFilter;    // 匹配起点的过滤器，至少按首字节过滤
+    std::shared_ptr<const Prefilter> requiredFilter; // 每个匹配都包含的字面量，可能没有
+    std::shared_ptr<SearchAutomata> searchCache; // 复制的DFA共用
+};
+
+// NFA化简，放在 Thompson 构造和子集构造之间，语言和每个模式的接受都不变：
+//   1. 消除ε转换：只保留开始状态和非空转换的目标状态，每个保留的状态带上它ε闭包里所有的非空转换，
+//      闭包里有接受状态时它自己就是接受状态；从开始状态走不到的状态随之去掉
+//   2. 去掉走不到任何接受状态的死状态和指向它们的转换
+//   3. 合并等价状态：接受情况相同、转换（目标按所在的块）相同的状态合成一个状态，按强连通分量的逆拓扑序一遍完成，
+//      环上的状态只在所在的（不太大的）分量内部合并
+// 结果没有ε转换，子集构造和NFA模拟都不再需要算闭包。Thompson NFA 的状态大约一半只有ε转换，化简后通常少一半以上。
+// 多模式NFA中某个闭包同时含有两个模式的接受状态时（两个模式都能匹配同一个位置，例如都接受空串），
+// 一个状态记不下两个模式编号，这时原样返回；消除ε转换使边数超过原来的 EDGE_GROWTH 倍时（例如 (a?){n}，
+// 每个状态的闭包里都有后面所有的状态，边数是平方级的）同样原样返回
+NFA optimizeNFA(const NFA &nfa)
+{
+    PhaseTimer timer(compileStats.optimizeSeconds);
+    const uint32_t n = nfa.size();
+    checkCompileBudget(0, n); // 输入的NFA不一定是在这次编译中构造的
+    const uint32_t NONE = UINT32_MAX;
+    const size_t EDGE_GROWTH = 16;
+    const size_t maxEdges = EDGE_GROWTH * (nfa.edges.size() + 64);
+    auto unchanged = [&]
+    {
+        NFA copy = nfa;
+        chargeCompileMemory(copy.memoryBytes());
+        return copy;
+    };
+
+    struct Edge
+    {
+        uint8_t lo;
+        uint8_t hi;
+        uint32_t target;
+    };
+    // 区间按 (目标, 下界) 排序后合并同一目标上重叠或相邻的区间，再按 (下界, 目标) 排序
+    auto normalize = [](std::vector<Edge> &list)
+    {
+        std::sort(list.begin(), list.end(), [](const Edge &x, const Edge &y)
+                  { return x.target != y.target ? x.target < y.target : x.lo < y.lo; });
+        size_t kept = 0;
+        for (const Edge &e : list)
+        {
+            if (kept > 0 && list[kept - 1].target == e.target && list[kept - 1].hi + 1 >= e.lo)
+            {
+                list[kept - 1].hi = std::max(list[kept - 1].hi, e.hi);
+            }
+            else
+            {
+                list[kept++] = e;
+            }
+        }
+        list.resize(kept);
+        std::sort(list.begin(), list.end(), [](const Edge &x, const Edge &y)
+                  { return x.lo != y.lo ? x.lo < y.lo : x.target < y.target; });
+    };
+
+    // 1. 从开始状态出发，只访问保留下来的状态
+    std::vector<uint32_t> index(n, NONE); // 原状态 -> 保留状态的编号
+    std::vector<uint32_t> kept;
+    std::vector<std::vector<Edge>> edges;
+    std::vector<int> pattern; // 接受的模式编号，-1 表示不接受
+    std::vector<uint32_t> stamp(n, NONE);
+    std::vector<uint32_t> stack;
+    index[nfa.start] = 0;
+    kept.push_back(nfa.start);
+
+    // 预算：消除ε转换后边数最多是原来的平方级，每处理一批状态按已经产生的边更新一次
+    MemoryCharge working(vectorBytes(index) + vectorBytes(stamp));
+    size_t edgeBytes = 0;
+    size_t edgeCount = 0;
+    for (uint32_t k = 0; k < kept.size(); ++k)
+    {
+        if (k % 256 == 0 && compileBudget != nullptr)
+        {
+            working.update(vectorBytes(index) + vectorBytes(stamp) + vectorBytes(kept) + vectorBytes(edges) + edgeBytes);
+            compileBudget->check();
+        }
+        std::vector<Edge> out;
+        int accepted = -1;
+        stack.push_back(kept[k]);
+        stamp[kept[k]] = k;
+        while (!stack.empty())
+        {
+            uint32_t current = stack.back();
+            stack.pop_back();
+            const State &state = nfa.states[current];
+            if (state.isFinal)
+            {
+                if (accepted >= 0 && accepted != state.pattern)
+                {
+                    trace<TraceLevel::Info>([&](std::ostream &log)
+                                            { log << "optimizeNFA: patterns " << accepted << " and " << state.pattern << " accept at the same state, NFA left as is"; });
+                    return unchanged();
+                }
+                accepted = state.pattern;
+            }
+            for (const Transition *t = nfa.edgesBegin(current); t != nfa.edgesEnd(current); ++t)
+            {
+                if (t->epsilon)
+                {
+                    if (stamp[t->target] != k)
+                    {
+                        stamp[t->target] = k;
+                        stack.push_back(t->target);
+                    }
+                    continue;
+                }
+                if (index[t->target] == NONE)
+                {
+                    index[t->target] = static_cast<uint32_t>(kept.size());
+                    kept.push_back(t->target);
+                }
+                out.push_back(Edge{t->lo, t->hi, index[t->target]});
+            }
+        }
+        normalize(out);
+        edgeCount += out.size();
+        if (edgeCount > maxEdges)
+        {
+            trace<TraceLevel::Info>([&](std::ostream &log)
+                                    { log << "optimizeNFA: removing epsilon transitions needs more than " << maxEdges << " edges, NFA left as is"; });
+            return unchanged();
+        }
+        edgeBytes += vectorBytes(out);
+        edges.push_back(std::move(out));
+        pattern.push_back(accepted);
+    }
+    const uint32_t m = static_cast<uint32_t>(kept.size());
+
+    // 2. 反向可达：能走到接受状态的才是活状态
+    std::vector<std::vector<uint32_t>> reverse(m);
+    std::vector<char> live(m, 0);
+    for (uint32_t k = 0; k < m; ++k)
+    {
+        for (const Edge &e : edges[k])
+        {
+            reverse[e.target].push_back(k);
+        }
+        if (pattern[k] >= 0)
+        {
+            live[k] = 1;
+            stack.push_back(k);
+        }
+    }
+    while (!stack.empty())
+    {
+        uint32_t current = stack.back();
+        stack.pop_back();
+        for (uint32_t from : reverse[current])
+        {
+            if (!live[from])
+            {
+                live[from] = 1;
+                stack.push_back(from);
+            }
+        }
+    }
+    for (std::vector<Edge> &out : edges)
+    {
+        out.erase(std::remove_if(out.begin(), out.end(), [&](const Edge &e)
+                                 { return !live[e.target]; }),
+                  out.end());
+    }
+
+    // 3. 按强连通分量的逆拓扑序（Tarjan 算法完成分量的顺序）给状态分块。不在环上的状态完成时，
+    //    它的后继都已经有了最终的块，(接受的模式, 转换目标所在的块) 相同的状态直接合成一块，一遍就是精确的。
+    //    环上的状态之间只在同一个分量里合并：分量不大时在分量内部反复细分到稳定，大分量每个状态单独一块；
+    //    分量完成之后，不在环上的状态仍然可以并进环上状态的块。
+    //    整个阶段是线性的（小分量的细分每个分量最多 SMALL_COMPONENT 轮）
+    const uint32_t SMALL_COMPONENT = 64;
+    const uint32_t INTERNAL = 0x80000000u; // 细分时指向同一分量内状态的目标，低位是分量内的块号
+    struct SignatureHash
+    {
+        size_t operator()(const std::vector<uint32_t> &signature) const
+        {
+            return static_cast<size_t>(StateSetMap::hashSet(signature.data(), signature.size()));
+        }
+    };
+    std::vector<uint32_t> block(m, NONE);
+    uint32_t blockCount = 0;
+    std::unordered_map<std::vector<uint32_t>, uint32_t, SignatureHash> signatures;
+    std::vector<uint32_t> signature;
+    std::vector<Edge> mapped;
+    // 状态 k 的签名。local 非空时 k 所在的分量还没有完成，指向分量内状态的转换用 local 里的块号
+    auto makeSignature = [&](uint32_t k, const std::vector<uint32_t> *local)
+    {
+        signature.assign(1, static_cast<uint32_t>(pattern[k] + 1));
+        mapped.clear();
+        for (const Edge &e : edges[k])
+        {
+            const uint32_t target = block[e.target] != NONE ? block[e.target] : (INTERNAL | (*local)[e.target]);
+            mapped.push_back(Edge{e.lo, e.hi, target});
+        }
+        normalize(mapped);
+        for (const Edge &e : mapped)
+        {
+            signature.push_back(static_cast<uint32_t>(e.lo) << 8 | e.hi);
+            signature.push_back(e.target);
+        }
+    };
+
+    std::vector<uint32_t> order(m, NONE); // Tarjan 的访问序号
+    std::vector<uint32_t> low(m, NONE);
+    std::vector<uint32_t> component;      // 还没有完成分量的状态
+    std::vector<std::pair<uint32_t, uint32_t>> frames; // (状态, 下一条要看的转换)
+    std::vector<uint32_t> local(m, NONE);
+    std::vector<uint32_t> members;
+    std::unordered_map<std::vector<uint32_t>, uint32_t, SignatureHash> localSignatures;
+    uint32_t visited = 0;
+    uint32_t finished = 0;
+    order[0] = low[0] = visited++;
+    component.push_back(0);
+    frames.emplace_back(0, 0);
+    while (!frames.empty())
+    {
+        const uint32_t v = frames.back().first;
+        if (frames.back().second < edges[v].size())
+        {
+            const uint32_t w = edges[v][frames.back().second++].target;
+            if (order[w] == NONE)
+            {
+                order[w] = low[w] = visited++;
+                component.push_back(w);
+                frames.emplace_back(w, 0);
+            }
+            else if (block[w] == NONE) // 还在栈上
+            {
+                low[v] = std::min(low[v], order[w]);
+            }
+            continue;
+        }
+        frames.pop_back();
+        if (!frames.empty())
+        {
+            low[frames.back().first] = std::min(low[frames.back().first], low[v]);
+        }
+        if (low[v] != order[v])
+        {
+            continue;
+        }
+
+        members.clear();
+        do
+        {
+            members.push_back(component.back());
+            component.pop_back();
+        } while (members.back() != v);
+        if ((finished += static_cast<uint32_t>(members.size())) >= 1024)
+        {
+            finished = 0;
+            checkCompileBudget();
+        }
+        const bool cyclic = members.size() > 1 || std::any_of(edges[v].begin(), edges[v].end(), [&](const Edge &e)
+                                                              { return e.target == v; });
+        if (!cyclic)
+        {
+            makeSignature(v, nullptr);
+            auto inserted = signatures.emplace(signature, blockCount);
+            blockCount += inserted.second;
+            block[v] = inserted.first->second;
+            continue;
+        }
+        if (members.size() > SMALL_COMPONENT)
+        {
+            for (uint32_t k : members)
+            {
+                block[k] = blockCount++;
+            }
+        }
+        else
+        {
+            // 分量内部：先按接受的模式分块，再用 (块, 转换目标所在的块) 反复细分，直到块数不再增加
+            for (uint32_t k : members)
+            {
+                local[k] = static_cast<uint32_t>(pattern[k] + 1);
+            }
+            for (size_t localCount = 0;;)
+            {
+                localSignatures.clear();
+                std::vector<uint32_t> refined;
+                for (uint32_t k : members)
+                {
+                    makeSignature(k, &local);
+                    signature.push_back(local[k]);
+                    refined.push_back(localSignatures.emplace(signature, static_cast<uint32_t>(localSignatures.size())).first->second);
+                }
+                for (size_t i = 0; i < members.size(); ++i)
+                {
+                    local[members[i]] = refined[i];
+                }
+                if (localSignatures.size() == localCount)
+                {
+                    break;
+                }
+                localCount = localSignatures.size();
+            }
+            const uint32_t first = blockCount;
+            for (uint32_t k : members)
+            {
+                block[k] = first + local[k];
+                blockCount = std::max(blockCount, block[k] + 1);
+            }
+        }
+        // 分量的签名也登记下来，之后完成的不在环上的状态可以和环上的状态合并（例如 (a|b)*abb 的开始状态）
+        for (uint32_t k : members)
+        {
+            makeSignature(k, nullptr);
+            signatures.emplace(signature, block[k]);
+        }
+    }
+
+    // 块按第一次出现的顺序重新编号，开始状态所在的块是0
+    std::vector<uint32_t> renumbered(blockCount, NONE);
+    blockCount = 0;
+    for (uint32_t k = 0; k < m; ++k)
+    {
+        if (block[k] != NONE)
+        {
+            if (renumbered[block[k]] == NONE)
+            {
+                renumbered[block[k]] = blockCount++;
+            }
+            block[k] = renumbered[block[k]];
+        }
+    }
+    NFA result;
+    result.patternPriority = nfa.patternPriority;
+    result.start = 0;
+    std::vector<uint32_t> representative(blockCount, NONE);
+    for (uint32_t k = 0; k < m; ++k)
+    {
+        if (block[k] != NONE && representative[block[k]] == NONE)
+        {
+            representative[block[k]] = k;
+        }
+    }
+    bool acceptSet = false;
+    for (uint32_t b = 0; b < blockCount; ++b)
+    {
+        uint32_t k = representative[b];
+        State state(pattern[k] >= 0);
+        state.pattern = pattern[k];
+        state.firstEdge = static_cast<uint32_t>(result.edges.size());
+        mapped.clear();
+        for (const Edge &e : edges[k])
+        {
+            mapped.push_back(Edge{e.lo, e.hi, block[e.target]});
+        }
+        normalize(mapped);
+        for (const Edge &e : mapped)
+        {
+            result.edges.emplace_back(e.lo, e.hi, e.target);
+        }
+        state.edgeCount = static_cast<uint32_t>(mapped.size());
+        result.states.push_back(state);
+        if (state.isFinal && (!acceptSet || (state.pattern == 0 && result.states[result.accept].pattern != 0)))
+        {
+            result.accept = b;
+            acceptSet = true;
+        }
+    }
+
+    compileStats.optimizedStates += result.size();
+    compileStats.optimizedEdges += result.edges.size();
+    chargeCompileMemory(result.memoryBytes());
+    trace<TraceLevel::Info>([&](std::ostream &log)
+                            { log << "optimizeNFA: " << n << " states / " << nfa.edges.size() << " edges -> "
+                                  << result.size() << " states / " << result.edges.size() << " edges"; });
+    return result;
+}
+
+// 模式集合的字面量：任何一个模式的匹配都以这些前缀之一开始；必需因子对模式集合没有意义，不合并
+LiteralInfo patternSetLiterals(const std::vector<LiteralInfo> &patterns)
+{
+    LiteralInfo literals;
+    literals.prefixesKnown = true;
+    for (const LiteralInfo &info : patterns)
+    {
+        literals.prefixesKnown = literals.prefixesKnown && info.prefixesKnown;
+        literals.prefixes.insert(literals.prefixes.end(), info.prefixes.begin(), info.prefixes.end());
+    }
+    literals.prefixesKnown = literals.prefixesKnown && normalizeLiterals(literals.prefixes);
+    if (!literals.prefixesKnown)
+    {
+        literals.prefixes.clear();
+    }
+    return literals;
+}
+
+// 作用域内把本线程的 compileStats 换成 target，各阶段的计数直接累加进 target
+class StatsScope
+{
+public:
+    explicit StatsScope(CompileStats &_target) : target(_target), saved(compileStats) { compileStats = target; }
+    ~StatsScope()
+    {
+        target = compileStats;
+        compileStats = saved;
+    }
+
+private:
+    CompileStats &target;
+    CompileStats saved;
+};
+
+// 作用域内的编译使用一个按 limits 建立的预算，结束时把内存峰值记到 stats。
+// 外层已经有预算时（例如 compile() 中调用的各个阶段）沿用外层的预算，什么都不做
+class BudgetScope
+{
+public:
+    BudgetScope(const CompileLimits &limits, CompileStats &_stats) : stats(_stats)
+    {
+        if (compileBudget == nullptr)
+        {
+            owned.emplace(limits);
+            compileBudget = &*owned;
+        }
+    }
+    ~BudgetScope()
+    {
+        if (owned)
+        {
+            compileBudget = nullptr;
+            stats.peakCompileBytes = std::max<uint64_t>(stats.peakCompileBytes, owned->peakBytes());
+        }
+    }
+    BudgetScope(const BudgetScope &) = delete;
+    BudgetScope &operator=(const BudgetScope &) = delete;
+
+private:
+    CompileStats &stats;
+    std::optional<CompileBudget> owned;
+};
+
+// 编译流水线。每一步的结果都是独立拥有、可移动的值，没有全局状态：
+//   RegexCompiler compiler;
+//   NFA nfa = compiler.parse(regex);            // 解析和 Thompson 构造
+//   NFA simple = compiler.optimize(nfa);        // 可选：消除ε转换、合并等价状态
+//   DFA dfa = compiler.determinize(simple);     // 子集构造
+//   MinimizedDFA minimal = compiler.minimize(dfa);
+//   CompiledDFA table(minimal);
+// compile() 一次完成全部步骤并附加字面量分析。一个 RegexCompiler 同一时间只在一个线程里使用，
+// 各线程用各自的对象就可以同时编译；stats() 是这个对象做过的所有编译的累计统计。
+// Options::limits 限制每次调用（compile() 是整个流水线，单独调用时是那一步）的DFA状态数、内存和耗时，
+// 超过时抛出 CompileLimitError，已经分配的数据结构随异常释放，编译器可以继续使用
+class RegexCompiler
+{
+public:
+    struct Options
+    {
+        unsigned threads = 1;    // 子集构造的线程数，大于1时用并行构造，结果相同
+        bool optimizeNFA = true; // compile() 在子集构造之前先化简NFA
+        CompileLimits limits;    // 默认不限制
+    };
+
+    RegexCompiler() = default;
+    explicit RegexCompiler(Options _options) : options(_options) {}
+
+    NFA parse(const std::string &regex)
+    {
+        BudgetScope budget(options.limits, statistics); // 在 StatsScope 之外，峰值写进 statistics 时不会被覆盖
+        StatsScope scope(statistics);
+        return generateThompsonNFAFromPostfix(infixToPostfix(regex));
+    }
+
+    // 多个模式：每个模式的NFA挂在同一个开始状态下，接受状态记录模式编号
+    NFA parse(const std::vector<PatternSpec> &patterns)
+    {
+        BudgetScope budget(options.limits, statistics);
+        StatsScope scope(statistics);
+        return generateNFAForPatterns(patterns);
+    }
+
+    NFA optimize(const NFA &nfa)
+    {
+        BudgetScope budget(options.limits, statistics);
+        StatsScope scope(statistics);
+        return optimizeNFA(nfa);
+    }
+
+    DFA determinize(const NFA &nfa)
+    {
+        BudgetScope budget(options.limits, statistics);
+        StatsScope scope(statistics);
+        if (options.threads > 1)
+        {
+            return constructDFAFromNFAParallel(nfa, collectStatesFromNFA(nfa), options.threads);
+        }
+        return constructDFAFromNFA(nfa, collectStatesFromNFA(nfa));
+    }
+
+    MinimizedDFA minimize(const DFA &dfa)
+    {
+        BudgetScope budget(options.limits, statistics);
+        StatsScope scope(statistics);
+        return minimizeDFA(dfa);
+    }
+
+    // 单个正则表达式编译成最小化的表驱动DFA
+    CompiledDFA compile(const std::string &regex)
+    {
+        BudgetScope budget(options.limits, statistics);
+        CompiledDFA dfa(finish(parse(regex)));
+        dfa.attachLiterals(regexLiterals(regex));
+        return dfa;
+    }
+
+    // 多模式编译：所有模式只做一次确定化和最小化
+    CompiledDFA compile(const std::vector<PatternSpec> &patterns)
+    {
+        BudgetScope budget(options.limits, statistics);
+        CompiledDFA dfa(finish(parse(patterns)));
+        std::vector<LiteralInfo> literals;
+        for (const PatternSpec &pattern : patterns)
+        {
+            literals.push_back(regexLiterals(pattern.regex));
+        }
+        dfa.attachLiterals(patternSetLiterals(literals));
+        return dfa;
+    }
+
+    const CompileStats &stats() const { return statistics; }
+
+private:
+    // parse 之后的各步。每一步的输入用完就释放，同时从预算中退还
+    MinimizedDFA finish(NFA nfa)
+    {
+        if (options.optimizeNFA)
+        {
+            NFA simple = optimize(nfa);
+            releaseCompileMemory(nfa.memoryBytes());
+            nfa = std::move(simple);
+        }
+        DFA dfa = determinize(nfa);
+        releaseCompileMemory(nfa.memoryBytes());
+        nfa = NFA();
+        MinimizedDFA minimal = minimize(dfa);
+        releaseCompileMemory(dfa.memoryBytes());
+        return minimal;
+    }
+
+    Options options;
+    CompileStats statistics;
+};
+
+// 规则很多时确定化是主要开销，threads 大于1时用并行子集构造，结果与单线程相同
+CompiledDFA compilePatternSet(const std::vector<PatternSpec> &patterns, unsigned threads = 1)
+{
+    RegexCompiler::Options options;
+    options.threads = threads;
+    return RegexCompiler(options).compile(patterns);
+}
+
+CompiledDFA compileRegex(const std::string &regex)
+{
+    return RegexCompiler().compile(regex);
+}
+
+// 并发编译一组正则表达式（例如重新加载配置时的全部规则），结果与 regexes 一一对应。
+// 每个线程用自己的 RegexCompiler；有语法错误时抛出下标最小的那个错误
+std::vector<CompiledDFA> compileRegexes(const std::vector<std::string> &regexes, ThreadPool &pool)
+{
+    std::vector<std::optional<CompiledDFA>> compiled(regexes.size());
+    std::vector<std::exception_ptr> errors(regexes.size());
+    pool.parallelFor(regexes.size(), 16, [&](size_t begin, size_t end)
+                     {
+                         RegexCompiler compiler;
+                         for (size_t i = begin; i < end; ++i)
+                         {
+                             try
+                             {
+                                 compiled[i] = compiler.compile(regexes[i]);
+                             }
+                             catch (...)
+                             {
+                                 errors[i] = std::current_exception(); // 异常不能离开工作线程
+                             }
+                         } });
+    for (const std::exception_ptr &error : errors)
+    {
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+    }
+    std::vector<CompiledDFA> results;
+    results.reserve(compiled.size());
+    for (std::optional<CompiledDFA> &dfa : compiled)
+    {
+        results.push_back(std::move(*dfa));
+    }
+    return results;
+}
+
+// 两个DFA的积：状态是 (a 的状态, b 的状态) 对，一边缺失的转移当作那一边停在陷阱状态，两边都缺失时没有转移。
+// 接受两边各自接受的所有模式，按 priorities（以模式编号为下标）重新排序。只构造从 (a.start, b.start) 可达的状态对。
+// 两边的模式编号不相交且各自是最小DFA时，积也是最小的：等价的状态对要求两边分别等价
+DFA productDFA(const DFA &a, const DFA &b, const std::vector<int> &priorities)
+{
+    PhaseTimer timer(compileStats.subsetSeconds);
+    DFA dfa;
+    dfa.byteClasses = ByteClasses(a.byteClasses, b.byteClasses);
+    const int classCount = dfa.byteClasses.size();
+
+    typedef std::pair<const DFAState *, const DFAState *> Pair;
+    std::unordered_map<uint64_t, DFAState *> index; // 键是两边的状态编号加一，缺失的一边为0
+    std::vector<Pair> pairs;
+    auto getOrCreate = [&](Pair pair)
+    {
+        const uint64_t key = (static_cast<uint64_t>(pair.first != nullptr ? pair.first->id + 1 : 0) << 32) |
+                             static_cast<uint64_t>(pair.second != nullptr ? pair.second->id + 1 : 0);
+        auto found = index.find(key);
+        if (found != index.end())
+        {
+            ++compileStats.dfaStatesFound;
+            return found->second;
+        }
+        auto state = std::make_unique<DFAState>(static_cast<int>(dfa.size()));
+        for (const DFAState *side : {pair.first, pair.second})
+        {
+            if (side != nullptr)
+            {
+                state->acceptTags.insert(state->acceptTags.end(), side->acceptTags.begin(), side->acceptTags.end());
+            }
+        }
+        std::sort(state->acceptTags.begin(), state->acceptTags.end(), [&](int x, int y)
+                  { return priorities[x] != priorities[y] ? priorities[x] > priorities[y] : x < y; });
+        state->acceptTags.erase(std::unique(state->acceptTags.begin(), state->acceptTags.end()), state->acceptTags.end());
+        state->isFinal = !state->acceptTags.empty();
+        ++compileStats.dfaStatesCreated;
+        pairs.push_back(pair);
+        return index[key] = dfa.add(std::move(state));
+    };
+    auto step = [](const DFA &side, const DFAState *state, unsigned char byte) -> const DFAState *
+    {
+        if (state == nullptr)
+        {
+            return nullptr;
+        }
+        auto found = state->transitions.find(side.byteClasses[byte]);
+        return found == state->transitions.end() ? nullptr : found->second;
+    };
+
+    dfa.start = getOrCreate(Pair(a.start, b.start));
+    for (size_t i = 0; i < pairs.size(); ++i)
+    {
+        const Pair pair = pairs[i];
+        for (int c = 0; c < classCount; ++c)
+        {
+            unsigned char byte = dfa.byteClasses.first(c);
+            Pair next(step(a, pair.first, byte), step(b, pair.second, byte));
+            if (next.first != nullptr || next.second != nullptr)
+            {
+                dfa.states[i]->transitions[c] = getOrCreate(next);
+            }
+        }
+    }
+    compileStats.byteClasses = static_cast<uint64_t>(classCount);
+    return dfa;
+}
+
+// 可以逐个增删模式的多模式自动机，规则只改几条时不必重新编译全部。
+// 每个模式单独编译成最小DFA，作为一棵完全二叉树的叶子；内部结点是两个孩子的积（productDFA），根就是整个集合的DFA。
+// 各模式的编号互不相同，所以积不需要再最小化，根与从头编译剩下的模式得到的最小DFA相同（只是模式编号不同）。
+// 增删模式只替换对应的叶子，再沿着到根的路径重新计算积，其余子树原样共享：
+// 一次修改是 O(log n) 次积，不再对全部模式做子集构造和最小化。
+// 模式编号是 add() 的返回值，删除后不再使用。修改在写者一侧串行执行，完成后整体换上新的快照：
+// 读者用 snapshot() 取得当前快照，修改期间继续用旧的快照匹配，只在复制 shared_ptr 时短暂持锁
+class PatternSet
+{
+public:
+    struct Snapshot
+    {
+        CompiledDFA dfa;                    // acceptingPattern() 返回模式编号
+        std::map<int, PatternSpec> patterns; // 这个版本中的模式，以编号为键
+        uint64_t version;
+    };
+
+    PatternSet() { publish(); }
+
+    int add(const PatternSpec &pattern)
+    {
+        std::vector<int> ids;
+        update({pattern}, {}, &ids);
+        return ids[0];
+    }
+
+    void remove(int id) { update({}, {id}); }
+
+    // 一次删除和增加若干模式，只生成一个新版本；ids 返回新模式的编号。
+    // 新模式有语法错误时抛出 RegexSyntaxError，当前版本不变；删除不存在的编号没有效果
+    void update(const std::vector<PatternSpec> &added, const std::vector<int> &removed, std::vector<int> *ids = nullptr)
+    {
+        std::lock_guard<std::mutex> lock(editMutex);
+
+        // 新模式先各自编译（出错时什么都没有改），接受标记换成分配的编号
+        RegexCompiler compiler;
+        std::vector<std::shared_ptr<const DFA>> compiled;
+        std::vector<LiteralInfo> literals;
+        for (size_t i = 0; i < added.size(); ++i)
+        {
+            DFA dfa = compiler.minimize(compiler.determinize(compiler.optimize(compiler.parse(std::vector<PatternSpec>{added[i]}))));
+            for (const auto &state : dfa.states)
+            {
+                for (int &tag : state->acceptTags)
+                {
+                    tag = static_cast<int>(priorities.size() + i);
+                }
+            }
+            compiled.push_back(std::make_shared<const DFA>(std::move(dfa)));
+            literals.push_back(regexLiterals(added[i].regex));
+        }
+
+        std::vector<size_t> touched; // 换过的叶子
+        for (int id : removed)
+        {
+            auto found = live.find(id);
+            if (found != live.end())
+            {
+                tree[capacity + found->second.leaf].reset();
+                freeLeaves.push_back(found->second.leaf);
+                touched.push_back(found->second.leaf);
+                live.erase(found);
+            }
+        }
+        for (size_t i = 0; i < added.size(); ++i)
+        {
+            const int id = static_cast<int>(priorities.size());
+            priorities.push_back(added[i].priority);
+            const size_t leaf = allocateLeaf();
+            tree[capacity + leaf] = compiled[i];
+            live[id] = Entry{added[i], literals[i], leaf};
+            touched.push_back(leaf);
+            if (ids != nullptr)
+            {
+                ids->push_back(id);
+            }
+        }
+        if (touched.empty())
+        {
+            return;
+        }
+
+        // 自底向上重新计算受影响的内部结点：孩子的下标总是比父结点大，按下标从大到小处理
+        statistics = compiler.stats();
+        StatsScope scope(statistics);
+        std::set<size_t> dirty;
+        for (size_t leaf : touched)
+        {
+            if (capacity + leaf > 1)
+            {
+                dirty.insert((capacity + leaf) / 2);
+            }
+        }
+        while (!dirty.empty())
+        {
+            const size_t node = *dirty.rbegin();
+            dirty.erase(node);
+            const std::shared_ptr<const DFA> &left = tree[2 * node];
+            const std::shared_ptr<const DFA> &right = tree[2 * node + 1];
+            if (left == nullptr || right == nullptr)
+            {
+                tree[node] = left != nullptr ? left : right;
+            }
+            else
+            {
+                tree[node] = std::make_shared<const DFA>(productDFA(*left, *right, priorities));
+            }
+            if (node > 1)
+            {
+                dirty.insert(node / 2);
+            }
+        }
+        publish();
+    }
+
+    std::shared_ptr<const Snapshot> snapshot() const
+    {
+        std::lock_guard<std::mutex> lock(publishMutex);
+        return published;
+    }
+
+    // 最近一次修改的编译统计
+    CompileStats stats() const
+    {
+        std::lock_guard<std::mutex> lock(editMutex);
+        return statistics;
+    }
+
+private:
+    struct Entry
+    {
+        PatternSpec spec;
+        LiteralInfo literals;
+        size_t leaf;
+    };
+
+    mutable std::mutex editMutex; // 串行化修改，保护下面的写者状态
+    // 堆式编号的完全二叉树：结点 i 的孩子是 2i 和 2i+1，叶子 j 是结点 capacity + j；空指针表示空的子树
+    std::vector<std::shared_ptr<const DFA>> tree;
+    size_t capacity = 0;            // 叶子的个数，总是2的幂
+    size_t leafCount = 0;           // 用过的叶子
+    std::vector<size_t> freeLeaves; // 删除模式后空出来的叶子
+    std::vector<int> priorities;    // 以模式编号为下标，包括已经删除的
+    std::map<int, Entry> live;
+    CompileStats statistics;
+    uint64_t version = 0;
+
+    mutable std::mutex publishMutex; // 只保护 published 的读写
+    std::shared_ptr<const Snapshot> published;
+
+    size_t allocateLeaf()
+    {
+        if (!freeLeaves.empty())
+        {
+            size_t leaf = freeLeaves.back();
+            freeLeaves.pop_back();
+            return leaf;
+        }
+        if (leafCount == capacity)
+        {
+            grow();
+        }
+        return leafCount++;
+    }
+
+    // 叶子数翻倍：原来的树整体成为新根的左子树，右子树为空，已有的积都不用重新计算。
+    // 深度为 d 的结点 i 下移一层后编号是 i + 2^d
+    void grow()
+    {
+        const size_t grownCapacity = capacity == 0 ? 1 : 2 * capacity;
+        std::vector<std::shared_ptr<const DFA>> grown(2 * grownCapacity);
+        size_t level = 1;
+        for (size_t node = 1; node < tree.size(); ++node)
+        {
+            if (node == 2 * level)
+            {
+                level = node;
+            }
+            grown[node + level] = std::move(tree[node]);
+        }
+        if (capacity > 0)
+        {
+            grown[1] = grown[2];
+        }
+        tree = std::move(grown);
+        capacity = grownCapacity;
+    }
+
+    // 由树根编译新的快照并换上；调用者持有 editMutex（构造时除外）
+    void publish()
+    {
+        DFA empty;
+        const DFA *root = tree.empty() ? nullptr : tree[1].get();
+        if (root == nullptr)
+        {
+            // 空的模式集合：只有一个不接受的开始状态
+            empty.start = empty.add(std::make_unique<DFAState>(0));
+            root = &empty;
+        }
+        std::map<int, PatternSpec> patterns;
+        std::vector<LiteralInfo> literals;
+        for (const auto &[id, entry] : live)
+        {
+            patterns[id] = entry.spec;
+            literals.push_back(entry.literals);
+        }
+        CompiledDFA dfa(*root);
+        dfa.attachLiterals(patternSetLiterals(literals));
+        auto snapshot = std::make_shared<const Snapshot>(Snapshot{std::move(dfa), std::move(patterns), ++version});
+        std::lock_guard<std::mutex> lock(publishMutex);
+        published = std::move(snapshot);
+    }
+};
+#if defined(__cpp_nontype_template_args) && __cpp_nontype_template_args >= 201911L
+
+// 编译期正则表达式编译（需要 C++20）：
+//   static constexpr auto re = compileRegex<"a|(b|c)d*">();
+// 解析、Thompson 构造、子集构造和最小化都在编译期完成，结果 StaticDFA 是大小固定的转移表，
+// 运行时没有启动开销也不分配内存，语法错误在编译时报告。语法和匹配语义与运行时的 compileRegex 相同。
+// 各阶段只用固定容量的数组：语法树和字符类区间的容量由模式长度决定，NFA 先数出大小再构造，
+// 子集构造的DFA状态数上限由模板参数 MaxStates 指定，超过时编译失败。
+// 状态集合的查找是线性的，适合常见的短模式；很大的模式仍应在运行时编译
+
+// 作为模板参数的字符串字面量
+template <size_t N>
+struct FixedString
+{
+    char text[N] = {};
+
+    constexpr FixedString(const char (&literal)[N])
+    {
+        for (size_t i = 0; i < N; ++i)
+        {
+            text[i] = literal[i];
+        }
+    }
+
+    constexpr std::string_view view() const { return std::string_view(text, N - 1); }
+};
+
+template <typename T, size_t Capacity>
+struct FixedVector
+{
+    T items[Capacity > 0 ? Capacity : 1] = {};
+    size_t count = 0;
+
+    constexpr void push_back(const T &value)
+    {
+        if (count == Capacity)
+        {
+            throw std::length_error("FixedVector 的容量不足");
+        }
+        items[count++] = value;
+    }
+
+    constexpr size_t size() const { return count; }
+    constexpr T &operator[](size_t i) { return items[i]; }
+    constexpr const T &operator[](size_t i) const { return items[i]; }
+};
+
+struct StaticCodePointRange
+{
+    uint32_t lo = 0;
+    uint32_t hi = 0;
+};
+
+// 语法树结点，和 RegexNode 的含义相同；子结点用 firstChild/nextSibling 链起来，字符类的区间放在公共的数组里
+struct StaticRegexNode
+{
+    RegexNode::Kind kind = RegexNode::Empty;
+    uint32_t cp = 0;
+    bool isByte = false;
+    uint32_t rangeBegin = 0; // Class：区间为 ranges[rangeBegin, rangeEnd)
+    uint32_t rangeEnd = 0;
+    int min = 0;
+    int max = 0;
+    int firstChild = -1;
+    int nextSibling = -1;
+};
+
+// 每个字符最多产生一个原子或一个重复结点，串联和选择结点不超过括号数加 | 的个数；
+// 每个字符最多贡献4个区间（\w），取补集时临时多用同样多的空间
+template <size_t Length>
+struct StaticRegexTree
+{
+    FixedVector<StaticRegexNode, 3 * Length + 3> nodes;
+    FixedVector<StaticCodePointRange, 10 * Length + 10> ranges;
+    int root = -1;
+};
+
+// 和 RegexParser 相同的递归下降分析，错误同样抛出 RegexSyntaxError（在编译期表现为编译错误）
+template <size_t Length>
+class StaticRegexParser
+{
+public:
+    static constexpr StaticRegexTree<Length> parse(std::string_view regex)
+    {
+        StaticRegexParser parser(regex);
+        parser.tree.root = parser.parseAlternation();
+        if (parser.pos < regex.size())
+        {
+            throw RegexSyntaxError("多余的 ')'", parser.pos);
+        }
+        return parser.tree;
+    }
+
+private:
+    StaticRegexTree<Length> tree;
+    std::string_view regex;
+    size_t pos = 0;
+    int depth = 0;
+    bool bytes = false; // 在 (?-u:...) 中
+
+    constexpr explicit StaticRegexParser(std::string_view _regex) : regex(_regex) {}
+
+    constexpr bool at(char c) const { return pos < regex.size() && regex[pos] == c; }
+
+    constexpr int addNode(const StaticRegexNode &node)
+    {
+        tree.nodes.push_back(node);
+        return static_cast<int>(tree.nodes.size()) - 1;
+    }
+
+    // 只有一个子结点时不建立父结点，直接返回子结点
+    constexpr int addParent(RegexNode::Kind kind, int first, int count)
+    {
+        if (count == 1)
+        {
+            return first;
+        }
+        StaticRegexNode node;
+        node.kind = kind;
+        node.firstChild = first;
+        return addNode(node);
+    }
+
+    constexpr int parseAlternation()
+    {
+        int first = parseConcat(), last = first, count = 1;
+        while (at('|'))
+        {
+            ++pos;
+            int child = parseConcat();
+            tree.nodes[last].nextSibling = child;
+            last = child;
+            ++count;
+        }
+        return addParent(RegexNode::Alternate, first, count);
+    }
+
+    constexpr int parseConcat()
+    {
+        int first = -1, last = -1, count = 0;
+        while (pos < regex.size() && !at('|') && !at(')'))
+        {
+            int child = parseRepeat();
+            if (last >= 0)
+            {
+                tree.nodes[last].nextSibling = child;
+            }
+            first = first < 0 ? child : first;
+            last = child;
+            ++count;
+        }
+        return count == 0 ? addNode(StaticRegexNode()) : addParent(RegexNode::Concat, first, count);
+    }
+
+    constexpr int parseRepeat()
+    {
+        int node = parseAtom();
+        for (;;)
+        {
+            int min = 0, max = RegexNode::UNBOUNDED;
+            if (at('*') || at('+') || at('?'))
+            {
+                min = at('+') ? 1 : 0;
+                max = at('?') ? 1 : RegexNode::UNBOUNDED;
+                ++pos;
+            }
+            else if (!parseCount(min, max))
+            {
+                return node;
+            }
+            StaticRegexNode repeat;
+            repeat.kind = RegexNode::Repeat;
+            repeat.min = min;
+            repeat.max = max;
+            repeat.firstChild = node;
+            node = addNode(repeat);
+        }
+    }
+
+    constexpr bool parseCount(int &min, int &max)
+    {
+        if (!at('{'))
+        {
+            return false;
+        }
+        size_t p = pos + 1;
+        auto number = [&](int &value)
+        {
+            size_t begin = p;
+            value = 0;
+            while (p < regex.size() && regex[p] >= '0' && regex[p] <= '9')
+            {
+                value = std::min(value * 10 + (regex[p++] - '0'), RegexParser::MAX_REPEAT + 1);
+            }
+            return p > begin;
+        };
+        if (!number(min))
+        {
+            return false;
+        }
+        max = min;
+        if (p < regex.size() && regex[p] == ',')
+        {
+            ++p;
+            if (!number(max))
+            {
+                max = RegexNode::UNBOUNDED;
+            }
+        }
+        if (p >= regex.size() || regex[p] != '}')
+        {
+            return false;
+        }
+        if (min > RegexParser::MAX_REPEAT || max > RegexParser::MAX_REPEAT)
+        {
+            throw RegexSyntaxError("重复次数超过 1000", pos);
+        }
+        if (max != RegexNode::UNBOUNDED && max < min)
+        {
+            throw RegexSyntaxError("重复次数的上限小于下限", pos);
+        }
+        pos = p + 1;
+        return true;
+    }
+
+    constexpr void addRange(uint32_t lo, uint32_t hi)
+    {
+        tree.ranges.push_back(StaticCodePointRange{lo, hi});
+    }
+
+    // ranges[begin, end) 排序并合并重叠或相邻的区间
+    constexpr void normalizeRanges(size_t begin)
+    {
+        auto &ranges = tree.ranges;
+        for (size_t i = begin + 1; i < ranges.size(); ++i)
+        {
+            for (size_t j = i; j > begin && ranges[j].lo < ranges[j - 1].lo; --j)
+            {
+                StaticCodePointRange swapped = ranges[j];
+                ranges[j] = ranges[j - 1];
+                ranges[j - 1] = swapped;
+            }
+        }
+        size_t merged = begin;
+        for (size_t i = begin; i < ranges.size(); ++i)
+        {
+            if (merged > begin && ranges[i].lo <= ranges[merged - 1].hi + 1)
+            {
+                ranges[merged - 1].hi = std::max(ranges[merged - 1].hi, ranges[i].hi);
+            }
+            else
+            {
+                ranges[merged++] = ranges[i];
+            }
+        }
+        ranges.count = merged;
+    }
+
+    // 规范化的 ranges[begin, end) 换成它在 [0, max] 中的补集
+    constexpr void complementRanges(size_t begin, uint32_t max)
+    {
+        auto &ranges = tree.ranges;
+        const size_t end = ranges.size();
+        uint32_t next = 0;
+        for (size_t i = begin; i < end; ++i)
+        {
+            if (ranges[i].lo > next)
+            {
+                addRange(next, ranges[i].lo - 1);
+            }
+            next = ranges[i].hi + 1;
+        }
+        if (next <= max)
+        {
+            addRange(next, max);
+        }
+        for (size_t i = end; i < ranges.size(); ++i)
+        {
+            ranges[begin + i - end] = ranges[i];
+        }
+        ranges.count = begin + ranges.size() - end;
+    }
+
+    constexpr void addPerlClass(char letter)
+    {
+        const size_t begin = tree.ranges.size();
+        const PerlClassRanges perl = perlClassRanges(letter);
+        for (int k = 0; k < perl.count; ++k)
+        {
+            addRange(perl.ranges[k][0], perl.ranges[k][1]);
+        }
+        if (letter >= 'A' && letter <= 'Z')
+        {
+            complementRanges(begin, bytes ? 0xFF : 0x10FFFF);
+        }
+    }
+
+    // 字节模式：ranges[begin, end) 中的字节值换成字符类的区间（同 rawByteRanges）
+    constexpr void rawByteRanges(size_t begin)
+    {
+        auto &ranges = tree.ranges;
+        const size_t end = ranges.size();
+        for (size_t i = begin; i < end; ++i)
+        {
+            if (ranges[i].lo >= 0x80)
+            {
+                ranges[i].lo += RAW_BYTE_BASE;
+                ranges[i].hi += RAW_BYTE_BASE;
+            }
+            else if (ranges[i].hi >= 0x80)
+            {
+                addRange(RAW_BYTE_BASE + 0x80, RAW_BYTE_BASE + ranges[i].hi);
+                ranges[i].hi = 0x7F;
+            }
+        }
+        normalizeRanges(begin);
+    }
+
+    constexpr int classNode(size_t begin)
+    {
+        StaticRegexNode node;
+        node.kind = RegexNode::Class;
+        node.rangeBegin = static_cast<uint32_t>(begin);
+        node.rangeEnd = static_cast<uint32_t>(tree.ranges.size());
+        return addNode(node);
+    }
+
+    constexpr int parseClass()
+    {
+        const size_t open = pos++;
+        const size_t begin = tree.ranges.size();
+        bool negate = at('^');
+        if (negate)
+        {
+            ++pos;
+        }
+        for (bool first = true; pos < regex.size() && (regex[pos] != ']' || first); first = false)
+        {
+            if (regex[pos] == '\\' && pos + 1 < regex.size() && perlClassRanges(regex[pos + 1]).count > 0)
+            {
+                addPerlClass(regex[pos + 1]);
+                pos += 2;
+                continue;
+            }
+            const size_t element = pos;
+            bool isByte = false;
+            uint32_t lo = readRegexChar(regex, pos, isByte);
+            bool character = !isByte && lo >= 0x80; // 非 ASCII 字符，字节模式中不允许
+            uint32_t hi = lo;
+            if (pos + 1 < regex.size() && regex[pos] == '-' && regex[pos + 1] != ']')
+            {
+                ++pos;
+                hi = readRegexChar(regex, pos, isByte);
+                character = character || (!isByte && hi >= 0x80);
+            }
+            if (bytes && character)
+            {
+                throw RegexSyntaxError("字节模式的字符类中只能有 ASCII 字符和 \\xHH", element);
+            }
+            addRange(std::min(lo, hi), std::max(lo, hi));
+        }
+        if (pos >= regex.size())
+        {
+            throw RegexSyntaxError("字符类缺少 ']'", open);
+        }
+        ++pos;
+        normalizeRanges(begin);
+        if (negate)
+        {
+            complementRanges(begin, bytes ? 0xFF : 0x10FFFF);
+        }
+        if (bytes)
+        {
+            rawByteRanges(begin);
+        }
+        return classNode(begin);
+    }
+
+    constexpr int parseAtom()
+    {
+        char c = regex[pos];
+        if (c == '(')
+        {
+            const size_t open = pos++;
+            if (++depth > RegexParser::MAX_DEPTH)
+            {
+                throw RegexSyntaxError("括号嵌套过深", open);
+            }
+            const bool byteMode = regex.substr(pos, 4) == "?-u:";
+            pos += byteMode ? 4 : 0;
+            const bool outer = bytes;
+            bytes = bytes || byteMode;
+            int node = parseAlternation();
+            bytes = outer;
+            if (!at(')'))
+            {
+                throw RegexSyntaxError("缺少 ')'", open);
+            }
+            ++pos;
+            --depth;
+            return node;
+        }
+        if (c == '*' || c == '+' || c == '?')
+        {
+            throw RegexSyntaxError(c == '*'   ? "'*' 前面没有可以重复的内容"
+                                   : c == '+' ? "'+' 前面没有可以重复的内容"
+                                              : "'?' 前面没有可以重复的内容",
+                                   pos);
+        }
+        if (c == '[')
+        {
+            return parseClass();
+        }
+        if (c == '.')
+        {
+            const size_t begin = tree.ranges.size();
+            addRange(0, '\n' - 1);
+            addRange('\n' + 1, bytes ? 0xFF : 0x10FFFF);
+            if (bytes)
+            {
+                rawByteRanges(begin);
+            }
+            ++pos;
+            return classNode(begin);
+        }
+        if (c == ' ')
+        {
+            ++pos; // 空串
+            return addNode(StaticRegexNode());
+        }
+        if (c == '\\' && pos + 1 < regex.size() && perlClassRanges(regex[pos + 1]).count > 0)
+        {
+            const size_t begin = tree.ranges.size();
+            addPerlClass(regex[pos + 1]);
+            if (bytes)
+            {
+                rawByteRanges(begin);
+            }
+            pos += 2;
+            return classNode(begin);
+        }
+        StaticRegexNode node;
+        node.kind = RegexNode::Literal;
+        node.cp = readRegexChar(regex, pos, node.isByte);
+        return addNode(node);
+    }
+};
+
+struct StaticFragment
+{
+    uint32_t start;
+    uint32_t accept;
+};
+
+// 只数状态和转换的个数，用来确定 StaticNfa 的容量
+struct StaticNfaCounter
+{
+    uint32_t states = 0;
+    uint32_t edges = 0;
+
+    constexpr uint32_t newState() { return states++; }
+    constexpr void addEdge(uint32_t, uint32_t, uint8_t, uint8_t, bool) { ++edges; }
+};
+
+template <size_t States, size_t Edges>
+struct StaticNfa
+{
+    struct Edge
+    {
+        uint32_t from = 0;
+        uint32_t to = 0;
+        uint8_t lo = 0;
+        uint8_t hi = 0;
+        bool epsilon = false;
+    };
+
+    FixedVector<Edge, Edges> edges; // finish() 之后按 from 排序
+    uint32_t edgeBegin[States + 1] = {};
+    uint32_t states = 0;
+    uint32_t start = 0;
+    uint32_t accept = 0;
+
+    constexpr uint32_t newState() { return states++; }
+
+    constexpr void addEdge(uint32_t from, uint32_t to, uint8_t lo, uint8_t hi, bool epsilon)
+    {
+        edges.push_back(Edge{from, to, lo, hi, epsilon});
+    }
+
+    // 按起点做计数排序，得到每个状态的出边区间 [edgeBegin[s], edgeBegin[s + 1])
+    constexpr void finish(StaticFragment fragment)
+    {
+        start = fragment.start;
+        accept = fragment.accept;
+        for (size_t e = 0; e < edges.size(); ++e)
+        {
+            ++edgeBegin[edges[e].from + 1];
+        }
+        for (size_t s = 0; s < States; ++s)
+        {
+            edgeBegin[s + 1] += edgeBegin[s];
+        }
+        FixedVector<Edge, Edges> sorted;
+        sorted.count = edges.size();
+        uint32_t next[States + 1] = {};
+        for (size_t s = 0; s <= States; ++s)
+        {
+            next[s] = edgeBegin[s];
+        }
+        for (size_t e = 0; e < edges.size(); ++e)
+        {
+            sorted[next[edges[e].from]++] = edges[e];
+        }
+        edges = sorted;
+    }
+};
+
+// 语法树到 Thompson NFA，结构与运行时相同：计数重复展开成 m 个副本加上 n - m 个可选的副本
+template <typename Builder, size_t Length>
+class StaticThompson
+{
+public:
+    constexpr StaticThompson(Builder &_builder, const StaticRegexTree<Length> &_tree) : builder(_builder), tree(_tree) {}
+
+    constexpr StaticFragment build(int index)
+    {
+        const StaticRegexNode &node = tree.nodes[index];
+        switch (node.kind)
+        {
+        case RegexNode::Empty:
+            return empty();
+        case RegexNode::Literal:
+        {
+            uint8_t bytes[4] = {};
+            int length = node.isByte ? (bytes[0] = static_cast<uint8_t>(node.cp), 1) : encodeUtf8(node.cp, bytes);
+            StaticFragment fragment = empty();
+            for (int k = 0; k < length; ++k)
+            {
+                uint32_t next = builder.newState();
+                builder.addEdge(fragment.accept, next, bytes[k], bytes[k], false);
+                fragment.accept = next;
+            }
+            return fragment;
+        }
+        case RegexNode::Class:
+        {
+            StaticFragment fragment{builder.newState(), builder.newState()};
+            for (uint32_t r = node.rangeBegin; r < node.rangeEnd; ++r)
+            {
+                forEachUtf8Sequence(tree.ranges[r].lo, tree.ranges[r].hi, [&](const uint8_t *first, const uint8_t *last, int length)
+                                    {
+                                        uint32_t from = fragment.start;
+                                        for (int k = 0; k < length; ++k)
+                                        {
+                                            uint32_t to = k + 1 == length ? fragment.accept : builder.newState();
+                                            builder.addEdge(from, to, first[k], last[k], false);
+                                            from = to;
+                                        } });
+            }
+            return fragment;
+        }
+        case RegexNode::Concat:
+        {
+            StaticFragment fragment = build(node.firstChild);
+            for (int child = tree.nodes[node.firstChild].nextSibling; child >= 0; child = tree.nodes[child].nextSibling)
+            {
+                fragment = concatenate(fragment, build(child));
+            }
+            return fragment;
+        }
+        case RegexNode::Alternate:
+        {
+            StaticFragment fragment{builder.newState(), builder.newState()};
+            for (int child = node.firstChild; child >= 0; child = tree.nodes[child].nextSibling)
+            {
+                StaticFragment branch = build(child);
+                epsilon(fragment.start, branch.start);
+                epsilon(branch.accept, fragment.accept);
+            }
+            return fragment;
+        }
+        case RegexNode::Repeat:
+        {
+            StaticFragment fragment = empty();
+            for (int i = 0; i < node.min; ++i)
+            {
+                fragment = concatenate(fragment, build(node.firstChild));
+            }
+            if (node.max == RegexNode::UNBOUNDED)
+            {
+                return concatenate(fragment, star(build(node.firstChild)));
+            }
+            for (int i = node.min; i < node.max; ++i)
+            {
+                fragment = concatenate(fragment, optional(build(node.firstChild)));
+            }
+            return fragment;
+        }
+        }
+        return empty();
+    }
+
+private:
+    Builder &builder;
+    const StaticRegexTree<Length> &tree;
+
+    constexpr void epsilon(uint32_t from, uint32_t to) { builder.addEdge(from, to, 0, 0, true); }
+
+    constexpr StaticFragment empty()
+    {
+        uint32_t state = builder.newState();
+        return StaticFragment{state, state};
+    }
+
+    constexpr StaticFragment concatenate(StaticFragment first, StaticFragment second)
+    {
+        epsilon(first.accept, second.start);
+        return StaticFragment{first.start, second.accept};
+    }
+
+    constexpr StaticFragment star(StaticFragment inner)
+    {
+        StaticFragment fragment{builder.newState(), builder.newState()};
+        epsilon(fragment.start, inner.start);
+        epsilon(fragment.start, fragment.accept);
+        epsilon(inner.accept, inner.start);
+        epsilon(inner.accept, fragment.accept);
+        return fragment;
+    }
+
+    constexpr StaticFragment optional(StaticFragment inner)
+    {
+        StaticFragment fragment{builder.newState(), builder.newState()};
+        epsilon(fragment.start, inner.start);
+        epsilon(fragment.start, fragment.accept);
+        epsilon(inner.accept, fragment.accept);
+        return fragment;
+    }
+};
+
+// 字节等价类，划分方式与 ByteClasses 相同
+struct StaticByteClasses
+{
+    uint8_t classOf[256] = {};
+    uint8_t representative[256] = {}; // 每个类的第一个字节
+    uint32_t count = 0;
+
+    template <typename Nfa>
+    constexpr explicit StaticByteClasses(const Nfa &nfa)
+    {
+        bool boundary[257] = {};
+        for (size_t e = 0; e < nfa.edges.size(); ++e)
+        {
+            if (!nfa.edges[e].epsilon)
+            {
+                boundary[nfa.edges[e].lo] = true;
+                boundary[nfa.edges[e].hi + 1] = true;
+            }
+        }
+        for (int b = 0; b < 256; ++b)
+        {
+            if (b == 0 || boundary[b])
+            {
+                representative[count++] = static_cast<uint8_t>(b);
+            }
+            classOf[b] = static_cast<uint8_t>(count - 1);
+        }
+    }
+};
+
+// 编译期匹配器，接口与 CompiledDFA 相同。状态0是死状态
+template <size_t States, size_t Classes>
+struct StaticDFA
+{
+    using StateType = std::conditional_t<(States <= 0x100), uint8_t, std::conditional_t<(States <= 0x10000), uint16_t, uint32_t>>;
+    static constexpr uint32_t DEAD_STATE = 0;
+
+    uint8_t byteClass[256] = {};
+    StateType table[States][Classes] = {};
+    bool accepting[States] = {};
+    uint32_t start = DEAD_STATE;
+
+    constexpr uint32_t stateCount() const { return static_cast<uint32_t>(States); }
+    constexpr uint32_t startState() const { return start; }
+    constexpr uint32_t classCount() const { return static_cast<uint32_t>(Classes); }
+
+    constexpr uint32_t next(uint32_t state, unsigned char byte) const
+    {
+        return table[state][byteClass[byte]];
+    }
+
+    constexpr bool isAccepting(uint32_t state) const
+    {
+        return accepting[state];
+    }
+
+    constexpr bool fullMatch(std::string_view input) const
+    {
+        uint32_t s = start;
+        for (size_t i = 0; s != DEAD_STATE && i < input.size(); ++i)
+        {
+            s = next(s, static_cast<unsigned char>(input[i]));
+        }
+        return accepting[s];
+    }
+
+    constexpr bool prefixMatch(std::string_view input, size_t &matchLength) const
+    {
+        uint32_t s = start;
+        size_t last = accepting[s] ? 0 : SIZE_MAX;
+        for (size_t i = 0; s != DEAD_STATE && i < input.size(); ++i)
+        {
+            s = next(s, static_cast<unsigned char>(input[i]));
+            last = accepting[s] ? i + 1 : last;
+        }
+        if (last == SIZE_MAX)
+        {
+            return false;
+        }
+        matchLength = last;
+        return true;
+    }
+
+    constexpr bool find(std::string_view input, size_t &matchBegin, size_t &matchEnd) const
+    {
+        for (size_t begin = 0; begin <= input.size(); ++begin)
+        {
+            size_t matchLength = 0;
+            if (prefixMatch(input.substr(begin), matchLength))
+            {
+                matchBegin = begin;
+                matchEnd = begin + matchLength;
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// 子集构造：状态集合是 NFA 状态的位图，0号是空集（死状态）
+template <size_t NfaStates, size_t Classes, size_t MaxStates>
+struct StaticSubsetDFA
+{
+    static constexpr size_t WORDS = (NfaStates + 63) / 64;
+
+    uint64_t sets[MaxStates][WORDS] = {};
+    uint32_t table[MaxStates][Classes] = {};
+    bool accepting[MaxStates] = {};
+    uint32_t count = 0;
+    uint32_t start = 0;
+
+    template <typename Nfa>
+    static constexpr StaticSubsetDFA build(const Nfa &nfa, const StaticByteClasses &classes)
+    {
+        StaticSubsetDFA dfa;
+        uint64_t set[WORDS] = {};
+        dfa.count = 1;
+        set[nfa.start / 64] |= uint64_t(1) << (nfa.start % 64);
+        dfa.start = dfa.intern(nfa, set);
+
+        for (uint32_t i = 1; i < dfa.count; ++i)
+        {
+            for (uint32_t c = 0; c < Classes; ++c)
+            {
+                const uint8_t byte = classes.representative[c];
+                uint64_t next[WORDS] = {};
+                for (uint32_t s = 0; s < NfaStates; ++s)
+                {
+                    if (!((dfa.sets[i][s / 64] >> (s % 64)) & 1))
+                    {
+                        continue;
+                    }
+                    for (uint32_t e = nfa.edgeBegin[s]; e < nfa.edgeBegin[s + 1]; ++e)
+                    {
+                        if (!nfa.edges[e].epsilon && nfa.edges[e].lo <= byte && byte <= nfa.edges[e].hi)
+                        {
+                            next[nfa.edges[e].to / 64] |= uint64_t(1) << (nfa.edges[e].to % 64);
+                        }
+                    }
+                }
+                dfa.table[i][c] = dfa.intern(nfa, next);
+            }
+        }
+        return dfa;
+    }
+
+    // 求 ε 闭包后查找或加入状态集合，返回DFA状态编号
+    template <typename Nfa>
+    constexpr uint32_t intern(const Nfa &nfa, uint64_t (&set)[WORDS])
+    {
+        uint32_t stack[NfaStates > 0 ? NfaStates : 1] = {};
+        size_t top = 0;
+        bool empty = true;
+        for (uint32_t s = 0; s < NfaStates; ++s)
+        {
+            if ((set[s / 64] >> (s % 64)) & 1)
+            {
+                stack[top++] = s;
+                empty = false;
+            }
+        }
+        if (empty)
+        {
+            return 0;
+        }
+        while (top > 0)
+        {
+            uint32_t s = stack[--top];
+            for (uint32_t e = nfa.edgeBegin[s]; e < nfa.edgeBegin[s + 1]; ++e)
+            {
+                uint32_t to = nfa.edges[e].to;
+                if (nfa.edges[e].epsilon && !((set[to / 64] >> (to % 64)) & 1))
+                {
+                    set[to / 64] |= uint64_t(1) << (to % 64);
+                    stack[top++] = to;
+                }
+            }
+        }
+
+        for (uint32_t d = 1; d < count; ++d)
+        {
+            bool same = true;
+            for (size_t w = 0; same && w < WORDS; ++w)
+            {
+                same = sets[d][w] == set[w];
+            }
+            if (same)
+            {
+                return d;
+            }
+        }
+        if (count == MaxStates)
+        {
+            throw std::length_error("编译期DFA的状态数超过 MaxStates，请增大 compileRegex 的 MaxStates 参数");
+        }
+        for (size_t w = 0; w < WORDS; ++w)
+        {
+            sets[count][w] = set[w];
+        }
+        accepting[count] = (set[nfa.accept / 64] >> (nfa.accept % 64)) & 1;
+        return count++;
+    }
+
+    // Moore 算法最小化：反复按 (所在块, 各个类的后继所在块) 细分，直到块数不再增加。
+    // 死状态所在的块编号为0，其余的块按第一次出现的顺序编号
+    struct Partition
+    {
+        uint32_t block[MaxStates] = {};
+        uint32_t count = 0;
+    };
+
+    constexpr Partition minimize() const
+    {
+        Partition partition;
+        for (uint32_t s = 0; s < count; ++s)
+        {
+            partition.block[s] = accepting[s] ? 1 : 0;
+        }
+        partition.count = 0;
+        for (;;)
+        {
+            Partition refined;
+            uint32_t first[MaxStates] = {}; // 每个新块的第一个状态
+            for (uint32_t s = 0; s < count; ++s)
+            {
+                uint32_t b = 0;
+                for (; b < refined.count; ++b)
+                {
+                    uint32_t t = first[b];
+                    bool same = partition.block[t] == partition.block[s];
+                    for (uint32_t c = 0; same && c < Classes; ++c)
+                    {
+                        same = partition.block[table[t][c]] == partition.block[table[s][c]];
+                    }
+                    if (same)
+                    {
+                        break;
+                    }
+                }
+                if (b == refined.count)
+                {
+                    first[refined.count++] = s;
+                }
+                refined.block[s] = b;
+            }
+            if (refined.count == partition.count)
+            {
+                return refined;
+            }
+            partition = refined;
+        }
+    }
+
+    template <size_t Minimized>
+    constexpr StaticDFA<Minimized, Classes> toStaticDFA(const Partition &partition, const StaticByteClasses &classes) const
+    {
+        using StateType = typename StaticDFA<Minimized, Classes>::StateType;
+        StaticDFA<Minimized, Classes> result;
+        for (int b = 0; b < 256; ++b)
+        {
+            result.byteClass[b] = classes.classOf[b];
+        }
+        for (uint32_t s = 0; s < count; ++s)
+        {
+            const uint32_t to = partition.block[s];
+            result.accepting[to] = accepting[s];
+            for (uint32_t c = 0; c < Classes; ++c)
+            {
+                result.table[to][c] = static_cast<StateType>(partition.block[table[s][c]]);
+            }
+        }
+        result.start = partition.block[start];
+        return result;
+    }
+};
+
+// 编译期流水线的各个阶段，每个阶段的结果是一个常量，后面阶段的容量由前面的结果决定
+template <FixedString Pattern, size_t MaxStates>
+struct StaticRegexCompiler
+{
+    static constexpr std::string_view regex = Pattern.view();
+    static constexpr auto tree = StaticRegexParser<regex.size()>::parse(regex);
+
+    static constexpr StaticNfaCounter size = []
+    {
+        StaticNfaCounter counter;
+        StaticThompson<StaticNfaCounter, regex.size()>(counter, tree).build(tree.root);
+        return counter;
+    }();
+
+    static constexpr auto nfa = []
+    {
+        StaticNfa<size.states, size.edges> nfa;
+        StaticFragment fragment = StaticThompson<decltype(nfa), regex.size()>(nfa, tree).build(tree.root);
+        nfa.finish(fragment);
+        return nfa;
+    }();
+
+    static constexpr StaticByteClasses classes = StaticByteClasses(nfa);
+    static constexpr auto subset = StaticSubsetDFA<size.states, classes.count, MaxStates>::build(nfa, classes);
+    static constexpr auto partition = subset.minimize();
+    static constexpr auto dfa = subset.template toStaticDFA<partition.count>(partition, classes);
+};
+
+template <FixedString Pattern, size_t MaxStates = 256>
+consteval auto compileRegex()
+{
+    return StaticRegexCompiler<Pattern, MaxStates>::dfa;
+}
+
+#endif
+
+// C++ 代码生成（类似 re2c）：把编译好的DFA写成独立的头文件，运行时不再编译也不查表。
+// 默认每个状态一个标签，用 goto 跳转：转移分成少数几段的状态按区间比较（二分），
+// 分散成很多段的状态用 switch，交给编译器生成跳转表。
+// table 为 true 时改为输出 constexpr 转移表和查表循环，匹配函数可以在编译期求值。
+// 两种形式的接口相同：
+//   std::ptrdiff_t prefixMatch(std::string_view input, int *pattern = nullptr) 最长前缀匹配的长度，不匹配为 -1
+//   bool fullMatch(std::string_view input)
+struct CodegenOptions
+{
+    std::string name = "matcher"; // 生成的命名空间
+    bool table = false;
+    std::vector<std::string> sources; // 源正则表达式，写进注释
+};
+
+// 一个状态在 0..255 上的转移，相邻且目标相同的字节合并为一段
+struct ByteRun
+{
+    int lo;
+    int hi;
+    uint32_t target;
+};
+
+std::vector<ByteRun> byteRuns(const CompiledDFA &dfa, uint32_t state)
+{
+    std::vector<ByteRun> runs;
+    for (int b = 0; b < 256; ++b)
+    {
+        uint32_t target = dfa.next(state, static_cast<unsigned char>(b));
+        if (!runs.empty() && runs.back().target == target)
+        {
+            runs.back().hi = b;
+        }
+        else
+        {
+            runs.push_back(ByteRun{b, b, target});
+        }
+    }
+    return runs;
+}
+
+// 字符串写成C++字符串字面量的内容，注释里用它显示源正则表达式（避免行尾的反斜杠续行）
+std::string cppStringLiteral(const std::string &text)
+{
+    std::string result = "\"";
+    for (unsigned char c : text)
+    {
+        if (c == '"' || c == '\\')
+        {
+            result += '\\';
+            result += static_cast<char>(c);
+        }
+        else if (c < 0x20 || c == 0x7f)
+        {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\x%02x", c);
+            result += escaped;
+        }
+        else
+        {
+            result += static_cast<char>(c);
+        }
+    }
+    return result + "\"";
+}
+
+std::string cppByte(int b)
+{
+    char text[8];
+    std::snprintf(text, sizeof(text), "0x%02x", b);
+    return text;
+}
+
+std::string stateLabel(uint32_t state)
+{
+    return state == CompiledDFA::DEAD_STATE ? "done" : "S" + std::to_string(state);
+}
+
+// 段数不超过这个值的状态用区间比较，否则用 switch
+constexpr size_t kCodegenMaxRangeRuns = 8;
+
+// runs[begin, end) 覆盖一段连续的字节，按中间一段的下界二分
+void emitRangeTree(std::ostream &out, const std::vector<ByteRun> &runs, size_t begin, size_t end, const std::string &indent)
+{
+    if (end - begin == 1)
+    {
+        out << indent << "goto " << stateLabel(runs[begin].target) << ";\n";
+        return;
+    }
+    size_t middle = (begin + end) / 2;
+    out << indent << "if (c < " << cppByte(runs[middle].lo) << ")\n"
+        << indent << "{\n";
+    emitRangeTree(out, runs, begin, middle, indent + "    ");
+    out << indent << "}\n";
+    emitRangeTree(out, runs, middle, end, indent);
+}
+
+void emitSwitch(std::ostream &out, const std::vector<ByteRun> &runs)
+{
+    // 覆盖字节最多的目标作为 default，其余目标逐个列出 case
+    std::map<uint32_t, int> coverage;
+    for (const ByteRun &run : runs)
+    {
+        coverage[run.target] += run.hi - run.lo + 1;
+    }
+    uint32_t fallback = coverage.begin()->first;
+    for (const auto &[target, count] : coverage)
+    {
+        fallback = count > coverage[fallback] ? target : fallback;
+    }
+
+    out << "    switch (c)\n"
+        << "    {\n";
+    for (const auto &[target, count] : coverage)
+    {
+        if (target == fallback)
+        {
+            continue;
+        }
+        for (const ByteRun &run : runs)
+        {
+            for (int b = run.lo; run.target == target && b <= run.hi; ++b)
+            {
+                out << "    case " << cppByte(b) << ":\n";
+            }
+        }
+        out << "        goto " << stateLabel(target) << ";\n";
+    }
+    out << "    default:\n"
+        << "        goto " << stateLabel(fallback) << ";\n"
+        << "    }\n";
+}
+
+void emitGotoMatcher(std::ostream &out, const CompiledDFA &dfa)
+{
+    // 开始状态放在最前面直接进入；其余状态只输出被跳转到的，避免未使用标签的警告
+    std::vector<uint32_t> order;
+    std::vector<std::vector<ByteRun>> runs(dfa.stateCount());
+    std::vector<char> referenced(dfa.stateCount(), 0);
+    bool readsInput = false;
+    if (dfa.startState() != CompiledDFA::DEAD_STATE)
+    {
+        order.push_back(dfa.startState());
+    }
+    for (uint32_t s = 1; s < dfa.stateCount(); ++s)
+    {
+        runs[s] = byteRuns(dfa, s);
+        for (const ByteRun &run : runs[s])
+        {
+            referenced[run.target] = 1;
+            readsInput = readsInput || run.target != CompiledDFA::DEAD_STATE;
+        }
+        if (s != dfa.startState())
+        {
+            order.push_back(s);
+        }
+    }
+
+    out << "inline std::ptrdiff_t prefixMatch(std::string_view input, int *pattern = nullptr)\n"
+        << "{\n";
+    if (readsInput)
+    {
+        out << "    const unsigned char *const begin = reinterpret_cast<const unsigned char *>(input.data());\n"
+            << "    const unsigned char *const end = begin + input.size();\n"
+            << "    const unsigned char *p = begin;\n"
+            << "    unsigned char c;\n";
+    }
+    else
+    {
+        out << "    (void)input;\n";
+    }
+    out << "    std::ptrdiff_t last = -1;\n"
+        << "    int lastPattern = -1;\n";
+    if (dfa.startState() == CompiledDFA::DEAD_STATE)
+    {
+        out << "    goto done;\n";
+    }
+
+    for (uint32_t s : order)
+    {
+        if (s != dfa.startState() && !referenced[s])
+        {
+            continue; // 不可达
+        }
+        out << "\n";
+        if (referenced[s])
+        {
+            out << stateLabel(s) << ":\n";
+        }
+        if (dfa.isAccepting(s))
+        {
+            out << "    last = " << (readsInput ? "p - begin" : "0") << ";\n"
+                << "    lastPattern = " << dfa.acceptingPattern(s) << ";\n";
+        }
+        if (runs[s].size() == 1 && runs[s][0].target == CompiledDFA::DEAD_STATE)
+        {
+            out << "    goto done;\n";
+            continue;
+        }
+        out << "    if (p == end)\n"
+            << "    {\n"
+            << "        goto done;\n"
+            << "    }\n"
+            << "    c = *p++;\n";
+        if (runs[s].size() <= kCodegenMaxRangeRuns)
+        {
+            emitRangeTree(out, runs[s], 0, runs[s].size(), "    ");
+        }
+        else
+        {
+            emitSwitch(out, runs[s]);
+        }
+    }
+
+    out << "\n"
+        << "done:\n"
+        << "    if (pattern != nullptr && last >= 0)\n"
+        << "    {\n"
+        << "        *pattern = lastPattern;\n"
+        << "    }\n"
+        << "    return last;\n"
+        << "}\n";
+}
+
+void emitTableMatcher(std::ostream &out, const CompiledDFA &dfa)
+{
+    const uint32_t states = dfa.stateCount();
+    const uint32_t classes = dfa.classCount();
+    const char *stateType = states <= 0x100 ? "std::uint8_t" : states <= 0x10000 ? "std::uint16_t" : "std::uint32_t";
+
+    // 每个类取第一个字节作为代表
+    std::vector<int> representative(classes, -1);
+    for (int b = 255; b >= 0; --b)
+    {
+        representative[dfa.classOf(static_cast<unsigned char>(b))] = b;
+    }
+
+    out << "inline constexpr std::uint8_t byteClass[256] = {";
+    for (int b = 0; b < 256; ++b)
+    {
+        out << (b % 16 == 0 ? "\n    " : " ") << static_cast<int>(dfa.classOf(static_cast<unsigned char>(b))) << ",";
+    }
+    out << "\n};\n\n";
+
+    out << "// 状态0是死状态\n"
+        << "inline constexpr " << stateType << " table[" << states << "][" << classes << "] = {\n";
+    for (uint32_t s = 0; s < states; ++s)
+    {
+        out << "    {";
+        for (uint32_t c = 0; c < classes; ++c)
+        {
+            out << (c == 0 ? "" : ", ") << dfa.next(s, static_cast<unsigned char>(representative[c]));
+        }
+        out << "},\n";
+    }
+    out << "};\n\n";
+
+    out << "inline constexpr int acceptPattern[" << states << "] = {";
+    for (uint32_t s = 0; s < states; ++s)
+    {
+        out << (s % 16 == 0 ? "\n    " : " ") << dfa.acceptingPattern(s) << ",";
+    }
+    out << "\n};\n\n";
+
+    out << "inline constexpr std::uint32_t startState = " << dfa.startState() << ";\n\n"
+        << "constexpr std::ptrdiff_t prefixMatch(std::string_view input, int *pattern = nullptr)\n"
+        << "{\n"
+        << "    std::uint32_t s = startState;\n"
+        << "    std::ptrdiff_t last = acceptPattern[s] >= 0 ? 0 : -1;\n"
+        << "    int lastPattern = acceptPattern[s];\n"
+        << "    for (std::size_t i = 0; s != 0 && i < input.size(); ++i)\n"
+        << "    {\n"
+        << "        s = table[s][byteClass[static_cast<unsigned char>(input[i])]];\n"
+        << "        if (acceptPattern[s] >= 0)\n"
+        << "        {\n"
+        << "            last = static_cast<std::ptrdiff_t>(i) + 1;\n"
+        << "            lastPattern = acceptPattern[s];\n"
+        << "        }\n"
+        << "    }\n"
+        << "    if (pattern != nullptr && last >= 0)\n"
+        << "    {\n"
+        << "        *pattern = lastPattern;\n"
+        << "    }\n"
+        << "    return last;\n"
+        << "}\n";
+}
+
+// 生成的头文件只依赖标准库
+void generateCppMatcher(const CompiledDFA &dfa, const std::string &filename, const CodegenOptions &options)
+{
+    PhaseTimer timer(compileStats.exportSeconds);
+    std::ofstream outfile(filename);
+
+    if (outfile.is_open())
+    {
+        outfile << "// 由 Thompson codegen 生成，不要手动修改\n";
+        for (size_t i = 0; i < options.sources.size(); ++i)
+        {
+            outfile << "// 模式 " << i << ": " << cppStringLiteral(options.sources[i]) << "\n";
+        }
+        outfile << "#pragma once\n"
+                << "#include <cstddef>\n"
+                << "#include <cstdint>\n"
+                << "#include <string_view>\n\n"
+                << "namespace " << options.name << "\n"
+                << "{\n\n";
+        if (options.table)
+        {
+            emitTableMatcher(outfile, dfa);
+        }
+        else
+        {
+            emitGotoMatcher(outfile, dfa);
+        }
+        outfile << "\n"
+                << (options.table ? "constexpr" : "inline") << " bool fullMatch(std::string_view input)\n"
+                << "{\n"
+                << "    return prefixMatch(input) == static_cast<std::ptrdiff_t>(input.size());\n"
+                << "}\n\n"
+                << "} // namespace " << options.name << "\n";
+        outfile.close();
+        std::cout << "C++ matcher has been generated to " << filename << "\n";
+    }
+    else
+    {
+        std::cerr << "Unable to open file for writing output\n";
+    }
+}
+
+// 分块流式匹配：搜索的进度（CompiledDFA::SearchScan）跨块保留，报告的是整个流中的绝对偏移。
+// 结果与对整个输入反复调用 find()（最左最长、互不重叠）相同，每个字节只由正向的搜索自动机读一次，
+// 找到匹配的结束位置后才用反向DFA往回找起点。
+// 只有还活着的候选匹配跨越块边界时，才把从它们最早的可能起点开始的字节留在 carry 中
+class StreamMatcher
+{
+public:
+    explicit StreamMatcher(const CompiledDFA &_dfa) : dfa(_dfa) {}
+
+    // onMatch(begin, end) 对每个匹配 [begin, end) 调用一次
+    template <typename Callback>
+    void feed(const char *data, size_t length, Callback &&onMatch)
+    {
+        if (carry.empty())
+        {
+            uint64_t base = streamEnd;
+            streamEnd += length;
+            process(reinterpret_cast<const unsigned char *>(data), base, length, false, onMatch);
+            if (active)
+            {
+                carry.assign(data + (scan.restart - base), static_cast<size_t>(streamEnd - scan.restart));
+                carryBase = scan.restart;
+            }
+            else
+            {
+                carryBase = streamEnd;
+            }
+        }
+        else
+        {
+            carry.append(data, length);
+            streamEnd += length;
+            process(reinterpret_cast<const unsigned char *>(carry.data()), carryBase, carry.size(), false, onMatch);
+            keepCandidate();
+        }
+    }
+
+    // 输入结束：结算最后一个候选匹配，之后可以开始新的流
+    template <typename Callback>
+    void finish(Callback &&onMatch)
+    {
+        process(reinterpret_cast<const unsigned char *>(carry.data()), carryBase, carry.size(), true, onMatch);
+        reset();
+    }
+
+    void reset()
+    {
+        carry.clear();
+        carryBase = streamEnd = searchPosition = 0;
+        active = false;
+    }
+
+    uint64_t bytesConsumed() const { return streamEnd; }
+
+private:
+    const CompiledDFA &dfa;
+    std::string carry;
+    uint64_t carryBase = 0; // carry[0] 在流中的偏移
+    uint64_t streamEnd = 0;
+    uint64_t searchPosition = 0; // 下一次搜索从这里开始
+    bool active = false;
+    CompiledDFA::SearchScan scan;
+
+    void keepCandidate()
+    {
+        if (active)
+        {
+            carry.erase(0, static_cast<size_t>(scan.restart - carryBase));
+            carryBase = scan.restart;
+        }
+        else
+        {
+            carry.clear();
+            carryBase = streamEnd;
+        }
+    }
+
+    // data 覆盖流中的 [base, base + length)
+    template <typename Callback>
+    void process(const unsigned char *data, uint64_t base, size_t length, bool atEnd, Callback &onMatch)
+    {
+        const uint64_t end = base + length;
+        const bool emptyMatch = dfa.isAccepting(dfa.startState());
+
+        for (;;)
+        {
+            if (!active)
+            {
+                if (searchPosition > end || (searchPosition == end && (!atEnd || !emptyMatch)))
+                {
+                    break;
+                }
+                active = true;
+                dfa.beginSearch(scan, searchPosition);
+            }
+
+            dfa.advanceSearch(scan, data, base, length, !atEnd);
+            if (!scan.done() && !atEnd)
+            {
+                break; // 匹配还可能变长，或者还可能从块末尾开始，等待下一块
+            }
+
+            active = false;
+            if (scan.matchEnd == CompiledDFA::NO_MATCH)
+            {
+                searchPosition = end;
+                break;
+            }
+            uint64_t begin = dfa.matchStart(data, base, scan);
+            onMatch(begin, scan.matchEnd);
+            searchPosition = scan.matchEnd > begin ? scan.matchEnd : begin + 1;
+        }
+    }
+};
+
+// 把映射的文件按块送进 StreamMatcher，onMatch 收到文件内的绝对偏移
+template <typename Callback>
+bool scanFile(const std::string &path, const CompiledDFA &dfa, Callback &&onMatch, size_t chunkSize = size_t(1) << 20)
+{
+    MappedFile file(path);
+    if (!file.isOpen())
+    {
+        return false;
+    }
+    StreamMatcher matcher(dfa);
+    for (size_t offset = 0; offset < file.size(); offset += chunkSize)
+    {
+        matcher.feed(file.data() + offset, std::min(chunkSize, file.size() - offset), onMatch);
+    }
+    matcher.finish(onMatch);
+    return true;
+}
+
+// 行模式：对每个包含 dfa 的匹配的行调用 onLine(行起始偏移, 行长度)。
+// 用 dfa.searchDFA() 一遍扫描，行内一旦到达接受状态就直接跳到下一行；
+// 搜索DFA的状态太多没有展开时，逐行调用 find()
+template <typename Callback>
+void grepBuffer(const CompiledDFA &dfa, const char *data, size_t length, Callback &&onLine)
+{
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+    const CompiledDFA *searchDfa = dfa.searchDFA();
+    const bool emptyMatch = dfa.isAccepting(dfa.startState());
+    const Prefilter *required = dfa.required();
+    size_t position = 0;
+
+    while (position < length)
+    {
+        if (required != nullptr)
+        {
+            // 不包含必需字面量的行不可能匹配，直接跳到下一次出现所在的行首
+            size_t hit = required->find(p, position, length, false);
+            if (hit == length)
+            {
+                break;
+            }
+            while (hit > position && p[hit - 1] != '\n')
+            {
+                --hit;
+            }
+            position = hit;
+        }
+        size_t lineStart = position;
+        bool matched = emptyMatch;
+        if (searchDfa != nullptr)
+        {
+            uint32_t s = searchDfa->startState();
+            while (!matched && position < length && p[position] != '\n')
+            {
+                s = searchDfa->next(s, p[position]);
+                matched = searchDfa->isAccepting(s);
+                ++position;
+            }
+        }
+
+        const void *newline = std::memchr(data + position, '\n', length - position);
+        size_t lineEnd = newline ? static_cast<const char *>(newline) - data : length;
+        if (searchDfa == nullptr && !matched)
+        {
+            size_t matchBegin, matchEnd;
+            matched = dfa.find(data + lineStart, lineEnd - lineStart, matchBegin, matchEnd);
+        }
+        if (matched)
+        {
+            onLine(lineStart, lineEnd - lineStart);
+        }
+        position = lineEnd + 1;
+    }
+}
+
+template <typename Callback>
+bool grepFile(const std::string &path, const CompiledDFA &dfa, Callback &&onLine)
+{
+    MappedFile file(path);
+    if (!file.isOpen())
+    {
+        return false;
+    }
+    grepBuffer(dfa, file.data(), file.size(), onLine);
+    return true;
+}
+
+// 惰性DFA：匹配时才构造输入实际走到的DFA状态。
+// 缓存的状态数有上限，maxMemoryBytes 非0时整个对象（NFA的副本加缓存）的字节数也有上限，满了就清空重来；如果清空过于频繁（每个状态平均处理的字节太少），
+// 说明缓存在抖动，之后改用不缓存的NFA模拟，保证每个模式占用的内存可预测。
+// ε闭包在构造新状态时沿ε转换现算，不像子集构造那样预先为每个NFA状态存一份：那张表可能是NFA状态数的平方。
+// 不是线程安全的：匹配函数都会修改状态缓存（包括 fullMatch/find），所以都不是 const。
+// 多个线程匹配同一个模式时每个线程各自构造一个 LazyDFA，或者由调用者加锁
+class LazyDFA
+{
+public:
+    static constexpr uint32_t UNKNOWN_STATE = UINT32_MAX;
+    static constexpr uint32_t DEAD_STATE = UINT32_MAX - 1;
+    static constexpr uint32_t CACHE_FULL = UINT32_MAX - 2;
+
+    LazyDFA(const NFA &nfa, const std::vector<uint32_t> &nfaStates, size_t maxCachedStates = 4096,
+            size_t minBytesPerState = 10, size_t maxBadClears = 3, size_t maxMemoryBytes = 0)
+        : subset(nfa, nfaStates, false), stride(static_cast<size_t>(subset.classes.size())),
+          capacity(std::max<size_t>(maxCachedStates, 2)),
+          minBytesPerState(minBytesPerState), maxBadClears(maxBadClears)
+    {
+        scratch.reset(subset);
+        eClosure(subset, {subset.start}, scratch);
+        startSet = scratch.result;
+        if (maxMemoryBytes > 0)
+        {
+            // 缓存的各个数组按倍增分配，实际占用最多是元素字节数的两倍，所以元素只用剩下的一半
+            const size_t fixed = subset.memoryBytes() + scratch.memoryBytes() + vectorBytes(startSet);
+            cacheByteLimit = std::max<size_t>(maxMemoryBytes > fixed ? (maxMemoryBytes - fixed) / 2 : 0, 1);
+        }
+
+        for (int b = 0; b < 256; ++b)
+        {
+            firstByte[b] = false;
+            int symbol = subset.classes[static_cast<unsigned char>(b)];
+            for (uint32_t s : startSet)
+            {
+                for (uint32_t e = subset.edgeStart[s]; e < subset.edgeStart[s + 1]; ++e)
+                {
+                    firstByte[b] = firstByte[b] || subset.edges[e].first == symbol;
+                }
+            }
+        }
+        clearCache();
+    }
+
+    bool fullMatch(std::string_view input)
+    {
+        size_t matchLength;
+        return prefixMatch(input.data(), input.size(), matchLength) && matchLength == input.size();
+    }
+
+    bool prefixMatch(std::string_view input, size_t &matchLength)
+    {
+        return prefixMatch(input.data(), input.size(), matchLength);
+    }
+
+    // 从输入开头起的最长匹配
+    bool prefixMatch(const char *data, size_t length, size_t &matchLength)
+    {
+        const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+        size_t last = accepting[0] ? 0 : SIZE_MAX;
+        size_t i = 0;
+
+        if (!nfaFallback)
+        {
+            uint32_t s = 0; // 开始状态在缓存中总是0号
+            for (; i < length; ++i)
+            {
+                uint32_t t = transitions[s * stride + subset.classes[p[i]]];
+                if (t == UNKNOWN_STATE)
+                {
+                    t = computeNext(s, p[i], bytesScanned + i);
+                }
+                if (t == DEAD_STATE || nfaFallback)
+                {
+                    break;
+                }
+                s = t;
+                last = accepting[s] ? i + 1 : last;
+            }
+            bytesScanned += i;
+
+            if (nfaFallback && i < length)
+            {
+                // computeNext 已经把下一个状态集留在 pendingSet 中
+                current.swap(pendingSet);
+                if (containsFinal(current))
+                {
+                    last = i + 1;
+                }
+                simulate(p, i + 1, length, last);
+            }
+        }
+        else
+        {
+            current = startSet;
+            simulate(p, 0, length, last);
+        }
+
+        if (last == SIZE_MAX)
+        {
+            return false;
+        }
+        matchLength = last;
+        return true;
+    }
+
+    // 查找最左最长匹配，一遍扫描（同 CompiledDFA::buildLeftmost）：每个起点是一个线程，线程就是缓存中的一个状态，
+    // 按起点从早到晚排列。两个线程走到同一个状态时只留起点早的；有线程接受后起点更晚的线程全部丢掉，也不再加入新线程，
+    // 所有线程都死掉时最后记下的就是结果。缓存中途满了时保留线程的状态集重建缓存；退回NFA模拟后改用 simulateFind
+    bool find(std::string_view input, size_t &matchBegin, size_t &matchEnd)
+    {
+        const unsigned char *p = reinterpret_cast<const unsigned char *>(input.data());
+        const size_t length = input.size();
+        if (nfaFallback)
+        {
+            return simulateFind(p, length, matchBegin, matchEnd);
+        }
+        const bool emptyMatch = containsFinal(startSet);
+        size_t bestBegin = SIZE_MAX, bestEnd = 0;
+        threads.clear();
+        size_t i = 0;
+        for (;; ++i)
+        {
+            // 开始状态在缓存中总是0号，已经有起点更早的线程在那里时不用再加
+            if (bestBegin == SIZE_MAX && (emptyMatch || (i < length && firstByte[p[i]])) &&
+                (threads.empty() || threadMark[0] != threadEpoch))
+            {
+                threads.push_back({0, i});
+            }
+            for (size_t k = 0; k < threads.size(); ++k)
+            {
+                if (accepting[threads[k].state])
+                {
+                    bestBegin = threads[k].start;
+                    bestEnd = i;
+                    threads.resize(k + 1);
+                    break;
+                }
+            }
+            if (i == length || (threads.empty() && bestBegin != SIZE_MAX))
+            {
+                break;
+            }
+            if (!advanceThreads(p[i], bytesScanned + i))
+            {
+                bytesScanned += i;
+                return simulateFind(p, length, matchBegin, matchEnd);
+            }
+        }
+        bytesScanned += i;
+        if (bestBegin == SIZE_MAX)
+        {
+            return false;
+        }
+        matchBegin = bestBegin;
+        matchEnd = bestEnd;
+        return true;
+    }
+
+    size_t cachedStates() const { return sets.size(); }
+    size_t cacheClears() const { return clears; }
+    bool usingNFASimulation() const { return nfaFallback; }
+
+private:
+    SubsetNFA subset;
+    size_t stride; // 每个状态一行，每个字节类一列
+    SubsetScratch scratch;
+    StateSetMap sets;
+    std::vector<uint32_t> startSet;
+    std::vector<uint32_t> transitions; // [状态][字节类]
+    std::vector<char> accepting;
+    std::vector<uint32_t> targets;
+    std::vector<uint32_t> current;
+    std::vector<uint32_t> pendingSet;
+    bool firstByte[256];
+
+    // find 的线程：当前所在的状态（缓存中的状态，NFA模拟时是NFA状态）和起点
+    struct Thread
+    {
+        uint32_t state;
+        size_t start;
+    };
+    std::vector<Thread> threads;
+    std::vector<Thread> nextThreads;
+    std::vector<uint32_t> threadMark; // 缓存状态上一次被哪一步的线程占用，去掉走到同一状态的后来者
+    uint32_t threadEpoch = 0;
+    std::vector<std::vector<uint32_t>> keptSets;
+
+    size_t capacity;
+    size_t cacheByteLimit = 0; // 缓存元素的字节数上限，0 表示只限制状态数
+    size_t minBytesPerState;
+    size_t maxBadClears;
+    size_t clears = 0;
+    size_t badClears = 0;
+    uint64_t bytesScanned = 0;
+    uint64_t bytesAtLastClear = 0;
+    bool nfaFallback = false;
+
+    bool containsFinal(const std::vector<uint32_t> &stateSet) const
+    {
+        for (uint32_t s : stateSet)
+        {
+            if (subset.isFinal[s])
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // 单个符号的 move + ε闭包，结果在 scratch.result 中；没有后继时返回 false
+    bool step(const uint32_t *stateSet, size_t count, unsigned char byte)
+    {
+        int symbol = subset.classes[byte];
+        targets.clear();
+        for (size_t i = 0; i < count; ++i)
+        {
+            uint32_t s = stateSet[i];
+            for (uint32_t e = subset.edgeStart[s]; e < subset.edgeStart[s + 1]; ++e)
+            {
+                if (subset.edges[e].first == symbol)
+                {
+                    targets.push_back(subset.edges[e].second);
+                }
+            }
+        }
+        if (targets.empty())
+        {
+            return false;
+        }
+        eClosure(subset, targets, scratch);
+        return true;
+    }
+
+    uint32_t addState(const std::vector<uint32_t> &stateSet, uint64_t hash)
+    {
+        uint32_t id = static_cast<uint32_t>(sets.insert(stateSet.data(), stateSet.size(), hash));
+        transitions.resize((static_cast<size_t>(id) + 1) * stride, UNKNOWN_STATE);
+        accepting.push_back(containsFinal(stateSet));
+        return id;
+    }
+
+    size_t cacheBytes() const
+    {
+        return sets.usedBytes() + transitions.size() * sizeof(uint32_t) + accepting.size();
+    }
+
+    void clearCache()
+    {
+        sets.clear();
+        transitions.clear();
+        accepting.clear();
+        addState(startSet, StateSetMap::hashSet(startSet.data(), startSet.size()));
+    }
+
+    // keepCache 为 true 时缓存满了不清空，返回 CACHE_FULL，由调用者记下它还要用的状态集之后自己清空
+    uint32_t computeNext(uint32_t s, unsigned char byte, uint64_t position, bool keepCache = false)
+    {
+        size_t slot = s * stride + subset.classes[byte];
+        if (!step(sets.data(static_cast<int>(s)), sets.count(static_cast<int>(s)), byte))
+        {
+            transitions[slot] = DEAD_STATE;
+            return DEAD_STATE;
+        }
+
+        const std::vector<uint32_t> &next = scratch.result;
+        uint64_t hash = StateSetMap::hashSet(next.data(), next.size());
+        int found = sets.find(next.data(), next.size(), hash);
+        if (found >= 0)
+        {
+            transitions[slot] = static_cast<uint32_t>(found);
+            return static_cast<uint32_t>(found);
+        }
+
+        if (sets.size() >= capacity || (cacheByteLimit > 0 && cacheBytes() + (next.size() + stride) * sizeof(uint32_t) > cacheByteLimit))
+        {
+            // 缓存已满：两次清空之间平均每个状态处理的字节太少就记为一次抖动
+            if (position - bytesAtLastClear < minBytesPerState * sets.size() && ++badClears >= maxBadClears)
+            {
+                nfaFallback = true;
+                pendingSet = next;
+                return UNKNOWN_STATE;
+            }
+            ++clears;
+            bytesAtLastClear = position;
+            pendingSet = next;
+            if (keepCache)
+            {
+                return CACHE_FULL;
+            }
+            clearCache();
+            return addState(pendingSet, hash);
+        }
+
+        uint32_t id = addState(next, hash);
+        transitions[slot] = id;
+        return id;
+    }
+
+    // find 的一步：所有线程读入 byte。缓存满了时记下线程的状态集，清空缓存后重新加入，再重做这一步；
+    // 重建后仍然放不下这些线程，或者缓存开始抖动，返回 false，由调用者改用NFA模拟
+    bool advanceThreads(unsigned char byte, uint64_t position)
+    {
+        const int symbol = subset.classes[byte];
+        for (bool rebuilt = false;; rebuilt = true)
+        {
+            threadMark.resize(sets.size(), 0);
+            if (++threadEpoch == 0)
+            {
+                std::fill(threadMark.begin(), threadMark.end(), 0);
+                threadEpoch = 1;
+            }
+            nextThreads.clear();
+            bool full = false;
+            for (const Thread &thread : threads)
+            {
+                uint32_t t = transitions[thread.state * stride + symbol];
+                if (t == UNKNOWN_STATE)
+                {
+                    t = computeNext(thread.state, byte, position, true);
+                    threadMark.resize(sets.size(), 0);
+                }
+                if (nfaFallback || (t == CACHE_FULL && rebuilt))
+                {
+                    return false;
+                }
+                if (t == CACHE_FULL)
+                {
+                    full = true;
+                    break;
+                }
+                if (t != DEAD_STATE && threadMark[t] != threadEpoch)
+                {
+                    threadMark[t] = threadEpoch;
+                    nextThreads.push_back({t, thread.start});
+                }
+            }
+            if (!full)
+            {
+                threads.swap(nextThreads);
+                return true;
+            }
+            keptSets.resize(threads.size());
+            for (size_t k = 0; k < threads.size(); ++k)
+            {
+                const uint32_t *set = sets.data(static_cast<int>(threads[k].state));
+                keptSets[k].assign(set, set + sets.count(static_cast<int>(threads[k].state)));
+            }
+            clearCache();
+            for (size_t k = 0; k < threads.size(); ++k)
+            {
+                const uint64_t hash = StateSetMap::hashSet(keptSets[k].data(), keptSets[k].size());
+                const int found = sets.find(keptSets[k].data(), keptSets[k].size(), hash);
+                threads[k].state = found >= 0 ? static_cast<uint32_t>(found) : addState(keptSets[k], hash);
+            }
+        }
+    }
+
+    // 不缓存的 find：线程是NFA状态，按起点从早到晚排列，同一状态只留起点最早的线程（同 PikeVM），规则与 find 相同
+    bool simulateFind(const unsigned char *p, size_t length, size_t &matchBegin, size_t &matchEnd)
+    {
+        const bool emptyMatch = containsFinal(startSet);
+        size_t bestBegin = SIZE_MAX, bestEnd = 0;
+        threads.clear();
+        nextSimulationStep();
+        for (size_t i = 0;; ++i)
+        {
+            if (bestBegin == SIZE_MAX && (emptyMatch || (i < length && firstByte[p[i]])))
+            {
+                addClosure(subset.start, i, threads);
+            }
+            for (size_t k = 0; k < threads.size(); ++k)
+            {
+                if (subset.isFinal[threads[k].state])
+                {
+                    bestBegin = threads[k].start;
+                    bestEnd = i;
+                    size_t end = k + 1;
+                    while (end < threads.size() && threads[end].start == bestBegin)
+                    {
+                        ++end;
+                    }
+                    threads.resize(end);
+                    break;
+                }
+            }
+            if (i == length || (threads.empty() && bestBegin != SIZE_MAX))
+            {
+                break;
+            }
+            nextSimulationStep();
+            nextThreads.clear();
+            const int symbol = subset.classes[p[i]];
+            for (const Thread &thread : threads)
+            {
+                for (uint32_t e = subset.edgeStart[thread.state]; e < subset.edgeStart[thread.state + 1]; ++e)
+                {
+                    if (subset.edges[e].first == symbol)
+                    {
+                        addClosure(subset.edges[e].second, thread.start, nextThreads);
+                    }
+                }
+            }
+            threads.swap(nextThreads);
+        }
+        if (bestBegin == SIZE_MAX)
+        {
+            return false;
+        }
+        matchBegin = bestBegin;
+        matchEnd = bestEnd;
+        return true;
+    }
+
+    void nextSimulationStep()
+    {
+        if (++scratch.epoch == 0)
+        {
+            std::fill(scratch.stamp.begin(), scratch.stamp.end(), 0);
+            scratch.epoch = 1;
+        }
+    }
+
+    // 把 s 的ε闭包中这一步还没有线程占用的状态作为起点为 start 的线程加入 list
+    void addClosure(uint32_t s, size_t start, std::vector<Thread> &list)
+    {
+        if (scratch.stamp[s] == scratch.epoch)
+        {
+            return;
+        }
+        scratch.stamp[s] = scratch.epoch;
+        scratch.stack.push_back(s);
+        while (!scratch.stack.empty())
+        {
+            const uint32_t u = scratch.stack.back();
+            scratch.stack.pop_back();
+            list.push_back({u, start});
+            for (uint32_t e = subset.epsilonStart[u]; e < subset.epsilonStart[u + 1]; ++e)
+            {
+                const uint32_t target = subset.epsilonTargets[e];
+                if (scratch.stamp[target] != scratch.epoch)
+                {
+                    scratch.stamp[target] = scratch.epoch;
+                    scratch.stack.push_back(target);
+                }
+            }
+        }
+    }
+
+    // 不缓存的NFA模拟，从 p[i] 开始推进 current
+    void simulate(const unsigned char *p, size_t i, size_t length, size_t &last)
+    {
+        for (; i < length; ++i)
+        {
+            if (!step(current.data(), current.size(), p[i]))
+            {
+                break;
+            }
+            current.swap(scratch.result);
+            if (containsFinal(current))
+            {
+                last = i + 1;
+            }
+        }
+    }
+};
+
+// 稀疏集合：插入、查找、清空都是 O(1)，用作 Pike VM 的线程表
+class SparseSet
+{
+public:
+    explicit SparseSet(uint32_t capacity = 0) : dense(capacity), sparse(capacity), count(0) {}
+
+    bool contains(uint32_t value) const
+    {
+        uint32_t i = sparse[value];
+        return i < count && dense[i] == value;
+    }
+
+    uint32_t insert(uint32_t value)
+    {
+        sparse[value] = count;
+        dense[count] = value;
+        return count++;
+    }
+
+    void clear() { count = 0; }
+    uint32_t size() const { return count; }
+    uint32_t operator[](uint32_t i) const { return dense[i]; }
+
+private:
+    std::vector<uint32_t> dense;
+    std::vector<uint32_t> sparse;
+    uint32_t count;
+};
+
+// Pike VM：直接在汤普森NFA上模拟，不做子集构造。
+// 每个线程记录匹配的起点，同一状态只保留起点最早的线程，因此 find() 得到最左最长匹配。
+// NFA 必须比 PikeVM 活得久
+class PikeVM
+{
+public:
+    explicit PikeVM(const NFA &_nfa)
+        : nfa(_nfa), current(_nfa.size()), next(_nfa.size()),
+          currentStart(_nfa.size()), nextStart(_nfa.size()) {}
+
+    bool fullMatch(std::string_view input)
+    {
+        size_t matchLength;
+        return prefixMatch(input, matchLength) && matchLength == input.size();
+    }
+
+    // 从输入开头起的最长匹配
+    bool prefixMatch(std::string_view input, size_t &matchLength)
+    {
+        size_t begin, end;
+        if (!run(input, true, begin, end))
+        {
+            return false;
+        }
+        matchLength = end;
+        return true;
+    }
+
+    // 查找最左最长匹配
+    bool find(std::string_view input, size_t &matchBegin, size_t &matchEnd)
+    {
+        return run(input, false, matchBegin, matchEnd);
+    }
+
+private:
+    static constexpr size_t NO_MATCH = SIZE_MAX;
+
+    const NFA &nfa;
+    SparseSet current;
+    SparseSet next;
+    std::vector<size_t> currentStart; // 与线程表的 dense 下标对应
+    std::vector<size_t> nextStart;
+    std::vector<uint32_t> stack;
+
+    // 把 state 的ε闭包加入线程表，已有的状态保留原来（更早）的起点
+    void addThread(SparseSet &list, std::vector<size_t> &starts, uint32_t state, size_t start)
+    {
+        stack.push_back(state);
+        while (!stack.empty())
+        {
+            uint32_t s = stack.back();
+            stack.pop_back();
+            if (list.contains(s))
+            {
+                continue;
+            }
+            starts[list.insert(s)] = start;
+            for (const Transition *t = nfa.edgesEnd(s); t != nfa.edgesBegin(s);)
+            {
+                --t;
+                if (t->epsilon && !list.contains(t->target))
+                {
+                    stack.push_back(t->target);
+                }
+            }
+        }
+    }
+
+    bool run(std::string_view input, bool anchored, size_t &matchBegin, size_t &matchEnd)
+    {
+        size_t bestBegin = NO_MATCH;
+        size_t bestEnd = NO_MATCH;
+        current.clear();
+
+        for (size_t i = 0;; ++i)
+        {
+            // 还没有找到匹配时，每个位置都开始一个新线程（锚定模式只在开头）
+            if (bestBegin == NO_MATCH && (!anchored || i == 0))
+            {
+                addThread(current, currentStart, nfa.start, i);
+            }
+            if (current.size() == 0)
+            {
+                break;
+            }
+
+            for (uint32_t k = 0; k < current.size(); ++k)
+            {
+                if (nfa.states[current[k]].isFinal && currentStart[k] <= bestBegin)
+                {
+                    bestBegin = currentStart[k];
+                    bestEnd = i;
+                }
+            }
+            if (i == input.size())
+            {
+                break;
+            }
+
+            next.clear();
+            unsigned char c = static_cast<unsigned char>(input[i]);
+            for (uint32_t k = 0; k < current.size(); ++k)
+            {
+                // 已有匹配后，起点更晚的线程不可能更优
+                if (currentStart[k] > bestBegin)
+                {
+                    continue;
+                }
+                uint32_t s = current[k];
+                for (const Transition *t = nfa.edgesBegin(s); t != nfa.edgesEnd(s); ++t)
+                {
+                    if (t->accepts(c))
+                    {
+                        addThread(next, nextStart, t->target, currentStart[k]);
+                    }
+                }
+            }
+            std::swap(current, next);
+            std::swap(currentStart, nextStart);
+        }
+
+        if (bestBegin == NO_MATCH)
+        {
+            return false;
+        }
+        matchBegin = bestBegin;
+        matchEnd = bestEnd;
+        return true;
+    }
+};
+
+// 捕获组的匹配位置 [begin, end)，没有参与匹配的组两者都是 NO_POSITION
+struct Submatch
+{
+    static constexpr size_t NO_POSITION = SIZE_MAX;
+
+    size_t begin = NO_POSITION;
+    size_t end = NO_POSITION;
+
+    bool matched() const { return begin != NO_POSITION; }
+};
+
+// 下标0是整个匹配，1 .. groupCount() 是按左括号顺序编号的捕获组
+using Captures = std::vector<Submatch>;
+
+// 带标记的DFA（TDFA）：确定化时跟踪每个NFA状态经过的标记，把“记下当前位置”变成DFA转移上的寄存器操作，
+// 一遍扫描就得到捕获组的位置，不回溯，时间与输入长度成正比。
+// 语义：整个匹配是最左最长的，与 CompiledDFA 相同；有多条路径产生这个匹配时取优先级最高的一条：
+// 选择的左分支优先，* + ? 优先多匹配（与 Perl/RE2 的贪婪规则一致）。组在重复中匹配多次时取最后一次。
+//
+// DFA状态是按优先级排列的 (NFA状态, 每个标记所在的寄存器) 列表。读入一个字节后，各项的后继按优先级
+// 深度优先地做ε闭包，同一个NFA状态只保留第一次到达的一项，经过标记时这个标记改记“当前位置”。
+// 寄存器按第一次出现的顺序重新编号后列表相同的就是同一个DFA状态，编号前的来源（旧寄存器或当前位置）
+// 就是这条转移的寄存器操作。match() 是 const 的，寄存器在每个线程自己的缓冲区里
+class TaggedDFA
+{
+public:
+    static constexpr int32_t DEAD = -1;
+
+    explicit TaggedDFA(const std::string &regex) : bounds(compileRegex(regex))
+    {
+        std::string postfix = infixToTaggedPostfix(regex, groups);
+        tags = static_cast<uint32_t>(2 * groups);
+        NFA nfa = generateTaggedNFAFromPostfix(postfix);
+        build(nfa);
+    }
+
+    int groupCount() const { return groups; }
+    uint32_t stateCount() const { return static_cast<uint32_t>(accepting.size()); }
+    uint32_t registerCount() const { return registers; }
+
+    // 整个输入匹配时返回 true，captures 是各组的位置
+    bool match(std::string_view input, Captures &captures) const
+    {
+        thread_local std::vector<size_t> file, scratch;
+        file.resize(std::max<size_t>(registers, 1));
+        scratch.resize(file.size());
+        apply(startOps.data(), startOps.data() + startOps.size(), false, 0, file.data(), scratch.data());
+
+        uint32_t s = 0;
+        for (size_t i = 0; i < input.size(); ++i)
+        {
+            size_t index = static_cast<size_t>(s) * stride + classOf[static_cast<unsigned char>(input[i])];
+            int32_t target = transitions[index];
+            if (target == DEAD)
+            {
+                return false;
+            }
+            if (opStart[index] != opStart[index + 1])
+            {
+                apply(ops.data() + opStart[index], ops.data() + opStart[index + 1], parallel[index], i + 1, file.data(), scratch.data());
+            }
+            s = static_cast<uint32_t>(target);
+        }
+        if (!accepting[s])
+        {
+            return false;
+        }
+
+        captures.assign(groups + 1, Submatch());
+        captures[0] = Submatch{0, input.size()};
+        const uint32_t *final = finalRegisters.data() + static_cast<size_t>(s) * tags;
+        for (int g = 1; g <= groups; ++g)
+        {
+            size_t begin = file[final[2 * g - 2]], end = file[final[2 * g - 1]];
+            if (begin != Submatch::NO_POSITION && end != Submatch::NO_POSITION)
+            {
+                captures[g] = Submatch{begin, end};
+            }
+        }
+        return true;
+    }
+
+    // 最左最长匹配：先用普通的DFA（带预过滤）找到匹配的范围，再只在这个范围上求捕获组
+    bool find(std::string_view input, Captures &captures) const
+    {
+        size_t begin, end;
+        if (!bounds.find(input, begin, end))
+        {
+            return false;
+        }
+        match(input.substr(begin, end - begin), captures);
+        for (Submatch &submatch : captures)
+        {
+            if (submatch.matched())
+            {
+                submatch.begin += begin;
+                submatch.end += begin;
+            }
+        }
+        return true;
+    }
+
+private:
+    // 寄存器操作 dst = src，src 是来源状态的寄存器，或者下面两个特殊值
+    static constexpr uint32_t POSITION = UINT32_MAX;  // 当前位置
+    static constexpr uint32_t UNSET = UINT32_MAX - 1; // 还没有值
+
+    struct RegisterOp
+    {
+        uint32_t dst;
+        uint32_t src;
+    };
+
+    CompiledDFA bounds; // find() 用来确定匹配范围
+    int groups = 0;
+    uint32_t tags = 0;      // 每个捕获组两个标记：开始 2g-2，结束 2g-1
+    uint32_t registers = 0; // 所有状态中寄存器个数的最大值
+    uint32_t stride = 0;    // 字节类的个数
+    uint8_t classOf[256];
+    std::vector<int32_t> transitions;     // [状态 * stride + 类]，DEAD 表示失败
+    std::vector<uint32_t> opStart;        // 转移 i 的操作是 ops[opStart[i] .. opStart[i + 1])
+    std::vector<RegisterOp> ops;          // 只存改变寄存器的操作
+    std::vector<char> parallel;           // 转移的操作读到了同一转移中写入的寄存器，要先读出全部来源再写
+    std::vector<RegisterOp> startOps;     // 开始状态的寄存器初值
+    std::vector<char> accepting;
+    std::vector<uint32_t> finalRegisters; // [状态 * tags + 标记]：接受时各标记所在的寄存器
+
+    static void apply(const RegisterOp *op, const RegisterOp *end, bool parallel, size_t position, size_t *file, size_t *scratch)
+    {
+        auto value = [&](uint32_t src)
+        {
+            return src == POSITION ? position : src == UNSET ? Submatch::NO_POSITION : file[src];
+        };
+        if (!parallel)
+        {
+            for (; op != end; ++op)
+            {
+                file[op->dst] = value(op->src);
+            }
+            return;
+        }
+        size_t k = 0;
+        for (const RegisterOp *p = op; p != end; ++p)
+        {
+            scratch[k++] = value(p->src);
+        }
+        k = 0;
+        for (const RegisterOp *p = op; p != end; ++p)
+        {
+            file[p->dst] = scratch[k++];
+        }
+    }
+
+    void build(const NFA &nfa)
+    {
+        PhaseTimer timer(compileStats.subsetSeconds);
+        const uint32_t n = nfa.size();
+        ByteClasses classes(nfa, collectStatesFromNFA(nfa));
+        stride = static_cast<uint32_t>(classes.size());
+        for (int b = 0; b < 256; ++b)
+        {
+            classOf[b] = classes[static_cast<unsigned char>(b)];
+        }
+
+        // 只有非空转换或者是接受状态的NFA状态才记在DFA状态里，纯ε的中间状态只在闭包中经过
+        std::vector<char> kernel(n, 0);
+        for (uint32_t q = 0; q < n; ++q)
+        {
+            kernel[q] = nfa.states[q].isFinal;
+            for (const Transition *t = nfa.edgesBegin(q); !kernel[q] && t != nfa.edgesEnd(q); ++t)
+            {
+                kernel[q] = !t->epsilon;
+            }
+        }
+
+        // DFA状态的键：[项数, NFA状态..., 每项各标记的寄存器...]
+        StateSetMap stateMap;
+        std::vector<uint32_t> stamp(n, UINT32_MAX);
+        uint32_t epoch = 0;
+        std::vector<std::pair<uint32_t, size_t>> stack; // (NFA状态, pool 中来源的偏移)
+        std::vector<uint32_t> pool;                     // 闭包中每条路径上各标记的来源
+        std::vector<uint32_t> seedStates, itemStates, itemSources;
+        std::vector<size_t> seedSources;
+        std::vector<uint32_t> renumber, sourceOf, key;
+        std::vector<char> written;
+
+        // 按顺序对每个种子做闭包，结果是 itemStates 和每项 tags 个来源 itemSources
+        auto closure = [&]()
+        {
+            ++epoch;
+            itemStates.clear();
+            itemSources.clear();
+            for (size_t seed = 0; seed < seedStates.size(); ++seed)
+            {
+                stack.emplace_back(seedStates[seed], seedSources[seed]);
+                while (!stack.empty())
+                {
+                    uint32_t q = stack.back().first;
+                    size_t sources = stack.back().second;
+                    stack.pop_back();
+                    if (stamp[q] == epoch)
+                    {
+                        continue;
+                    }
+                    stamp[q] = epoch;
+                    if (kernel[q])
+                    {
+                        itemStates.push_back(q);
+                        itemSources.insert(itemSources.end(), pool.begin() + sources, pool.begin() + sources + tags);
+                    }
+                    // 倒序压栈，先处理优先级高的转换
+                    for (const Transition *t = nfa.edgesEnd(q); t != nfa.edgesBegin(q);)
+                    {
+                        --t;
+                        if (!t->epsilon || stamp[t->target] == epoch)
+                        {
+                            continue;
+                        }
+                        size_t next = sources;
+                        if (t->tag != 0)
+                        {
+                            next = pool.size();
+                            pool.resize(next + tags);
+                            std::copy(pool.begin() + sources, pool.begin() + sources + tags, pool.begin() + next);
+                            pool[next + t->tag - 1] = POSITION;
+                        }
+                        stack.emplace_back(t->target, next);
+                    }
+                }
+            }
+        };
+
+        // 闭包的结果编成DFA状态：寄存器按第一次出现的顺序编号，返回状态编号，ops 返回每个新寄存器的来源
+        auto intern = [&](uint32_t oldRegisters)
+        {
+            renumber.assign(oldRegisters + 2, UINT32_MAX);
+            sourceOf.clear();
+            key.assign(1, static_cast<uint32_t>(itemStates.size()));
+            key.insert(key.end(), itemStates.begin(), itemStates.end());
+            for (uint32_t source : itemSources)
+            {
+                uint32_t slot = source == POSITION ? oldRegisters : source == UNSET ? oldRegisters + 1 : source;
+                if (renumber[slot] == UINT32_MAX)
+                {
+                    renumber[slot] = static_cast<uint32_t>(sourceOf.size());
+                    sourceOf.push_back(source);
+                }
+                key.push_back(renumber[slot]);
+            }
+            uint64_t hash = StateSetMap::hashSet(key.data(), key.size());
+            int id = stateMap.find(key.data(), key.size(), hash);
+            if (id < 0)
+            {
+                id = stateMap.insert(key.data(), key.size(), hash);
+                registers = std::max(registers, static_cast<uint32_t>(sourceOf.size()));
+                accepting.push_back(0);
+                finalRegisters.resize(finalRegisters.size() + tags);
+                for (size_t item = 0; item < itemStates.size(); ++item)
+                {
+                    if (nfa.states[itemStates[item]].isFinal)
+                    {
+                        accepting.back() = 1;
+                        std::copy(key.begin() + 1 + itemStates.size() + item * tags, key.begin() + 1 + itemStates.size() + (item + 1) * tags,
+                                  finalRegisters.end() - tags);
+                        break; // 优先级最高的接受项
+                    }
+                }
+            }
+            return id;
+        };
+
+        // 不改变寄存器的操作（来源就是自己）不存
+        auto emitOps = [&](std::vector<RegisterOp> &out)
+        {
+            size_t first = out.size();
+            written.assign(sourceOf.size(), 0);
+            for (uint32_t dst = 0; dst < sourceOf.size(); ++dst)
+            {
+                if (sourceOf[dst] != dst)
+                {
+                    out.push_back(RegisterOp{dst, sourceOf[dst]});
+                    written[dst] = 1;
+                }
+            }
+            bool overlapping = false;
+            for (size_t k = first; k < out.size(); ++k)
+            {
+                overlapping = overlapping || (out[k].src < written.size() && written[out[k].src]);
+            }
+            return overlapping;
+        };
+
+        pool.assign(tags, UNSET);
+        seedStates.assign(1, nfa.start);
+        seedSources.assign(1, 0);
+        closure();
+        intern(0);
+        emitOps(startOps);
+
+        opStart.push_back(0);
+        for (uint32_t id = 0; id < stateMap.size(); ++id)
+        {
+            // 从键中取出这个状态的项；stateMap 会增长，先复制出来
+            std::vector<uint32_t> state(stateMap.data(static_cast<int>(id)), stateMap.data(static_cast<int>(id)) + stateMap.count(static_cast<int>(id)));
+            const uint32_t items = state[0];
+            uint32_t stateRegisters = 0;
+            pool.clear();
+            for (uint32_t item = 0; item < items; ++item)
+            {
+                for (uint32_t t = 0; t < tags; ++t)
+                {
+                    uint32_t r = state[1 + items + item * tags + t];
+                    pool.push_back(r);
+                    stateRegisters = std::max(stateRegisters, r + 1);
+                }
+            }
+            const size_t base = pool.size();
+
+            for (uint32_t c = 0; c < stride; ++c)
+            {
+                seedStates.clear();
+                seedSources.clear();
+                for (uint32_t item = 0; item < items; ++item)
+                {
+                    uint32_t q = state[1 + item];
+                    for (const Transition *t = nfa.edgesBegin(q); t != nfa.edgesEnd(q); ++t)
+                    {
+                        if (!t->epsilon && classes[t->lo] <= c && c <= classes[t->hi])
+                        {
+                            seedStates.push_back(t->target);
+                            seedSources.push_back(static_cast<size_t>(item) * tags);
+                        }
+                    }
+                }
+                pool.resize(base); // 丢掉上一个类的闭包中复制出来的来源
+                int32_t target = DEAD;
+                if (!seedStates.empty())
+                {
+                    closure();
+                    target = intern(stateRegisters);
+                }
+                transitions.push_back(target);
+                parallel.push_back(target != DEAD && emitOps(ops));
+                opStart.push_back(static_cast<uint32_t>(ops.size()));
+            }
+        }
+        trace<TraceLevel::Info>([&](std::ostream &out)
+                                { out << "Tagged DFA: " << stateCount() << " states, " << registers << " registers, "
+                                      << ops.size() << " register operations"; });
+    }
+};
+
+// 位并行的 Glushkov 自动机（shift-and 的推广）：每个字母出现的位置对应一位，
+// 第0位表示“还在开头”。状态是一个 uint64_t，一步转移为 follow(D) & B[c]，
+// follow 按字节查 8 张表。适用于不超过 63 个位置的模式
+class BitParallelMatcher
+{
+public:
+    static constexpr int MAX_POSITIONS = 63;
+
+    // 从后缀表达式构造，位置太多时返回 false
+    bool build(const std::string &postfix)
+    {
+        struct Item
+        {
+            bool nullable;
+            uint64_t first;
+            uint64_t last;
+        };
+        std::stack<Item> stack;
+        uint64_t follow[64] = {};
+        std::fill(std::begin(byteMask), std::end(byteMask), 0);
+        int positions = 0;
+
+        // 分配一个新位置，它接受 [lo, hi] 中的字节；超过上限时返回 0
+        auto newPosition = [&](uint8_t lo, uint8_t hi) -> uint64_t
+        {
+            if (++positions > MAX_POSITIONS)
+            {
+                return 0;
+            }
+            uint64_t bit = uint64_t(1) << positions;
+            for (int b = lo; b <= hi; ++b)
+            {
+                byteMask[b] |= bit;
+            }
+            return bit;
+        };
+        auto addFollow = [&](uint64_t from, uint64_t to)
+        {
+            for (int i = 1; i <= positions; ++i)
+            {
+                if ((from >> i) & 1)
+                {
+                    follow[i] |= to;
+                }
+            }
+        };
+
+        PostfixToken token;
+        for (size_t pos = 0; readPostfixToken(postfix, pos, token);)
+        {
+            if (token.kind == PostfixToken::Epsilon)
+            {
+                stack.push(Item{true, 0, 0}); // 空串
+            }
+            else if (token.kind == PostfixToken::Literal)
+            {
+                uint64_t bit = newPosition(token.byte, token.byte);
+                if (bit == 0)
+                {
+                    return false;
+                }
+                stack.push(Item{false, bit, bit});
+            }
+            else if (token.kind == PostfixToken::Class)
+            {
+                // 单字节的序列共用一个位置，多字节序列是若干位置的串联，整体是它们的并
+                Item item{false, 0, 0};
+                uint64_t single = 0;
+                for (const ByteRangeSequence &sequence : utf8Sequences(token.ranges))
+                {
+                    uint64_t previous = 0;
+                    for (size_t k = 0; k < sequence.size(); ++k)
+                    {
+                        uint64_t bit;
+                        if (sequence.size() == 1 && single != 0)
+                        {
+                            bit = single;
+                            for (int b = sequence[k].first; b <= sequence[k].second; ++b)
+                            {
+                                byteMask[b] |= bit;
+                            }
+                        }
+                        else if ((bit = newPosition(sequence[k].first, sequence[k].second)) == 0)
+                        {
+                            return false;
+                        }
+                        single = sequence.size() == 1 ? bit : single;
+                        if (k == 0)
+                        {
+                            item.first |= bit;
+                        }
+                        else
+                        {
+                            addFollow(previous, bit);
+                        }
+                        previous = bit;
+                    }
+                    item.last |= previous;
+                }
+                stack.push(item);
+            }
+            else if (token.kind == PostfixToken::Alternate || token.kind == PostfixToken::Concat)
+            {
+                Item b = stack.top();
+                stack.pop();
+                Item a = stack.top();
+                stack.pop();
+                if (token.kind == PostfixToken::Alternate)
+                {
+                    stack.push(Item{a.nullable || b.nullable, a.first | b.first, a.last | b.last});
+                }
+                else
+                {
+                    addFollow(a.last, b.first);
+                    stack.push(Item{a.nullable && b.nullable, a.nullable ? a.first | b.first : a.first,
+                                    b.nullable ? a.last | b.last : b.last});
+                }
+            }
+            else if (token.kind == PostfixToken::Star || token.kind == PostfixToken::Plus)
+            {
+                Item a = stack.top();
+                stack.pop();
+                addFollow(a.last, a.first);
+                stack.push(Item{token.kind == PostfixToken::Star || a.nullable, a.first, a.last});
+            }
+            else if (token.kind == PostfixToken::Optional)
+            {
+                Item a = stack.top();
+                stack.pop();
+                stack.push(Item{true, a.first, a.last});
+            }
+        }
+        if (stack.empty())
+        {
+            return false;
+        }
+
+        Item top = stack.top();
+        follow[0] = top.first;
+        acceptMask = top.last | (top.nullable ? 1 : 0);
+        for (int k = 0; k < 8; ++k)
+        {
+            for (int b = 0; b < 256; ++b)
+            {
+                uint64_t mask = 0;
+                for (int j = 0; j < 8; ++j)
+                {
+                    if ((b >> j) & 1)
+                    {
+                        mask |= follow[8 * k + j];
+                    }
+                }
+                followTable[k][b] = mask;
+            }
+        }
+        return true;
+    }
+
+    bool fullMatch(std::string_view input) const
+    {
+        uint64_t d = 1;
+        for (unsigned char c : input)
+        {
+            d = step(d, c);
+            if (d == 0)
+            {
+                return false;
+            }
+        }
+        return (d & acceptMask) != 0;
+    }
+
+    bool prefixMatch(std::string_view input, size_t &matchLength) const
+    {
+        uint64_t d = 1;
+        size_t last = (d & acceptMask) ? 0 : SIZE_MAX;
+        for (size_t i = 0; i < input.size() && d != 0; ++i)
+        {
+            d = step(d, static_cast<unsigned char>(input[i]));
+            last = (d & acceptMask) ? i + 1 : last;
+        }
+        if (last == SIZE_MAX)
+        {
+            return false;
+        }
+        matchLength = last;
+        return true;
+    }
+
+    // 最左最长匹配，一遍扫描：每个起点是一个线程，状态是它的位向量，线程按起点从早到晚排列。
+    // 转移对每一位是独立的，起点早的线程已经有的位，后来的线程再有也只能得到更靠右的匹配，所以去掉；
+    // 每个活着的线程至少独占一位，最多 MAX_POSITIONS 个，加上这一步新开始的一个。
+    // 有线程接受后起点更晚的线程全部丢掉，也不再加入新线程（同 LazyDFA::find）
+    bool find(std::string_view input, size_t &matchBegin, size_t &matchEnd) const
+    {
+        struct Thread
+        {
+            uint64_t d;
+            size_t start;
+        };
+        Thread threads[MAX_POSITIONS + 1];
+        size_t count = 0;
+        const bool emptyMatch = (acceptMask & 1) != 0;
+        size_t bestBegin = SIZE_MAX, bestEnd = 0;
+        for (size_t i = 0;; ++i)
+        {
+            if (bestBegin == SIZE_MAX && (emptyMatch || (i < input.size() && step(1, static_cast<unsigned char>(input[i])) != 0)))
+            {
+                threads[count++] = Thread{1, i};
+            }
+            for (size_t k = 0; k < count; ++k)
+            {
+                if (threads[k].d & acceptMask)
+                {
+                    bestBegin = threads[k].start;
+                    bestEnd = i;
+                    count = k + 1;
+                    break;
+                }
+            }
+            if (i == input.size() || (count == 0 && bestBegin != SIZE_MAX))
+            {
+                break;
+            }
+            uint64_t owned = 0;
+            size_t alive = 0;
+            for (size_t k = 0; k < count; ++k)
+            {
+                uint64_t d = step(threads[k].d, static_cast<unsigned char>(input[i])) & ~owned;
+                if (d != 0)
+                {
+                    owned |= d;
+                    threads[alive++] = Thread{d, threads[k].start};
+                }
+            }
+            count = alive;
+        }
+        if (bestBegin == SIZE_MAX)
+        {
+            return false;
+        }
+        matchBegin = bestBegin;
+        matchEnd = bestEnd;
+        return true;
+    }
+
+private:
+    uint64_t byteMask[256];
+    uint64_t followTable[8][256];
+    uint64_t acceptMask = 0;
+
+    uint64_t step(uint64_t d, unsigned char c) const
+    {
+        uint64_t reach = 0;
+        for (int k = 0; k < 8; ++k)
+        {
+            reach |= followTable[k][(d >> (8 * k)) & 0xff];
+        }
+        return reach & byteMask[c];
+    }
+};
+
+// 模式规模（Glushkov 位置数）：每个字面字节一个位置，字符类中单字节的部分共用一个位置，
+// 多字节的 UTF-8 序列每个字节一个位置
+size_t countPositions(const std::string &postfix)
+{
+    size_t positions = 0;
+    PostfixToken token;
+    for (size_t pos = 0; readPostfixToken(postfix, pos, token);)
+    {
+        if (token.kind == PostfixToken::Literal)
+        {
+            ++positions;
+        }
+        else if (token.kind == PostfixToken::Class)
+        {
+            bool single = false;
+            for (const ByteRangeSequence &sequence : utf8Sequences(token.ranges))
+            {
+                single = single || sequence.size() == 1;
+                positions += sequence.size() == 1 ? 0 : sequence.size();
+            }
+            positions += single ? 1 : 0;
+        }
+    }
+    return positions;
+}
+
+// 执行方式
+enum class ExecutionEngine
+{
+    BitParallel, // 位并行 Glushkov，构造代价几乎为零
+    PikeVM,      // 直接模拟NFA
+    LazyDFA,     // 按需构造DFA
+    CompiledDFA  // 完整的确定化 + 最小化
+};
+
+// 根据预计要扫描的输入长度和模式规模选择执行方式。先看输入长度：
+// 输入相对模式足够长时，确定化的代价摊得回来，用DFA（每个字节一次查表，基准中比位并行快两倍以上），
+// 模式很大时用惰性DFA限制内存；输入短时不做确定化，小模式用位并行，其余直接模拟NFA
+constexpr ExecutionEngine chooseEngine(size_t positions, size_t nfaStates, size_t expectedInputLength)
+{
+    if (expectedInputLength >= nfaStates * 64)
+    {
+        return nfaStates > 20000 ? ExecutionEngine::LazyDFA : ExecutionEngine::CompiledDFA;
+    }
+    if (positions <= static_cast<size_t>(BitParallelMatcher::MAX_POSITIONS))
+    {
+        return ExecutionEngine::BitParallel;
+    }
+    return ExecutionEngine::PikeVM;
+}
+
+static_assert(chooseEngine(8, 20, size_t(1) << 30) == ExecutionEngine::CompiledDFA, "长输入上小模式也用DFA");
+static_assert(chooseEngine(8, 20, 64) == ExecutionEngine::BitParallel, "短输入上的小模式用位并行");
+static_assert(chooseEngine(500, 1000, 64) == ExecutionEngine::PikeVM, "短输入上的大模式直接模拟NFA");
+static_assert(chooseEngine(5000, 30000, size_t(1) << 30) == ExecutionEngine::LazyDFA, "长输入上的超大模式用惰性DFA");
+
+#if defined(__cpp_nontype_template_args) && __cpp_nontype_template_args >= 201911L
+// 编译期流水线（解析、Thompson 构造、子集构造、最小化）只有实例化时才会被编译，这几个断言让它的回归直接让构建失败
+static_assert(compileRegex<"a|(b|c)d*">().fullMatch("cddd") && compileRegex<"a|(b|c)d*">().fullMatch("a") &&
+                  !compileRegex<"a|(b|c)d*">().fullMatch("ad"),
+              "编译期编译的选择和闭包");
+static_assert(compileRegex<"x[0-9]{1,2}">().fullMatch("x42") && !compileRegex<"x[0-9]{1,2}">().fullMatch("x420"),
+              "编译期编译的字符类和有界重复");
+static_assert(compileRegex<"(a|b)*abb">().fullMatch("babb") && !compileRegex<"(a|b)*abb">().fullMatch("abba"),
+              "编译期编译的子集构造");
+static_assert(compileRegex<"(a|b)*abb">().stateCount() == 5, "编译期编译的结果是最小DFA（4个状态加死状态）");
+static_assert(compileRegex<"(?-u:[\\x80-\\xBF])">().fullMatch("\x80") && !compileRegex<"(?-u:[\\x80-\\xBF])">().fullMatch("\xC2\x80") &&
+                  compileRegex<"[\\xE9]">().fullMatch("\xC3\xA9"),
+              "编译期编译的字节模式字符类");
+#endif
+
+// 一个模式的执行方式：完整编译的 CompiledDFA、惰性DFA、位并行或者直接模拟NFA（Pike VM）。
+// 资源受限编译退回惰性DFA时，惰性DFA只构造输入实际走到的状态，缓存的状态数由预算决定，
+// 缓存抖动时它自己再退回NFA模拟，所以不管模式是什么，匹配占用的内存都有上限。
+// 惰性DFA和 Pike VM 匹配时会修改内部状态，一个 ExecutionPlan 同一时间只在一个线程里使用
+class ExecutionPlan
+{
+public:
+    explicit ExecutionPlan(CompiledDFA _dfa) : dfa(std::move(_dfa)) {}
+    ExecutionPlan(std::unique_ptr<LazyDFA> _lazy, std::optional<CompileLimitError> _fallback = std::nullopt)
+        : lazy(std::move(_lazy)), fallback(std::move(_fallback)) {}
+    explicit ExecutionPlan(std::unique_ptr<BitParallelMatcher> _bitParallel) : bitParallel(std::move(_bitParallel)) {}
+    // Pike VM 引用它模拟的NFA，NFA放在堆上，移动 ExecutionPlan 时地址不变
+    explicit ExecutionPlan(std::unique_ptr<NFA> _nfa) : nfa(std::move(_nfa)), pike(std::make_unique<PikeVM>(*nfa)) {}
+
+    ExecutionEngine engine() const
+    {
+        if (dfa)
+        {
+            return ExecutionEngine::CompiledDFA;
+        }
+        if (bitParallel)
+        {
+            return ExecutionEngine::BitParallel;
+        }
+        if (pike)
+        {
+            return ExecutionEngine::PikeVM;
+        }
+        return lazy->usingNFASimulation() ? ExecutionEngine::PikeVM : ExecutionEngine::LazyDFA;
+    }
+
+    // 因为超出预算而退回惰性DFA时是超出的那一项上限，其余情况为空
+    const CompileLimitError *fallbackError() const { return fallback ? &*fallback : nullptr; }
+
+    // 完整编译时的DFA，可以保存、生成代码或者共享给多个线程；其余执行方式为空
+    const CompiledDFA *compiled() const { return dfa ? &*dfa : nullptr; }
+
+    // 把完整编译的DFA移交出去（例如放进 RegexCache），之后 compiled() 为空，这个执行方式不能再用来匹配
+    std::optional<CompiledDFA> releaseCompiled() { return std::exchange(dfa, std::nullopt); }
+
+    bool fullMatch(std::string_view input)
+    {
+        return dfa ? dfa->fullMatch(input) : bitParallel ? bitParallel->fullMatch(input)
+                                         : pike        ? pike->fullMatch(input)
+                                                       : lazy->fullMatch(input);
+    }
+
+    bool prefixMatch(std::string_view input, size_t &matchLength)
+    {
+        return dfa ? dfa->prefixMatch(input, matchLength) : bitParallel ? bitParallel->prefixMatch(input, matchLength)
+                                                        : pike        ? pike->prefixMatch(input, matchLength)
+                                                                      : lazy->prefixMatch(input, matchLength);
+    }
+
+    bool find(std::string_view input, size_t &matchBegin, size_t &matchEnd)
+    {
+        return dfa ? dfa->find(input, matchBegin, matchEnd) : bitParallel ? bitParallel->find(input, matchBegin, matchEnd)
+                                                            : pike        ? pike->find(input, matchBegin, matchEnd)
+                                                                          : lazy->find(input, matchBegin, matchEnd);
+    }
+
+private:
+    std::optional<CompiledDFA> dfa;
+    std::unique_ptr<LazyDFA> lazy;
+    std::unique_ptr<BitParallelMatcher> bitParallel;
+    std::unique_ptr<NFA> nfa;
+    std::unique_ptr<PikeVM> pike;
+    std::optional<CompileLimitError> fallback;
+};
+
+// 在 limits 之内编译正则表达式，给不能信任的模式（例如多租户服务中用户提供的规则）用。
+// 整个调用共用一个预算：期限从调用开始算起，内存按同时存在的数据结构计算，退回的步骤不会重新计时。
+// NFA只构造一次：化简超出预算时直接用没有化简的NFA，子集构造或最小化超出预算时用已经构造好的NFA，退回惰性DFA。
+// 惰性DFA的缓存按同样的上限设置：状态数上限直接作为缓存的状态数，内存上限作为整个惰性DFA的字节数上限。
+// 解析和 Thompson 构造本身超出预算时（NFA 与展开有界重复之后的模式同样大）没有更小的执行方式，
+// 照常抛出 CompileLimitError；语法错误抛出 RegexSyntaxError
+ExecutionPlan compileBounded(const std::string &regex, const CompileLimits &limits, RegexCompiler::Options options = {})
+{
+    options.limits = limits;
+    RegexCompiler compiler(options);
+    CompileStats stats;
+    BudgetScope budget(limits, stats); // 下面各步的 BudgetScope 都用这一个预算
+
+    NFA nfa = compiler.parse(regex);
+    auto fallback = [&](const CompileLimitError &error)
+    {
+        trace<TraceLevel::Info>([&](std::ostream &out)
+                                { out << "compileBounded: " << error.what() << ", falling back to a lazy DFA"; });
+        const size_t cachedStates = limits.maxDFAStates > 0 ? limits.maxDFAStates : 4096;
+        return ExecutionPlan(std::make_unique<LazyDFA>(nfa, collectStatesFromNFA(nfa), cachedStates, 10, 3, limits.maxMemoryBytes), error);
+    };
+
+    if (options.optimizeNFA)
+    {
+        try
+        {
+            NFA simple = compiler.optimize(nfa);
+            releaseCompileMemory(nfa.memoryBytes());
+            nfa = std::move(simple);
+        }
+        catch (const CompileLimitError &error)
+        {
+            return fallback(error);
+        }
+    }
+    try
+    {
+        DFA dfa = compiler.determinize(nfa);
+        MinimizedDFA minimal = compiler.minimize(dfa);
+        CompiledDFA compiled(minimal);
+        compiled.attachLiterals(regexLiterals(regex));
+        return ExecutionPlan(std::move(compiled));
+    }
+    catch (const CompileLimitError &error)
+    {
+        return fallback(error);
+    }
+}
+
+// 按 chooseEngine 的选择构造执行方式，expectedInputLength 是预计每次匹配扫描的字节数。
+// 选中DFA时按 limits 完整编译（见 compileBounded），超出预算同样退回惰性DFA
+ExecutionPlan planExecution(const std::string &regex, size_t expectedInputLength, const CompileLimits &limits = {},
+                            RegexCompiler::Options options = {})
+{
+    const std::string postfix = infixToPostfix(regex);
+    options.limits = limits;
+    RegexCompiler compiler(options);
+    NFA nfa = compiler.parse(regex);
+    switch (chooseEngine(countPositions(postfix), nfa.size(), expectedInputLength))
+    {
+    case ExecutionEngine::BitParallel:
+    {
+        auto bitParallel = std::make_unique<BitParallelMatcher>();
+        if (bitParallel->build(postfix))
+        {
+            return ExecutionPlan(std::move(bitParallel));
+        }
+        return ExecutionPlan(std::make_unique<NFA>(std::move(nfa))); // 模式中有位并行不支持的结构
+    }
+    case ExecutionEngine::PikeVM:
+        return ExecutionPlan(std::make_unique<NFA>(std::move(nfa)));
+    case ExecutionEngine::LazyDFA:
+        return ExecutionPlan(std::make_unique<LazyDFA>(nfa, collectStatesFromNFA(nfa)));
+    default:
+        return compileBounded(regex, limits, options);
+    }
+}
+
+// 进程内的编译结果缓存：同样的正则表达式（或模式集合）只编译一次，之后的使用只需一次哈希查找。
+//   auto dfa = RegexCache::global().get("error: [0-9]+");
+// 条目以编译选项加规范化后的模式为键（解析并化简后的后缀式，写法不同但等价的模式共用一项），
+// 另有一层原始文本到条目的别名，命中时不必重新解析。两层都分片，各片一把读写锁，命中只取读锁。
+// 选项中的 limits 和 optimizeNFA 是键的一部分：同一个模式在较宽的上限下编译成功，不代表在较严的上限下也能用；
+// threads 不影响结果，不在键里。单个正则表达式经 compileBounded 编译，超出 limits 时抛出它退回惰性DFA的
+// 那个 CompileLimitError（惰性DFA匹配时会修改自己，不能在线程之间共享）。
+// 同一个键并发未命中时只有一个线程编译，其他线程等待它的结果（single-flight）；编译失败的异常传给所有等待者，
+// 不缓存。每片有 budget / 片数 的字节预算，超出时淘汰最久没有使用的条目：每片把已完成的条目按使用顺序串成链表，
+// 命中时把条目移到表头，淘汰时从表尾取，都是常数时间。
+// 返回的 CompiledDFA 与缓存共享，条目被淘汰后仍然有效
+class RegexCache
+{
+public:
+    static constexpr size_t DEFAULT_BUDGET = size_t(64) << 20;
+    static constexpr int SHARD_BITS = 4;
+    static constexpr size_t SHARDS = size_t(1) << SHARD_BITS;
+
+    struct Counters
+    {
+        uint64_t hits = 0;        // 找到已编译（或正在编译）的条目
+        uint64_t misses = 0;      // 由本次调用编译
+        uint64_t coalesced = 0;   // 命中中等待其他线程正在进行的编译的次数
+        uint64_t evictions = 0;
+        uint64_t failures = 0;    // 编译失败（语法错误）
+        uint64_t entries = 0;
+        uint64_t bytes = 0;
+    };
+
+    explicit RegexCache(size_t _budget = DEFAULT_BUDGET) : budget(_budget) {}
+
+    RegexCache(const RegexCache &) = delete;
+    RegexCache &operator=(const RegexCache &) = delete;
+
+    // 整个进程共用的缓存
+    static RegexCache &global()
+    {
+        static RegexCache cache;
+        return cache;
+    }
+
+    std::shared_ptr<const CompiledDFA> get(const std::string &regex, const RegexCompiler::Options &options = {})
+    {
+        const std::string prefix = "R" + optionsKey(options);
+        return lookup(prefix + regex, [&]
+                      { return prefix + infixToPostfix(regex); },
+                      [&]
+                      {
+                          ExecutionPlan plan = compileBounded(regex, options.limits, options);
+                          if (const CompileLimitError *error = plan.fallbackError())
+                          {
+                              throw *error;
+                          }
+                          return std::move(*plan.releaseCompiled()); });
+    }
+
+    // 模式集合：顺序和优先级都是键的一部分，每个模式写成 "优先级,长度:文本"。
+    // 集合没有退回的执行方式，超出 limits 时 RegexCompiler 直接抛出 CompileLimitError
+    std::shared_ptr<const CompiledDFA> get(const std::vector<PatternSpec> &patterns, const RegexCompiler::Options &options = {})
+    {
+        auto append = [](std::string &key, int priority, const std::string &text)
+        {
+            key += std::to_string(priority) + ',' + std::to_string(text.size()) + ':' + text;
+        };
+        const std::string prefix = "S" + optionsKey(options);
+        std::string raw = prefix;
+        for (const PatternSpec &pattern : patterns)
+        {
+            append(raw, pattern.priority, pattern.regex);
+        }
+        return lookup(raw, [&]
+                      {
+                          std::string key = prefix;
+                          for (const PatternSpec &pattern : patterns)
+                          {
+                              append(key, pattern.priority, infixToPostfix(pattern.regex));
+                          }
+                          return key; },
+                      [&]
+                      { return RegexCompiler(options).compile(patterns); });
+    }
+
+    Counters counters() const
+    {
+        Counters c;
+        c.hits = hits.load(std::memory_order_relaxed);
+        c.misses = misses.load(std::memory_order_relaxed);
+        c.coalesced = coalesced.load(std::memory_order_relaxed);
+        c.evictions = evictions.load(std::memory_order_relaxed);
+        c.failures = failures.load(std::memory_order_relaxed);
+        for (const EntryShard &shard : entryShards)
+        {
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            c.entries += shard.entries.size();
+            c.bytes += shard.bytes;
+        }
+        return c;
+    }
+
+    void clear()
+    {
+        for (EntryShard &shard : entryShards)
+        {
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            std::lock_guard<std::mutex> recencyLock(shard.recencyMutex);
+            for (Entry *entry : shard.recency)
+            {
+                entry->listed = false;
+            }
+            shard.recency.clear();
+            shard.entries.clear();
+            shard.bytes = 0;
+        }
+        for (AliasShard &shard : aliasShards)
+        {
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            shard.aliases.clear();
+        }
+    }
+
+private:
+    using Result = std::shared_ptr<const CompiledDFA>;
+
+    struct EntryShard;
+
+    struct Entry
+    {
+        std::shared_future<Result> result;
+        size_t charge = 0; // 编译完成之前为 0，不计入预算，也不会被淘汰
+        EntryShard *shard = nullptr;
+        const std::string *key = nullptr; // entries 中这一项的键，结点不随重新散列移动
+        // 下面两项由 shard->recencyMutex 保护。listed 为真时条目在 recency 链表中，position 是它的位置
+        bool listed = false;
+        std::list<Entry *>::iterator position;
+    };
+
+    // recency 只含已完成的条目，表头是最近使用的。命中只取读锁，移动链表另用一把互斥锁，临界区只有一次 splice；
+    // 增删链表结点时两把锁都要持有（先 mutex 后 recencyMutex）
+    struct alignas(64) EntryShard
+    {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<std::string, std::shared_ptr<Entry>> entries;
+        size_t bytes = 0;
+        std::mutex recencyMutex;
+        std::list<Entry *> recency;
+    };
+
+    // 别名不拥有条目，条目被淘汰后自然失效；失效的别名在表变大时清理
+    struct alignas(64) AliasShard
+    {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<std::string, std::weak_ptr<Entry>> aliases;
+        size_t purgeAt = 64;
+    };
+
+    size_t budget;
+    EntryShard entryShards[SHARDS];
+    AliasShard aliasShards[SHARDS];
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> coalesced{0};
+    std::atomic<uint64_t> evictions{0};
+    std::atomic<uint64_t> failures{0};
+
+    static size_t shardOf(const std::string &key)
+    {
+        return static_cast<size_t>((std::hash<std::string>()(key) * 0x9E3779B97F4A7C15ull) >> (64 - SHARD_BITS));
+    }
+
+    // 编译选项中影响结果的部分
+    static std::string optionsKey(const RegexCompiler::Options &options)
+    {
+        const CompileLimits &limits = options.limits;
+        return std::to_string(options.optimizeNFA) + ',' + std::to_string(limits.maxDFAStates) + ',' +
+               std::to_string(limits.maxMemoryBytes) + ',' + std::to_string(limits.timeout.count()) + ';';
+    }
+
+    Result use(Entry &entry)
+    {
+        {
+            std::lock_guard<std::mutex> lock(entry.shard->recencyMutex);
+            if (entry.listed)
+            {
+                entry.shard->recency.splice(entry.shard->recency.begin(), entry.shard->recency, entry.position);
+            }
+        }
+        if (entry.result.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            coalesced.fetch_add(1, std::memory_order_relaxed);
+        }
+        return entry.result.get();
+    }
+
+    template <typename Normalize, typename Compile>
+    Result lookup(const std::string &raw, Normalize &&normalize, Compile &&compile)
+    {
+        AliasShard &aliasShard = aliasShards[shardOf(raw)];
+        {
+            std::shared_lock<std::shared_mutex> lock(aliasShard.mutex);
+            auto found = aliasShard.aliases.find(raw);
+            std::shared_ptr<Entry> entry = found != aliasShard.aliases.end() ? found->second.lock() : nullptr;
+            if (entry)
+            {
+                lock.unlock();
+                hits.fetch_add(1, std::memory_order_relaxed);
+                return use(*entry);
+            }
+        }
+
+        std::string key;
+        try
+        {
+            key = normalize();
+        }
+        catch (...)
+        {
+            failures.fetch_add(1, std::memory_order_relaxed);
+            throw;
+        }
+        EntryShard &shard = entryShards[shardOf(key)];
+        std::shared_ptr<Entry> entry;
+        std::promise<Result> promise;
+        bool owner = false;
+        {
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            auto found = shard.entries.find(key);
+            if (found != shard.entries.end())
+            {
+                entry = found->second;
+            }
+            else
+            {
+                entry = std::make_shared<Entry>();
+                entry->result = promise.get_future().share();
+                entry->shard = &shard;
+                entry->key = &shard.entries.emplace(key, entry).first->first;
+                owner = true;
+            }
+        }
+        addAlias(aliasShard, raw, entry);
+        if (!owner)
+        {
+            hits.fetch_add(1, std::memory_order_relaxed);
+            return use(*entry);
+        }
+
+        misses.fetch_add(1, std::memory_order_relaxed);
+        Result result;
+        try
+        {
+            result = std::make_shared<const CompiledDFA>(compile());
+        }
+        catch (...)
+        {
+            failures.fetch_add(1, std::memory_order_relaxed);
+            {
+                std::unique_lock<std::shared_mutex> lock(shard.mutex);
+                auto self = shard.entries.find(key);
+                if (self != shard.entries.end() && self->second == entry)
+                {
+                    shard.entries.erase(self);
+                }
+            }
+            promise.set_exception(std::current_exception());
+            throw;
+        }
+        promise.set_value(result);
+        charge(shard, key, *entry, result->memoryBytes() + key.size() + sizeof(Entry));
+        return result;
+    }
+
+    void addAlias(AliasShard &shard, const std::string &raw, const std::shared_ptr<Entry> &entry)
+    {
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        shard.aliases[raw] = entry;
+        if (shard.aliases.size() >= shard.purgeAt)
+        {
+            for (auto it = shard.aliases.begin(); it != shard.aliases.end();)
+            {
+                it = it->second.expired() ? shard.aliases.erase(it) : std::next(it);
+            }
+            shard.purgeAt = std::max<size_t>(64, shard.aliases.size() * 2);
+        }
+    }
+
+    // 编译完成的条目计入预算并放到 recency 表头，超出时从表尾（最久没有使用）开始淘汰其他已完成的条目。
+    // 单个条目就超过一片的预算时不缓存
+    void charge(EntryShard &shard, const std::string &key, Entry &entry, size_t bytes)
+    {
+        const size_t shardBudget = budget / SHARDS;
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        auto self = shard.entries.find(key);
+        if (self == shard.entries.end() || self->second.get() != &entry)
+        {
+            return; // 编译期间被 clear() 清掉了
+        }
+        if (bytes > shardBudget)
+        {
+            shard.entries.erase(self);
+            evictions.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        std::lock_guard<std::mutex> recencyLock(shard.recencyMutex);
+        entry.charge = bytes;
+        shard.bytes += bytes;
+        entry.position = shard.recency.insert(shard.recency.begin(), &entry);
+        entry.listed = true;
+        while (shard.bytes > shardBudget && shard.recency.back() != &entry)
+        {
+            Entry *oldest = shard.recency.back();
+            shard.recency.pop_back();
+            oldest->listed = false;
+            shard.bytes -= oldest->charge;
+            shard.entries.erase(shard.entries.find(*oldest->key)); // 键就在要删除的结点里，先找到结点
+            evictions.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+};
+
+// 基准测试：分别计时编译流水线的各个阶段，并测量各执行引擎的匹配吞吐量。
+// 每个用例输出一行JSON，便于在不同版本之间比较
+constexpr int kBenchFormatVersion = 14;
+
+// 上次调用以来进程的峰值常驻内存（KB）。每个基准用例输出时调用一次，得到的就是这个用例的峰值。
+// Linux 读 /proc/self/status 中的 VmHWM，再写 /proc/self/clear_refs 把峰值重设为当前值；
+// 其他平台的峰值不能重设（进程级的峰值只增不减，分不出用例），返回 -1
+long casePeakMemoryKB()
+{
+#ifdef __linux__
+    long peak = -1;
+    std::ifstream status("/proc/self/status");
+    for (std::string line; std::getline(status, line);)
+    {
+        if (line.compare(0, 6, "VmHWM:") == 0)
+        {
+            peak = std::strtol(line.c_str() + 6, nullptr, 10);
+        }
+    }
+    std::ofstream("/proc/self/clear_refs") << "5";
+    return peak;
+#else
+    return -1;
+#endif
+}
+
+// 重复执行 body，返回单次耗时的最小值（秒）
+template <typename Body>
+double benchMinSeconds(int repeats, Body &&body)
+{
+    double best = 1e30;
+    for (int r = 0; r < repeats; ++r)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        body();
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count());
+    }
+    return best;
+}
+
+struct BenchCase
+{
+    std::string family;
+    int parameter;
+    std::string regex;
+    std::string alphabet; // 生成匹配输入用的字母
+};
+
+std::vector<BenchCase> benchCases(bool quick)
+{
+    std::vector<BenchCase> cases;
+
+    // 嵌套的星号：((a*)*)*...
+    for (int depth : quick ? std::vector<int>{4, 16} : std::vector<int>{4, 16, 64, 256})
+    {
+        std::string regex = "a";
+        for (int i = 0; i < depth; ++i)
+        {
+            regex = "(" + regex + ")*";
+        }
+        cases.push_back({"nested_star", depth, regex, "ab"});
+    }
+
+    // (a|b)*a(a|b){n}：DFA状态数随 n 指数增长
+    for (int n : quick ? std::vector<int>{4, 8} : std::vector<int>{4, 8, 12, 14})
+    {
+        std::string regex = "(a|b)*a";
+        for (int i = 0; i < n; ++i)
+        {
+            regex += "(a|b)";
+        }
+        cases.push_back({"ab_star_a_ab_n", n, regex, "ab"});
+    }
+
+    // 大量字面量的选择
+    std::mt19937 rng(12345);
+    for (int words : quick ? std::vector<int>{10, 100} : std::vector<int>{10, 100, 1000, 5000})
+    {
+        std::string regex;
+        for (int i = 0; i < words; ++i)
+        {
+            if (i > 0)
+            {
+                regex += '|';
+            }
+            int length = 4 + static_cast<int>(rng() % 7);
+            for (int k = 0; k < length; ++k)
+            {
+                regex += static_cast<char>('a' + rng() % 26);
             }
-            stateName.back() = '}'; // 替换最后的逗号
+        }
+        cases.push_back({"literal_alternation", words, regex, "abcdefghijklmnopqrstuvwxyz"});
+    }
+    return cases;
+}
+
+// 预过滤器：在合成的日志文本上（匹配很少）比较有字面量分析和只有首字节过滤时
+// 非锚定查找所有匹配、grep 逐行判断的吞吐量
+void runPrefilterBenchmarks(bool quick, std::ostream &out)
+{
+    const int repeats = quick ? 2 : 5;
+    const size_t inputBytes = quick ? (size_t(1) << 20) : (size_t(16) << 20);
+    static const char *levels[] = {"scalar", "sse2", "ssse3", "avx2"};
+    static const char *words[] = {"request", "handled", "user", "session", "cache", "lookup", "status", "worker"};
+
+    std::mt19937 rng(7);
+    std::string input;
+    while (input.size() < inputBytes)
+    {
+        input += "2024-05-0" + std::to_string(1 + rng() % 9) + " INFO " + words[rng() % 8] + " id=" + std::to_string(rng() % 100000) +
+                 " " + words[rng() % 8] + " in " + std::to_string(rng() % 1000) + " ms\n";
+        if (rng() % 1000 == 0)
+        {
+            input += "2024-05-09 ERROR worker timeout after " + std::to_string(rng() % 1000) + " ms\n";
+        }
+    }
+    const double megabytes = static_cast<double>(input.size()) / (1024.0 * 1024.0);
 
-            if (dfaState->isFinal)
+    const std::vector<std::pair<std::string, std::string>> cases = {
+        {"literal", "ERROR"},
+        {"prefix_set", "(timeout|refused|reset)\\ after"},
+        {"required_factor", "[a-z]+\\ timeout\\ after\\ [0-9]+\\ ms"},
+        {"digits", "[0-9]+\\ ms"}}; // 空格在正则表达式里表示空串，要写成 "\\ "
+    for (const auto &[name, regex] : cases)
+    {
+        RegexCompiler compiler;
+        CompiledDFA filtered = compiler.compile(regex);
+        CompiledDFA plain(compiler.minimize(compiler.determinize(compiler.parse(regex)))); // 同一个DFA，只有首字节过滤
+        volatile size_t sink = 0;
+        auto findAll = [&](const CompiledDFA &dfa)
+        {
+            size_t matches = 0, position = 0, begin, end;
+            while (position <= input.size() && dfa.find(input.data() + position, input.size() - position, begin, end))
             {
-                outfile << "  \"" << stateName << "\" [shape = doublecircle];\n";
+                ++matches;
+                position += end > begin ? end : begin + 1;
             }
-            else
+            sink = sink + matches;
+        };
+        auto grepAll = [&](const CompiledDFA &dfa)
+        {
+            size_t lines = 0;
+            grepBuffer(dfa, input.data(), input.size(), [&](size_t, size_t)
+                       { ++lines; });
+            sink = sink + lines;
+        };
+        double findFiltered = benchMinSeconds(repeats, [&]
+                                              { findAll(filtered); });
+        double findPlain = benchMinSeconds(repeats, [&]
+                                           { findAll(plain); });
+        // 搜索DFA第一次用到时才构造，先构造好，不计入扫描时间
+        filtered.searchDFA();
+        plain.searchDFA();
+        double grepFiltered = benchMinSeconds(repeats, [&]
+                                              { grepAll(filtered); });
+        double grepPlain = benchMinSeconds(repeats, [&]
+                                           { grepAll(plain); });
+
+        out << "{\"version\":" << kBenchFormatVersion
+            << ",\"family\":\"prefilter_" << name << "\",\"regex_bytes\":" << regex.size()
+            << ",\"simd\":\"" << levels[static_cast<int>(simdLevel())] << "\""
+            << ",\"required_literal\":" << (filtered.required() != nullptr ? "true" : "false")
+            << ",\"mb_per_s\":{\"find_prefilter\":" << megabytes / findFiltered
+            << ",\"find_first_byte\":" << megabytes / findPlain
+            << ",\"grep_prefilter\":" << megabytes / grepFiltered
+            << ",\"grep_dfa\":" << megabytes / grepPlain
+            << "},\"case_peak_rss_kb\":" << casePeakMemoryKB() << "}\n";
+        out.flush();
+    }
+}
+
+// 批量匹配：大量短字符串（类似URL）逐个 fullMatch，与交错执行的单线程、多线程批量接口比较
+void runBatchBenchmarks(bool quick, std::ostream &out)
+{
+    const int repeats = quick ? 2 : 5;
+    const size_t count = quick ? 20000 : 100000;
+    static const char *hosts[] = {"example", "opentopic", "cdn", "api", "static"};
+    static const char *tlds[] = {"com", "org", "net", "io"};
+
+    std::mt19937 rng(18);
+    std::vector<std::string> storage(count);
+    for (std::string &url : storage)
+    {
+        url = std::string(rng() % 2 ? "https" : "http") + "://" + hosts[rng() % 5] + "." + tlds[rng() % 4];
+        for (int segments = rng() % 4; segments > 0; --segments)
+        {
+            url += "/";
+            for (int k = 1 + rng() % 10; k > 0; --k)
             {
-                outfile << "  \"" << stateName << "\" [shape = circle];\n";
+                url += "abcdefghijklmnopqrstuvwxyz0123456789"[rng() % 36];
             }
+        }
+    }
+    std::vector<std::string_view> inputs(storage.begin(), storage.end());
+    size_t bytes = 0;
+    for (const std::string &url : storage)
+    {
+        bytes += url.size();
+    }
 
-            for (const auto &transition : dfaState->transitions)
-            {
-                std::string targetName = "{";
-                for (State *nfaState : transition.second->nfaStates)
-                {
-                    targetName += "S" + std::to_string(nfaState->id) + ",";
-                }
-                targetName.back() = '}';
+    const std::string regex = "https?://[a-z]+\\.(com|org|net)(/[a-z0-9]+)*";
+    CompiledDFA dfa = compileRegex(regex);
+    ThreadPool pool;
+    std::vector<uint64_t> bitmap;
+    volatile size_t sink = 0;
+
+    double loopTime = benchMinSeconds(repeats, [&]
+                                      {
+                                          size_t matches = 0;
+                                          for (std::string_view input : inputs)
+                                          {
+                                              matches += dfa.fullMatch(input);
+                                          }
+                                          sink = sink + matches; });
+    double batchTime = benchMinSeconds(repeats, [&]
+                                       { dfa.matchBatch(inputs, bitmap); });
+    double poolTime = benchMinSeconds(repeats, [&]
+                                      { dfa.matchBatch(inputs, bitmap, BatchMode::Full, &pool); });
+
+    const double millions = static_cast<double>(count) / 1e6;
+    out << "{\"version\":" << kBenchFormatVersion
+        << ",\"family\":\"batch_full_match\",\"n\":" << count
+        << ",\"regex_bytes\":" << regex.size()
+        << ",\"input_bytes\":" << bytes
+        << ",\"threads\":" << pool.size()
+        << ",\"m_items_per_s\":{\"loop\":" << millions / loopTime
+        << ",\"batch\":" << millions / batchTime
+        << ",\"batch_threads\":" << millions / poolTime
+        << "},\"case_peak_rss_kb\":" << casePeakMemoryKB() << "}\n";
+    out.flush();
+}
+
+// 字段提取：每行日志用带捕获组的 TDFA 取出各字段，与不取捕获组的 fullMatch 比较
+void runCaptureBenchmarks(bool quick, std::ostream &out)
+{
+    const int repeats = quick ? 2 : 5;
+    const size_t count = quick ? 20000 : 100000;
+    static const char *users[] = {"alice", "bob", "carol", "dave", "eve"};
 
-                outfile << "  \"" << stateName << "\" -> \"" << targetName << "\" [label=\"" << transition.first << "\"];\n";
+    std::mt19937 rng(22);
+    std::vector<std::string> lines(count);
+    size_t bytes = 0;
+    for (std::string &line : lines)
+    {
+        line = std::string("user=") + users[rng() % 5] + " status=" + std::to_string(100 + rng() % 500) + " path=";
+        for (int segments = 1 + rng() % 4; segments > 0; --segments)
+        {
+            line += "/";
+            for (int k = 1 + rng() % 10; k > 0; --k)
+            {
+                line += "abcdefghijklmnopqrstuvwxyz0123456789"[rng() % 36];
             }
         }
+        bytes += line.size();
+    }
 
-        outfile << "}\n";
-        outfile.close();
-        std::cout << "DFA已生成到 " << filename << " 文件中\n";
+    const std::string regex = "user=([a-z]+)\\ status=([0-9]+)\\ path=((/[a-z0-9]+)*)";
+    CompiledDFA dfa = compileRegex(regex);
+    TaggedDFA tagged(regex);
+    Captures captures;
+    volatile size_t sink = 0;
+
+    double dfaTime = benchMinSeconds(repeats, [&]
+                                     {
+                                         size_t matches = 0;
+                                         for (const std::string &line : lines)
+                                         {
+                                             matches += dfa.fullMatch(line);
+                                         }
+                                         sink = sink + matches; });
+    double taggedTime = benchMinSeconds(repeats, [&]
+                                        {
+                                            size_t length = 0;
+                                            for (const std::string &line : lines)
+                                            {
+                                                length += tagged.match(line, captures) ? captures[3].end - captures[3].begin : 0;
+                                            }
+                                            sink = sink + length; });
+
+    const double megabytes = static_cast<double>(bytes) / (1024.0 * 1024.0);
+    out << "{\"version\":" << kBenchFormatVersion
+        << ",\"family\":\"capture_fields\",\"n\":" << count
+        << ",\"regex_bytes\":" << regex.size()
+        << ",\"groups\":" << tagged.groupCount()
+        << ",\"tdfa_states\":" << tagged.stateCount()
+        << ",\"tdfa_registers\":" << tagged.registerCount()
+        << ",\"mb_per_s\":{\"dfa_full_match\":" << megabytes / dfaTime
+        << ",\"tdfa_captures\":" << megabytes / taggedTime
+        << "},\"case_peak_rss_kb\":" << casePeakMemoryKB() << "}\n";
+    out.flush();
+}
+
+// 资源受限编译：(a|b)*a(a|b){n} 的最小DFA有 2^(n+1) 个状态。完整编译与 compileBounded 比较，
+// 后者在状态数超过上限时很快放弃，退回惰性DFA匹配
+void runBoundedCompileBenchmarks(bool quick, std::ostream &out)
+{
+    const int repeats = quick ? 2 : 3;
+    const size_t inputBytes = quick ? (size_t(256) << 10) : (size_t(1) << 20);
+    CompileLimits limits;
+    limits.maxDFAStates = 4096;
+
+    std::mt19937 rng(24);
+    std::string input(inputBytes, 'a');
+    for (char &c : input)
+    {
+        c = "ab"[rng() % 2];
     }
-    else
+    const double megabytes = static_cast<double>(input.size()) / (1024.0 * 1024.0);
+    volatile size_t sink = 0;
+
+    for (int n : {8, 12, 16})
     {
-        std::cerr << "无法打开文件以写入输出\n";
+        const std::string regex = "(a|b)*a(a|b){" + std::to_string(n) + "}";
+        RegexCompiler compiler;
+        double fullTime = benchMinSeconds(repeats, [&]
+                                          { sink = sink + compiler.compile(regex).stateCount(); });
+        double boundedTime = benchMinSeconds(repeats, [&]
+                                             { sink = sink + static_cast<size_t>(compileBounded(regex, limits).engine()); });
+
+        ExecutionPlan plan = compileBounded(regex, limits);
+        double matchTime = benchMinSeconds(repeats, [&]
+                                           {
+                                               size_t length = 0;
+                                               for (size_t offset = 0; offset < input.size(); offset += 64)
+                                               {
+                                                   size_t matchLength;
+                                                   std::string_view piece(input.data() + offset, std::min<size_t>(64, input.size() - offset));
+                                                   length += plan.prefixMatch(piece, matchLength) ? matchLength : 0;
+                                               }
+                                               sink = sink + length; });
+
+        out << "{\"version\":" << kBenchFormatVersion
+            << ",\"family\":\"bounded_compile\",\"n\":" << n
+            << ",\"max_dfa_states\":" << limits.maxDFAStates
+            << ",\"full_compile_peak_bytes\":" << compiler.stats().peakCompileBytes
+            << ",\"engine\":\"" << (plan.compiled() != nullptr ? "compiled_dfa" : "lazy_dfa") << "\""
+            << ",\"ms\":{\"full_compile\":" << fullTime * 1e3
+            << ",\"bounded_compile\":" << boundedTime * 1e3
+            << "},\"mb_per_s\":{\"plan_prefix\":" << megabytes / matchTime
+            << "},\"case_peak_rss_kb\":" << casePeakMemoryKB() << "}\n";
+        out.flush();
     }
 }
-// 最小化
-// DFA 最小化
-void minimizeDFA()
+
+// 图导出：(a|b)*a(a|b){n} 的未最小化DFA，三种格式写到临时文件的耗时和大小
+void runGraphExportBenchmarks(bool quick, std::ostream &out)
+{
+    const int repeats = quick ? 2 : 3;
+    const int n = quick ? 12 : 15;
+    NFA nfa = generateThompsonNFAFromPostfix(infixToPostfix("(a|b)*a(a|b){" + std::to_string(n) + "}"));
+    DFA dfa = constructDFAFromNFA(nfa, collectStatesFromNFA(nfa));
+
+    out << "{\"version\":" << kBenchFormatVersion
+        << ",\"family\":\"graph_export\",\"n\":" << n
+        << ",\"dfa_states\":" << dfa.size();
+    static const GraphFormat formats[] = {GraphFormat::Dot, GraphFormat::Json, GraphFormat::Binary};
+    static const char *names[] = {"dot", "json", "binary"};
+    std::ostringstream times;
+    std::ostringstream sizes;
+    for (int f = 0; f < 3; ++f)
+    {
+        GraphExportOptions options;
+        options.format = formats[f];
+        long bytes = 0;
+        double time = benchMinSeconds(repeats, [&]
+                                      {
+                                          std::FILE *file = std::tmpfile();
+                                          if (file != nullptr)
+                                          {
+                                              exportGraph(dfa, file, options);
+                                              bytes = std::ftell(file);
+                                              std::fclose(file);
+                                          } });
+        times << (f > 0 ? "," : "") << "\"" << names[f] << "\":" << time * 1e3;
+        sizes << (f > 0 ? "," : "") << "\"" << names[f] << "\":" << bytes;
+    }
+    out << ",\"ms\":{" << times.str() << "},\"bytes\":{" << sizes.str() << "},\"case_peak_rss_kb\":" << casePeakMemoryKB() << "}\n";
+    out.flush();
+}
+
+// 规则集的热更新：替换一条规则（删一条、加一条）时，PatternSet 的增量更新与重新编译整个模式集合比较
+void runPatternSetBenchmarks(bool quick, std::ostream &out)
 {
-    // 初始化
-    std::vector<std::set<DFAState *>> partitions;
-    std::set<DFAState *> accepting, nonAccepting;
+    const int repeats = quick ? 2 : 5;
+    const size_t count = quick ? 100 : 400;
+    static const char *fields[] = {"user", "path", "host", "agent", "status"};
 
-    for (DFAState *state : dfaStates)
+    std::mt19937 rng(23);
+    auto makeRule = [&]
     {
-        if (state->isFinal)
+        std::string rule = std::string(fields[rng() % 5]) + "=";
+        for (int c = 3 + rng() % 6; c > 0; --c)
         {
-            accepting.insert(state);
+            rule += static_cast<char>('a' + rng() % 26);
         }
-        else
+        return PatternSpec{rule + (rng() % 2 ? "[0-9]*" : "(/[a-z]+)*"), static_cast<int>(rng() % 3)};
+    };
+    std::vector<PatternSpec> rules(count);
+    for (PatternSpec &rule : rules)
+    {
+        rule = makeRule();
+    }
+
+    volatile size_t sink = 0;
+    double fullTime = benchMinSeconds(repeats, [&]
+                                      { sink = sink + compilePatternSet(rules).stateCount(); });
+
+    PatternSet set;
+    std::vector<int> ids;
+    set.update(rules, {}, &ids);
+    size_t next = 0;
+    double updateTime = benchMinSeconds(repeats, [&]
+                                        {
+                                            std::vector<int> added;
+                                            set.update({makeRule()}, {ids[next]}, &added);
+                                            ids[next] = added[0];
+                                            next = (next + 1) % ids.size(); });
+
+    out << "{\"version\":" << kBenchFormatVersion
+        << ",\"family\":\"pattern_set_reload\",\"n\":" << count
+        << ",\"dfa_states\":" << set.snapshot()->dfa.stateCount()
+        << ",\"ms\":{\"full_recompile\":" << fullTime * 1e3
+        << ",\"incremental_update\":" << updateTime * 1e3
+        << "},\"case_peak_rss_kb\":" << casePeakMemoryKB() << "}\n";
+    out.flush();
+}
+
+// 配置重新加载：编译大量互不相关的规则，逐个编译与用线程池并发编译比较
+void runCompileManyBenchmarks(bool quick, std::ostream &out)
+{
+    const int repeats = quick ? 1 : 3;
+    const size_t count = quick ? 500 : 5000;
+    static const char *fields[] = {"user", "path", "host", "agent", "status"};
+
+    std::mt19937 rng(19);
+    std::vector<std::string> rules(count);
+    for (std::string &rule : rules)
+    {
+        rule = std::string(fields[rng() % 5]) + "=(";
+        for (int k = 0, words = 1 + rng() % 4; k < words; ++k)
         {
-            nonAccepting.insert(state);
+            rule += k > 0 ? "|" : "";
+            for (int c = 3 + rng() % 6; c > 0; --c)
+            {
+                rule += static_cast<char>('a' + rng() % 26);
+            }
         }
+        rule += rng() % 2 ? ")[0-9]*" : ")(/[a-z]+)*";
+    }
+
+    ThreadPool pool;
+    volatile size_t sink = 0;
+    double sequentialTime = benchMinSeconds(repeats, [&]
+                                            {
+                                                RegexCompiler compiler;
+                                                for (const std::string &rule : rules)
+                                                {
+                                                    sink = sink + compiler.compile(rule).stateCount();
+                                                } });
+    double poolTime = benchMinSeconds(repeats, [&]
+                                      { sink = sink + compileRegexes(rules, pool).size(); });
+
+    // 缓存预热之后，每次使用只是一次查找
+    RegexCache cache;
+    for (const std::string &rule : rules)
+    {
+        cache.get(rule);
     }
+    double cachedTime = benchMinSeconds(repeats, [&]
+                                        {
+                                            for (const std::string &rule : rules)
+                                            {
+                                                sink = sink + cache.get(rule)->stateCount();
+                                            } });
 
-    partitions.push_back(accepting);
-    partitions.push_back(nonAccepting);
+    out << "{\"version\":" << kBenchFormatVersion
+        << ",\"family\":\"compile_many\",\"n\":" << count
+        << ",\"threads\":" << pool.size()
+        << ",\"rules_per_s\":{\"sequential\":" << count / sequentialTime
+        << ",\"thread_pool\":" << count / poolTime
+        << ",\"cache_hit\":" << count / cachedTime
+        << "},\"case_peak_rss_kb\":" << casePeakMemoryKB() << "}\n";
+    out.flush();
+}
 
-    std::vector<std::set<DFAState *>> newPartitions;
-    bool partitioned = true;
+void runBenchmarks(bool quick, std::ostream &out)
+{
+    casePeakMemoryKB(); // 从这里开始计第一个用例的峰值
+    const int repeats = quick ? 2 : 5;
+    const size_t inputBytes = quick ? (size_t(1) << 20) : (size_t(16) << 20);
+    std::mt19937 rng(42);
 
-    while (partitioned)
+    for (const BenchCase &bc : benchCases(quick))
     {
-        partitioned = false;
-        newPartitions.clear();
+        std::string postfix;
+        double parseTime = benchMinSeconds(repeats, [&]
+                                           { postfix = infixToPostfix(bc.regex); });
+        double thompsonTime = benchMinSeconds(repeats, [&]
+                                              { NFA nfa = generateThompsonNFAFromPostfix(postfix); });
 
-        for (const auto &part : partitions)
+        NFA nfa = generateThompsonNFAFromPostfix(postfix);
+        std::vector<uint32_t> nfaStates = collectStatesFromNFA(nfa);
+        DFA dfa;
+        double subsetTime = benchMinSeconds(repeats, [&]
+                                            { dfa = constructDFAFromNFA(nfa, nfaStates); });
+
+        // 化简后的NFA：化简本身的耗时，以及在它上面做子集构造的耗时
+        NFA optimized;
+        double optimizeTime = benchMinSeconds(repeats, [&]
+                                              { optimized = optimizeNFA(nfa); });
+        std::vector<uint32_t> optimizedStates = collectStatesFromNFA(optimized);
+        double optimizedSubsetTime = benchMinSeconds(repeats, [&]
+                                                     { DFA subset = constructDFAFromNFA(optimized, optimizedStates); });
+        const unsigned threads = std::max(std::thread::hardware_concurrency(), 1u);
+        double parallelSubsetTime = benchMinSeconds(repeats, [&]
+                                                    { DFA parallel = constructDFAFromNFAParallel(nfa, nfaStates, threads); });
+
+        // 最小化不改动原来的DFA，可以在同一个DFA上重复
+        MinimizedDFA minimized;
+        double minimizeTime = benchMinSeconds(repeats, [&]
+                                              { minimized = minimizeDFA(dfa); });
+        CompiledDFA compiled(minimized);
+
+        std::string input(inputBytes, 'a');
+        for (char &c : input)
         {
-            std::map<std::string, std::set<DFAState *>> splitSets;
+            c = bc.alphabet[rng() % bc.alphabet.size()];
+        }
+        const double megabytes = static_cast<double>(input.size()) / (1024.0 * 1024.0);
 
-            for (DFAState *state : part)
-            {
-                std::string signature = "";
-                for (const auto &[symbol, targetState] : state->transitions)
-                {
-                    for (size_t i = 0; i < partitions.size(); ++i)
-                    {
-                        if (partitions[i].find(targetState) != partitions[i].end())
-                        {
-                            signature += std::to_string(i) + symbol;
-                            break;
-                        }
-                    }
-                }
-                splitSets[signature].insert(state);
-            }
+        // 非锚定扫描：统计搜索DFA到达接受状态的次数，每个字节都走一次转移表。搜索DFA太大没有展开时不测
+        const CompiledDFA *search = compiled.searchDFA();
+        volatile size_t sink = 0;
+        double dfaTime = search ? benchMinSeconds(repeats, [&]
+                                                  {
+                                                      uint32_t s = search->startState();
+                                                      size_t hits = 0;
+                                                      for (unsigned char c : input)
+                                                      {
+                                                          s = search->next(s, c);
+                                                          hits += search->isAccepting(s);
+                                                      }
+                                                      sink = sink + hits; })
+                                : 0;
 
-            for (const auto &[_, splitSet] : splitSets)
+        // 其余引擎用锚定的最长前缀匹配在较短的切片上测量
+        const size_t sliceBytes = std::min<size_t>(input.size(), size_t(256) << 10);
+        const double sliceMegabytes = static_cast<double>(sliceBytes) / (1024.0 * 1024.0);
+        auto prefixLoop = [&](auto &engine)
+        {
+            size_t length = 0;
+            for (size_t offset = 0; offset < sliceBytes; offset += 64)
             {
-                newPartitions.push_back(splitSet);
+                size_t matchLength;
+                std::string_view piece(input.data() + offset, std::min<size_t>(64, sliceBytes - offset));
+                length += engine.prefixMatch(piece, matchLength) ? matchLength : 0;
             }
-        }
+            sink = sink + length;
+        };
+        double compiledPrefixTime = benchMinSeconds(repeats, [&]
+                                                    { prefixLoop(compiled); });
+        LazyDFA lazy(nfa, nfaStates);
+        double lazyTime = benchMinSeconds(repeats, [&]
+                                          { prefixLoop(lazy); });
+        PikeVM pike(nfa);
+        double pikeTime = benchMinSeconds(repeats, [&]
+                                          { prefixLoop(pike); });
+        PikeVM optimizedPike(optimized);
+        double optimizedPikeTime = benchMinSeconds(repeats, [&]
+                                                   { prefixLoop(optimizedPike); });
+        BitParallelMatcher bitParallel;
+        bool hasBitParallel = bitParallel.build(postfix);
+        double bitParallelTime = hasBitParallel ? benchMinSeconds(repeats, [&]
+                                                                  { prefixLoop(bitParallel); })
+                                                : 0;
 
-        if (newPartitions.size() != partitions.size())
+        out << "{\"version\":" << kBenchFormatVersion
+            << ",\"family\":\"" << bc.family << "\",\"n\":" << bc.parameter
+            << ",\"regex_bytes\":" << bc.regex.size()
+            << ",\"nfa_states\":" << nfa.size()
+            << ",\"nfa_states_optimized\":" << optimized.size()
+            << ",\"dfa_states\":" << dfa.size()
+            << ",\"minimized_states\":" << minimized.size()
+            << ",\"byte_classes\":" << compiled.classCount()
+            << ",\"dfa_table_bytes\":" << compiled.tableBytes()
+            << ",\"seconds\":{\"infix_to_postfix\":" << parseTime
+            << ",\"thompson\":" << thompsonTime
+            << ",\"subset\":" << subsetTime
+            << ",\"optimize_nfa\":" << optimizeTime
+            << ",\"subset_optimized\":" << optimizedSubsetTime
+            << ",\"subset_parallel\":" << parallelSubsetTime
+            << ",\"minimize\":" << minimizeTime << "}"
+            << ",\"threads\":" << threads
+            << ",\"mb_per_s\":{\"dfa_prefix\":" << sliceMegabytes / compiledPrefixTime
+            << ",\"lazy_dfa_prefix\":" << sliceMegabytes / lazyTime
+            << ",\"pike_vm_prefix\":" << sliceMegabytes / pikeTime
+            << ",\"pike_vm_optimized_prefix\":" << sliceMegabytes / optimizedPikeTime;
+        if (hasBitParallel)
+        {
+            out << ",\"bit_parallel_prefix\":" << sliceMegabytes / bitParallelTime;
+        }
+        if (search)
         {
-            partitioned = true;
-            partitions = newPartitions;
+            out << ",\"dfa_scan\":" << megabytes / dfaTime;
         }
+        out << "},\"case_peak_rss_kb\":" << casePeakMemoryKB() << "}\n";
+        out.flush();
     }
+    runPrefilterBenchmarks(quick, out);
+    runBatchBenchmarks(quick, out);
+    runCaptureBenchmarks(quick, out);
+    runCompileManyBenchmarks(quick, out);
+    runPatternSetBenchmarks(quick, out);
+    runBoundedCompileBenchmarks(quick, out);
+    runGraphExportBenchmarks(quick, out);
+}
 
-    // 创建新的DFA状态
-    std::vector<DFAState *> newDFAStates;
-    for (const auto &part : partitions)
+// 自检：把各个引擎、各个实现互相对照，以及几个曾经超出时间或内存的模式。
+// 每一项失败时输出一行说明，全部通过时返回 true
+class SelfTest
+{
+public:
+    explicit SelfTest(std::ostream &_out) : out(_out) {}
+
+    void check(bool ok, const std::string &what)
     {
-        if (!part.empty())
+        ++checks;
+        if (!ok && ++failures <= 50)
         {
-            DFAState *newState = new DFAState(newDFAStates.size());
-            newDFAStates.push_back(newState);
-            std::cout << "Creating new state with id: " << newState->id << std::endl; // 调试输出
+            out << "失败: " << what << "\n";
         }
     }
 
-    // 设置转换
-    for (size_t index = 0; index < partitions.size(); ++index)
-    {
-        const auto &part = partitions[index];
-        DFAState *newState = newDFAStates[index];
-        DFAState *representative = *part.begin();
-        newState->isFinal = representative->isFinal;
+    bool passed() const { return failures == 0; }
+    size_t checkCount() const { return checks; }
+    size_t failureCount() const { return failures; }
 
-        for (const auto &[symbol, targetState] : representative->transitions)
-        {
-            for (size_t i = 0; i < partitions.size(); ++i)
-            {
-                if (partitions[i].find(targetState) != partitions[i].end())
-                {
-                    newState->transitions[symbol] = newDFAStates[i];
-                    std::cout << "Setting transition: " << symbol << " -> State " << newDFAStates[i]->id << std::endl; // 调试输出
-                    break;
-                }
-            }
-        }
+private:
+    std::ostream &out;
+    size_t checks = 0;
+    size_t failures = 0;
+};
+
+// 随机正则表达式，只用字母 a b c，深处只生成单个字符，避免模式过大
+std::string randomTestRegex(std::mt19937 &rng, int depth = 0)
+{
+    switch (rng() % (depth > 3 ? 3 : 8))
+    {
+    case 3:
+        return randomTestRegex(rng, depth + 1) + randomTestRegex(rng, depth + 1);
+    case 4:
+        return "(" + randomTestRegex(rng, depth + 1) + "|" + randomTestRegex(rng, depth + 1) + ")";
+    case 5:
+        return "(" + randomTestRegex(rng, depth + 1) + ")" + "*+?"[rng() % 3];
+    case 6:
+        return "(" + randomTestRegex(rng, depth + 1) + "){" + std::to_string(rng() % 3) + "," + std::to_string(2 + rng() % 2) + "}";
+    case 7:
+        return "[ab]";
+    default:
+        return std::string(1, "abc"[rng() % 3]);
     }
+}
 
-    // 释放原始DFA状态的内存
-    for (DFAState *state : dfaStates)
+std::string randomTestInput(std::mt19937 &rng, size_t maxLength, std::string_view alphabet)
+{
+    std::string input(rng() % (maxLength + 1), 'a');
+    for (char &c : input)
     {
-        delete state;
+        c = alphabet[rng() % alphabet.size()];
     }
+    return input;
+}
 
-    // 更新DFA状态列表
-    dfaStates = newDFAStates;
+std::string describeMatch(bool found, size_t begin, size_t end)
+{
+    return found ? "[" + std::to_string(begin) + "," + std::to_string(end) + ")" : "无";
 }
 
-void generateMinimizedDotFileForDFA(const std::string &filename)
+std::string readWholeFile(const std::string &path)
 {
-    std::ofstream outfile(filename);
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
 
-    if (outfile.is_open())
+// 同一个输入上各引擎的 prefixMatch 和 find 与完整编译的DFA相同；
+// 最小化前后、并行与单线程子集构造、保存再加载之后的DFA也都相同
+void testEngineAgreement(SelfTest &test, int patterns)
+{
+    std::mt19937 rng(12345);
+    const std::string path = ".thompson-selftest.dfa";
+    const unsigned threads = std::max(std::thread::hardware_concurrency(), 2u);
+    for (int p = 0; p < patterns; ++p)
     {
-        outfile << "digraph MinimizedDFA {\n";
-        outfile << "  rankdir=LR;\n";
-        outfile << "  node [shape = circle];\n";
+        const std::string regex = randomTestRegex(rng);
+        CompiledDFA dfa = compileRegex(regex);
+
+        // 最小化：只是合并等价状态，结果不变；已经最小的DFA再最小化，状态数不变
+        RegexCompiler compiler;
+        NFA nfa = compiler.parse(regex);
+        DFA subset = compiler.determinize(nfa);
+        MinimizedDFA minimized = minimizeDFA(subset);
+        CompiledDFA unminimized(subset);
+        test.check(minimizeDFA(minimized).size() == minimized.size(), "再次最小化减少了状态: " + regex);
 
-        for (DFAState *dfaState : dfaStates)
+        // 并行子集构造的结果与单线程相同，最小化后序列化的字节也相同
+        RegexCompiler::Options options;
+        options.threads = threads;
+        RegexCompiler parallel(options);
+        CompiledDFA parallelDFA = parallel.compile(regex);
+        bool saved = dfa.save(path) && parallelDFA.save(path + ".parallel");
+        test.check(saved && readWholeFile(path) == readWholeFile(path + ".parallel"), "并行构造的DFA与单线程不同: " + regex);
+        std::remove((path + ".parallel").c_str());
+        CompiledDFA loaded = CompiledDFA::load(path);
+        test.check(loaded.stateCount() == dfa.stateCount() && loaded.startState() == dfa.startState(), "加载的DFA与保存的不同: " + regex);
+
+        LazyDFA lazy(nfa, collectStatesFromNFA(nfa));
+        LazyDFA tinyCache(nfa, collectStatesFromNFA(nfa), 2, 0, 1000000); // 几乎每一步都清空缓存
+        PikeVM pike(nfa);
+        BitParallelMatcher bitParallel;
+        const bool hasBitParallel = bitParallel.build(infixToPostfix(regex));
+        for (int k = 0; k < 100; ++k)
         {
-            std::string stateName = "S" + std::to_string(dfaState->id);
-            std::cout << "Processing state with id: " << dfaState->id << std::endl; // 调试输出
-            if (dfaState->isFinal)
+            const std::string input = randomTestInput(rng, 40, "abcd");
+            const std::string where = regex + " '" + input + "'";
+            size_t length = 0, other = 0;
+            const bool matched = dfa.prefixMatch(input, length);
+            auto samePrefix = [&](bool found)
+            { return found == matched && (!found || other == length); };
+            test.check(samePrefix(unminimized.prefixMatch(input, other)), "最小化前后 prefixMatch 不同: " + where);
+            test.check(samePrefix(parallelDFA.prefixMatch(input, other)), "并行构造的DFA prefixMatch 不同: " + where);
+            test.check(samePrefix(loaded.prefixMatch(input, other)), "加载的DFA prefixMatch 不同: " + where);
+            test.check(samePrefix(lazy.prefixMatch(input, other)), "惰性DFA prefixMatch 不同: " + where);
+            test.check(samePrefix(tinyCache.prefixMatch(input, other)), "缓存很小的惰性DFA prefixMatch 不同: " + where);
+
+            size_t begin = 0, end = 0, otherBegin = 0, otherEnd = 0;
+            const bool found = dfa.find(input, begin, end);
+            auto sameFind = [&](const char *engine, bool result)
             {
-                outfile << "  \"" << stateName << "\" [shape = doublecircle];\n";
-            }
-            else
+                test.check(result == found && (!result || (otherBegin == begin && otherEnd == end)),
+                           std::string(engine) + " find 得到 " + describeMatch(result, otherBegin, otherEnd) +
+                               "，应为 " + describeMatch(found, begin, end) + ": " + where);
+            };
+            sameFind("惰性DFA", lazy.find(input, otherBegin, otherEnd));
+            sameFind("缓存很小的惰性DFA", tinyCache.find(input, otherBegin, otherEnd));
+            sameFind("Pike VM", pike.find(input, otherBegin, otherEnd));
+            sameFind("加载的DFA", loaded.find(input, otherBegin, otherEnd));
+            if (hasBitParallel)
             {
-                outfile << "  \"" << stateName << "\" [shape = circle];\n";
+                sameFind("位并行", bitParallel.find(input, otherBegin, otherEnd));
             }
+        }
+    }
+    std::remove(path.c_str());
+}
 
-            for (const auto &transition : dfaState->transitions)
+// 预过滤器：当前CPU支持的每一级 SIMD 实现与标量实现在每个起点给出同样的候选位置
+void testPrefilterLevels(SelfTest &test)
+{
+    static const char *levels[] = {"scalar", "sse2", "ssse3", "avx2"};
+    const std::vector<std::vector<std::string>> literalSets = {
+        {"x"}, {"x", "y"}, {"x", "y", "z"}, {"xyz"}, {"abcabd"}, {"xy", "zab"}, {"ab", "ba", "xyz", "cab", "zz"}};
+    std::mt19937 rng(99);
+    for (const std::vector<std::string> &literals : literalSets)
+    {
+        const Prefilter filter = Prefilter::forLiterals(literals);
+        for (int k = 0; k < 50; ++k)
+        {
+            // 字面量出现得足够多，末尾常常只有字面量的一部分
+            std::string input = randomTestInput(rng, 200, "abcdxyz");
+            for (size_t at = rng() % 40; at < input.size(); at += 1 + rng() % 40)
             {
-                if (!transition.second)
+                input.replace(at, 0, literals[rng() % literals.size()]);
+            }
+            const unsigned char *data = reinterpret_cast<const unsigned char *>(input.data());
+            for (int level = 1; level <= static_cast<int>(simdLevel()); ++level)
+            {
+                for (size_t from = 0; from <= input.size(); ++from)
                 {
-                    std::cerr << "Error: Invalid pointer for target DFA state." << std::endl;
-                    continue; // Skip this transition
+                    for (bool partial : {false, true})
+                    {
+                        const size_t scalar = filter.find(data, from, input.size(), partial, SimdLevel::Scalar);
+                        const size_t simd = filter.find(data, from, input.size(), partial, static_cast<SimdLevel>(level));
+                        if (simd != scalar)
+                        {
+                            test.check(false, std::string(levels[level]) + " 预过滤器与标量实现不同: " + literals[0] + " '" + input +
+                                                  "' 从 " + std::to_string(from));
+                        }
+                    }
                 }
+            }
+        }
+    }
+}
 
-                std::cout << "Transition: " << transition.first << " -> State " << transition.second->id << std::endl; // 调试输出
+// 捕获组：最左最长的整体匹配中，选择优先左分支，重复取最后一次
+void testCaptures(SelfTest &test)
+{
+    struct CaptureCase
+    {
+        std::string regex;
+        std::string input;
+        std::vector<std::pair<size_t, size_t>> groups; // 从组1开始，没有参与匹配的组写 NO_POSITION
+    };
+    const size_t none = Submatch::NO_POSITION;
+    const std::vector<CaptureCase> cases = {
+        {"(a*)(a*)", "aaa", {{0, 3}, {3, 3}}},
+        {"(a|ab)(c|bcd)(d*)", "abcd", {{0, 1}, {1, 4}, {4, 4}}},
+        {"(a)*", "aaa", {{2, 3}}},
+        {"(a)|b", "b", {{none, none}}},
+        {"((a)|b)*", "ab", {{1, 2}, {0, 1}}},
+        {"(a?)((ab)?)b?", "ab", {{0, 1}, {1, 1}, {none, none}}},
+    };
+    for (const CaptureCase &c : cases)
+    {
+        TaggedDFA tagged(c.regex);
+        Captures captures;
+        bool matched = tagged.match(c.input, captures);
+        bool same = matched && captures.size() == c.groups.size() + 1 && captures[0].begin == 0 && captures[0].end == c.input.size();
+        for (size_t g = 0; same && g < c.groups.size(); ++g)
+        {
+            same = captures[g + 1].begin == c.groups[g].first && captures[g + 1].end == c.groups[g].second;
+        }
+        test.check(same, "捕获组不对: " + c.regex + " '" + c.input + "'");
+    }
 
-                std::string targetName = "S" + std::to_string(transition.second->id);
-                outfile << "  \"" << stateName << "\" -> \"" << targetName << "\" [label=\"" << transition.first << "\"];\n";
-            }
+    // 整个匹配与 CompiledDFA 的 fullMatch 一致
+    std::mt19937 rng(2024);
+    for (int p = 0; p < 100; ++p)
+    {
+        const std::string regex = randomTestRegex(rng);
+        TaggedDFA tagged(regex);
+        CompiledDFA dfa = compileRegex(regex);
+        for (int k = 0; k < 50; ++k)
+        {
+            const std::string input = randomTestInput(rng, 12, "abc");
+            Captures captures;
+            bool matched = tagged.match(input, captures);
+            test.check(matched == dfa.fullMatch(input) && (!matched || (captures[0].begin == 0 && captures[0].end == input.size())),
+                       "TDFA 的整体匹配与DFA不同: " + regex + " '" + input + "'");
         }
+    }
+}
 
-        outfile << "}\n";
-        outfile.close();
-        std::cout << "Minimized DFA has been generated to " << filename << "\n";
+// 字节模式：(?-u:...) 中的 \xHH 是单个字节，字符类里不能写非ASCII的字符
+void testByteMode(SelfTest &test)
+{
+    CompiledDFA bytes = compileRegex("(?-u:[\\x80-\\xFF]+)");
+    test.check(bytes.fullMatch("\xFF\x80") && !bytes.fullMatch("a"), "字节模式的字符类");
+    test.check(compileRegex("[\\xE9]").fullMatch("\xC3\xA9") && !compileRegex("[\\xE9]").fullMatch("\xE9"), "Unicode 模式的 \\xE9 是 UTF-8 编码的 é");
+    bool rejected = false;
+    try
+    {
+        compileRegex("(?-u:[\xC3\xA9])");
+    }
+    catch (const RegexSyntaxError &)
+    {
+        rejected = true;
+    }
+    test.check(rejected, "字节模式的字符类里接受了非ASCII字符");
+}
+
+// 曾经耗尽时间或内存的模式：资源受限编译在期限内结束，峰值内存不超过上限的1.5倍（分配器保留的空闲内存）；
+// 叠在一起的量词线性地解析；惰性DFA和位并行的 find 与输入长度成正比
+void testBudgetRegressions(SelfTest &test)
+{
+    using Clock = std::chrono::steady_clock;
+    auto milliseconds = [](Clock::time_point since)
+    { return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - since).count(); };
+
+    CompileLimits limits;
+    limits.maxDFAStates = 10000;
+    limits.maxMemoryBytes = size_t(64) << 20;
+    limits.timeout = std::chrono::milliseconds(1000);
+    casePeakMemoryKB();
+    const long baseline = casePeakMemoryKB();
+    Clock::time_point started = Clock::now();
+    long elapsed = 0, peak = 0;
+    try
+    {
+        ExecutionPlan plan = compileBounded("((a?){1000}){10}", limits);
+        elapsed = milliseconds(started);
+        peak = casePeakMemoryKB();
+        size_t length = 0;
+        test.check(plan.prefixMatch(std::string(50, 'a'), length) && length == 50, "((a?){1000}){10} 的匹配");
+    }
+    catch (const CompileLimitError &)
+    {
+        // 超出上限时报错也是有界的结果
+        elapsed = milliseconds(started);
+        peak = casePeakMemoryKB();
+    }
+    test.check(elapsed < 3000, "((a?){1000}){10} 的资源受限编译用了 " + std::to_string(elapsed) + "ms");
+    test.check(baseline < 0 || peak < 0 || static_cast<size_t>(peak - baseline) * 1024 < limits.maxMemoryBytes * 3 / 2,
+               "((a?){1000}){10} 的资源受限编译峰值内存增加了 " + std::to_string(peak - baseline) + "KB");
+
+    started = Clock::now();
+    CompiledDFA stacked = compileRegex("a" + std::string(60000, '*'));
+    test.check(stacked.fullMatch("aaa") && stacked.fullMatch(""), "叠在一起的量词的匹配");
+    test.check(milliseconds(started) < 1000, "叠在一起的60000个量词用了 " + std::to_string(milliseconds(started)) + "ms");
+
+    const std::string regex = "(a|b)*a(a|b){20}";
+    const std::string input(200000, 'b');
+    NFA nfa = RegexCompiler().parse(regex);
+    LazyDFA lazy(nfa, collectStatesFromNFA(nfa));
+    BitParallelMatcher bitParallel;
+    test.check(bitParallel.build(infixToPostfix(regex)), "位并行接受 " + regex);
+    size_t begin = 0, end = 0;
+    started = Clock::now();
+    test.check(!lazy.find(input, begin, end), "惰性DFA在没有匹配的输入上找到了匹配");
+    test.check(milliseconds(started) < 1000, "惰性DFA的 find 用了 " + std::to_string(milliseconds(started)) + "ms");
+    started = Clock::now();
+    test.check(!bitParallel.find(input, begin, end), "位并行在没有匹配的输入上找到了匹配");
+    test.check(milliseconds(started) < 1000, "位并行的 find 用了 " + std::to_string(milliseconds(started)) + "ms");
+}
+
+bool runSelfTests(std::ostream &out)
+{
+    SelfTest test(out);
+    testEngineAgreement(test, 300);
+    testPrefilterLevels(test);
+    testCaptures(test);
+    testByteMode(test);
+    testBudgetRegressions(test);
+    out << (test.passed() ? "通过" : "失败") << ": " << test.checkCount() << " 项检查，" << test.failureCount() << " 项失败\n";
+    return test.passed();
+}
+
+// 报告正则表达式的语法错误，并在下一行指出出错的位置
+void reportSyntaxError(const std::string &regex, const RegexSyntaxError &error)
+{
+    std::cerr << "正则表达式语法错误: " << error.what() << "\n  " << regex << "\n  " << std::string(error.position, ' ') << "^\n";
+}
+
+// 命令行上编译模式时的上限：命令行上的模式同样可能让确定化爆炸，超出时 scan/grep 退回惰性DFA，compile 报错
+CompileLimits commandLineLimits()
+{
+    CompileLimits limits;
+    limits.maxDFAStates = 1000000;
+    limits.maxMemoryBytes = size_t(1) << 30;
+    limits.timeout = std::chrono::seconds(30);
+    return limits;
+}
+
+// scan/grep 模式
+int runSearch(const std::string &mode, const CompiledDFA &dfa, const std::string &path)
+{
+    bool ok;
+    if (mode == "scan")
+    {
+        ok = scanFile(path, dfa, [](uint64_t begin, uint64_t end)
+                      { std::cout << begin << "-" << end << "\n"; });
     }
     else
     {
-        std::cerr << "Unable to open file for writing output\n";
+        MappedFile file(path);
+        ok = file.isOpen();
+        grepBuffer(dfa, file.data(), file.size(), [&](size_t offset, size_t length)
+                   { std::cout << offset << ":" << std::string_view(file.data() + offset, length) << "\n"; });
+    }
+    if (!ok)
+    {
+        std::cerr << "无法打开文件 " << path << "\n";
+        return 1;
+    }
+    return 0;
+}
+
+// 模式只能用惰性DFA执行时的 scan/grep：整个文件映射进来，scan 逐个找不重叠的匹配，grep 逐行查找
+int runSearch(const std::string &mode, ExecutionPlan &plan, const std::string &path)
+{
+    MappedFile file(path);
+    if (!file.isOpen())
+    {
+        std::cerr << "无法打开文件 " << path << "\n";
+        return 1;
+    }
+    const std::string_view text(file.data(), file.size());
+    size_t matchBegin, matchEnd;
+    if (mode == "scan")
+    {
+        for (size_t position = 0; position <= text.size() && plan.find(text.substr(position), matchBegin, matchEnd);)
+        {
+            std::cout << position + matchBegin << "-" << position + matchEnd << "\n";
+            position += matchEnd > matchBegin ? matchEnd : matchBegin + 1;
+        }
+        return 0;
+    }
+    for (size_t lineStart = 0; lineStart < text.size();)
+    {
+        size_t lineEnd = std::min(text.find('\n', lineStart), text.size());
+        std::string_view line = text.substr(lineStart, lineEnd - lineStart);
+        if (plan.find(line, matchBegin, matchEnd))
+        {
+            std::cout << lineStart << ":" << line << "\n";
+        }
+        lineStart = lineEnd + 1;
     }
+    return 0;
+}
+
+// compile 模式：离线编译一个或多个模式（按命令行顺序，靠前的优先），写成可以直接映射的 .dfa 文件。
+// 源正则表达式按行写进元数据
+int runCompile(const std::string &path, const std::vector<std::string> &regexes)
+{
+    std::vector<PatternSpec> patterns;
+    std::string metadata;
+    for (const std::string &regex : regexes)
+    {
+        // 先逐个解析，出错时才能指出是哪一个模式
+        try
+        {
+            infixToPostfix(regex);
+        }
+        catch (const RegexSyntaxError &error)
+        {
+            reportSyntaxError(regex, error);
+            return 1;
+        }
+        patterns.push_back(PatternSpec{regex, 0});
+        metadata += regex + "\n";
+    }
+    RegexCompiler::Options options;
+    options.limits = commandLineLimits();
+    RegexCompiler compiler(options);
+    std::optional<CompiledDFA> compiled;
+    try
+    {
+        compiled.emplace(patterns.size() == 1 ? compiler.compile(regexes.front()) : compiler.compile(patterns));
+    }
+    catch (const CompileLimitError &error)
+    {
+        std::cerr << "编译超出上限: " << error.what() << "\n";
+        return 1;
+    }
+    const CompiledDFA &dfa = *compiled;
+    if (!dfa.save(path, metadata))
+    {
+        std::cerr << "无法写入文件 " << path << "\n";
+        return 1;
+    }
+    std::cout << path << ": " << dfa.stateCount() << " 个状态, " << dfa.classCount() << " 个字节类, "
+              << dfa.tableBytes() << " 字节的转移表\n";
+    return 0;
+}
+
+// codegen 模式：生成匹配这些模式的C++头文件，可以在构建时运行
+int runCodegen(const std::string &name, const std::string &path, const std::vector<std::string> &regexes, bool table)
+{
+    bool identifier = !name.empty() && !std::isdigit(static_cast<unsigned char>(name[0]));
+    for (char c : name)
+    {
+        identifier = identifier && (std::isalnum(static_cast<unsigned char>(c)) || c == '_');
+    }
+    if (!identifier)
+    {
+        std::cerr << "命名空间不是合法的C++标识符: " << name << "\n";
+        return 1;
+    }
+
+    std::vector<PatternSpec> patterns;
+    for (const std::string &regex : regexes)
+    {
+        try
+        {
+            infixToPostfix(regex);
+        }
+        catch (const RegexSyntaxError &error)
+        {
+            reportSyntaxError(regex, error);
+            return 1;
+        }
+        patterns.push_back(PatternSpec{regex, 0});
+    }
+    CompiledDFA dfa = patterns.size() == 1 ? compileRegex(regexes.front()) : compilePatternSet(patterns);
+    generateCppMatcher(dfa, path, CodegenOptions{name, table, regexes});
+    return 0;
 }
 
-int main()
+int main(int argc, char *argv[])
 {
+    std::string mode = argc > 1 ? argv[1] : "";
+    bool precompiled = argc == 5 && std::string(argv[2]) == "--dfa";
+    if ((mode == "scan" || mode == "grep") && (argc == 4 || precompiled))
+    {
+        try
+        {
+            if (precompiled)
+            {
+                return runSearch(mode, CompiledDFA::load(argv[3]), argv[4]);
+            }
+            ExecutionPlan plan = compileBounded(argv[2], commandLineLimits());
+            if (plan.compiled() != nullptr)
+            {
+                return runSearch(mode, *plan.compiled(), argv[3]);
+            }
+            std::cerr << "编译超出上限: " << plan.fallbackError()->what() << "，改用惰性DFA\n";
+            return runSearch(mode, plan, argv[3]);
+        }
+        catch (const RegexSyntaxError &error)
+        {
+            reportSyntaxError(argv[2], error);
+            return 1;
+        }
+        catch (const CompileLimitError &error)
+        {
+            std::cerr << "编译超出上限: " << error.what() << "\n";
+            return 1;
+        }
+        catch (const DFAFormatError &error)
+        {
+            std::cerr << argv[3] << ": " << error.what() << "\n";
+            return 1;
+        }
+    }
+    if (mode == "compile" && argc >= 4)
+    {
+        return runCompile(argv[2], std::vector<std::string>(argv + 3, argv + argc));
+    }
+    bool table = argc > 2 && std::string(argv[2]) == "--table";
+    if (mode == "codegen" && argc >= 5 + table)
+    {
+        return runCodegen(argv[2 + table], argv[3 + table], std::vector<std::string>(argv + 4 + table, argv + argc), table);
+    }
+    if (mode == "bench")
+    {
+        runBenchmarks(argc > 2 && std::string(argv[2]) == "--quick", std::cout);
+        return 0;
+    }
+    if (mode == "test" && argc == 2)
+    {
+        return runSelfTests(std::cout) ? 0 : 1;
+    }
+    if (!mode.empty())
+    {
+        std::cerr << "用法: " << argv[0] << " [scan|grep <regex>|--dfa <file.dfa> <file>] [compile <file.dfa> <regex>...]\n"
+                  << "       [codegen [--table] <namespace> <file.h> <regex>...] [bench [--quick]] [test]\n";
+        return 1;
+    }
 
     std::string regex = "a|(b|c|e) | |d*";
     std::string postfix = infixToPostfix(regex);
-    std::cout << "后缀表达式: " << postfix << std::endl;
-    NFA *finalNFA = generateThompsonNFAFromPostfix(postfix);
+    std::cout << "后缀表达式: " << postfix << "\n";
+    NFA finalNFA = generateThompsonNFAFromPostfix(postfix);
     generateDotFile(finalNFA, "thompson_nfa.dot");
+    generateDotFile(optimizeNFA(finalNFA), "optimized_nfa.dot");
 
-    std::set<State *> nfaStates = collectStatesFromNFA(finalNFA);
+    std::vector<uint32_t> nfaStates = collectStatesFromNFA(finalNFA);
 
-    constructDFAFromNFA(finalNFA, nfaStates);
-    generateDotFileForDFA("dfa_output.dot");
-    minimizeDFA();
-    generateMinimizedDotFileForDFA("minimized_dfa_output.dot");
+    DFA dfa = constructDFAFromNFA(finalNFA, nfaStates);
+    generateDotFileForDFA(dfa, "dfa_output.dot");
+    MinimizedDFA minimized = minimizeDFA(dfa);
+    generateMinimizedDotFileForDFA(minimized, "minimized_dfa_output.dot");
+
+    CompiledDFA compiled(minimized);
+    LazyDFA lazy(finalNFA, nfaStates);
+    PikeVM pike(finalNFA);
+    for (const char *input : {"", "a", "b", "d", "dddd", "bd"})
+    {
+        std::cout << "fullMatch(\"" << input << "\") = " << (compiled.fullMatch(input) ? "true" : "false")
+                  << ", lazy: " << (lazy.fullMatch(input) ? "true" : "false")
+                  << ", pike: " << (pike.fullMatch(input) ? "true" : "false") << "\n";
+    }
+
+    // 捕获组：(b|c|e) 匹配到了什么
+    TaggedDFA tagged(regex);
+    Captures captures;
+    for (const char *input : {"b", "e", "dd"})
+    {
+        if (tagged.match(input, captures))
+        {
+            std::cout << "match(\"" << input << "\"): 组1 = "
+                      << (captures[1].matched() ? "[" + std::to_string(captures[1].begin) + ", " + std::to_string(captures[1].end) + ")" : std::string("未参与"))
+                      << "\n";
+        }
+    }
+    std::cout << "编译统计: " << compileStats.toJson() << "\n";
 
     return 0;
 }